@@ -67,15 +67,23 @@ const QString SettingsNames::imapBlacklistedCapabilities = QLatin1String("imap.c
 const QString SettingsNames::imapUseSystemProxy = QLatin1String("imap.proxy.system");
 const QString SettingsNames::imapNeedsNetwork = QLatin1String("imap.needsNetwork");
 const QString SettingsNames::imapNumberRefreshInterval = QLatin1String("imap.numberRefreshInterval");
+const QString SettingsNames::imapConnectionsMin = QLatin1String("imap.connections.min");
+const QString SettingsNames::imapConnectionsMax = QLatin1String("imap.connections.max");
+const QString SettingsNames::imapConnectionsPerServer = QLatin1String("imap.connections.perServer");
+const QString SettingsNames::imapCachedCapabilitiesServer = QLatin1String("imap.capabilities.cache.server");
+const QString SettingsNames::imapCachedCapabilitiesBeforeLogin = QLatin1String("imap.capabilities.cache.beforeLogin");
+const QString SettingsNames::imapCachedCapabilitiesAfterLogin = QLatin1String("imap.capabilities.cache.afterLogin");
 const QString SettingsNames::composerSaveToImapKey = QLatin1String("composer/saveToImapEnabled");
 const QString SettingsNames::composerImapSentKey = QLatin1String("composer/imapSentName");
 const QString SettingsNames::cacheMetadataKey = QLatin1String("offline.metadataCache");
 const QString SettingsNames::cacheMetadataMemory = QLatin1String("memory");
 const QString SettingsNames::cacheOfflineKey = QLatin1String("offline.cache");
+const QString SettingsNames::cacheSearchLocally = QLatin1String("offline.searchLocally");
 const QString SettingsNames::cacheOfflineNone = QLatin1String("memory");
 const QString SettingsNames::cacheOfflineXDays = QLatin1String("days");
 const QString SettingsNames::cacheOfflineAll = QLatin1String("all");
 const QString SettingsNames::cacheOfflineNumberDaysKey = QLatin1String("offline.cache.numDays");
+const QString SettingsNames::cacheOfflineMirrorMailboxes = QLatin1String("offline.mirror.mailboxes");
 const QString SettingsNames::xtConnectCacheDirectory = QLatin1String("xtconnect.cachedir");
 const QString SettingsNames::xtSyncMailboxList = QLatin1String("xtconnect.listOfMailboxes");
 const QString SettingsNames::xtDbHost = QLatin1String("xtconnect.db.hostname");
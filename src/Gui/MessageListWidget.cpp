@@ -33,6 +33,7 @@
 #include "LineEdit.h"
 #include "MsgListView.h"
 #include "ReplaceCharValidator.h"
+#include "Imap/Model/PrettyMsgListModel.h"
 #include "UiUtils/IconLoader.h"
 
 namespace Gui {
@@ -58,7 +59,7 @@ MessageListWidget::MessageListWidget(QWidget *parent) :
     m_queryPlaceholder = tr("<query>");
 
     connect(m_quickSearchText, SIGNAL(returnPressed()), this, SLOT(slotApplySearch()));
-    connect(m_quickSearchText, SIGNAL(textChanged(QString)), this, SLOT(slotConditionalSearchReset()));
+    connect(m_quickSearchText, SIGNAL(textChanged(QString)), this, SLOT(slotQuickFilter()));
     connect(m_quickSearchText, SIGNAL(cursorPositionChanged(int, int)), this, SLOT(slotUpdateSearchCursor()));
 
     m_searchOptions = new QToolButton(this);
@@ -69,6 +70,7 @@ MessageListWidget::MessageListWidget(QWidget *parent) :
     QMenu *optionsMenu = new QMenu(m_searchOptions);
     m_searchFuzzy = optionsMenu->addAction(tr("Fuzzy Search"));
     m_searchFuzzy->setCheckable(true);
+    connect(m_searchFuzzy, SIGNAL(toggled(bool)), this, SLOT(slotQuickFilter()));
     optionsMenu->addSeparator();
     m_searchInSubject = optionsMenu->addAction(tr("Subject"));
     m_searchInSubject->setCheckable(true);
@@ -80,6 +82,10 @@ MessageListWidget::MessageListWidget(QWidget *parent) :
     m_searchInSenders->setChecked(true);
     m_searchInRecipients = optionsMenu->addAction(tr("Recipients"));
     m_searchInRecipients->setCheckable(true);
+    connect(m_searchInSubject, SIGNAL(toggled(bool)), this, SLOT(slotQuickFilter()));
+    connect(m_searchInBody, SIGNAL(toggled(bool)), this, SLOT(slotQuickFilter()));
+    connect(m_searchInSenders, SIGNAL(toggled(bool)), this, SLOT(slotQuickFilter()));
+    connect(m_searchInRecipients, SIGNAL(toggled(bool)), this, SLOT(slotQuickFilter()));
 
     optionsMenu->addSeparator();
 
@@ -132,9 +138,9 @@ MessageListWidget::MessageListWidget(QWidget *parent) :
     layout->addWidget(m_quickSearchText);
     layout->addWidget(tree);
 
-    m_searchResetTimer = new QTimer(this);
-    m_searchResetTimer->setSingleShot(true);
-    connect(m_searchResetTimer, SIGNAL(timeout()), SLOT(slotApplySearch()));
+    m_searchTimer = new QTimer(this);
+    m_searchTimer->setSingleShot(true);
+    connect(m_searchTimer, SIGNAL(timeout()), SLOT(slotApplySearch()));
 
     slotAutoEnableDisableSearch();
 }
@@ -158,7 +164,54 @@ void MessageListWidget::focusRawSearch()
 
 void MessageListWidget::slotApplySearch()
 {
-    emit requestingSearch(searchConditions());
+    m_searchTimer->stop();
+    m_appliedSearchConditions = searchConditions();
+    emit requestingSearch(m_appliedSearchConditions);
+}
+
+/** @short Filter the already loaded messages on each keystroke, and ask the server once the user stops typing
+
+The server only gets asked when the local filter cannot give the full answer, i.e. when searching in the message bodies, or when
+some of the envelopes are not known yet.
+*/
+void MessageListWidget::slotQuickFilter()
+{
+    QString text = m_quickSearchText->text();
+    const bool isRawSearch = m_rawSearch->isChecked() && text.startsWith(QLatin1String(":="));
+    const QStringList conditions = searchConditions();
+
+    Imap::Mailbox::PrettyMsgListModel *prettyModel = tree ? qobject_cast<Imap::Mailbox::PrettyMsgListModel*>(tree->model()) : 0;
+
+    Imap::Mailbox::AbstractCache::TextFields fields;
+    if (m_searchInSubject->isChecked())
+        fields |= Imap::Mailbox::AbstractCache::TEXT_SUBJECT;
+    if (m_searchInSenders->isChecked())
+        fields |= Imap::Mailbox::AbstractCache::TEXT_FROM;
+    if (m_searchInRecipients->isChecked())
+        fields |= Imap::Mailbox::AbstractCache::TEXT_RECIPIENTS;
+
+    // While a server-side search is in effect, the source does not contain all messages, so there's no telling
+    const bool localFilterIsEnough = prettyModel && fields && !m_searchInBody->isChecked() && !isRawSearch &&
+            m_appliedSearchConditions.isEmpty() && !prettyModel->hasUnfetchedMessages();
+
+    if (isRawSearch || localFilterIsEnough || conditions == m_appliedSearchConditions) {
+        // Either there's nothing new to ask for, or it's an incomplete raw query which would only make the server complain
+        m_searchTimer->stop();
+    } else {
+        // The empty text restores the whole mailbox, there's no point in waiting for more keystrokes then
+        m_searchTimer->start(text.isEmpty() ? 250 : 500);
+    }
+
+    if (!prettyModel)
+        return;
+
+    if (m_searchInBody->isChecked() || !fields || isRawSearch) {
+        // The message bodies are not available locally and the raw IMAP queries are not understood; leave that to the server
+        text.clear();
+    }
+    prettyModel->setQuickFilter(text, fields, isFuzzySearch() ? Imap::Mailbox::PrettyMsgListModel::QUICKFILTER_FUZZY :
+                                                                Imap::Mailbox::PrettyMsgListModel::QUICKFILTER_EXACT,
+                                localFilterIsEnough ? QStringList() : conditions);
 }
 
 void MessageListWidget::slotAutoEnableDisableSearch()
@@ -191,14 +244,6 @@ void MessageListWidget::slotResetSortingFailed()
     m_quickSearchText->setPalette(QPalette());
 }
 
-void MessageListWidget::slotConditionalSearchReset()
-{
-    if (m_quickSearchText->text().isEmpty())
-        m_searchResetTimer->start(250);
-    else
-        m_searchResetTimer->stop();
-}
-
 void MessageListWidget::slotUpdateSearchCursor()
 {
     int cp = m_quickSearchText->cursorPosition();
@@ -281,7 +326,7 @@ QStringList MessageListWidget::searchConditions() const
 
     QStringList res;
     Q_FOREACH(const QString &key, keys) {
-        if (m_supportsFuzzySearch)
+        if (isFuzzySearch())
             res << QLatin1String("FUZZY");
         res << key << m_quickSearchText->text();
     }
@@ -296,6 +341,11 @@ QStringList MessageListWidget::searchConditions() const
     return res;
 }
 
+bool MessageListWidget::isFuzzySearch() const
+{
+    return m_supportsFuzzySearch && m_searchFuzzy->isChecked();
+}
+
 void MessageListWidget::setFuzzySearchSupported(bool supported)
 {
     m_supportsFuzzySearch = supported;
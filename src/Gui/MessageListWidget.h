@@ -63,12 +63,14 @@ protected slots:
 
 private slots:
     void slotComplexSearchInput(QAction*);
-    void slotConditionalSearchReset();
     void slotDeActivateSimpleSearch();
+    void slotQuickFilter();
     void slotResetSortingFailed();
     void slotUpdateSearchCursor();
 
 private:
+    bool isFuzzySearch() const;
+
     LineEdit *m_quickSearchText;
     QToolButton *m_searchOptions;
     QAction *m_searchInSubject;
@@ -78,8 +80,11 @@ private:
     QAction *m_searchFuzzy;
     QAction *m_rawSearch;
     bool m_supportsFuzzySearch;
-    QTimer *m_searchResetTimer;
+    /** @short Delays the server-side search until the user stops typing */
+    QTimer *m_searchTimer;
     QString m_queryPlaceholder;
+    /** @short Search conditions which were last sent to the server */
+    QStringList m_appliedSearchConditions;
 };
 
 }
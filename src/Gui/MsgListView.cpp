@@ -29,10 +29,13 @@
 #include <QHeaderView>
 #include <QKeyEvent>
 #include <QPainter>
+#include <QScrollBar>
 #include <QSignalMapper>
 #include <QTimer>
+#include "Imap/Model/Model.h"
 #include "Imap/Model/MsgListModel.h"
 #include "Imap/Model/PrettyMsgListModel.h"
+#include "Imap/Model/Utils.h"
 
 namespace Gui
 {
@@ -61,6 +64,13 @@ MsgListView::MsgListView(QWidget *parent): QTreeView(parent), m_autoActivateAfte
     m_naviActivationTimer = new QTimer(this);
     m_naviActivationTimer->setSingleShot(true);
     connect(m_naviActivationTimer, SIGNAL(timeout()), SLOT(slotCurrentActivated()));
+
+    // Wait for the scrolling to settle down before telling the model what we show
+    m_visibleMessagesTimer = new QTimer(this);
+    m_visibleMessagesTimer->setSingleShot(true);
+    m_visibleMessagesTimer->setInterval(50);
+    connect(m_visibleMessagesTimer, SIGNAL(timeout()), SLOT(slotReportVisibleMessages()));
+    connect(verticalScrollBar(), SIGNAL(valueChanged(int)), m_visibleMessagesTimer, SLOT(start()));
 }
 
 // left might collapse a thread, question is whether ending there (on closing the thread) should be
@@ -407,6 +417,22 @@ void MsgListView::setModel(QAbstractItemModel *model)
         connect(prettyModel, SIGNAL(sortingPreferenceChanged(int,Qt::SortOrder)),
                 this, SLOT(slotHandleSortCriteriaChanged(int,Qt::SortOrder)));
     }
+    m_visibleMessagesTimer->start();
+}
+
+void MsgListView::slotReportVisibleMessages()
+{
+    Imap::Mailbox::Model *imapModel = findImapModel(model());
+    if (!imapModel)
+        return;
+
+    QModelIndexList visible;
+    for (QModelIndex index = indexAt(QPoint(0, 0)); index.isValid(); index = indexBelow(index)) {
+        if (visualRect(index).top() > viewport()->height())
+            break;
+        visible << Imap::deproxifiedIndex(index);
+    }
+    imapModel->setVisibleMessages(visible);
 }
 
 void MsgListView::slotHandleSortCriteriaChanged(int column, Qt::SortOrder order)
@@ -430,6 +456,14 @@ Imap::Mailbox::PrettyMsgListModel *MsgListView::findPrettyMsgListModel(QAbstract
     return 0;
 }
 
+/** @short Walk the hierarchy of proxy models down to the Imap::Mailbox::Model */
+Imap::Mailbox::Model *MsgListView::findImapModel(QAbstractItemModel *model)
+{
+    while (QAbstractProxyModel *proxy = qobject_cast<QAbstractProxyModel*>(model))
+        model = proxy->sourceModel();
+    return qobject_cast<Imap::Mailbox::Model*>(model);
+}
+
 void MsgListView::setAutoActivateAfterKeyNavigation(bool enabled)
 {
     m_autoActivateAfterKeyNavigation = enabled;
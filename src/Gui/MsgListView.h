@@ -29,6 +29,7 @@ class QSignalMapper;
 
 namespace Imap {
 namespace Mailbox {
+class Model;
 class PrettyMsgListModel;
 }
 }
@@ -70,11 +71,15 @@ private slots:
     /** @short conditionally emits activated(currentIndex()) for keyboard events */
     void slotCurrentActivated();
     void slotHandleNewColumns(int oldCount, int newCount);
+    /** @short Tell the IMAP model which messages are visible so that they get fetched first */
+    void slotReportVisibleMessages();
 private:
     static Imap::Mailbox::PrettyMsgListModel *findPrettyMsgListModel(QAbstractItemModel *model);
+    static Imap::Mailbox::Model *findImapModel(QAbstractItemModel *model);
 
     QSignalMapper *headerFieldsMapper;
     QTimer *m_naviActivationTimer;
+    QTimer *m_visibleMessagesTimer;
     bool m_autoActivateAfterKeyNavigation;
     bool m_autoResizeSections;
 };
@@ -472,6 +472,10 @@ void MainWindow::createActions()
     m_actionSubscribeMailbox->setEnabled(false);
     connect(m_actionSubscribeMailbox, SIGNAL(triggered()), this, SLOT(slotSubscribeCurrentMailbox()));
 
+    m_actionKeepMailboxOffline = new QAction(tr("&Keep Available Offline"), this);
+    m_actionKeepMailboxOffline->setCheckable(true);
+    connect(m_actionKeepMailboxOffline, SIGNAL(triggered()), this, SLOT(slotKeepCurrentMailboxOffline()));
+
     aboutTrojita = new QAction(trUtf8("&About Trojitá..."), this);
     connect(aboutTrojita, SIGNAL(triggered()), this, SLOT(slotShowAboutTrojita()));
 
@@ -882,26 +886,6 @@ bool MainWindow::eventFilter(QObject *o, QEvent *e)
         }
         return false;
     }
-    if (msgListWidget && msgListWidget->tree && o == msgListWidget->tree->header()->viewport()) {
-        // installed if sorting is not really possible.
-        QWidget *header = static_cast<QWidget*>(o);
-        QMouseEvent *mouse = static_cast<QMouseEvent*>(e);
-        if (e->type() == QEvent::MouseButtonPress) {
-            if (mouse->button() == Qt::LeftButton && header->cursor().shape() == Qt::ArrowCursor) {
-                m_headerDragStart = mouse->pos();
-            }
-            return false;
-        }
-        if (e->type() == QEvent::MouseButtonRelease) {
-            if (mouse->button() == Qt::LeftButton && header->cursor().shape() == Qt::ArrowCursor &&
-               (m_headerDragStart - mouse->pos()).manhattanLength() < QApplication::startDragDistance()) {
-                    m_actionSortDescending->toggle();
-                    Qt::SortOrder order = m_actionSortDescending->isChecked() ? Qt::DescendingOrder : Qt::AscendingOrder;
-                    msgListWidget->tree->header()->setSortIndicator(-1, order);
-                    return true; // prevent regular click
-            }
-        }
-    }
     return false;
 }
 
@@ -997,6 +981,10 @@ void MainWindow::showContextMenuMboxTree(const QPoint &position)
         actionList.append(m_actionSubscribeMailbox);
         m_actionSubscribeMailbox->setChecked(mboxTree->indexAt(position).data(Imap::Mailbox::RoleMailboxIsSubscribed).toBool());
 
+        actionList.append(m_actionKeepMailboxOffline);
+        m_actionKeepMailboxOffline->setChecked(imapModel()->isMailboxKeptOffline(
+                                                   mboxTree->indexAt(position).data(Imap::Mailbox::RoleMailboxName).toString()));
+
 #ifdef XTUPLE_CONNECT
         actionList.append(xtIncludeMailboxInSync);
         xtIncludeMailboxInSync->setChecked(
@@ -1853,6 +1841,17 @@ void MainWindow::slotSubscribeCurrentMailbox()
     }
 }
 
+void MainWindow::slotKeepCurrentMailboxOffline()
+{
+    QModelIndex index = mboxTree->currentIndex();
+    if (! index.isValid())
+        return;
+
+    QString mailbox = index.data(Imap::Mailbox::RoleMailboxName).toString();
+    imapModel()->setMailboxKeptOffline(mailbox, m_actionKeepMailboxOffline->isChecked());
+    m_settings->setValue(Common::SettingsNames::cacheOfflineMirrorMailboxes, imapModel()->offlineMirrorMailboxes());
+}
+
 void MainWindow::slotShowOnlySubscribed()
 {
     if (m_actionShowOnlySubscribed->isEnabled()) {
@@ -2025,13 +2024,8 @@ void MainWindow::slotHideRead()
 
 void MainWindow::slotCapabilitiesUpdated(const QStringList &capabilities)
 {
-    msgListWidget->tree->header()->viewport()->removeEventFilter(this);
-    if (capabilities.contains(QLatin1String("SORT"))) {
-        m_actionSortByDate->actionGroup()->setEnabled(true);
-    } else {
-        m_actionSortByDate->actionGroup()->setEnabled(false);
-        msgListWidget->tree->header()->viewport()->installEventFilter(this);
-    }
+    // Without the SORT extension, the messages are sorted on the client side
+    m_actionSortByDate->actionGroup()->setEnabled(true);
 
     msgListWidget->setFuzzySearchSupported(capabilities.contains(QLatin1String("SEARCH=FUZZY")));
 
@@ -2041,16 +2035,10 @@ void MainWindow::slotCapabilitiesUpdated(const QStringList &capabilities)
                                                Common::SettingsNames::guiMailboxListShowOnlySubscribed, false).toBool());
     m_actionSubscribeMailbox->setEnabled(m_actionShowOnlySubscribed->isEnabled());
 
-    const QStringList supportedCapabilities = Imap::Mailbox::ThreadingMsgListModel::supportedCapabilities();
-    Q_FOREACH(const QString &capability, capabilities) {
-        if (supportedCapabilities.contains(capability)) {
-            actionThreadMsgList->setEnabled(true);
-            if (actionThreadMsgList->isChecked())
-                slotThreadMsgList();
-            return;
-        }
-    }
-    actionThreadMsgList->setEnabled(false);
+    // Servers without the THREAD extension get their messages threaded on the client side
+    actionThreadMsgList->setEnabled(true);
+    if (actionThreadMsgList->isChecked())
+        slotThreadMsgList();
 }
 
 void MainWindow::slotShowImapInfo()
@@ -167,6 +167,7 @@ private slots:
     void slotXtSyncCurrentMailbox();
 #endif
     void slotSubscribeCurrentMailbox();
+    void slotKeepCurrentMailboxOffline();
     void slotShowOnlySubscribed();
     void updateMessageFlags();
     void updateMessageFlags(const QModelIndex &index);
@@ -326,6 +327,7 @@ private:
     QAction *m_actionMarkMailboxAsRead;
 
     QAction *m_actionSubscribeMailbox;
+    QAction *m_actionKeepMailboxOffline;
     QAction *m_actionShowOnlySubscribed;
 
     QToolBar *m_mainToolbar;
@@ -352,7 +354,6 @@ private:
     MainWindow &operator=(const MainWindow &); // don't implement
 
     QSystemTrayIcon *m_trayIcon;
-    QPoint m_headerDragStart;
 };
 
 }
@@ -0,0 +1,47 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAP_APPENDDATA_H
+#define IMAP_APPENDDATA_H
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QStringList>
+
+namespace Imap {
+namespace Mailbox {
+
+/** @short One message to upload through APPEND, along with its flags and the INTERNALDATE */
+struct AppendData {
+    QByteArray data;
+    QStringList flags;
+    QDateTime timestamp;
+
+    AppendData() {}
+    AppendData(const QByteArray &data, const QStringList &flags, const QDateTime &timestamp):
+        data(data), flags(flags), timestamp(timestamp) {}
+};
+
+}
+}
+
+#endif // IMAP_APPENDDATA_H
@@ -33,5 +33,19 @@ AbstractCache::~AbstractCache()
 {
 }
 
+void AbstractCache::setMsgPartTexts(const QList<MessagePartText> &texts)
+{
+    Q_UNUSED(texts);
+}
+
+bool AbstractCache::searchText(const QString &mailbox, const QString &query, const TextFields fields, Imap::Uids &result) const
+{
+    Q_UNUSED(mailbox);
+    Q_UNUSED(query);
+    Q_UNUSED(fields);
+    Q_UNUSED(result);
+    return false;
+}
+
 }
 }
@@ -129,14 +129,61 @@ public:
     /** @short Save information about how messages are threaded */
     virtual void setMessageThreading(const QString &mailbox, const QVector<Imap::Responses::ThreadingNode> &threading) = 0;
 
+    /** @short Return a previously stored result of a search or sort in the given mailbox
+
+    The @arg key identifies the search criteria and the sort order, the @arg mailboxState is an opaque token describing the
+    state of the mailbox at the time the result was obtained.  Returns false unless there is a result for this @arg key which
+    was stored for exactly the same @arg mailboxState.
+    */
+    virtual bool searchResult(const QString &mailbox, const QByteArray &mailboxState, const QByteArray &key, Imap::Uids &result) const = 0;
+    /** @short Remember the result of a search or sort in the given mailbox
+
+    Results which were stored for another @arg mailboxState of the same mailbox are forgotten.
+    */
+    virtual void setSearchResult(const QString &mailbox, const QByteArray &mailboxState, const QByteArray &key, const Imap::Uids &result) = 0;
+
     /** @short How many days is it OK not to mark entries as accessed? */
     virtual void setRenewalThreshold(const int days) = 0;
 
+    /** @short Parts of a message which the full-text index knows about */
+    typedef enum {
+        TEXT_SUBJECT = 1 << 0,
+        TEXT_FROM = 1 << 1,
+        TEXT_RECIPIENTS = 1 << 2,
+        TEXT_BODY = 1 << 3
+    } TextField;
+    Q_DECLARE_FLAGS(TextFields, TextField)
+
+    /** @short The decoded text of a message part as it shall be indexed */
+    struct MessagePartText {
+        QString mailbox;
+        uint uid;
+        QByteArray partId;
+        QString text;
+
+        MessagePartText(): uid(0) {}
+    };
+
+    /** @short Put the decoded texts of several message parts into the full-text index at once
+
+    Caches without a full-text index ignore this.
+    */
+    virtual void setMsgPartTexts(const QList<MessagePartText> &texts);
+
+    /** @short Search the full-text index
+
+    The UIDs of messages in the @arg mailbox which contain all words from the @arg query in any of the requested @arg fields
+    are stored into the @arg result, the best matches first.  Returns false if this cache has no full-text index.
+    */
+    virtual bool searchText(const QString &mailbox, const QString &query, const TextFields fields, Imap::Uids &result) const;
+
 signals:
     /** @short Some cache error has occurred */
     void error(const QString &error) const;
 };
 
+Q_DECLARE_OPERATORS_FOR_FLAGS(AbstractCache::TextFields)
+
 }
 
 }
@@ -22,6 +22,7 @@
 
 #include "CombinedCache.h"
 #include "DiskPartCache.h"
+#include "FullTextIndex.h"
 #include "SQLCache.h"
 
 namespace Imap
@@ -30,7 +31,7 @@ namespace Mailbox
 {
 
 CombinedCache::CombinedCache(QObject *parent, const QString &name, const QString &cacheDir):
-    AbstractCache(parent), name(name), cacheDir(cacheDir)
+    AbstractCache(parent), fullTextIndex(0), name(name), cacheDir(cacheDir)
 {
     sqlCache = new SQLCache(this);
     connect(sqlCache, SIGNAL(error(QString)), this, SIGNAL(error(QString)));
@@ -44,7 +45,17 @@ CombinedCache::~CombinedCache()
 
 bool CombinedCache::open()
 {
-    return sqlCache->open(name, cacheDir + QLatin1String("/imap.cache.sqlite"));
+    if (!sqlCache->open(name, cacheDir + QLatin1String("/imap.cache.sqlite")))
+        return false;
+
+    // The cache is perfectly usable without the full-text index, the searches just go to the server. That's also why its
+    // errors are not propagated as the cache errors which would make us drop the whole persistent cache.
+    fullTextIndex = new FullTextIndex(this);
+    if (!fullTextIndex->open(name + QLatin1String("-fts"), cacheDir + QLatin1String("/imap.fts.sqlite"))) {
+        delete fullTextIndex;
+        fullTextIndex = 0;
+    }
+    return true;
 }
 
 QList<MailboxMetadata> CombinedCache::childMailboxes(const QString &mailbox) const
@@ -91,12 +102,16 @@ void CombinedCache::clearAllMessages(const QString &mailbox)
 {
     sqlCache->clearAllMessages(mailbox);
     diskPartCache->clearAllMessages(mailbox);
+    if (fullTextIndex)
+        fullTextIndex->forgetMailbox(mailbox);
 }
 
 void CombinedCache::clearMessage(const QString mailbox, const uint uid)
 {
     sqlCache->clearMessage(mailbox, uid);
     diskPartCache->clearMessage(mailbox, uid);
+    if (fullTextIndex)
+        fullTextIndex->forgetMessage(mailbox, uid);
 }
 
 QStringList CombinedCache::msgFlags(const QString &mailbox, const uint uid) const
@@ -117,6 +132,8 @@ AbstractCache::MessageDataBundle CombinedCache::messageMetadata(const QString &m
 void CombinedCache::setMessageMetadata(const QString &mailbox, const uint uid, const MessageDataBundle &metadata)
 {
     sqlCache->setMessageMetadata(mailbox, uid, metadata);
+    if (fullTextIndex)
+        fullTextIndex->indexEnvelope(mailbox, uid, metadata.envelope);
 }
 
 QByteArray CombinedCache::messagePart(const QString &mailbox, const uint uid, const QByteArray &partId) const
@@ -153,10 +170,34 @@ void CombinedCache::setMessageThreading(const QString &mailbox, const QVector<Im
     sqlCache->setMessageThreading(mailbox, threading);
 }
 
+bool CombinedCache::searchResult(const QString &mailbox, const QByteArray &mailboxState, const QByteArray &key, Imap::Uids &result) const
+{
+    return sqlCache->searchResult(mailbox, mailboxState, key, result);
+}
+
+void CombinedCache::setSearchResult(const QString &mailbox, const QByteArray &mailboxState, const QByteArray &key, const Imap::Uids &result)
+{
+    sqlCache->setSearchResult(mailbox, mailboxState, key, result);
+}
+
 void CombinedCache::setRenewalThreshold(const int days)
 {
     sqlCache->setRenewalThreshold(days);
 }
 
+void CombinedCache::setMsgPartTexts(const QList<MessagePartText> &texts)
+{
+    if (fullTextIndex)
+        fullTextIndex->indexTexts(texts);
+}
+
+bool CombinedCache::searchText(const QString &mailbox, const QString &query, const TextFields fields, Imap::Uids &result) const
+{
+    if (!fullTextIndex)
+        return false;
+    result = fullTextIndex->search(mailbox, query, fields);
+    return true;
+}
+
 }
 }
@@ -33,6 +33,7 @@ namespace Mailbox
 
 class SQLCache;
 class DiskPartCache;
+class FullTextIndex;
 
 
 /** @short A hybrid cache, using both SQLite and on-disk format
@@ -87,8 +88,14 @@ public:
     virtual QVector<Imap::Responses::ThreadingNode> messageThreading(const QString &mailbox);
     virtual void setMessageThreading(const QString &mailbox, const QVector<Imap::Responses::ThreadingNode> &threading);
 
+    virtual bool searchResult(const QString &mailbox, const QByteArray &mailboxState, const QByteArray &key, Imap::Uids &result) const;
+    virtual void setSearchResult(const QString &mailbox, const QByteArray &mailboxState, const QByteArray &key, const Imap::Uids &result);
+
     virtual void setRenewalThreshold(const int days);
 
+    virtual void setMsgPartTexts(const QList<MessagePartText> &texts);
+    virtual bool searchText(const QString &mailbox, const QString &query, const TextFields fields, Imap::Uids &result) const;
+
     /** @short Open a connection to the cache */
     bool open();
 
@@ -97,6 +104,8 @@ private:
     SQLCache *sqlCache;
     /** @short Cache for bigger message parts */
     DiskPartCache *diskPartCache;
+    /** @short Index for searching without the IMAP server, or null if it could not be opened */
+    FullTextIndex *fullTextIndex;
     /** @short Name of the DB connection */
     QString name;
     /** @short Directory to serve as a cache root */
@@ -0,0 +1,187 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <QHash>
+#include "ConnectionPool.h"
+#include "Model.h"
+
+namespace {
+
+/** @short All existing pools, for enforcing the per-server limits */
+QList<Imap::Mailbox::ConnectionPool *> allPools;
+
+/** @short The configured per-server limits */
+QHash<QString, int> serverLimits;
+
+}
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+ConnectionPool::ConnectionPool(Model *model):
+    m_model(model), m_minimum(1), m_maximum(1)
+{
+    allPools << this;
+}
+
+ConnectionPool::~ConnectionPool()
+{
+    allPools.removeOne(this);
+}
+
+void ConnectionPool::setLimits(const int minimum, const int maximum)
+{
+    m_maximum = qMax(1, maximum);
+    m_minimum = qBound(1, minimum, m_maximum);
+}
+
+int ConnectionPool::minimumConnections() const
+{
+    return m_minimum;
+}
+
+int ConnectionPool::maximumConnections() const
+{
+    return m_maximum;
+}
+
+void ConnectionPool::setServer(const QString &server)
+{
+    m_server = server;
+}
+
+void ConnectionPool::setServerLimit(const QString &server, const int maximum)
+{
+    if (maximum > 0)
+        serverLimits[server] = maximum;
+    else
+        serverLimits.remove(server);
+}
+
+QList<Parser *> ConnectionPool::liveParsers() const
+{
+    QList<Parser *> res;
+    for (QMap<Parser *,ParserState>::const_iterator it = m_model->m_parsers.constBegin(); it != m_model->m_parsers.constEnd(); ++it) {
+        if (it->connState != CONN_STATE_LOGOUT)
+            res << it.key();
+    }
+    return res;
+}
+
+int ConnectionPool::liveConnections() const
+{
+    return liveParsers().size();
+}
+
+int ConnectionPool::connectionsToServer() const
+{
+    int res = 0;
+    Q_FOREACH(const ConnectionPool *pool, allPools) {
+        if (pool->m_server == m_server)
+            res += pool->liveConnections();
+    }
+    return res;
+}
+
+bool ConnectionPool::canOpenConnection() const
+{
+    if (liveConnections() >= m_maximum)
+        return false;
+    if (m_server.isEmpty())
+        return true;
+    QHash<QString, int>::const_iterator limit = serverLimits.constFind(m_server);
+    return limit == serverLimits.constEnd() || connectionsToServer() < *limit;
+}
+
+/** @short Find an authenticated connection which is not doing anything besides keeping its mailbox open */
+Parser *ConnectionPool::idleParser() const
+{
+    Q_FOREACH(Parser *parser, liveParsers()) {
+        if (parser == m_foregroundParser)
+            continue;
+        const ParserState &state = m_model->m_parsers[parser];
+        if (state.connState < CONN_STATE_AUTHENTICATED)
+            continue;
+        if (state.activeTasks.isEmpty() ||
+                (state.activeTasks.size() == 1 && state.activeTasks.front() == state.maintainingTask.data())) {
+            return parser;
+        }
+    }
+    return 0;
+}
+
+/** @short Find the connection with the shortest queue of active tasks, avoiding the foreground one if possible */
+Parser *ConnectionPool::leastBusyParser() const
+{
+    Parser *best = 0;
+    int bestLoad = 0;
+    Q_FOREACH(Parser *parser, liveParsers()) {
+        // The foreground connection is counted as if it was much busier than it is
+        int load = m_model->m_parsers[parser].activeTasks.size();
+        if (parser == m_foregroundParser)
+            load += 1000;
+        if (!best || load < bestLoad) {
+            best = parser;
+            bestLoad = load;
+        }
+    }
+    return best;
+}
+
+bool ConnectionPool::hasBackgroundCapacity() const
+{
+    return canOpenConnection() || idleParser();
+}
+
+Parser *ConnectionPool::parserForMailbox(const bool foreground)
+{
+    if (foreground && m_foregroundParser && m_model->m_parsers.contains(m_foregroundParser) &&
+            m_model->m_parsers[m_foregroundParser].connState != CONN_STATE_LOGOUT) {
+        return m_foregroundParser;
+    }
+    return parserForBackgroundWork();
+}
+
+Parser *ConnectionPool::parserForBackgroundWork()
+{
+    if (liveConnections() < m_minimum && canOpenConnection())
+        return 0;
+    if (Parser *parser = idleParser())
+        return parser;
+    if (canOpenConnection())
+        return 0;
+    // Nothing is idle and we are not allowed to open another connection. This could still return the null pointer when
+    // there are no connections at all but the server limit has been exhausted by other accounts; there is nothing else
+    // we could do in that case.
+    return leastBusyParser();
+}
+
+void ConnectionPool::setForegroundParser(Parser *parser)
+{
+    m_foregroundParser = parser;
+}
+
+}
+}
@@ -0,0 +1,100 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#ifndef IMAP_MODEL_CONNECTIONPOOL_H
+#define IMAP_MODEL_CONNECTIONPOOL_H
+
+#include <QList>
+#include <QPointer>
+#include <QString>
+
+namespace Imap {
+class Parser;
+namespace Mailbox {
+
+class Model;
+
+/** @short Decide which IMAP connection shall be used for a new piece of work
+
+The mailbox which the user is looking at keeps its own connection (the "foreground" one) so that it is never stolen by
+a background synchronization of some other mailbox. All other mailboxes and the background tasks like STATUS are spread
+over the remaining connections. An idle connection is always preferred to opening a new one; new connections are opened
+only when the pool has not reached its limit yet. Once the limit is hit, the least busy connection gets reused.
+
+Servers often limit the number of concurrent sessions of a single user. Several accounts (i.e. several Model instances)
+can share a server, which is why an additional, process-wide limit can be configured for each server.
+*/
+class ConnectionPool
+{
+public:
+    explicit ConnectionPool(Model *model);
+    ~ConnectionPool();
+
+    /** @short Configure how many connections shall be kept open at least and how many are allowed at most */
+    void setLimits(const int minimum, const int maximum);
+    int minimumConnections() const;
+    int maximumConnections() const;
+
+    /** @short Identify the server this pool is talking to for the purpose of the per-server limits */
+    void setServer(const QString &server);
+    /** @short Set the maximal number of connections to the given server across all pools, zero means no limit */
+    static void setServerLimit(const QString &server, const int maximum);
+
+    /** @short Return the connection which shall be used for maintaining a mailbox
+
+    The null pointer means that a new connection shall be opened.
+    */
+    Parser *parserForMailbox(const bool foreground);
+    /** @short Return the connection for a background task which can work in any mailbox, or null for a new connection */
+    Parser *parserForBackgroundWork();
+    /** @short Remember which connection is used by the mailbox the user is looking at */
+    void setForegroundParser(Parser *parser);
+
+    /** @short Can a new mailbox be opened without taking a connection away from some other mailbox? */
+    bool hasBackgroundCapacity() const;
+
+    /** @short Number of connections which are established or being established, but not going away */
+    int liveConnections() const;
+
+private:
+    QList<Parser *> liveParsers() const;
+    bool canOpenConnection() const;
+    int connectionsToServer() const;
+    Parser *idleParser() const;
+    Parser *leastBusyParser() const;
+
+    Model *m_model;
+    QPointer<Parser> m_foregroundParser;
+    QString m_server;
+    int m_minimum;
+    int m_maximum;
+
+    ConnectionPool(const ConnectionPool &); // don't implement
+    ConnectionPool &operator=(const ConnectionPool &); // don't implement
+};
+
+}
+}
+
+#endif // IMAP_MODEL_CONNECTIONPOOL_H
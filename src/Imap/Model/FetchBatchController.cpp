@@ -0,0 +1,188 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <cmath>
+#include "FetchBatchController.h"
+
+namespace {
+
+/** @short Responses shorter than this are dominated by the latency */
+const qint64 smallResponse = 4 * 1024;
+/** @short Responses longer than this are dominated by the transfer time */
+const qint64 bigResponse = 64 * 1024;
+
+const double minScale = 1.0 / 16;
+const double maxScale = 8;
+/** @short How much to grow after each successful batch, in the units of the initial limits */
+const double additiveIncrease = 0.25;
+
+}
+
+namespace Imap {
+namespace Mailbox {
+
+FetchBatchStats::FetchBatchStats():
+    parserId(0), smoothedRtt(-1), throughput(-1), scale(1), messagesPerBatch(0), bytesPerBatch(0), parallelBatches(0),
+    batchesCompleted(0), decreases(0)
+{
+}
+
+FetchBatchController::FetchBatchController():
+    m_bytesReceived(0), m_smoothedRtt(-1), m_rttVariance(0), m_minRtt(-1), m_throughput(-1), m_lastBatchFinished(-1),
+    m_targetBatchDuration(1000 * 1000), m_initialMessages(300), m_initialBytes(1024 * 1024), m_initialParallel(10), m_scale(1),
+    m_configured(false), m_adaptive(true), m_batchesCompleted(0), m_decreases(0)
+{
+}
+
+void FetchBatchController::setInitialLimits(const int messages, const uint bytes, const int parallelBatches)
+{
+    m_initialMessages = qMax(1, messages);
+    m_initialBytes = qMax(1u, bytes);
+    m_initialParallel = qMax(1, parallelBatches);
+    m_configured = true;
+}
+
+bool FetchBatchController::isConfigured() const
+{
+    return m_configured;
+}
+
+void FetchBatchController::setTargetBatchDuration(const qint64 usecs)
+{
+    m_targetBatchDuration = qMax(Q_INT64_C(1), usecs);
+}
+
+void FetchBatchController::setAdaptive(const bool adaptive)
+{
+    m_adaptive = adaptive;
+}
+
+void FetchBatchController::commandSent(const QByteArray &tag, const qint64 now)
+{
+    InFlight cmd;
+    cmd.sent = now;
+    cmd.bytesBefore = m_bytesReceived;
+    m_inFlight[tag] = cmd;
+}
+
+void FetchBatchController::responseReceived(const int bytes)
+{
+    m_bytesReceived += bytes;
+}
+
+void FetchBatchController::commandCompleted(const QByteArray &tag, const qint64 now)
+{
+    QHash<QByteArray, InFlight>::iterator it = m_inFlight.find(tag);
+    if (it == m_inFlight.end())
+        return;
+    const qint64 elapsed = qMax(Q_INT64_C(1), now - it->sent);
+    // With pipelining, this includes responses to other commands as well, which makes the estimates conservative
+    const qint64 bytes = m_bytesReceived - it->bytesBefore;
+    m_inFlight.erase(it);
+
+    if (m_minRtt < 0 || elapsed < m_minRtt)
+        m_minRtt = elapsed;
+
+    if (bytes < smallResponse) {
+        // The same smoothing as TCP uses, RFC 6298
+        if (m_smoothedRtt < 0) {
+            m_smoothedRtt = elapsed;
+            m_rttVariance = elapsed / 2;
+        } else {
+            m_rttVariance = (3 * m_rttVariance + qAbs(m_smoothedRtt - elapsed)) / 4;
+            m_smoothedRtt = (7 * m_smoothedRtt + elapsed) / 8;
+        }
+    } else if (bytes >= bigResponse) {
+        const qint64 rtt = m_smoothedRtt >= 0 ? m_smoothedRtt : m_minRtt;
+        const qint64 transfer = qMax(elapsed - rtt, elapsed / 4);
+        const qint64 sample = bytes * 1000 * 1000 / transfer;
+        m_throughput = m_throughput < 0 ? sample : (3 * m_throughput + sample) / 4;
+    }
+}
+
+void FetchBatchController::batchCompleted(const qint64 started, const qint64 now)
+{
+    ++m_batchesCompleted;
+    // Only count the time the server has spent on this batch, not the time it waited for the previous ones
+    const qint64 duration = now - qMax(started, m_lastBatchFinished);
+    m_lastBatchFinished = now;
+
+    if (!m_adaptive)
+        return;
+
+    if (duration <= m_targetBatchDuration) {
+        m_scale = qMin(maxScale, m_scale + additiveIncrease);
+    } else {
+        m_scale = qMax(minScale, m_scale / 2);
+        ++m_decreases;
+    }
+}
+
+void FetchBatchController::batchFailed()
+{
+    if (!m_adaptive)
+        return;
+    m_scale = qMax(minScale, m_scale / 2);
+    ++m_decreases;
+}
+
+int FetchBatchController::messagesPerBatch() const
+{
+    return qMax(1, static_cast<int>(m_initialMessages * m_scale));
+}
+
+uint FetchBatchController::bytesPerBatch() const
+{
+    return qMax(1u, static_cast<uint>(m_initialBytes * m_scale));
+}
+
+int FetchBatchController::parallelBatches() const
+{
+    if (!m_adaptive || m_throughput <= 0)
+        return m_initialParallel;
+    const qint64 rtt = m_smoothedRtt >= 0 ? m_smoothedRtt : m_minRtt;
+    if (rtt <= 0)
+        return m_initialParallel;
+
+    // One batch is being transferred while the others cover the round trip of the next request
+    const double batchTransfer = static_cast<double>(bytesPerBatch()) * 1000 * 1000 / m_throughput;
+    const int wanted = 1 + static_cast<int>(std::ceil(rtt / qMax(1.0, batchTransfer)));
+    return qBound(1, wanted, m_initialParallel);
+}
+
+FetchBatchStats FetchBatchController::stats() const
+{
+    FetchBatchStats res;
+    res.smoothedRtt = m_smoothedRtt >= 0 ? m_smoothedRtt : m_minRtt;
+    res.throughput = m_throughput;
+    res.scale = m_scale;
+    res.messagesPerBatch = messagesPerBatch();
+    res.bytesPerBatch = bytesPerBatch();
+    res.parallelBatches = parallelBatches();
+    res.batchesCompleted = m_batchesCompleted;
+    res.decreases = m_decreases;
+    return res;
+}
+
+}
+}
@@ -0,0 +1,130 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#ifndef IMAP_MODEL_FETCHBATCHCONTROLLER_H
+#define IMAP_MODEL_FETCHBATCHCONTROLLER_H
+
+#include <QHash>
+#include <QByteArray>
+
+namespace Imap {
+namespace Mailbox {
+
+/** @short Statistics of the adaptive sizing of the FETCH batches on one connection */
+struct FetchBatchStats {
+    /** @short Identification of the connection */
+    uint parserId;
+    /** @short Smoothed round-trip time in microseconds, or -1 if not measured yet */
+    qint64 smoothedRtt;
+    /** @short Estimated throughput in bytes per second, or -1 if not measured yet */
+    qint64 throughput;
+    /** @short Current multiplier of the initial batch sizes */
+    double scale;
+    int messagesPerBatch;
+    uint bytesPerBatch;
+    int parallelBatches;
+    /** @short How many batches have completed since the connection got established */
+    uint batchesCompleted;
+    /** @short How many times the batches had to shrink */
+    uint decreases;
+
+    FetchBatchStats();
+};
+
+/** @short Size the FETCH batches according to the measured latency and throughput of a connection
+
+The round-trip time and the throughput are estimated from the time it takes the server to respond to the tagged commands.
+Short commands (the ones with small responses) are used for measuring the latency, the long ones for the throughput.
+
+The size of the batches follows the AIMD scheme known from the TCP congestion control. As long as the server manages to
+deliver a batch within the target time, the batches grow additively; when it does not, they shrink to a half. The time
+which a batch spends waiting behind the previous ones in the pipeline is not counted. The number of batches which are
+pipelined at once is chosen so that the link does not idle while waiting for the next batch, i.e. it covers the round-trip
+time.
+
+All timestamps are in microseconds of a monotonic clock, see TaskTrace::now().
+*/
+class FetchBatchController
+{
+public:
+    FetchBatchController();
+
+    /** @short Use these limits as the starting point; the batches are allowed to get several times smaller or bigger */
+    void setInitialLimits(const int messages, const uint bytes, const int parallelBatches);
+    /** @short Have the initial limits been set already? */
+    bool isConfigured() const;
+    /** @short How long shall the server take to deliver a single batch, in microseconds */
+    void setTargetBatchDuration(const qint64 usecs);
+    /** @short Turn off the adaptation, making the initial limits effective */
+    void setAdaptive(const bool adaptive);
+
+    void commandSent(const QByteArray &tag, const qint64 now);
+    void responseReceived(const int bytes);
+    void commandCompleted(const QByteArray &tag, const qint64 now);
+
+    /** @short A FETCH batch has been completed
+
+    The @arg started is when the batch has been sent, @arg now is when it got completed.
+    */
+    void batchCompleted(const qint64 started, const qint64 now);
+    void batchFailed();
+
+    int messagesPerBatch() const;
+    uint bytesPerBatch() const;
+    int parallelBatches() const;
+
+    FetchBatchStats stats() const;
+
+private:
+    struct InFlight {
+        qint64 sent;
+        qint64 bytesBefore;
+    };
+
+    QHash<QByteArray, InFlight> m_inFlight;
+    /** @short Total size of the responses received over this connection */
+    qint64 m_bytesReceived;
+    qint64 m_smoothedRtt;
+    qint64 m_rttVariance;
+    /** @short The fastest response seen so far; it can't be shorter than the round-trip time */
+    qint64 m_minRtt;
+    qint64 m_throughput;
+    /** @short When the last batch has finished, for excluding the time it waited in the pipeline */
+    qint64 m_lastBatchFinished;
+    qint64 m_targetBatchDuration;
+
+    int m_initialMessages;
+    uint m_initialBytes;
+    int m_initialParallel;
+    double m_scale;
+    bool m_configured;
+    bool m_adaptive;
+    uint m_batchesCompleted;
+    uint m_decreases;
+};
+
+}
+}
+
+#endif // IMAP_MODEL_FETCHBATCHCONTROLLER_H
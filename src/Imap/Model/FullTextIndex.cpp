@@ -0,0 +1,457 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <QDebug>
+#include <QSqlError>
+#include <QSqlRecord>
+#include <QTimer>
+#include "FullTextIndex.h"
+#include "Common/SqlTransactionAutoAborter.h"
+
+namespace {
+
+/** @short How much an occurrence of a word in the given field counts */
+double fieldWeight(const int field)
+{
+    switch (field) {
+    case Imap::Mailbox::AbstractCache::TEXT_SUBJECT:
+        return 3;
+    case Imap::Mailbox::AbstractCache::TEXT_FROM:
+    case Imap::Mailbox::AbstractCache::TEXT_RECIPIENTS:
+        return 2;
+    default:
+        return 1;
+    }
+}
+
+QString addressesToText(const QList<Imap::Message::MailAddress> &addresses)
+{
+    QStringList res;
+    Q_FOREACH(const Imap::Message::MailAddress &address, addresses) {
+        res << address.name << address.mailbox + QLatin1Char('@') + address.host;
+    }
+    return res.join(QLatin1String(" "));
+}
+
+typedef QPair<double, uint> ScoredUid;
+
+bool betterMatch(const ScoredUid &a, const ScoredUid &b)
+{
+    // Newer messages win when the score is the same
+    return a.first > b.first || (a.first == b.first && a.second > b.second);
+}
+
+}
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+FullTextIndex::FullTextIndex(QObject *parent):
+    QObject(parent), delayedCommit(0), inTransaction(false)
+{
+}
+
+FullTextIndex::~FullTextIndex()
+{
+    timeToCommit();
+    const QString connectionName = db.connectionName();
+    db.close();
+    db = QSqlDatabase();
+    if (!connectionName.isEmpty())
+        QSqlDatabase::removeDatabase(connectionName);
+}
+
+bool FullTextIndex::open(const QString &name, const QString &fileName)
+{
+    db = QSqlDatabase::addDatabase(QLatin1String("QSQLITE"), name);
+    db.setDatabaseName(fileName);
+    if (!db.open()) {
+        emitError(tr("Can't open database: %1").arg(db.lastError().text()));
+        return false;
+    }
+
+    Common::SqlTransactionAutoAborter txn(&db);
+    QSqlQuery q(QString(), db);
+
+    // There's just one version of the layout so far; anything else gets rebuilt from scratch
+    if (!db.record(QLatin1String("fts_version")).contains(QLatin1String("version"))) {
+        if (!createTables())
+            return false;
+    } else {
+        if (!q.exec(QLatin1String("SELECT version FROM fts_version")) || !q.first()) {
+            emitError(tr("Can't determine version info"), q);
+            return false;
+        }
+        if (q.value(0).toUInt() != 1) {
+            emitError(tr("Unknown version"));
+            return false;
+        }
+    }
+    txn.commit();
+
+    if (!prepareQueries())
+        return false;
+
+    bool ok;
+    int num = parent() ? parent()->property("trojita-sqlcache-commit-delay").toInt(&ok) : 0;
+    if (!parent() || !ok)
+        num = 10000;
+    delayedCommit = new QTimer(this);
+    delayedCommit->setSingleShot(true);
+    delayedCommit->setInterval(num);
+    connect(delayedCommit, SIGNAL(timeout()), this, SLOT(timeToCommit()));
+    return true;
+}
+
+bool FullTextIndex::createTables()
+{
+    QSqlQuery q(QString(), db);
+    if (!q.exec(QLatin1String("CREATE TABLE fts_version (version INT NOT NULL)"))
+            || !q.exec(QLatin1String("INSERT INTO fts_version (version) VALUES (1)"))) {
+        emitError(tr("Can't store version info"), q);
+        return false;
+    }
+    if (!q.exec(QLatin1String("CREATE TABLE fts_documents ("
+                              "mailbox STRING NOT NULL, "
+                              "uid INT NOT NULL, "
+                              "PRIMARY KEY (mailbox, uid)"
+                              ")"))) {
+        emitError(tr("Can't create table fts_documents"), q);
+        return false;
+    }
+    if (!q.exec(QLatin1String("CREATE TABLE fts_words ("
+                              "mailbox STRING NOT NULL, "
+                              "word STRING NOT NULL, "
+                              "field INT NOT NULL, "
+                              "uid INT NOT NULL, "
+                              "count INT NOT NULL, "
+                              "PRIMARY KEY (mailbox, word, field, uid)"
+                              ")"))) {
+        emitError(tr("Can't create table fts_words"), q);
+        return false;
+    }
+    if (!q.exec(QLatin1String("CREATE INDEX fts_words_by_message ON fts_words (mailbox, uid)"))) {
+        emitError(tr("Can't create index fts_words_by_message"), q);
+        return false;
+    }
+    if (!q.exec(QLatin1String("CREATE TABLE fts_parts ("
+                              "mailbox STRING NOT NULL, "
+                              "uid INT NOT NULL, "
+                              "part_id BINARY NOT NULL, "
+                              "PRIMARY KEY (mailbox, uid, part_id)"
+                              ")"))) {
+        emitError(tr("Can't create table fts_parts"), q);
+        return false;
+    }
+    return true;
+}
+
+#define TROJITA_FTS_PREPARE(QUERY, SQL) \
+    QUERY = QSqlQuery(db); \
+    if (!QUERY.prepare(QLatin1String(SQL))) { \
+        emitError(tr("Failed to prepare %1").arg(QLatin1String(#QUERY)), QUERY); \
+        return false; \
+    }
+
+bool FullTextIndex::prepareQueries()
+{
+    TROJITA_FTS_PREPARE(queryAddDocument, "INSERT OR IGNORE INTO fts_documents (mailbox, uid) VALUES (?, ?)");
+    TROJITA_FTS_PREPARE(queryDocumentCount, "SELECT COUNT(*) FROM fts_documents WHERE mailbox = ?");
+    TROJITA_FTS_PREPARE(queryForgetField, "DELETE FROM fts_words WHERE mailbox = ? AND uid = ? AND field = ?");
+    // One statement per word, no matter whether the message has already been seen with that word
+    TROJITA_FTS_PREPARE(queryAddWord, "INSERT OR REPLACE INTO fts_words (mailbox, word, field, uid, count) VALUES (?, ?, ?, ?, ? + "
+                        "COALESCE((SELECT count FROM fts_words WHERE mailbox = ? AND word = ? AND field = ? AND uid = ?), 0))");
+    TROJITA_FTS_PREPARE(queryMarkPartIndexed, "INSERT OR IGNORE INTO fts_parts (mailbox, uid, part_id) VALUES (?, ?, ?)");
+    TROJITA_FTS_PREPARE(queryLookupPrefix, "SELECT uid, field, count FROM fts_words WHERE mailbox = ? AND word >= ? AND word < ?");
+    TROJITA_FTS_PREPARE(queryForgetMessage1, "DELETE FROM fts_documents WHERE mailbox = ? AND uid = ?");
+    TROJITA_FTS_PREPARE(queryForgetMessage2, "DELETE FROM fts_words WHERE mailbox = ? AND uid = ?");
+    TROJITA_FTS_PREPARE(queryForgetMessage3, "DELETE FROM fts_parts WHERE mailbox = ? AND uid = ?");
+    TROJITA_FTS_PREPARE(queryForgetMailbox1, "DELETE FROM fts_documents WHERE mailbox = ?");
+    TROJITA_FTS_PREPARE(queryForgetMailbox2, "DELETE FROM fts_words WHERE mailbox = ?");
+    TROJITA_FTS_PREPARE(queryForgetMailbox3, "DELETE FROM fts_parts WHERE mailbox = ?");
+    return true;
+}
+
+#undef TROJITA_FTS_PREPARE
+
+void FullTextIndex::emitError(const QString &message, const QSqlQuery &query) const
+{
+    emitError(QString::fromUtf8("%1: %2").arg(message, query.lastError().text()));
+}
+
+void FullTextIndex::emitError(const QString &message) const
+{
+    const QString text = QString::fromUtf8("FullTextIndex: %1").arg(message);
+    qDebug() << text;
+    emit error(text);
+}
+
+void FullTextIndex::touchingDB()
+{
+    delayedCommit->start();
+    if (!inTransaction) {
+        inTransaction = true;
+        db.transaction();
+    }
+}
+
+void FullTextIndex::timeToCommit()
+{
+    if (inTransaction) {
+        inTransaction = false;
+        db.commit();
+    }
+}
+
+QString FullTextIndex::mailboxName(const QString &mailbox)
+{
+    return mailbox.isEmpty() ? QLatin1String("") : mailbox;
+}
+
+QStringList FullTextIndex::tokenize(const QString &text)
+{
+    // Longer words are cut, there's no point in indexing base64 garbage in its full glory
+    const int maxLength = 64;
+    QStringList res;
+    QString word;
+    for (int i = 0; i <= text.size(); ++i) {
+        if (i < text.size() && text[i].isLetterOrNumber()) {
+            if (word.size() < maxLength)
+                word += text[i];
+            continue;
+        }
+        if (!word.isEmpty()) {
+            res << word.toCaseFolded();
+            word.clear();
+        }
+    }
+    return res;
+}
+
+void FullTextIndex::countWords(const QString &text, QHash<QString, int> &counts)
+{
+    Q_FOREACH(const QString &word, tokenize(text)) {
+        // Single letters would only bloat the index; the prefix match finds them anyway
+        if (word.size() > 1)
+            ++counts[word];
+    }
+}
+
+bool FullTextIndex::storeWords(const QString &mailbox, const uint uid, const AbstractCache::TextField field,
+                               const QHash<QString, int> &counts)
+{
+    for (QHash<QString, int>::const_iterator it = counts.constBegin(); it != counts.constEnd(); ++it) {
+        queryAddWord.bindValue(0, mailboxName(mailbox));
+        queryAddWord.bindValue(1, it.key());
+        queryAddWord.bindValue(2, static_cast<int>(field));
+        queryAddWord.bindValue(3, uid);
+        queryAddWord.bindValue(4, it.value());
+        queryAddWord.bindValue(5, mailboxName(mailbox));
+        queryAddWord.bindValue(6, it.key());
+        queryAddWord.bindValue(7, static_cast<int>(field));
+        queryAddWord.bindValue(8, uid);
+        if (!queryAddWord.exec()) {
+            emitError(tr("Query queryAddWord failed"), queryAddWord);
+            return false;
+        }
+    }
+    return true;
+}
+
+void FullTextIndex::indexEnvelope(const QString &mailbox, const uint uid, const Imap::Message::Envelope &envelope)
+{
+    touchingDB();
+    queryAddDocument.bindValue(0, mailboxName(mailbox));
+    queryAddDocument.bindValue(1, uid);
+    if (!queryAddDocument.exec()) {
+        emitError(tr("Query queryAddDocument failed"), queryAddDocument);
+        return;
+    }
+
+    QList<QPair<AbstractCache::TextField, QString> > fields;
+    fields << qMakePair(AbstractCache::TEXT_SUBJECT, envelope.subject)
+           << qMakePair(AbstractCache::TEXT_FROM, addressesToText(envelope.from))
+           << qMakePair(AbstractCache::TEXT_RECIPIENTS,
+                        addressesToText(envelope.to + envelope.cc + envelope.bcc));
+    for (int i = 0; i < fields.size(); ++i) {
+        queryForgetField.bindValue(0, mailboxName(mailbox));
+        queryForgetField.bindValue(1, uid);
+        queryForgetField.bindValue(2, static_cast<int>(fields[i].first));
+        if (!queryForgetField.exec()) {
+            emitError(tr("Query queryForgetField failed"), queryForgetField);
+            return;
+        }
+        QHash<QString, int> counts;
+        countWords(fields[i].second, counts);
+        if (!storeWords(mailbox, uid, fields[i].first, counts))
+            return;
+    }
+}
+
+void FullTextIndex::indexText(const QString &mailbox, const uint uid, const QByteArray &partId, const QString &text)
+{
+    AbstractCache::MessagePartText item;
+    item.mailbox = mailbox;
+    item.uid = uid;
+    item.partId = partId;
+    item.text = text;
+    indexTexts(QList<AbstractCache::MessagePartText>() << item);
+}
+
+void FullTextIndex::indexTexts(const QList<AbstractCache::MessagePartText> &texts)
+{
+    if (texts.isEmpty())
+        return;
+
+    // All of that goes into a single transaction, and the words of all parts of a message are stored at once
+    touchingDB();
+    typedef QPair<QString, uint> MessageKey;
+    QList<MessageKey> messages;
+    QHash<MessageKey, QHash<QString, int> > counts;
+    Q_FOREACH(const AbstractCache::MessagePartText &item, texts) {
+        queryMarkPartIndexed.bindValue(0, mailboxName(item.mailbox));
+        queryMarkPartIndexed.bindValue(1, item.uid);
+        queryMarkPartIndexed.bindValue(2, item.partId);
+        if (!queryMarkPartIndexed.exec()) {
+            emitError(tr("Query queryMarkPartIndexed failed"), queryMarkPartIndexed);
+            return;
+        }
+        if (queryMarkPartIndexed.numRowsAffected() == 0) {
+            // Refetching a part shall not count its words twice
+            continue;
+        }
+        const MessageKey key = qMakePair(item.mailbox, item.uid);
+        if (!counts.contains(key))
+            messages << key;
+        countWords(item.text, counts[key]);
+    }
+
+    Q_FOREACH(const MessageKey &key, messages) {
+        queryAddDocument.bindValue(0, mailboxName(key.first));
+        queryAddDocument.bindValue(1, key.second);
+        if (!queryAddDocument.exec()) {
+            emitError(tr("Query queryAddDocument failed"), queryAddDocument);
+            return;
+        }
+        if (!storeWords(key.first, key.second, AbstractCache::TEXT_BODY, counts[key]))
+            return;
+    }
+}
+
+void FullTextIndex::forgetMessage(const QString &mailbox, const uint uid)
+{
+    touchingDB();
+    QSqlQuery *queries[] = {&queryForgetMessage1, &queryForgetMessage2, &queryForgetMessage3};
+    for (int i = 0; i < 3; ++i) {
+        queries[i]->bindValue(0, mailboxName(mailbox));
+        queries[i]->bindValue(1, uid);
+        if (!queries[i]->exec()) {
+            emitError(tr("Query queryForgetMessage%1 failed").arg(i + 1), *queries[i]);
+        }
+    }
+}
+
+void FullTextIndex::forgetMailbox(const QString &mailbox)
+{
+    touchingDB();
+    QSqlQuery *queries[] = {&queryForgetMailbox1, &queryForgetMailbox2, &queryForgetMailbox3};
+    for (int i = 0; i < 3; ++i) {
+        queries[i]->bindValue(0, mailboxName(mailbox));
+        if (!queries[i]->exec()) {
+            emitError(tr("Query queryForgetMailbox%1 failed").arg(i + 1), *queries[i]);
+        }
+    }
+}
+
+Imap::Uids FullTextIndex::search(const QString &mailbox, const QString &query, const AbstractCache::TextFields fields) const
+{
+    const QStringList words = tokenize(query);
+    if (words.isEmpty())
+        return Imap::Uids();
+
+    queryDocumentCount.bindValue(0, mailboxName(mailbox));
+    if (!queryDocumentCount.exec() || !queryDocumentCount.first()) {
+        emitError(tr("Query queryDocumentCount failed"), queryDocumentCount);
+        return Imap::Uids();
+    }
+    const double documents = queryDocumentCount.value(0).toDouble();
+    queryDocumentCount.finish();
+
+    QHash<uint, double> scores;
+    for (int i = 0; i < words.size(); ++i) {
+        // Everything which starts with the word; U+FFFF sorts after any other character we could have stored
+        queryLookupPrefix.bindValue(0, mailboxName(mailbox));
+        queryLookupPrefix.bindValue(1, words[i]);
+        queryLookupPrefix.bindValue(2, words[i] + QChar(0xffff));
+        if (!queryLookupPrefix.exec()) {
+            emitError(tr("Query queryLookupPrefix failed"), queryLookupPrefix);
+            return Imap::Uids();
+        }
+        QHash<uint, double> occurrences;
+        while (queryLookupPrefix.next()) {
+            const int field = queryLookupPrefix.value(1).toInt();
+            if (!(fields & static_cast<AbstractCache::TextField>(field)))
+                continue;
+            occurrences[queryLookupPrefix.value(0).toUInt()] += queryLookupPrefix.value(2).toInt() * fieldWeight(field);
+        }
+        queryLookupPrefix.finish();
+
+        // Rare words say more about the message than the common ones
+        const double rarity = std::log(1 + documents / qMax(1, occurrences.size()));
+        if (i == 0) {
+            for (QHash<uint, double>::const_iterator it = occurrences.constBegin(); it != occurrences.constEnd(); ++it)
+                scores[it.key()] = it.value() * rarity;
+        } else {
+            for (QHash<uint, double>::iterator it = scores.begin(); it != scores.end(); /* nothing */) {
+                QHash<uint, double>::const_iterator found = occurrences.constFind(it.key());
+                if (found == occurrences.constEnd()) {
+                    it = scores.erase(it);
+                } else {
+                    *it += *found * rarity;
+                    ++it;
+                }
+            }
+        }
+        if (scores.isEmpty())
+            return Imap::Uids();
+    }
+
+    QVector<ScoredUid> ranked;
+    ranked.reserve(scores.size());
+    for (QHash<uint, double>::const_iterator it = scores.constBegin(); it != scores.constEnd(); ++it)
+        ranked << qMakePair(it.value(), it.key());
+    std::sort(ranked.begin(), ranked.end(), betterMatch);
+
+    Imap::Uids res;
+    res.reserve(ranked.size());
+    Q_FOREACH(const ScoredUid &item, ranked) {
+        res << item.second;
+    }
+    return res;
+}
+
+}
+}
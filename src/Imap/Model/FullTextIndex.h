@@ -0,0 +1,115 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAP_MODEL_FULLTEXTINDEX_H
+#define IMAP_MODEL_FULLTEXTINDEX_H
+
+#include <QHash>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include "Cache.h"
+
+class QTimer;
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+/** @short An on-disk inverted index of the cached messages
+
+The index maps words from the subject, the addresses and the decoded text parts of each message to the messages containing
+them, so that the usual searches can be answered without asking the IMAP server.  It lives in a separate SQLite database next
+to the SQLCache's one; just like that, it is an opaque format which gets thrown away whenever its layout changes.
+
+Words are case-folded and split on anything which is neither a letter nor a digit.  Each word of a query is matched as a
+prefix, and messages have to contain all of them.  The results are ranked by the number of occurrences weighted by the
+rarity of each word and by the field it was found in.
+*/
+class FullTextIndex : public QObject
+{
+    Q_OBJECT
+public:
+    explicit FullTextIndex(QObject *parent);
+    virtual ~FullTextIndex();
+
+    /** @short Open the index in the @arg fileName, using the @arg name as the name of the DB connection */
+    bool open(const QString &name, const QString &fileName);
+
+    /** @short Index the subject and addresses of a message, replacing what was known before */
+    void indexEnvelope(const QString &mailbox, const uint uid, const Imap::Message::Envelope &envelope);
+    /** @short Index the text of a message part unless it has been indexed already */
+    void indexText(const QString &mailbox, const uint uid, const QByteArray &partId, const QString &text);
+    /** @short Index the texts of several message parts in one go, skipping the parts which have been indexed already */
+    void indexTexts(const QList<AbstractCache::MessagePartText> &texts);
+    /** @short Remove a message from the index, typically after an expunge */
+    void forgetMessage(const QString &mailbox, const uint uid);
+    /** @short Remove all messages of a mailbox, typically after an UIDVALIDITY change */
+    void forgetMailbox(const QString &mailbox);
+
+    /** @short Return UIDs of the matching messages, the best matches first */
+    Imap::Uids search(const QString &mailbox, const QString &query, const AbstractCache::TextFields fields) const;
+
+    /** @short Split the text into the words which are stored in the index */
+    static QStringList tokenize(const QString &text);
+
+signals:
+    void error(const QString &message) const;
+
+private slots:
+    /** @short We haven't committed for a while */
+    void timeToCommit();
+
+private:
+    bool createTables();
+    bool prepareQueries();
+    void emitError(const QString &message, const QSqlQuery &query) const;
+    void emitError(const QString &message) const;
+    void touchingDB();
+    bool storeWords(const QString &mailbox, const uint uid, const AbstractCache::TextField field, const QHash<QString, int> &counts);
+
+    static void countWords(const QString &text, QHash<QString, int> &counts);
+
+    static QString mailboxName(const QString &mailbox);
+
+    QSqlDatabase db;
+    mutable QSqlQuery queryAddDocument;
+    mutable QSqlQuery queryDocumentCount;
+    mutable QSqlQuery queryForgetField;
+    mutable QSqlQuery queryAddWord;
+    mutable QSqlQuery queryMarkPartIndexed;
+    mutable QSqlQuery queryLookupPrefix;
+    mutable QSqlQuery queryForgetMessage1;
+    mutable QSqlQuery queryForgetMessage2;
+    mutable QSqlQuery queryForgetMessage3;
+    mutable QSqlQuery queryForgetMailbox1;
+    mutable QSqlQuery queryForgetMailbox2;
+    mutable QSqlQuery queryForgetMailbox3;
+
+    QTimer *delayedCommit;
+    bool inTransaction;
+};
+
+}
+}
+
+#endif // IMAP_MODEL_FULLTEXTINDEX_H
@@ -350,7 +350,14 @@ void ImapAccess::doConnect()
     m_imapModel->setCapabilitiesBlacklist(m_settings->value(Common::SettingsNames::imapBlacklistedCapabilities).toStringList());
     m_imapModel->setProperty("trojita-imap-id-no-versions", !m_settings->value(Common::SettingsNames::interopRevealVersions, true).toBool());
     m_imapModel->setProperty("trojita-imap-idle-renewal", m_settings->value(Common::SettingsNames::imapIdleRenewal).toUInt() * 60 * 1000);
+    m_imapModel->setProperty("trojita-imap-local-search", m_settings->value(Common::SettingsNames::cacheSearchLocally, false).toBool());
     m_imapModel->setNumberRefreshInterval(numberRefreshInterval());
+    m_imapModel->setOfflineMirrorMailboxes(m_settings->value(Common::SettingsNames::cacheOfflineMirrorMailboxes).toStringList());
+    m_imapModel->setConnectionLimits(m_settings->value(Common::SettingsNames::imapConnectionsMin, 1).toInt(),
+                                     m_settings->value(Common::SettingsNames::imapConnectionsMax, 3).toInt());
+    // Dovecot's default mail_max_userip_connections is 10, so let's stay well below that
+    m_imapModel->setServerConnectionLimit(QString::fromUtf8("%1:%2").arg(m_server, QString::number(m_port)),
+                                          m_settings->value(Common::SettingsNames::imapConnectionsPerServer, 10).toInt());
     connect(m_imapModel, SIGNAL(alertReceived(QString)), this, SLOT(alertReceived(QString)));
     connect(m_imapModel, SIGNAL(imapError(QString)), this, SLOT(imapError(QString)));
     connect(m_imapModel, SIGNAL(networkError(QString)), this, SLOT(networkError(QString)));
@@ -358,6 +365,12 @@ void ImapAccess::doConnect()
     connect(m_imapModel, SIGNAL(needsSslDecision(QList<QSslCertificate>,QList<QSslError>)),
             this, SLOT(slotSslErrors(QList<QSslCertificate>,QList<QSslError>)));
     connect(m_imapModel, SIGNAL(requireStartTlsInFuture()), this, SLOT(onRequireStartTlsInFuture()));
+    // Capabilities which were seen by the last connection save a few round trips when reconnecting
+    if (m_settings->value(Common::SettingsNames::imapCachedCapabilitiesServer).toString() == capabilityCacheIdentity()) {
+        m_imapModel->setCachedCapabilities(m_settings->value(Common::SettingsNames::imapCachedCapabilitiesBeforeLogin).toStringList(),
+                                           m_settings->value(Common::SettingsNames::imapCachedCapabilitiesAfterLogin).toStringList());
+    }
+    connect(m_imapModel, SIGNAL(cachedCapabilitiesChanged()), this, SLOT(onCachedCapabilitiesChanged()));
 
     if (m_settings->value(Common::SettingsNames::imapNeedsNetwork, true).toBool()) {
         m_netWatcher = new Imap::Mailbox::SystemNetworkWatcher(this, m_imapModel);
@@ -499,6 +512,20 @@ void ImapAccess::onRequireStartTlsInFuture()
     }
 }
 
+/** @short Identify the server and the account the remembered capabilities belong to */
+QString ImapAccess::capabilityCacheIdentity() const
+{
+    return QString::fromUtf8("%1@%2:%3/%4").arg(m_username, m_server, QString::number(m_port),
+                                                QString::number(static_cast<int>(m_connectionMethod)));
+}
+
+void ImapAccess::onCachedCapabilitiesChanged()
+{
+    m_settings->setValue(Common::SettingsNames::imapCachedCapabilitiesServer, capabilityCacheIdentity());
+    m_settings->setValue(Common::SettingsNames::imapCachedCapabilitiesBeforeLogin, m_imapModel->cachedCapabilitiesBeforeLogin());
+    m_settings->setValue(Common::SettingsNames::imapCachedCapabilitiesAfterLogin, m_imapModel->cachedCapabilitiesAfterLogin());
+}
+
 void ImapAccess::desiredNetworkPolicyChanged(const Mailbox::NetworkPolicy policy)
 {
     switch (policy) {
@@ -150,9 +150,12 @@ public slots:
 
 private slots:
     void onRequireStartTlsInFuture();
+    void onCachedCapabilitiesChanged();
     void desiredNetworkPolicyChanged(const Imap::Mailbox::NetworkPolicy policy);
 
 private:
+    QString capabilityCacheIdentity() const;
+
     QSettings *m_settings;
     Imap::Mailbox::Model *m_imapModel;
     Imap::Mailbox::MailboxModel *m_mailboxModel;
@@ -0,0 +1,222 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QDir>
+#include <QFileInfo>
+#include <QObject>
+#include "ImportSource.h"
+
+namespace {
+
+/** @short IMAP wants CRLF line endings while files on disk usually use plain LF */
+QByteArray toCrLf(QByteArray data)
+{
+    data.replace("\r\n", "\n");
+    data.replace('\n', "\r\n");
+    return data;
+}
+
+/** @short Is this a ">From " line, possibly with several levels of quoting? */
+bool isQuotedFromLine(const QByteArray &line)
+{
+    int i = 0;
+    while (i < line.size() && line[i] == '>')
+        ++i;
+    return i > 0 && line.mid(i, 5) == "From ";
+}
+
+/** @short Extract the asctime()-formatted date from the "From sender Thu Jan  1 00:00:00 2015" line */
+QDateTime fromLineTimestamp(const QByteArray &line)
+{
+    QList<QByteArray> items = line.simplified().split(' ');
+    if (items.size() < 7)
+        return QDateTime();
+    static const QByteArray months("JanFebMarAprMayJunJulAugSepOctNovDec");
+    int month = months.indexOf(items[3]);
+    if (items[3].size() != 3 || month == -1 || month % 3)
+        return QDateTime();
+    QDate date(items[6].toInt(), month / 3 + 1, items[4].toInt());
+    QTime time = QTime::fromString(QString::fromUtf8(items[5]), QLatin1String("hh:mm:ss"));
+    if (!date.isValid() || !time.isValid())
+        return QDateTime();
+    return QDateTime(date, time);
+}
+
+}
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+MboxImportSource::MboxImportSource(const QString &fileName):
+    m_file(fileName), m_fromLineNumber(1), m_lineNumber(0)
+{
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        m_errorString = QObject::tr("%1: %2").arg(fileName, m_file.errorString());
+        return;
+    }
+    m_fromLine = m_file.readLine();
+    ++m_lineNumber;
+    if (!m_fromLine.startsWith("From ")) {
+        m_errorString = QObject::tr("%1 is not an mbox file").arg(fileName);
+        m_file.close();
+    }
+}
+
+ImportSource::Result MboxImportSource::next(AppendData &message)
+{
+    if (!m_file.isOpen()) {
+        // The file could not be opened or read, and m_errorString says why
+        return RESULT_END;
+    }
+    if (m_fromLine.isEmpty()) {
+        m_errorString.clear();
+        return RESULT_END;
+    }
+
+    AppendData res;
+    res.timestamp = fromLineTimestamp(m_fromLine);
+    const int messageLine = m_fromLineNumber;
+    m_fromLine.clear();
+
+    bool inHeaders = true;
+    QByteArray data;
+    while (!m_file.atEnd()) {
+        QByteArray line = m_file.readLine();
+        ++m_lineNumber;
+        if (line.startsWith("From ")) {
+            m_fromLine = line;
+            m_fromLineNumber = m_lineNumber;
+            break;
+        }
+        if (inHeaders) {
+            if (line.trimmed().isEmpty()) {
+                inHeaders = false;
+            } else if (line.startsWith("Status:")) {
+                // The mbox-specific headers are not a part of the message
+                if (line.indexOf('R', 7) != -1)
+                    res.flags << QLatin1String("\\Seen");
+                continue;
+            } else if (line.startsWith("X-Status:")) {
+                if (line.indexOf('A', 9) != -1)
+                    res.flags << QLatin1String("\\Answered");
+                if (line.indexOf('F', 9) != -1)
+                    res.flags << QLatin1String("\\Flagged");
+                continue;
+            }
+        } else if (isQuotedFromLine(line)) {
+            line.remove(0, 1);
+        }
+        data.append(line);
+    }
+    if (m_file.error() != QFile::NoError) {
+        // Do not upload a truncated message
+        m_errorString = QObject::tr("%1: %2").arg(m_file.fileName(), m_file.errorString());
+        m_file.close();
+        return RESULT_END;
+    }
+
+    // The empty line separating the messages does not belong to any of them
+    if (data.endsWith("\n\n"))
+        data.chop(1);
+    else if (data.endsWith("\r\n\r\n"))
+        data.chop(2);
+    if (data.trimmed().isEmpty()) {
+        m_errorString = QObject::tr("%1: the message at line %2 is empty").arg(
+                    m_file.fileName(), QString::number(messageLine));
+        return RESULT_SKIPPED;
+    }
+    res.data = toCrLf(data);
+    message = res;
+    return RESULT_MESSAGE;
+}
+
+QString MboxImportSource::errorString() const
+{
+    return m_errorString;
+}
+
+MaildirImportSource::MaildirImportSource(const QString &path)
+{
+    Q_FOREACH(const QString &subdir, QStringList() << QLatin1String("cur") << QLatin1String("new")) {
+        QDir dir(path + QLatin1Char('/') + subdir);
+        Q_FOREACH(const QFileInfo &file, dir.entryInfoList(QDir::Files, QDir::Name)) {
+            m_files << file.absoluteFilePath();
+        }
+    }
+    if (m_files.isEmpty() && !QDir(path + QLatin1String("/cur")).exists())
+        m_errorString = m_openError = QObject::tr("%1 is not a Maildir").arg(path);
+}
+
+ImportSource::Result MaildirImportSource::next(AppendData &message)
+{
+    if (m_files.isEmpty()) {
+        m_errorString = m_openError;
+        return RESULT_END;
+    }
+
+    QFile file(m_files.takeFirst());
+    if (!file.open(QIODevice::ReadOnly)) {
+        m_errorString = QObject::tr("%1: %2").arg(file.fileName(), file.errorString());
+        return RESULT_SKIPPED;
+    }
+
+    AppendData res;
+    res.data = toCrLf(file.readAll());
+    if (file.error() != QFile::NoError) {
+        m_errorString = QObject::tr("%1: %2").arg(file.fileName(), file.errorString());
+        return RESULT_SKIPPED;
+    }
+    if (res.data.trimmed().isEmpty()) {
+        m_errorString = QObject::tr("%1: the message is empty").arg(file.fileName());
+        return RESULT_SKIPPED;
+    }
+    res.timestamp = QFileInfo(file).lastModified();
+
+    // The flags are encoded in the file name, see http://cr.yp.to/proto/maildir.html
+    QString fileName = QFileInfo(file).fileName();
+    int pos = fileName.indexOf(QLatin1String(":2,"));
+    if (pos != -1) {
+        QString info = fileName.mid(pos + 3);
+        if (info.contains(QLatin1Char('S')))
+            res.flags << QLatin1String("\\Seen");
+        if (info.contains(QLatin1Char('R')))
+            res.flags << QLatin1String("\\Answered");
+        if (info.contains(QLatin1Char('F')))
+            res.flags << QLatin1String("\\Flagged");
+        if (info.contains(QLatin1Char('T')))
+            res.flags << QLatin1String("\\Deleted");
+        if (info.contains(QLatin1Char('D')))
+            res.flags << QLatin1String("\\Draft");
+    }
+    message = res;
+    return RESULT_MESSAGE;
+}
+
+QString MaildirImportSource::errorString() const
+{
+    return m_errorString;
+}
+
+}
+}
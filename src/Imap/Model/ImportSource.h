@@ -0,0 +1,95 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAP_MODEL_IMPORTSOURCE_H
+#define IMAP_MODEL_IMPORTSOURCE_H
+
+#include <QFile>
+#include <QStringList>
+#include "AppendData.h"
+
+namespace Imap {
+namespace Mailbox {
+
+/** @short A stream of messages to be uploaded to the IMAP server
+
+The messages are read one by one as they are needed, so that importing a huge mail archive does not have to load all of
+it into memory.
+*/
+class ImportSource
+{
+public:
+    /** @short Outcome of reading a message through next() */
+    enum Result {
+        /** @short The message has been read */
+        RESULT_MESSAGE,
+        /** @short This message cannot be imported, see errorString(); the following messages might still be fine */
+        RESULT_SKIPPED,
+        /** @short There are no more messages; a non-empty errorString() means that the source was not read completely */
+        RESULT_END
+    };
+
+    virtual ~ImportSource() {}
+
+    /** @short Read the next message into @arg message */
+    virtual Result next(AppendData &message) = 0;
+    /** @short Description of the last error, or a null string if everything went fine */
+    virtual QString errorString() const { return QString(); }
+};
+
+/** @short Messages stored in a single mbox file (the "mboxrd" flavor with >From quoting is supported) */
+class MboxImportSource : public ImportSource
+{
+public:
+    explicit MboxImportSource(const QString &fileName);
+    virtual Result next(AppendData &message);
+    virtual QString errorString() const;
+
+private:
+    QFile m_file;
+    /** @short The "From " line of the next message, which was read as a terminator of the previous one */
+    QByteArray m_fromLine;
+    /** @short Line number of m_fromLine, for error reporting */
+    int m_fromLineNumber;
+    int m_lineNumber;
+    QString m_errorString;
+};
+
+/** @short Messages in a Maildir, i.e. one message per file in its new/ and cur/ subdirectories */
+class MaildirImportSource : public ImportSource
+{
+public:
+    explicit MaildirImportSource(const QString &path);
+    virtual Result next(AppendData &message);
+    virtual QString errorString() const;
+
+private:
+    QStringList m_files;
+    /** @short Why the Maildir could not be read at all */
+    QString m_openError;
+    QString m_errorString;
+};
+
+}
+}
+
+#endif // IMAP_MODEL_IMPORTSOURCE_H
@@ -111,6 +111,14 @@ enum {
     RoleMessageFlags,
     /** @short Is the current item a root of thread with unread messages */
     RoleThreadRootWithUnreadMessages,
+    /** @short Number of unread messages in the subtree rooted at the current item */
+    RoleThreadUnreadCount,
+    /** @short Number of flagged messages in the subtree rooted at the current item */
+    RoleThreadFlaggedCount,
+    /** @short The newest INTERNALDATE among the messages in the subtree rooted at the current item */
+    RoleThreadNewestDate,
+    /** @short Number of messages in the subtree rooted at the current item, the item itself included */
+    RoleThreadMessageCount,
     /** @short Fuzzy date of a particular message; useful for rough navigation */
     RoleMessageFuzzyDate,
     /** @short List of message IDs from the message's References header */
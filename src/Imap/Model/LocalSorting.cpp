@@ -0,0 +1,78 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include "LocalSorting.h"
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+bool operator<(const LocalSortKey &a, const LocalSortKey &b)
+{
+    int textOrder = a.text.compare(b.text);
+    if (textOrder != 0)
+        return textOrder < 0;
+    if (a.number != b.number)
+        return a.number < b.number;
+    return a.uid < b.uid;
+}
+
+void sortLocally(QVector<LocalSortKey> &keys)
+{
+    std::sort(keys.begin(), keys.end());
+}
+
+Imap::Uids uidsFromSortKeys(const QVector<LocalSortKey> &keys)
+{
+    Imap::Uids res;
+    res.reserve(keys.size());
+    Q_FOREACH(const LocalSortKey &key, keys) {
+        res << key.uid;
+    }
+    return res;
+}
+
+LocalSortingJob::LocalSortingJob(const uint generation, const QVector<LocalSortKey> &keys):
+    m_generation(generation), m_keys(keys)
+{
+}
+
+void LocalSortingJob::run()
+{
+    sortLocally(m_keys);
+    emit finished();
+}
+
+uint LocalSortingJob::generation() const
+{
+    return m_generation;
+}
+
+QVector<LocalSortKey> LocalSortingJob::result() const
+{
+    return m_keys;
+}
+
+}
+}
@@ -0,0 +1,78 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAP_MODEL_LOCALSORTING_H
+#define IMAP_MODEL_LOCALSORTING_H
+
+#include <QVector>
+#include "Imap/Parser/Uids.h"
+#include "WorkerJob.h"
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+/** @short Precomputed sort key of one message for the client-side sorting
+
+Only one of the textual and numeric parts is typically used, depending on the sort criterion.  The UID serves as a tie breaker,
+just like the sequence number does for the server-side SORT.
+*/
+struct LocalSortKey {
+    uint uid;
+    /** @short Case-folded text for sorting by subject or by addresses */
+    QString text;
+    /** @short A date in milliseconds since the epoch or a size */
+    qint64 number;
+
+    LocalSortKey(): uid(0), number(0) {}
+};
+
+bool operator<(const LocalSortKey &a, const LocalSortKey &b);
+
+/** @short Sort the keys in an ascending order */
+void sortLocally(QVector<LocalSortKey> &keys);
+
+/** @short Extract UIDs from the sorted keys */
+Imap::Uids uidsFromSortKeys(const QVector<LocalSortKey> &keys);
+
+/** @short Run the client-side sorting in a worker thread */
+class LocalSortingJob : public WorkerJob
+{
+    Q_OBJECT
+public:
+    LocalSortingJob(const uint generation, const QVector<LocalSortKey> &keys);
+    virtual void run();
+
+    /** @short Identification of the request, so that the outdated results can be ignored */
+    uint generation() const;
+    QVector<LocalSortKey> result() const;
+
+private:
+    uint m_generation;
+    QVector<LocalSortKey> m_keys;
+};
+
+}
+}
+
+#endif // IMAP_MODEL_LOCALSORTING_H
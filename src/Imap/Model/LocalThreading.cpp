@@ -0,0 +1,501 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <QHash>
+#include "LocalThreading.h"
+
+namespace {
+
+using Imap::Responses::ThreadingNode;
+
+/** @short Message-IDs are compared without the angle brackets and the surrounding whitespace */
+QByteArray normalizedMessageId(const QByteArray &id)
+{
+    QByteArray res = id.trimmed();
+    if (res.startsWith('<') && res.endsWith('>'))
+        res = res.mid(1, res.size() - 2);
+    return res;
+}
+
+/** @short Remove one leading "Re:", "Fw:" or "Fwd:", possibly with a [blob] before the colon */
+bool stripReplyPrefix(QString &s)
+{
+    int i;
+    if (s.startsWith(QLatin1String("fwd"), Qt::CaseInsensitive)) {
+        i = 3;
+    } else if (s.startsWith(QLatin1String("re"), Qt::CaseInsensitive) || s.startsWith(QLatin1String("fw"), Qt::CaseInsensitive)) {
+        i = 2;
+    } else {
+        return false;
+    }
+
+    while (i < s.size() && s[i].isSpace())
+        ++i;
+    if (i < s.size() && s[i] == QLatin1Char('[')) {
+        i = s.indexOf(QLatin1Char(']'), i);
+        if (i == -1)
+            return false;
+        ++i;
+        while (i < s.size() && s[i].isSpace())
+            ++i;
+    }
+    if (i < s.size() && s[i] == QLatin1Char(':')) {
+        s = s.mid(i + 1).trimmed();
+        return true;
+    }
+    return false;
+}
+
+/** @short Remove a leading [blob], unless that would leave nothing behind */
+bool stripBlob(QString &s)
+{
+    if (!s.startsWith(QLatin1Char('[')))
+        return false;
+    int end = s.indexOf(QLatin1Char(']'));
+    if (end == -1)
+        return false;
+    QString rest = s.mid(end + 1).trimmed();
+    if (rest.isEmpty())
+        return false;
+    s = rest;
+    return true;
+}
+
+/** @short A node of the threading tree, possibly without any message in it */
+struct Container {
+    /** @short UID of the message, or zero for a container which only exists because somebody refers to it */
+    uint uid;
+    int parent;
+    QVector<int> children;
+    QString baseSubject;
+    bool isReply;
+    qint64 date;
+
+    Container(): uid(0), parent(-1), isReply(false), date(0) {}
+};
+
+/** @short The state of the JWZ algorithm; containers are referenced by their index */
+class Threader
+{
+public:
+    int newContainer();
+    int containerFor(const QByteArray &messageId);
+    bool isAncestor(const int ancestor, int node) const;
+    void link(const int parent, const int child);
+    void unlink(const int child);
+    QVector<int> prune(const QVector<int> &siblings, const bool isRoot);
+    QVector<int> groupBySubject(const QVector<int> &roots);
+    int mergeSameSubject(const int existing, const int node);
+    void sortSiblings(QVector<int> &siblings);
+    QVector<ThreadingNode> toNodes(const QVector<int> &siblings) const;
+    bool earlierThan(const int a, const int b) const;
+
+    QVector<Container> containers;
+    QHash<QByteArray, int> idTable;
+
+private:
+    QString threadSubject(const int node) const;
+    uint firstUid(const int node) const;
+    qint64 sortDate(const int node) const;
+};
+
+int Threader::newContainer()
+{
+    containers.append(Container());
+    return containers.size() - 1;
+}
+
+int Threader::containerFor(const QByteArray &messageId)
+{
+    QHash<QByteArray, int>::const_iterator it = idTable.constFind(messageId);
+    if (it != idTable.constEnd())
+        return *it;
+    int res = newContainer();
+    idTable.insert(messageId, res);
+    return res;
+}
+
+/** @short Is the @arg ancestor equal to the @arg node or one of its parents? */
+bool Threader::isAncestor(const int ancestor, int node) const
+{
+    for (; node != -1; node = containers[node].parent) {
+        if (node == ancestor)
+            return true;
+    }
+    return false;
+}
+
+void Threader::link(const int parent, const int child)
+{
+    Q_ASSERT(containers[child].parent == -1);
+    containers[child].parent = parent;
+    containers[parent].children.append(child);
+}
+
+void Threader::unlink(const int child)
+{
+    int parent = containers[child].parent;
+    Q_ASSERT(parent != -1);
+    containers[parent].children.remove(containers[parent].children.indexOf(child));
+    containers[child].parent = -1;
+}
+
+/** @short Get rid of the containers which do not hold any message, RFC 5256's step 4 */
+QVector<int> Threader::prune(const QVector<int> &siblings, const bool isRoot)
+{
+    QVector<int> res;
+    Q_FOREACH(const int node, siblings) {
+        containers[node].children = prune(containers[node].children, false);
+        if (containers[node].uid) {
+            res << node;
+        } else if (containers[node].children.isEmpty()) {
+            // An empty container without children is useless
+            continue;
+        } else if (!isRoot || containers[node].children.size() == 1) {
+            // Promote the children, but do not make several messages top-level ones just because they share a parent
+            Q_FOREACH(const int child, containers[node].children) {
+                containers[child].parent = containers[node].parent;
+                res << child;
+            }
+            containers[node].children.clear();
+        } else {
+            res << node;
+        }
+    }
+    return res;
+}
+
+QString Threader::threadSubject(const int node) const
+{
+    if (containers[node].uid)
+        return containers[node].baseSubject;
+    return containers[node].children.isEmpty() ? QString() : containers[containers[node].children.front()].baseSubject;
+}
+
+/** @short Put top-level messages with the same base subject into one thread, RFC 5256's step 5 */
+QVector<int> Threader::groupBySubject(const QVector<int> &roots)
+{
+    QVector<int> res;
+    QHash<QString, int> bySubject;
+    Q_FOREACH(const int root, roots) {
+        const QString subject = threadSubject(root);
+        if (subject.isEmpty()) {
+            res << root;
+            continue;
+        }
+        QHash<QString, int>::iterator it = bySubject.find(subject);
+        if (it == bySubject.end()) {
+            bySubject.insert(subject, res.size());
+            res << root;
+            continue;
+        }
+        res[*it] = mergeSameSubject(res[*it], root);
+    }
+    return res;
+}
+
+/** @short Merge two threads with the same subject and return the container which represents them both */
+int Threader::mergeSameSubject(const int existing, const int node)
+{
+    Container &a = containers[existing];
+    Container &b = containers[node];
+    if (!a.uid && !b.uid) {
+        Q_FOREACH(const int child, b.children) {
+            containers[child].parent = existing;
+            a.children << child;
+        }
+        b.children.clear();
+        return existing;
+    } else if (!a.uid || (b.isReply && !a.isReply)) {
+        link(existing, node);
+        return existing;
+    } else if (!b.uid || (a.isReply && !b.isReply)) {
+        link(node, existing);
+        return node;
+    } else {
+        // Neither of them is a better parent, so they become siblings
+        int dummy = newContainer();
+        link(dummy, existing);
+        link(dummy, node);
+        return dummy;
+    }
+}
+
+uint Threader::firstUid(const int node) const
+{
+    if (containers[node].uid || containers[node].children.isEmpty())
+        return containers[node].uid;
+    return firstUid(containers[node].children.front());
+}
+
+qint64 Threader::sortDate(const int node) const
+{
+    if (containers[node].uid || containers[node].children.isEmpty())
+        return containers[node].date;
+    return sortDate(containers[node].children.front());
+}
+
+bool Threader::earlierThan(const int a, const int b) const
+{
+    qint64 dateA = sortDate(a), dateB = sortDate(b);
+    if (dateA != dateB)
+        return dateA < dateB;
+    return firstUid(a) < firstUid(b);
+}
+
+struct SiblingOrder {
+    const Threader *threader;
+    explicit SiblingOrder(const Threader *threader): threader(threader) {}
+    bool operator()(const int a, const int b) const { return threader->earlierThan(a, b); }
+};
+
+/** @short Order each set of siblings by the sent date, RFC 5256's step 6 */
+void Threader::sortSiblings(QVector<int> &siblings)
+{
+    for (int i = 0; i < siblings.size(); ++i)
+        sortSiblings(containers[siblings[i]].children);
+    std::stable_sort(siblings.begin(), siblings.end(), SiblingOrder(this));
+}
+
+QVector<ThreadingNode> Threader::toNodes(const QVector<int> &siblings) const
+{
+    QVector<ThreadingNode> res;
+    res.reserve(siblings.size());
+    Q_FOREACH(const int node, siblings) {
+        res << ThreadingNode(containers[node].uid, toNodes(containers[node].children));
+    }
+    return res;
+}
+
+}
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+QString threadingBaseSubject(const QString &subject, bool *isReply)
+{
+    QString s = subject.simplified();
+    bool reply = false;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        while (s.endsWith(QLatin1String("(fwd)"), Qt::CaseInsensitive)) {
+            s.chop(5);
+            s = s.trimmed();
+            reply = changed = true;
+        }
+        bool strippedLeader = true;
+        while (strippedLeader) {
+            strippedLeader = false;
+            while (stripBlob(s))
+                strippedLeader = changed = true;
+            if (stripReplyPrefix(s))
+                strippedLeader = reply = changed = true;
+        }
+        if (s.startsWith(QLatin1String("[fwd:"), Qt::CaseInsensitive) && s.endsWith(QLatin1Char(']'))) {
+            s = s.mid(5, s.size() - 6).trimmed();
+            reply = changed = true;
+        }
+    }
+    if (isReply)
+        *isReply = reply;
+    return s;
+}
+
+QVector<Imap::Responses::ThreadingNode> threadByReferences(const QVector<LocalThreadingInput> &messages,
+                                                           LocalThreadingIndex *index)
+{
+    Threader t;
+    t.containers.reserve(messages.size() * 2);
+
+    // Step 1: build the parent/child relation from the References
+    Q_FOREACH(const LocalThreadingInput &message, messages) {
+        const QByteArray messageId = normalizedMessageId(message.messageId);
+        int self = messageId.isEmpty() ? t.newContainer() : t.containerFor(messageId);
+        if (t.containers[self].uid) {
+            // A duplicate Message-ID; treat this message as if it had a unique one
+            self = t.newContainer();
+        }
+        t.containers[self].uid = message.uid;
+        t.containers[self].baseSubject = threadingBaseSubject(message.subject, &t.containers[self].isReply).toCaseFolded();
+        t.containers[self].date = message.date.isValid() ? message.date.toMSecsSinceEpoch() : 0;
+
+        int previous = -1;
+        Q_FOREACH(const QByteArray &reference, message.references) {
+            const QByteArray referenceId = normalizedMessageId(reference);
+            if (referenceId.isEmpty())
+                continue;
+            int current = t.containerFor(referenceId);
+            // Links which are already known take precedence, and no loops are allowed
+            if (previous != -1 && current != previous && t.containers[current].parent == -1 && !t.isAncestor(current, previous))
+                t.link(previous, current);
+            previous = current;
+        }
+
+        // The last reference is the parent of this message, no matter what the other messages had to say about that
+        if (t.containers[self].parent != -1)
+            t.unlink(self);
+        if (previous != -1 && !t.isAncestor(self, previous))
+            t.link(previous, self);
+    }
+
+    if (index) {
+        *index = LocalThreadingIndex();
+        for (QHash<QByteArray, int>::const_iterator it = t.idTable.constBegin(); it != t.idTable.constEnd(); ++it) {
+            const Container &container = t.containers[*it];
+            if (container.uid)
+                index->messageIds.insert(it.key(), container.uid);
+            else
+                index->missingReferences.insert(it.key());
+            if (container.parent != -1)
+                index->linked.insert(it.key());
+        }
+        Q_FOREACH(const Container &container, t.containers) {
+            if (container.uid) {
+                index->baseSubjects.insert(container.baseSubject);
+                index->highestUid = qMax(index->highestUid, container.uid);
+            }
+        }
+    }
+
+    // Step 2: the root set
+    QVector<int> roots;
+    for (int i = 0; i < t.containers.size(); ++i) {
+        if (t.containers[i].parent == -1)
+            roots << i;
+    }
+    t.idTable.clear();
+
+    roots = t.groupBySubject(t.prune(roots, true));
+    t.sortSiblings(roots);
+    return t.toNodes(roots);
+}
+
+bool attachToLocalThreads(LocalThreadingIndex &index, const LocalThreadingInput &message, uint &parentUid)
+{
+    LocalThreadingIndex additions;
+    if (!attachToLocalThreads(index, additions, message, parentUid))
+        return false;
+    mergeLocalThreadingIndex(index, additions);
+    return true;
+}
+
+bool attachToLocalThreads(const LocalThreadingIndex &index, LocalThreadingIndex &additions, const LocalThreadingInput &message,
+                          uint &parentUid)
+{
+    const QByteArray messageId = normalizedMessageId(message.messageId);
+    if (!messageId.isEmpty() && (index.messageIds.contains(messageId) || index.missingReferences.contains(messageId) ||
+                                 additions.messageIds.contains(messageId) || additions.missingReferences.contains(messageId))) {
+        // Either a duplicate, or some of the older messages are waiting for this one to become their parent
+        return false;
+    }
+
+    QList<QByteArray> references;
+    Q_FOREACH(const QByteArray &reference, message.references) {
+        const QByteArray referenceId = normalizedMessageId(reference);
+        if (referenceId.isEmpty() || referenceId == messageId || (!references.isEmpty() && references.last() == referenceId))
+            continue;
+        if (index.missingReferences.contains(referenceId) || additions.missingReferences.contains(referenceId)) {
+            // The placeholder is shared with other messages, they might get moved around
+            return false;
+        }
+        if (!references.isEmpty() &&
+                (index.messageIds.contains(referenceId) || additions.messageIds.contains(referenceId)) &&
+                !index.linked.contains(referenceId) && !additions.linked.contains(referenceId)) {
+            // The References would make an older message a child of another one
+            return false;
+        }
+        references << referenceId;
+    }
+
+    // The placeholders for the unknown references get pruned, so the closest known message becomes the parent
+    parentUid = 0;
+    for (int i = references.size() - 1; i >= 0 && !parentUid; --i) {
+        parentUid = index.messageIds.value(references[i], additions.messageIds.value(references[i]));
+    }
+
+    const QString baseSubject = threadingBaseSubject(message.subject).toCaseFolded();
+    if (!parentUid && !baseSubject.isEmpty() &&
+            (index.baseSubjects.contains(baseSubject) || additions.baseSubjects.contains(baseSubject))) {
+        // This would be grouped with an existing thread by its subject
+        return false;
+    }
+
+    for (int i = 0; i < references.size(); ++i) {
+        if (!index.messageIds.contains(references[i]) && !additions.messageIds.contains(references[i])) {
+            additions.missingReferences.insert(references[i]);
+            if (i > 0)
+                additions.linked.insert(references[i]);
+        }
+    }
+    if (!messageId.isEmpty()) {
+        additions.messageIds.insert(messageId, message.uid);
+        if (!references.isEmpty())
+            additions.linked.insert(messageId);
+    }
+    additions.baseSubjects.insert(baseSubject);
+    additions.highestUid = qMax(additions.highestUid, message.uid);
+    return true;
+}
+
+void mergeLocalThreadingIndex(LocalThreadingIndex &index, const LocalThreadingIndex &additions)
+{
+    for (QHash<QByteArray, uint>::const_iterator it = additions.messageIds.constBegin(); it != additions.messageIds.constEnd(); ++it)
+        index.messageIds.insert(it.key(), it.value());
+    index.missingReferences.unite(additions.missingReferences);
+    index.linked.unite(additions.linked);
+    index.baseSubjects.unite(additions.baseSubjects);
+    index.highestUid = qMax(index.highestUid, additions.highestUid);
+}
+
+LocalThreadingJob::LocalThreadingJob(const QString &mailbox, const QVector<LocalThreadingInput> &messages):
+    m_mailbox(mailbox), m_messages(messages)
+{
+}
+
+void LocalThreadingJob::run()
+{
+    m_result = threadByReferences(m_messages, &m_index);
+    m_messages.clear();
+    emit finished();
+}
+
+QString LocalThreadingJob::mailbox() const
+{
+    return m_mailbox;
+}
+
+QVector<Imap::Responses::ThreadingNode> LocalThreadingJob::result() const
+{
+    return m_result;
+}
+
+LocalThreadingIndex LocalThreadingJob::index() const
+{
+    return m_index;
+}
+
+}
+}
@@ -0,0 +1,129 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAP_MODEL_LOCALTHREADING_H
+#define IMAP_MODEL_LOCALTHREADING_H
+
+#include <QDateTime>
+#include <QHash>
+#include <QSet>
+#include <QStringList>
+#include "Imap/Parser/ThreadingNode.h"
+#include "WorkerJob.h"
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+/** @short Headers of one message which are used by the client-side threading */
+struct LocalThreadingInput {
+    uint uid;
+    /** @short The Message-ID of this message */
+    QByteArray messageId;
+    /** @short Contents of the References header, or of the In-Reply-To if there are no References */
+    QList<QByteArray> references;
+    QString subject;
+    /** @short The sent date from the envelope */
+    QDateTime date;
+
+    LocalThreadingInput(): uid(0) {}
+};
+
+/** @short What the client-side threading has learned about the messages it has seen
+
+This is enough for placing new arrivals into the existing threads without threading the whole mailbox again.
+*/
+struct LocalThreadingIndex {
+    /** @short UIDs of the messages by their Message-ID */
+    QHash<QByteArray, uint> messageIds;
+    /** @short Message-IDs which some message refers to, but which do not belong to any known message */
+    QSet<QByteArray> missingReferences;
+    /** @short Message-IDs whose parent has been determined from the References */
+    QSet<QByteArray> linked;
+    /** @short Case-folded base subjects of all messages */
+    QSet<QString> baseSubjects;
+    /** @short The highest UID of all messages */
+    uint highestUid;
+
+    LocalThreadingIndex(): highestUid(0) {}
+};
+
+/** @short Thread messages on the client side
+
+This is an implementation of the REFERENCES algorithm from RFC 5256, i.e. Jamie Zawinski's message threading algorithm.
+The result has the same form as an UID THREAD response from the IMAP server, so it can be fed directly to the
+ThreadingMsgListModel.  If the @arg index is provided, it is filled with data for attachToLocalThreads().
+*/
+QVector<Imap::Responses::ThreadingNode> threadByReferences(const QVector<LocalThreadingInput> &messages,
+                                                           LocalThreadingIndex *index = 0);
+
+/** @short Find the place of a new message in the threads described by the @arg index
+
+Returns false if the new message would change the shape of the existing threads, for example when some of the older
+messages refer to it, or when it would be grouped with them by its subject.  The whole mailbox has to be threaded again in
+that case.  Otherwise, the @arg parentUid is set to the UID of the message which the new one shall be attached to, or to zero
+when it starts a new thread, and the @arg index is updated to include the new message.
+*/
+bool attachToLocalThreads(LocalThreadingIndex &index, const LocalThreadingInput &message, uint &parentUid);
+
+/** @short Find the place of a new message without modifying the @arg index
+
+This works like the other overload, except that whatever has to be added to the index is put into the @arg additions
+instead, which also contain the results of the previous calls.  That way, several messages can be placed before deciding
+whether to apply any of them through mergeLocalThreadingIndex().
+*/
+bool attachToLocalThreads(const LocalThreadingIndex &index, LocalThreadingIndex &additions, const LocalThreadingInput &message,
+                          uint &parentUid);
+
+/** @short Add the @arg additions collected by attachToLocalThreads() to the @arg index */
+void mergeLocalThreadingIndex(LocalThreadingIndex &index, const LocalThreadingIndex &additions);
+
+/** @short Return the "base subject" as defined by RFC 5256, section 2.1
+
+The @arg isReply is set to true when anything which looks like "Re:" or "Fwd:" was removed.
+*/
+QString threadingBaseSubject(const QString &subject, bool *isReply = 0);
+
+/** @short Run the client-side threading in a worker thread */
+class LocalThreadingJob : public WorkerJob
+{
+    Q_OBJECT
+public:
+    LocalThreadingJob(const QString &mailbox, const QVector<LocalThreadingInput> &messages);
+    virtual void run();
+
+    QString mailbox() const;
+    QVector<Imap::Responses::ThreadingNode> result() const;
+    LocalThreadingIndex index() const;
+
+private:
+    QString m_mailbox;
+    QVector<LocalThreadingInput> m_messages;
+    QVector<Imap::Responses::ThreadingNode> m_result;
+    LocalThreadingIndex m_index;
+};
+
+}
+}
+
+#endif // IMAP_MODEL_LOCALTHREADING_H
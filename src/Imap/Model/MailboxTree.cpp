@@ -512,6 +512,7 @@ void TreeItemMailbox::handleFetchResponse(Model *const model,
                         // Do not store the data into cache if the raw data are already there
                         model->cache()->setMsgPart(mailbox(), message->uid(), part->partId(), part->m_data);
                     }
+                    model->indexPartTextLater(mailbox(), message->uid(), part);
                 }
 
             } else {
@@ -521,6 +522,7 @@ void TreeItemMailbox::handleFetchResponse(Model *const model,
                 changedParts.append(part);
                 if (message->uid()) {
                     model->cache()->setMsgPart(mailbox(), message->uid(), part->partId(), part->m_data);
+                    model->indexPartTextLater(mailbox(), message->uid(), part);
                 }
             }
         } else if (it.key() == "INTERNALDATE") {
@@ -589,7 +591,7 @@ void TreeItemMailbox::handleExpunge(Model *const model, const Responses::NumberR
     auto it = list->m_children.begin() + offset;
     TreeItemMessage *message = static_cast<TreeItemMessage *>(*it);
     list->m_children.erase(it);
-    model->cache()->clearMessage(static_cast<TreeItemMailbox *>(list->parent())->mailbox(), message->uid());
+    model->clearCachedMessage(static_cast<TreeItemMailbox *>(list->parent())->mailbox(), message->uid());
     for (int i = offset; i < list->m_children.size(); ++i) {
         --static_cast<TreeItemMessage *>(list->m_children[i])->m_offset;
     }
@@ -705,7 +707,7 @@ void TreeItemMailbox::handleVanished(Model *const model, const Responses::Vanish
             // (possibly tiny) time and we can therefore use it to get an idea about the UIDNEXT
             syncState.setUidNext(uid + 1);
         }
-        model->cache()->clearMessage(mailbox(), uid);
+        model->clearCachedMessage(mailbox(), uid);
         delete msgCandidate;
     }
 
@@ -1131,6 +1133,12 @@ QVariant TreeItemMessage::data(Model *const model, int role)
         // This one doesn't really make much sense here, but we do want to catch it to prevent a fetch request from this context
         qDebug() << "Warning: asked for RoleThreadRootWithUnreadMessages on TreeItemMessage. This does not make sense.";
         return QVariant();
+    case RoleThreadUnreadCount:
+    case RoleThreadFlaggedCount:
+    case RoleThreadNewestDate:
+    case RoleThreadMessageCount:
+        // These are only provided by the ThreadingMsgListModel; don't fetch anything when someone asks for them here
+        return QVariant();
     case RoleMailboxName:
     case RoleMailboxUidValidity:
         return parent()->parent()->data(model, role);
@@ -1368,6 +1376,39 @@ bool TreeItemMessage::hasAttachments(Model *const model)
     }
 }
 
+qint64 TreeItemMessage::memoryUsage() const
+{
+    qint64 res = 0;
+    if (m_data) {
+        // This is just a rough estimate; the envelope is dominated by the subject and the addresses
+        const Message::Envelope &e = m_data->m_envelope;
+        res += sizeof(MessageDataPayload) + e.subject.size() * sizeof(QChar) + e.messageId.size();
+        res += (e.from.size() + e.sender.size() + e.replyTo.size() + e.to.size() + e.cc.size() + e.bcc.size()) * 64;
+        Q_FOREACH(const QByteArray &ref, m_data->m_hdrReferences)
+            res += ref.size();
+        if (m_data->m_partHeader)
+            res += m_data->m_partHeader->memoryUsageRecursive();
+        if (m_data->m_partText)
+            res += m_data->m_partText->memoryUsageRecursive();
+    }
+    Q_FOREACH(TreeItem *item, m_children) {
+        res += static_cast<TreeItemPart *>(item)->memoryUsageRecursive();
+    }
+    return res;
+}
+
+bool TreeItemMessage::isLoadingParts() const
+{
+    if (m_data && ((m_data->m_partHeader && m_data->m_partHeader->isLoadingRecursive()) ||
+                   (m_data->m_partText && m_data->m_partText->isLoadingRecursive())))
+        return true;
+    Q_FOREACH(TreeItem *item, m_children) {
+        if (static_cast<TreeItemPart *>(item)->isLoadingRecursive())
+            return true;
+    }
+    return false;
+}
+
 /** @short Walk the MIME tree starting at @arg part and check if there are any attachments below (or at there) */
 bool TreeItemMessage::hasNestedAttachments(Model *const model, TreeItemPart *part)
 {
@@ -1548,8 +1589,10 @@ QVariant TreeItemPart::data(Model *const model, int role)
     case Qt::ToolTipRole:
         return QString::fromUtf8("%1 bytes of data").arg(m_data.size());
     case RolePartData:
+        model->touchMessageData(message());
         return m_data;
     case RolePartUnicodeText:
+        model->touchMessageData(message());
         if (m_mimeType.startsWith("text/")) {
             return decodeByteArray(m_data, m_charset);
         } else {
@@ -1692,6 +1735,30 @@ void TreeItemPart::silentlyReleaseMemoryRecursive()
     m_children.clear();
 }
 
+qint64 TreeItemPart::memoryUsageRecursive() const
+{
+    qint64 res = m_data.size();
+    Q_FOREACH(TreeItem *item, m_children) {
+        res += static_cast<TreeItemPart *>(item)->memoryUsageRecursive();
+    }
+    if (m_partMime)
+        res += m_partMime->memoryUsageRecursive();
+    if (m_partRaw)
+        res += m_partRaw->memoryUsageRecursive();
+    return res;
+}
+
+bool TreeItemPart::isLoadingRecursive() const
+{
+    if (loading())
+        return true;
+    Q_FOREACH(TreeItem *item, m_children) {
+        if (static_cast<TreeItemPart *>(item)->isLoadingRecursive())
+            return true;
+    }
+    return (m_partMime && m_partMime->isLoadingRecursive()) || (m_partRaw && m_partRaw->isLoadingRecursive());
+}
+
 
 
 TreeItemModifiedPart::TreeItemModifiedPart(TreeItem *parent, const PartModifier kind):
@@ -1845,5 +1912,21 @@ void TreeItemPartMultipartMessage::silentlyReleaseMemoryRecursive()
     }
 }
 
+qint64 TreeItemPartMultipartMessage::memoryUsageRecursive() const
+{
+    qint64 res = TreeItemPart::memoryUsageRecursive();
+    if (m_partHeader)
+        res += m_partHeader->memoryUsageRecursive();
+    if (m_partText)
+        res += m_partText->memoryUsageRecursive();
+    return res;
+}
+
+bool TreeItemPartMultipartMessage::isLoadingRecursive() const
+{
+    return TreeItemPart::isLoadingRecursive() || (m_partHeader && m_partHeader->isLoadingRecursive()) ||
+            (m_partText && m_partText->isLoadingRecursive());
+}
+
 }
 }
@@ -52,6 +52,8 @@ class TreeItem
     friend class KeepMailboxOpenTask; // for direct access to m_children
     friend class ListChildMailboxesTask; // setStatus() in case of failure
     friend class MsgListModel; // for direct access to m_children
+    friend class NumberOfMessagesTask; // for direct access to m_children
+    friend class OfflineMirror; // for direct access to m_children and the fetching status
     friend class ThreadingMsgListModel; // for direct access to m_children
     friend class UpdateFlagsOfAllMessagesTask; // for direct access to m_children
 
@@ -138,6 +140,7 @@ class TreeItemMailbox: public TreeItem
     friend class MailboxModel;
     friend class DeleteMailboxTask; // for direct access to maintainingTask
     friend class KeepMailboxOpenTask; // needs access to maintainingTask
+    friend class OfflineMirror; // needs access to maintainingTask
     friend class SubscribeUnsubscribeTask; // needs access to m_metadata.flags
     static QLatin1String flagNoInferiors;
     static QLatin1String flagHasNoChildren;
@@ -255,6 +258,7 @@ class TreeItemMessage: public TreeItem
     friend class KeepMailboxOpenTask; // needs access to m_offset
     friend class UpdateFlagsTask; // needs access to m_flags
     friend class UpdateFlagsOfAllMessagesTask; // needs access to m_flags
+    friend class ThreadingMsgListModel; // needs access to m_data for the client-side threading
     int m_offset;
     uint m_uid;
     mutable MessageDataPayload *m_data;
@@ -294,6 +298,10 @@ public:
     uint uid() const;
     virtual TreeItem *specialColumnPtr(int row, int column) const;
     bool hasAttachments(Model *const model);
+    /** @short Approximate amount of memory occupied by the downloaded data of this message and its parts */
+    qint64 memoryUsage() const;
+    /** @short Is any part of this message being fetched right now? */
+    bool isLoadingParts() const;
 };
 
 class TreeItemPart: public TreeItem
@@ -373,6 +381,8 @@ public:
     virtual bool isTopLevelMultiPart() const;
 
     virtual void silentlyReleaseMemoryRecursive();
+    virtual qint64 memoryUsageRecursive() const;
+    virtual bool isLoadingRecursive() const;
 protected:
     TreeItemPart(TreeItem *parent);
 };
@@ -412,6 +422,8 @@ public:
     virtual QVariant data(Model * const model, int role);
     virtual TreeItem *specialColumnPtr(int row, int column) const;
     virtual void silentlyReleaseMemoryRecursive();
+    virtual qint64 memoryUsageRecursive() const;
+    virtual bool isLoadingRecursive() const;
 };
 
 }
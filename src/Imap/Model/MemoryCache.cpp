@@ -91,6 +91,8 @@ void MemoryCache::clearAllMessages(const QString &mailbox)
     msgMetadata.remove(mailbox);
     parts.remove(mailbox);
     threads.remove(mailbox);
+    searchResultsState.remove(mailbox);
+    searchResults.remove(mailbox);
 }
 
 void MemoryCache::clearMessage(const QString mailbox, const uint uid)
@@ -179,6 +181,30 @@ void MemoryCache::setMessageThreading(const QString &mailbox, const QVector<Imap
     threads[mailbox] = threading;
 }
 
+bool MemoryCache::searchResult(const QString &mailbox, const QByteArray &mailboxState, const QByteArray &key, Imap::Uids &result) const
+{
+    if (searchResultsState.value(mailbox) != mailboxState)
+        return false;
+    const QMap<QByteArray, Imap::Uids> &firstLevel = searchResults[mailbox];
+    QMap<QByteArray, Imap::Uids>::const_iterator it = firstLevel.find(key);
+    if (it == firstLevel.end())
+        return false;
+    result = *it;
+    return true;
+}
+
+void MemoryCache::setSearchResult(const QString &mailbox, const QByteArray &mailboxState, const QByteArray &key, const Imap::Uids &result)
+{
+#ifdef CACHE_DEBUG
+    qDebug() << "saving search result for" << mailbox << key << result.size();
+#endif
+    if (searchResultsState.value(mailbox) != mailboxState) {
+        searchResultsState[mailbox] = mailboxState;
+        searchResults.remove(mailbox);
+    }
+    searchResults[mailbox][key] = result;
+}
+
 void MemoryCache::setRenewalThreshold(const int days)
 {
     Q_UNUSED(days);
@@ -72,6 +72,9 @@ public:
     virtual QVector<Imap::Responses::ThreadingNode> messageThreading(const QString &mailbox);
     virtual void setMessageThreading(const QString &mailbox, const QVector<Imap::Responses::ThreadingNode> &threading);
 
+    virtual bool searchResult(const QString &mailbox, const QByteArray &mailboxState, const QByteArray &key, Imap::Uids &result) const;
+    virtual void setSearchResult(const QString &mailbox, const QByteArray &mailboxState, const QByteArray &key, const Imap::Uids &result);
+
     virtual void setRenewalThreshold(const int days);
 
 private:
@@ -82,6 +85,8 @@ private:
     QMap<QString, QMap<uint, MessageDataBundle> > msgMetadata;
     QMap<QString, QMap<uint, QMap<QByteArray, QByteArray> > > parts;
     QMap<QString, QVector<Imap::Responses::ThreadingNode> > threads;
+    QMap<QString, QByteArray> searchResultsState;
+    QMap<QString, QMap<QByteArray, Imap::Uids> > searchResults;
 };
 
 }
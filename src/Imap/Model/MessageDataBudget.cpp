@@ -0,0 +1,114 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "MessageDataBudget.h"
+
+namespace Imap {
+namespace Mailbox {
+
+MessageDataBudget::MessageDataBudget(): m_limit(0), m_usage(0)
+{
+}
+
+void MessageDataBudget::setLimit(const qint64 bytes)
+{
+    m_limit = bytes;
+}
+
+qint64 MessageDataBudget::limit() const
+{
+    return m_limit;
+}
+
+qint64 MessageDataBudget::usage() const
+{
+    return m_usage;
+}
+
+bool MessageDataBudget::isExceeded() const
+{
+    return m_limit > 0 && m_usage > m_limit;
+}
+
+int MessageDataBudget::size() const
+{
+    return m_index.size();
+}
+
+void MessageDataBudget::record(const QString &mailbox, const uint uid, const qint64 bytes)
+{
+    forget(mailbox, uid);
+    if (bytes <= 0)
+        return;
+    Entry entry;
+    entry.key = qMakePair(mailbox, uid);
+    entry.bytes = bytes;
+    m_index[entry.key] = m_lru.insert(m_lru.end(), entry);
+    m_usage += bytes;
+}
+
+void MessageDataBudget::touch(const QString &mailbox, const uint uid)
+{
+    auto it = m_index.constFind(qMakePair(mailbox, uid));
+    if (it == m_index.constEnd())
+        return;
+    // Moving the node around keeps the iterators valid
+    m_lru.splice(m_lru.end(), m_lru, *it);
+}
+
+void MessageDataBudget::forget(const QString &mailbox, const uint uid)
+{
+    auto it = m_index.find(qMakePair(mailbox, uid));
+    if (it == m_index.end())
+        return;
+    m_usage -= (*it)->bytes;
+    m_lru.erase(*it);
+    m_index.erase(it);
+}
+
+void MessageDataBudget::clear()
+{
+    m_lru.clear();
+    m_index.clear();
+    m_usage = 0;
+}
+
+QList<MessageDataBudget::Key> MessageDataBudget::evictionCandidates(const QSet<Key> &pinned) const
+{
+    QList<Key> res;
+    if (!isExceeded())
+        return res;
+    qint64 usage = m_usage;
+    LruList::const_iterator mostRecent = m_lru.end();
+    --mostRecent;
+    for (LruList::const_iterator it = m_lru.begin(); it != mostRecent && usage > m_limit; ++it) {
+        if (pinned.contains(it->key))
+            continue;
+        res << it->key;
+        usage -= it->bytes;
+    }
+    return res;
+}
+
+}
+}
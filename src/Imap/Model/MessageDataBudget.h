@@ -0,0 +1,88 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef IMAP_MODEL_MESSAGEDATABUDGET_H
+#define IMAP_MODEL_MESSAGEDATABUDGET_H
+
+#include <list>
+#include <QHash>
+#include <QList>
+#include <QPair>
+#include <QSet>
+#include <QString>
+
+namespace Imap {
+namespace Mailbox {
+
+/** @short LRU bookkeeping of the memory occupied by the downloaded message data
+
+The messages are identified by the mailbox name and the UID, i.e. by the same key which the persistent cache uses. That way,
+the entries cannot become dangling when the corresponding tree items get deleted; they are simply not found anymore.
+*/
+class MessageDataBudget
+{
+public:
+    typedef QPair<QString, uint> Key;
+
+    MessageDataBudget();
+
+    /** @short Set the memory limit in bytes, zero means no limit */
+    void setLimit(const qint64 bytes);
+    qint64 limit() const;
+    /** @short Total size of the data of all tracked messages */
+    qint64 usage() const;
+    bool isExceeded() const;
+    int size() const;
+
+    /** @short Record the current size of data of the given message and mark it as the most recently used one */
+    void record(const QString &mailbox, const uint uid, const qint64 bytes);
+    /** @short Mark the message as the most recently used one, if it is tracked at all */
+    void touch(const QString &mailbox, const uint uid);
+    void forget(const QString &mailbox, const uint uid);
+    void clear();
+
+    /** @short Return the least recently used messages whose data have to go to get below the limit
+
+    Neither the most recently used message nor any of the @arg pinned ones are ever returned, so that the data which the user
+    is looking at or which some task is working with are safe even when they alone happen to exceed the limit.
+    */
+    QList<Key> evictionCandidates(const QSet<Key> &pinned = QSet<Key>()) const;
+
+private:
+    struct Entry {
+        Key key;
+        qint64 bytes;
+    };
+    typedef std::list<Entry> LruList;
+
+    /** @short Tracked messages, the least recently used ones go first */
+    LruList m_lru;
+    QHash<Key, LruList::iterator> m_index;
+    qint64 m_limit;
+    qint64 m_usage;
+};
+
+}
+}
+
+#endif /* IMAP_MODEL_MESSAGEDATABUDGET_H */
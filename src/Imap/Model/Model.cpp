@@ -24,9 +24,12 @@
 #include <QAuthenticator>
 #include <QCoreApplication>
 #include <QDebug>
+#include <QElapsedTimer>
+#include <QThreadPool>
 #include <QtAlgorithms>
 #include "Model.h"
 #include "MailboxTree.h"
+#include "OfflineMirror.h"
 #include "QAIM_reset.h"
 #include "SpecialFlagNames.h"
 #include "TaskPresentationModel.h"
@@ -35,6 +38,7 @@
 #include "Common/InvokeMethod.h"
 #include "Imap/Encoders.h"
 #include "Imap/Tasks/AppendTask.h"
+#include "Imap/Tasks/BulkAppendTask.h"
 #include "Imap/Tasks/GetAnyConnectionTask.h"
 #include "Imap/Tasks/KeepMailboxOpenTask.h"
 #include "Imap/Tasks/OpenConnectionTask.h"
@@ -104,8 +108,10 @@ Model::Model(QObject *parent, AbstractCache *cache, SocketFactoryPtr socketFacto
     // parent
     QAbstractItemModel(parent),
     // our tools
-    m_cache(cache), m_socketFactory(std::move(socketFactory)), m_taskFactory(std::move(taskFactory)), m_maxParsers(4), m_mailboxes(0),
-    m_netPolicy(NETWORK_OFFLINE),  m_taskModel(0), m_hasImapPassword(false)
+    m_cache(cache), m_socketFactory(std::move(socketFactory)), m_taskFactory(std::move(taskFactory)), m_connectionPool(this), m_mailboxes(0),
+    m_netPolicy(NETWORK_OFFLINE),  m_taskModel(0), m_hasImapPassword(false), m_responseProcessingBudget(8),
+    m_messageDataBudgetCheckPending(false), m_partTextIndexingPending(false), m_partTextExtractionInFlight(false),
+    m_offlineMirror(0), m_cachedCapabilitiesVerified(false)
 {
     m_cache->setParent(this);
     m_startTls = m_socketFactory->startTlsRequired();
@@ -126,6 +132,7 @@ Model::Model(QObject *parent, AbstractCache *cache, SocketFactoryPtr socketFacto
 #endif
 
     m_taskModel = new TaskPresentationModel(this);
+    m_offlineMirror = new OfflineMirror(this);
 
     // Make sure to update the first-character check inside normalizeFlags() when adding new flags here
     m_specialFlagNames[QLatin1String("\\seen")] = FlagNames::seen;
@@ -139,6 +146,8 @@ Model::Model(QObject *parent, AbstractCache *cache, SocketFactoryPtr socketFacto
     // polling every five minutes
     m_periodicMailboxNumbersRefresh->setInterval(5 * 60 * 1000);
     connect(m_periodicMailboxNumbersRefresh, SIGNAL(timeout()), this, SLOT(invalidateAllMessageCounts()));
+
+    m_messageDataBudget.setLimit(100 * 1024 * 1024);
 }
 
 Model::~Model()
@@ -146,98 +155,165 @@ Model::~Model()
     delete m_mailboxes;
 }
 
-/** @short Process responses from all sockets */
+/** @short Process responses from all sockets
+
+The connection which serves the mailbox the user is looking at goes first so that the GUI gets updated as soon as possible.
+*/
 void Model::responseReceived()
 {
-    for (QMap<Parser *,ParserState>::iterator it = m_parsers.begin(); it != m_parsers.end(); ++it) {
-        responseReceived(it);
+    QElapsedTimer turnTimer;
+    turnTimer.start();
+
+    // Processing the responses could kill some connections, so we cannot iterate over m_parsers directly
+    QList<Parser *> parsers = m_parsers.keys();
+    Parser *preferred = preferredParser();
+    if (preferred) {
+        parsers.removeOne(preferred);
+        parsers.prepend(preferred);
+    }
+
+    bool pending = false;
+    Q_FOREACH(Parser *parser, parsers) {
+        QMap<Parser *,ParserState>::iterator it = m_parsers.find(parser);
+        if (it == m_parsers.end() || !it->parser)
+            continue;
+        if (responseReceived(it, turnTimer))
+            pending = true;
+    }
+
+    if (pending) {
+        // Return to the event loop to handle GUI events, we will get back to the rest of the responses later
+        QTimer::singleShot(0, this, SLOT(responseReceived()));
     }
 }
 
-/** @short Process responses from the specified parser */
+/** @short Process responses from the specified parser
+
+If there are any pending responses on the connection which serves the mailbox the user is looking at, these go first.
+*/
 void Model::responseReceived(Parser *parser)
 {
-    QMap<Parser *,ParserState>::iterator it = m_parsers.find(parser);
-    if (it == m_parsers.end()) {
+    if (!m_parsers.contains(parser)) {
         // This is a queued signal, so it's perfectly possible that the sender is gone already
         return;
     }
-    responseReceived(it);
+
+    QElapsedTimer turnTimer;
+    turnTimer.start();
+    bool pending = false;
+
+    Parser *preferred = preferredParser();
+    if (preferred && preferred != parser) {
+        QMap<Parser *,ParserState>::iterator it = m_parsers.find(preferred);
+        if (it != m_parsers.end() && it->parser && it->parser->hasResponse())
+            pending = responseReceived(it, turnTimer);
+    }
+
+    QMap<Parser *,ParserState>::iterator it = m_parsers.find(parser);
+    if (it != m_parsers.end() && it->parser) {
+        if (responseReceived(it, turnTimer))
+            pending = true;
+    }
+
+    if (pending) {
+        // Return to the event loop to handle GUI events, we will get back to the rest of the responses later
+        QTimer::singleShot(0, this, SLOT(responseReceived()));
+    }
 }
 
-/** @short Process responses from the specified parser */
-void Model::responseReceived(const QMap<Parser *,ParserState>::iterator it)
+/** @short Process responses from the specified parser until the time budget of the current turn is exhausted
+
+At least one response is always processed so that no connection can starve. Returns true if there are more responses
+waiting to be processed.
+*/
+bool Model::responseReceived(const QMap<Parser *,ParserState>::iterator it, const QElapsedTimer &turnTimer)
 {
     Q_ASSERT(it->parser);
 
-    int counter = 0;
+    bool pending = false;
     while (it->parser && it->parser->hasResponse()) {
         QSharedPointer<Imap::Responses::AbstractResponse> resp = it->parser->getResponse();
         Q_ASSERT(resp);
         // Always log BAD responses from a central place. They're bad enough to warant an extra treatment.
         // FIXME: is it worth an UI popup?
-        if (Responses::State *stateResponse = dynamic_cast<Responses::State *>(resp.data())) {
-            if (stateResponse->kind == Responses::BAD) {
-                QString buf;
-                QTextStream s(&buf);
-                s << *stateResponse;
-                logTrace(it->parser->parserId(), Common::LOG_OTHER, QLatin1String("Model"), QString::fromUtf8("BAD response: %1").arg(buf));
-                qDebug() << buf;
-            }
+        Responses::State *stateResponse = dynamic_cast<Responses::State *>(resp.data());
+        it->fetchBatching.responseReceived(resp->rawSize);
+        if (stateResponse && !stateResponse->tag.isEmpty())
+            it->fetchBatching.commandCompleted(stateResponse->tag, TaskTrace::now());
+        if (stateResponse && stateResponse->kind == Responses::BAD) {
+            QString buf;
+            QTextStream s(&buf);
+            s << *stateResponse;
+            logTrace(it->parser->parserId(), Common::LOG_OTHER, QLatin1String("Model"), QString::fromUtf8("BAD response: %1").arg(buf));
+            qDebug() << buf;
         }
         try {
-            /* At this point, we want to iterate over all active tasks and try them
-            for processing the server's responses (the plug() method). However, this
-            is rather complex -- this call to plug() could result in signals being
-            emitted, and certain slots connected to those signals might in turn want
-            to queue more Tasks. Therefore, it->activeTasks could be modified, some
-            items could be appended to it using the QList::append, which in turn could
-            cause a realloc to happen, happily invalidating our iterators, and that
-            kind of sucks.
-
-            So, we have to iterate over a copy of the original list and instead of
-            deleting Tasks, we store them into a temporary list. When we're done with
-            processing, we walk the original list once again and simply remove all
-            "deleted" items for real.
-
-            This took me 3+ hours to track it down to what the hell was happening here,
-            even though the underlying reason is simple -- QList::append() could invalidate
-            existing iterators.
-            */
-
             bool handled = false;
-            QList<ImapTask *> taskSnapshot = it->activeTasks;
-            QList<ImapTask *> deletedTasks;
-            QList<ImapTask *>::const_iterator taskEnd = taskSnapshot.constEnd();
-
-            // Try various tasks, perhaps it's their response. Also check if they're already finished and remove them.
-            for (QList<ImapTask *>::const_iterator taskIt = taskSnapshot.constBegin(); taskIt != taskEnd; ++taskIt) {
-                if (! handled) {
 
-#ifdef DEBUG_TASK_ROUTING
-                    try {
-                        logTrace(it->parser->parserId(), Common::LOG_TASKS, QString(),
-                                 QString::fromAscii("Routing to %1 %2").arg(QString::fromAscii((*taskIt)->metaObject()->className()),
-                                                                            (*taskIt)->debugIdentification()));
-#endif
-                    handled = resp->plug(*taskIt);
-#ifdef DEBUG_TASK_ROUTING
-                        if (handled) {
-                            logTrace(it->parser->parserId(), Common::LOG_TASKS, (*taskIt)->debugIdentification(), QLatin1String("Handled"));
-                        }
-                    } catch (std::exception &e) {
-                        logTrace(it->parser->parserId(), Common::LOG_TASKS, (*taskIt)->debugIdentification(), QLatin1String("Got exception when handling"));
-                        throw;
+            // Most of the responses have an obvious recipient -- the tagged ones belong to whoever has sent the command, and
+            // the untagged updates of the mailbox state go to the task which maintains the selected mailbox. Try these at first
+            // to prevent offering each response to each of the (potentially hundreds of) active tasks.
+            ImapTask *target = routingTarget(*it, resp.data());
+            if (target) {
+                handled = offerResponseToTask(*it, resp.data(), target);
+                if (!it->parser) {
+                    // The connection got killed while processing this response
+                } else if (!handled) {
+                    ++it->routingStats.misses;
+                } else {
+                    if (stateResponse && !stateResponse->tag.isEmpty())
+                        ++it->routingStats.taggedHits;
+                    else
+                        ++it->routingStats.untaggedHits;
+                    // Handling the response could have finished more tasks than just the target, like those which depend on it
+                    QList<ImapTask *> deletedTasks;
+                    Q_FOREACH(ImapTask *task, it->activeTasks) {
+                        if (task->isFinished())
+                            deletedTasks << task;
                     }
-#endif
+                    removeDeletedTasks(deletedTasks, it->activeTasks);
                 }
+            }
 
-                if ((*taskIt)->isFinished()) {
-                    deletedTasks << *taskIt;
+            if (!handled && it->parser) {
+                ++it->routingStats.fullScans;
+
+                /* At this point, we want to iterate over all active tasks and try them
+                for processing the server's responses (the plug() method). However, this
+                is rather complex -- this call to plug() could result in signals being
+                emitted, and certain slots connected to those signals might in turn want
+                to queue more Tasks. Therefore, it->activeTasks could be modified, some
+                items could be appended to it using the QList::append, which in turn could
+                cause a realloc to happen, happily invalidating our iterators, and that
+                kind of sucks.
+
+                So, we have to iterate over a copy of the original list and instead of
+                deleting Tasks, we store them into a temporary list. When we're done with
+                processing, we walk the original list once again and simply remove all
+                "deleted" items for real.
+
+                This took me 3+ hours to track it down to what the hell was happening here,
+                even though the underlying reason is simple -- QList::append() could invalidate
+                existing iterators.
+                */
+
+                QList<ImapTask *> taskSnapshot = it->activeTasks;
+                QList<ImapTask *> deletedTasks;
+                QList<ImapTask *>::const_iterator taskEnd = taskSnapshot.constEnd();
+
+                // Try various tasks, perhaps it's their response. Also check if they're already finished and remove them.
+                for (QList<ImapTask *>::const_iterator taskIt = taskSnapshot.constBegin(); taskIt != taskEnd; ++taskIt) {
+                    if (! handled) {
+                        handled = offerResponseToTask(*it, resp.data(), *taskIt);
+                    }
+
+                    if ((*taskIt)->isFinished()) {
+                        deletedTasks << *taskIt;
+                    }
                 }
-            }
 
-            removeDeletedTasks(deletedTasks, it->activeTasks);
+                removeDeletedTasks(deletedTasks, it->activeTasks);
+            }
 
             runReadyTasks();
 
@@ -258,10 +334,9 @@ void Model::responseReceived(const QMap<Parser *,ParserState>::iterator it)
             break;
         }
 
-        // Return to the event loop every 100 messages to handle GUI events
-        ++counter;
-        if (counter == 100) {
-            QTimer::singleShot(0, this, SLOT(responseReceived()));
+        if (m_responseProcessingBudget > 0 && turnTimer.hasExpired(m_responseProcessingBudget)
+                && it->parser && it->parser->hasResponse()) {
+            pending = true;
             break;
         }
     }
@@ -272,6 +347,163 @@ void Model::responseReceived(const QMap<Parser *,ParserState>::iterator it)
         m_parsers.erase(it);
         RESET_MODEL_2(m_taskModel);
     }
+    return pending;
+}
+
+/** @short Return the parser which maintains the mailbox the user is looking at, if any */
+Parser *Model::preferredParser() const
+{
+    if (!m_preferredMailbox.isValid())
+        return 0;
+    TreeItemMailbox *mailbox = dynamic_cast<TreeItemMailbox *>(static_cast<TreeItem *>(m_preferredMailbox.internalPointer()));
+    if (!mailbox || !mailbox->maintainingTask)
+        return 0;
+    return mailbox->maintainingTask->parser;
+}
+
+/** @short Is there a connection which gets the changes in all mailboxes pushed through NOTIFY? */
+bool Model::hasNotifyConnection() const
+{
+    for (QMap<Parser *,ParserState>::const_iterator it = m_parsers.constBegin(); it != m_parsers.constEnd(); ++it) {
+        if (it->notifyActive && it->connState != CONN_STATE_LOGOUT)
+            return true;
+    }
+    return false;
+}
+
+/** @short Find a task which is expected to handle the response, or return 0 if all active tasks have to be asked
+
+Tagged responses are routed to the task which has issued the corresponding command. Untagged responses which update the
+state of the selected mailbox are routed to the task which maintains that mailbox, but only if that task is the first one in
+the list of active tasks. That way, the order in which the tasks get to see the responses is not affected.
+*/
+ImapTask *Model::routingTarget(ParserState &parserState, const Responses::AbstractResponse *const resp)
+{
+    if (parserState.activeTasks.isEmpty())
+        return 0;
+
+    if (const Responses::State *const state = dynamic_cast<const Responses::State *const>(resp)) {
+        if (state->tag.isEmpty())
+            return 0;
+
+        ImapTask *owner = parserState.commandOwners.take(state->tag).data();
+        if (!owner || owner->isFinished())
+            return 0;
+
+        switch (state->respCode) {
+        case Responses::UIDNEXT:
+        case Responses::UIDVALIDITY:
+        case Responses::UNSEEN:
+        case Responses::PERMANENTFLAGS:
+        case Responses::HIGHESTMODSEQ:
+        case Responses::NOMODSEQ:
+        case Responses::CLOSED:
+            // These response codes update the mailbox state, and the tasks which maintain that state want to see them
+            // no matter which command they are attached to
+            return 0;
+        default:
+            return owner;
+        }
+    }
+
+    if (dynamic_cast<const Responses::Fetch *const>(resp) || dynamic_cast<const Responses::NumberResponse *const>(resp) ||
+            dynamic_cast<const Responses::Vanished *const>(resp) || dynamic_cast<const Responses::Flags *const>(resp)) {
+        ImapTask *maintainingTask = parserState.maintainingTask.data();
+        if (maintainingTask && parserState.activeTasks.front() == maintainingTask && !maintainingTask->isFinished())
+            return maintainingTask;
+    }
+
+    return 0;
+}
+
+/** @short Let the @arg task process the response, recording which commands it issues in the meanwhile */
+bool Model::offerResponseToTask(ParserState &parserState, const Responses::AbstractResponse *const resp, ImapTask *task)
+{
+    bool handled = false;
+
+#ifdef DEBUG_TASK_ROUTING
+    try {
+        logTrace(parserState.parser->parserId(), Common::LOG_TASKS, QString(),
+                 QString::fromUtf8("Routing to %1 %2").arg(QString::fromUtf8(task->metaObject()->className()),
+                                                           task->debugIdentification()));
+#endif
+    handled = resp->plug(task);
+    if (handled) {
+        if (task->trace.firstResponse < 0)
+            task->trace.firstResponse = TaskTrace::now();
+        task->trace.bytesIn += resp->rawSize;
+    }
+#ifdef DEBUG_TASK_ROUTING
+        if (handled) {
+            logTrace(parserState.parser->parserId(), Common::LOG_TASKS, task->debugIdentification(), QLatin1String("Handled"));
+        }
+    } catch (std::exception &e) {
+        logTrace(parserState.parser->parserId(), Common::LOG_TASKS, task->debugIdentification(), QLatin1String("Got exception when handling"));
+        throw;
+    }
+#endif
+
+    return handled;
+}
+
+/** @short Remember which task has issued the command, so that its tagged response can be routed straight back to it
+
+The issuer is only valid for the single command queued through ImapTask::commandParser(). The commands which were sent in some
+other way are recorded without an owner, so that their traffic does not get accounted to the task which has sent the previous one.
+*/
+void Model::slotParserCommandTagged(Parser *parser, const QByteArray &tag)
+{
+    QMap<Parser *,ParserState>::iterator it = m_parsers.find(parser);
+    if (it == m_parsers.end())
+        return;
+    it->commandOwners[tag] = it->commandIssuer;
+    it->commandIssuer = 0;
+}
+
+void Model::recordTaskTrace(const TaskTrace &trace)
+{
+    // Keep just the recent history, this is meant for looking at what has happened in the last couple of minutes
+    if (m_taskTraces.size() >= 10000)
+        m_taskTraces.removeFirst();
+    m_taskTraces.append(trace);
+}
+
+QByteArray Model::taskTraceJson(const uint parserId) const
+{
+    if (!parserId)
+        return taskTracesToChromeJson(m_taskTraces);
+
+    QList<TaskTrace> traces;
+    Q_FOREACH(const TaskTrace &trace, m_taskTraces) {
+        if (trace.parserId == parserId)
+            traces << trace;
+    }
+    return taskTracesToChromeJson(traces);
+}
+
+ResponseRoutingStats Model::responseRoutingStats() const
+{
+    ResponseRoutingStats res;
+    for (QMap<Parser *,ParserState>::const_iterator it = m_parsers.constBegin(); it != m_parsers.constEnd(); ++it) {
+        res.taggedHits += it->routingStats.taggedHits;
+        res.untaggedHits += it->routingStats.untaggedHits;
+        res.misses += it->routingStats.misses;
+        res.fullScans += it->routingStats.fullScans;
+    }
+    return res;
+}
+
+QList<FetchBatchStats> Model::fetchBatchStats() const
+{
+    QList<FetchBatchStats> res;
+    for (QMap<Parser *,ParserState>::const_iterator it = m_parsers.constBegin(); it != m_parsers.constEnd(); ++it) {
+        if (!it->parser)
+            continue;
+        FetchBatchStats stats = it->fetchBatching.stats();
+        stats.parserId = it->parser->parserId();
+        res << stats;
+    }
+    return res;
 }
 
 void Model::handleState(Imap::Parser *ptr, const Imap::Responses::State *const resp)
@@ -313,6 +545,12 @@ void Model::handleState(Imap::Parser *ptr, const Imap::Responses::State *const r
             if (resp->respCode == NONE) {
                 // This one probably should not be logged at all; dovecot sends these reponses to keep NATted connections alive
                 break;
+            } else if (resp->respCode == NOTIFICATIONOVERFLOW) {
+                // RFC 5465: the server has given up on the NOTIFY, so we have to fall back to polling
+                logTrace(ptr->parserId(), Common::LOG_OTHER, QString(), QLatin1String("NOTIFY overflow, polling for changes again"));
+                accessParser(ptr).notifyActive = false;
+                invalidateAllMessageCounts();
+                break;
             } else {
                 logTrace(ptr->parserId(), Common::LOG_OTHER, QString(), QLatin1String("Warning: unhandled untagged OK with a response code"));
                 break;
@@ -424,6 +662,7 @@ void Model::finalizeIncrementalList(Parser *parser, const QString &parentMailbox
         beginInsertRows(parentIdx, (*it)->row(), (*it)->row());
     parentMbox->m_children.insert(it, mailboxes[0]);
     endInsertRows();
+    indexMailboxes(TreeItemChildrenList() << mailboxes[0]);
 }
 
 void Model::replaceChildMailboxes(TreeItemMailbox *mailboxPtr, const TreeItemChildrenList &mailboxes)
@@ -472,9 +711,12 @@ void Model::replaceChildMailboxes(TreeItemMailbox *mailboxPtr, const TreeItemChi
         auto oldItems = mailboxPtr->setChildren(TreeItemChildrenList());
         endRemoveRows();
 
+        unindexMailboxes(oldItems);
         qDeleteAll(oldItems);
     }
 
+    indexMailboxes(mailboxes);
+
     if (! mailboxes.isEmpty()) {
         beginInsertRows(parent, 1, mailboxes.size());
         auto dummy = mailboxPtr->setChildren(mailboxes);
@@ -784,6 +1026,7 @@ void Model::askForMessagesInMailbox(const QModelIndex &index)
     Q_ASSERT(index.model() == this);
     auto msgList = dynamic_cast<TreeItemMsgList *>(static_cast<TreeItem *>(index.internalPointer()));
     Q_ASSERT(msgList);
+    m_preferredMailbox = index.parent();
     askForMessagesInMailbox(msgList);
 }
 
@@ -905,7 +1148,7 @@ void Model::askForNumberOfMessages(TreeItemMsgList *item)
     }
 }
 
-void Model::askForMsgMetadata(TreeItemMessage *item, const PreloadingMode preloadMode)
+void Model::askForMsgMetadata(TreeItemMessage *item, const PreloadingMode preloadMode, const FetchPriority priority)
 {
     Q_ASSERT(item->uid());
     Q_ASSERT(!item->fetched());
@@ -948,6 +1191,7 @@ void Model::askForMsgMetadata(TreeItemMessage *item, const PreloadingMode preloa
                 }
                 item->setFetchStatus(TreeItem::DONE);
             }
+            accountMessageData(item);
         }
     }
 
@@ -959,14 +1203,14 @@ void Model::askForMsgMetadata(TreeItemMessage *item, const PreloadingMode preloa
     case NETWORK_EXPENSIVE:
         if (item->accessFetchStatus() != TreeItem::DONE) {
             item->setFetchStatus(TreeItem::LOADING);
-            findTaskResponsibleFor(mailboxPtr)->requestEnvelopeDownload(item->uid());
+            findTaskResponsibleFor(mailboxPtr)->requestEnvelopeDownload(item->uid(), priority);
         }
         break;
     case NETWORK_ONLINE:
     {
         if (item->accessFetchStatus() != TreeItem::DONE) {
             item->setFetchStatus(TreeItem::LOADING);
-            findTaskResponsibleFor(mailboxPtr)->requestEnvelopeDownload(item->uid());
+            findTaskResponsibleFor(mailboxPtr)->requestEnvelopeDownload(item->uid(), priority);
         }
 
         // preload
@@ -984,7 +1228,7 @@ void Model::askForMsgMetadata(TreeItemMessage *item, const PreloadingMode preloa
                 message->setFetchStatus(TreeItem::LOADING);
                 // cannot ask the KeepTask directly, that'd completely ignore the cache
                 // but we absolutely have to block the preload :)
-                askForMsgMetadata(message, PRELOAD_DISABLED);
+                askForMsgMetadata(message, PRELOAD_DISABLED, FETCH_PRIORITY_PRELOAD);
             }
         }
     }
@@ -993,7 +1237,7 @@ void Model::askForMsgMetadata(TreeItemMessage *item, const PreloadingMode preloa
     EMIT_LATER(this, dataChanged, Q_ARG(QModelIndex, item->toIndex(this)), Q_ARG(QModelIndex, item->toIndex(this)));
 }
 
-void Model::askForMsgPart(TreeItemPart *item, bool onlyFromCache)
+void Model::askForMsgPart(TreeItemPart *item, bool onlyFromCache, const FetchPriority priority)
 {
     Q_ASSERT(item->message());   // TreeItemMessage
     Q_ASSERT(item->message()->parent());   // TreeItemMsgList
@@ -1022,6 +1266,7 @@ void Model::askForMsgPart(TreeItemPart *item, bool onlyFromCache)
     if (! data.isNull()) {
         item->m_data = data;
         item->setFetchStatus(TreeItem::DONE);
+        accountMessageData(item->message());
         return;
     }
 
@@ -1032,6 +1277,7 @@ void Model::askForMsgPart(TreeItemPart *item, bool onlyFromCache)
         if (!data.isNull()) {
             Imap::decodeContentTransferEncoding(data, item->encoding(), item->dataPtr());
             item->setFetchStatus(TreeItem::DONE);
+            accountMessageData(item->message());
             return;
         }
 
@@ -1055,7 +1301,8 @@ void Model::askForMsgPart(TreeItemPart *item, bool onlyFromCache)
                 fetchingMode = TreeItemPart::FETCH_PART_BINARY;
             }
         }
-        keepTask->requestPartDownload(item->message()->m_uid, itemForFetchOperation->partIdForFetch(fetchingMode), item->octets());
+        keepTask->requestPartDownload(item->message()->m_uid, itemForFetchOperation->partIdForFetch(fetchingMode), item->octets(),
+                                      priority);
     }
 }
 
@@ -1183,6 +1430,8 @@ void Model::switchToMailbox(const QModelIndex &mbox)
     if (! mbox.isValid())
         return;
 
+    m_preferredMailbox = mbox;
+
     if (m_netPolicy == NETWORK_OFFLINE)
         return;
 
@@ -1309,7 +1558,7 @@ TreeItemChildrenList::iterator Model::findMessageOrNextOneByUid(TreeItemMsgList
 
 TreeItemMailbox *Model::findMailboxByName(const QString &name) const
 {
-    return findMailboxByName(name, m_mailboxes);
+    return m_mailboxIndex.value(name);
 }
 
 TreeItemMailbox *Model::findMailboxByName(const QString &name, const TreeItemMailbox *const root) const
@@ -1327,6 +1576,30 @@ TreeItemMailbox *Model::findMailboxByName(const QString &name, const TreeItemMai
     return 0;
 }
 
+/** @short Add the mailboxes and all of their child mailboxes to the index used by findMailboxByName() */
+void Model::indexMailboxes(const TreeItemChildrenList &mailboxes)
+{
+    Q_FOREACH(TreeItem *item, mailboxes) {
+        TreeItemMailbox *mailbox = static_cast<TreeItemMailbox *>(item);
+        m_mailboxIndex[mailbox->mailbox()] = mailbox;
+        if (mailbox->m_children.size() > 1)
+            indexMailboxes(mailbox->m_children.mid(1));
+    }
+}
+
+/** @short Remove the mailboxes and all of their child mailboxes from the index used by findMailboxByName() */
+void Model::unindexMailboxes(const TreeItemChildrenList &mailboxes)
+{
+    Q_FOREACH(TreeItem *item, mailboxes) {
+        TreeItemMailbox *mailbox = static_cast<TreeItemMailbox *>(item);
+        auto it = m_mailboxIndex.find(mailbox->mailbox());
+        if (it != m_mailboxIndex.end() && *it == mailbox)
+            m_mailboxIndex.erase(it);
+        if (mailbox->m_children.size() > 1)
+            unindexMailboxes(mailbox->m_children.mid(1));
+    }
+}
+
 /** @short Find a parent mailbox for the specified name */
 TreeItemMailbox *Model::findParentMailboxByName(const QString &name) const
 {
@@ -1498,6 +1771,23 @@ void Model::slotParserLineReceived(Parser *parser, const QByteArray &line)
 void Model::slotParserLineSent(Parser *parser, const QByteArray &line)
 {
     logTrace(parser->parserId(), Common::LOG_IO_WRITTEN, QString(), QString::fromUtf8(line));
+
+    QMap<Parser *,ParserState>::iterator it = m_parsers.find(parser);
+    if (it == m_parsers.end())
+        return;
+    // A new command starts with its tag; continuation of literals and the IDLE's DONE belong to the previous one
+    int space = line.indexOf(' ');
+    if (space > 0) {
+        QHash<CommandHandle, QPointer<ImapTask> >::const_iterator owner = it->commandOwners.constFind(line.left(space));
+        if (owner != it->commandOwners.constEnd()) {
+            it->commandWriter = *owner;
+            // The IDLE lasts for minutes, so it says nothing about the latency
+            if (!line.mid(space + 1).startsWith("IDLE"))
+                it->fetchBatching.commandSent(owner.key(), TaskTrace::now());
+        }
+    }
+    if (it->commandWriter)
+        it->commandWriter->trace.bytesOut += line.size();
 }
 
 void Model::setCache(AbstractCache *cache)
@@ -1560,35 +1850,22 @@ KeepMailboxOpenTask *Model::findTaskResponsibleFor(const QModelIndex &mailbox)
 KeepMailboxOpenTask *Model::findTaskResponsibleFor(TreeItemMailbox *mailboxPtr)
 {
     Q_ASSERT(mailboxPtr);
-    bool canCreateParallelConn = m_parsers.isEmpty(); // FIXME: multiple connections
 
-    if (mailboxPtr->maintainingTask) {
-        // The requested mailbox already has the maintaining task associated
-        if (accessParser(mailboxPtr->maintainingTask->parser).connState == CONN_STATE_LOGOUT) {
-            // The connection is currently getting closed, so we have to create another one
-            return m_taskFactory->createKeepMailboxOpenTask(this, mailboxPtr->toIndex(this), 0);
-        } else {
-            // it's usable as-is
-            return mailboxPtr->maintainingTask;
-        }
-    } else if (canCreateParallelConn) {
-        // The mailbox is not being maintained, but we can create a new connection
-        return m_taskFactory->createKeepMailboxOpenTask(this, mailboxPtr->toIndex(this), 0);
-    } else {
-        // Too bad, we have to re-use an existing parser. That will probably lead to
-        // stealing it from some mailbox, but there's no other way.
-        Q_ASSERT(!m_parsers.isEmpty());
-
-        for (QMap<Parser *,ParserState>::const_iterator it = m_parsers.constBegin(); it != m_parsers.constEnd(); ++it) {
-            if (it->connState == CONN_STATE_LOGOUT) {
-                // this one is not usable
-                continue;
-            }
-            return m_taskFactory->createKeepMailboxOpenTask(this, mailboxPtr->toIndex(this), it.key());
-        }
-        // At this point, we have no other choice than to create a new connection
-        return m_taskFactory->createKeepMailboxOpenTask(this, mailboxPtr->toIndex(this), 0);
+    if (mailboxPtr->maintainingTask &&
+            accessParser(mailboxPtr->maintainingTask->parser).connState != CONN_STATE_LOGOUT) {
+        // The requested mailbox already has the maintaining task associated and it's usable as-is
+        return mailboxPtr->maintainingTask;
     }
+
+    // Either the mailbox is not being maintained, or its connection is currently getting closed. The mailbox which the
+    // user is looking at gets its dedicated connection, the other ones are spread over the rest of the pool. Reusing
+    // a busy connection will probably lead to stealing it from some mailbox, but there's no other way.
+    const bool isForeground = m_preferredMailbox.isValid() && m_preferredMailbox.internalPointer() == mailboxPtr;
+    KeepMailboxOpenTask *task = m_taskFactory->createKeepMailboxOpenTask(this, mailboxPtr->toIndex(this),
+                                                                        m_connectionPool.parserForMailbox(isForeground));
+    if (isForeground)
+        m_connectionPool.setForegroundParser(task->parser);
+    return task;
 }
 
 void Model::genericHandleFetch(TreeItemMailbox *mailbox, const Imap::Responses::Fetch *const resp)
@@ -1608,6 +1885,11 @@ void Model::genericHandleFetch(TreeItemMailbox *mailbox, const Imap::Responses::
         emit dataChanged(index, index);
         emitMessageCountChanged(mailbox);
     }
+    if (!changedParts.isEmpty()) {
+        accountMessageData(changedParts.front()->message());
+    } else if (changedMessage) {
+        accountMessageData(changedMessage);
+    }
 }
 
 QModelIndex Model::findMailboxForItems(const QModelIndexList &items)
@@ -1695,6 +1977,7 @@ void Model::releaseMessageData(const QModelIndex &message)
         return;
 
     msg->setFetchStatus(TreeItem::NONE);
+    m_messageDataBudget.forget(static_cast<TreeItemMailbox *>(msg->parent()->parent())->mailbox(), msg->uid());
 
 #ifndef XTUPLE_CONNECT
     beginRemoveRows(realMessage, 0, msg->m_children.size() - 1);
@@ -1931,9 +2214,31 @@ QModelIndex Model::messageIndexByUid(const QString &mailboxName, const uint uid)
     }
 }
 
-/** @short Forget any cached data about number of messages in all mailboxes */
+QModelIndex Model::mailboxIndexByName(const QString &name)
+{
+    TreeItemMailbox *mailbox = findMailboxByName(name);
+    return mailbox ? mailbox->toIndex(this) : QModelIndex();
+}
+
+/** @short Refresh the number of messages in all mailboxes whose numbers were known
+
+The mailboxes are asked in batches so that thousands of them do not result in thousands of tasks. Each batch is served by
+either one LIST-STATUS command or a pipeline of STATUS commands, depending on what the server supports.
+*/
 void Model::invalidateAllMessageCounts()
 {
+    if (hasNotifyConnection()) {
+        // The server pushes the changes to us, there's no point in polling
+        return;
+    }
+
+    bool ok;
+    int batchSize = property("trojita-imap-status-batch-size").toInt(&ok);
+    if (!ok || batchSize <= 0)
+        batchSize = 100;
+    const bool online = networkPolicy() != NETWORK_OFFLINE;
+
+    QList<QPersistentModelIndex> batch;
     QList<TreeItemMailbox*> queue;
     queue.append(m_mailboxes);
     while (!queue.isEmpty()) {
@@ -1947,10 +2252,21 @@ void Model::invalidateAllMessageCounts()
         if (list->m_numberFetchingStatus == TreeItem::DONE && !head->maintainingTask) {
             // Ask only for data which were previously available
             // Also don't mess with a mailbox which is already being kept up-to-date because it's selected.
-            list->m_numberFetchingStatus = TreeItem::NONE;
+            if (online) {
+                list->m_numberFetchingStatus = TreeItem::LOADING;
+                batch << head->toIndex(this);
+                if (batch.size() >= batchSize) {
+                    m_taskFactory->createNumberOfMessagesTask(this, batch);
+                    batch.clear();
+                }
+            } else {
+                list->m_numberFetchingStatus = TreeItem::NONE;
+            }
             emitMessageCountChanged(head);
         }
     }
+    if (!batch.isEmpty())
+        m_taskFactory->createNumberOfMessagesTask(this, batch);
 }
 
 AppendTask *Model::appendIntoMailbox(const QString &mailbox, const QByteArray &rawMessageData, const QStringList &flags,
@@ -1965,6 +2281,11 @@ AppendTask *Model::appendIntoMailbox(const QString &mailbox, const QList<Catenat
     return m_taskFactory->createAppendTask(this, mailbox, data, flags, timestamp);
 }
 
+BulkAppendTask *Model::importIntoMailbox(const QString &mailbox, ImportSource *source)
+{
+    return m_taskFactory->createBulkAppendTask(this, mailbox, source);
+}
+
 GenUrlAuthTask *Model::generateUrlAuthForMessage(const QString &host, const QString &user, const QString &mailbox,
                                                  const uint uidValidity, const uint uid, const QString &part, const QString &access)
 {
@@ -2041,6 +2362,33 @@ void Model::setCapabilitiesBlacklist(const QStringList &blacklist)
     m_capabilitiesBlacklist = blacklist;
 }
 
+void Model::setCachedCapabilities(const QStringList &beforeLogin, const QStringList &afterLogin)
+{
+    m_cachedCapabilitiesVerified = false;
+    if (beforeLogin == m_cachedCapabilitiesBeforeLogin && afterLogin == m_cachedCapabilitiesAfterLogin)
+        return;
+    m_cachedCapabilitiesBeforeLogin = beforeLogin;
+    m_cachedCapabilitiesAfterLogin = afterLogin;
+    emit cachedCapabilitiesChanged();
+}
+
+/** @short Remember the capabilities which a connection has just obtained from the server */
+void Model::updateCachedCapabilities(const QStringList &beforeLogin, const QStringList &afterLogin)
+{
+    setCachedCapabilities(beforeLogin, afterLogin);
+    m_cachedCapabilitiesVerified = true;
+}
+
+QStringList Model::cachedCapabilitiesBeforeLogin() const
+{
+    return m_cachedCapabilitiesBeforeLogin;
+}
+
+QStringList Model::cachedCapabilitiesAfterLogin() const
+{
+    return m_cachedCapabilitiesAfterLogin;
+}
+
 bool Model::isCatenateSupported() const
 {
     return capabilities().contains(QLatin1String("CATENATE"));
@@ -2064,5 +2412,272 @@ void Model::setNumberRefreshInterval(const int interval)
     m_periodicMailboxNumbersRefresh->start(interval * 1000);
 }
 
+void Model::setResponseProcessingBudget(const int msecs)
+{
+    m_responseProcessingBudget = msecs;
+}
+
+/** @short Configure how many parallel connections shall be used for synchronizing the mailboxes */
+void Model::setConnectionLimits(const int minimum, const int maximum)
+{
+    m_connectionPool.setLimits(minimum, maximum);
+}
+
+/** @short Limit the number of connections to the given server, shared among all Model instances talking to it
+
+Zero means no limit.
+*/
+void Model::setServerConnectionLimit(const QString &server, const int maximum)
+{
+    m_connectionPool.setServer(server);
+    ConnectionPool::setServerLimit(server, maximum);
+}
+
+/** @short Let the model know which messages are currently shown
+
+The pending requests for the envelopes and message parts are reordered so that the visible messages are fetched
+first. The requests for messages which the user has scrolled past and which are not even close to the visible
+area anymore are dropped; they will be requested again when they get shown.
+*/
+void Model::setVisibleMessages(const QModelIndexList &messages)
+{
+    QHash<TreeItemMailbox *, QList<TreeItemMessage *> > visibleMessages;
+    Q_FOREACH(const QModelIndex &index, messages) {
+        if (!index.isValid() || index.model() != this)
+            continue;
+        TreeItemMessage *message = dynamic_cast<TreeItemMessage *>(static_cast<TreeItem *>(index.internalPointer()));
+        if (!message || !message->uid())
+            continue;
+        TreeItemMailbox *mailbox = dynamic_cast<TreeItemMailbox *>(message->parent()->parent());
+        Q_ASSERT(mailbox);
+        visibleMessages[mailbox] << message;
+    }
+
+    bool ok;
+    int preload = property("trojita-imap-preload-msg-metadata").toInt(&ok);
+    if (! ok)
+        preload = 50;
+
+    for (auto it = visibleMessages.constBegin(); it != visibleMessages.constEnd(); ++it) {
+        TreeItemMailbox *mailbox = it.key();
+        KeepMailboxOpenTask *keepTask = mailbox->maintainingTask;
+        if (!keepTask)
+            continue;
+        TreeItemMsgList *list = dynamic_cast<TreeItemMsgList *>(mailbox->m_children[0]);
+        Q_ASSERT(list);
+
+        QSet<uint> visible;
+        QSet<uint> nearby;
+        int nearbyEnd = 0;
+        QList<int> rows;
+        Q_FOREACH(TreeItemMessage *message, *it) {
+            visible.insert(message->uid());
+            rows << message->row();
+        }
+        qSort(rows);
+        Q_FOREACH(const int row, rows) {
+            // The neighbourhoods of the visible rows overlap, so make sure not to walk the same rows again
+            for (int i = qMax(nearbyEnd, row - preload); i < qMin(list->m_children.size(), row + preload + 1); ++i) {
+                if (uint uid = static_cast<TreeItemMessage *>(list->m_children[i])->uid())
+                    nearby.insert(uid);
+            }
+            nearbyEnd = qMax(nearbyEnd, row + preload + 1);
+        }
+
+        Imap::Uids cancelled = keepTask->updateFetchPriorities(visible, nearby);
+        qSort(cancelled);
+        Q_FOREACH(TreeItemMessage *message, findMessagesByUids(mailbox, cancelled)) {
+            if (message->loading())
+                message->setFetchStatus(TreeItem::NONE);
+        }
+    }
+}
+
+void Model::setOfflineMirrorMailboxes(const QStringList &mailboxes)
+{
+    m_offlineMirror->setMailboxes(mailboxes);
+}
+
+QStringList Model::offlineMirrorMailboxes() const
+{
+    return m_offlineMirror->mailboxes();
+}
+
+void Model::setMailboxKeptOffline(const QString &mailbox, const bool keepOffline)
+{
+    m_offlineMirror->setMirrored(mailbox, keepOffline);
+}
+
+bool Model::isMailboxKeptOffline(const QString &mailbox) const
+{
+    return m_offlineMirror->isMirrored(mailbox);
+}
+
+void Model::setMessageDataMemoryBudget(const qint64 bytes)
+{
+    m_messageDataBudget.setLimit(bytes);
+    if (m_messageDataBudget.isExceeded() && !m_messageDataBudgetCheckPending) {
+        m_messageDataBudgetCheckPending = true;
+        QTimer::singleShot(0, this, SLOT(enforceMessageDataBudget()));
+    }
+}
+
+/** @short Update the record about how much memory the message data occupy and schedule a cleanup if they are too big */
+void Model::accountMessageData(TreeItemMessage *message)
+{
+    if (!message || !message->uid())
+        return;
+    TreeItemMailbox *mailbox = dynamic_cast<TreeItemMailbox *>(message->parent()->parent());
+    Q_ASSERT(mailbox);
+    m_messageDataBudget.record(mailbox->mailbox(), message->uid(), message->memoryUsage());
+    if (m_messageDataBudget.isExceeded() && !m_messageDataBudgetCheckPending) {
+        // Don't release anything right now, we might be in the middle of processing some response for that message
+        m_messageDataBudgetCheckPending = true;
+        QTimer::singleShot(0, this, SLOT(enforceMessageDataBudget()));
+    }
+}
+
+/** @short Remember that the data of this message were just used */
+void Model::touchMessageData(TreeItemMessage *message)
+{
+    if (!message || !message->uid() || !m_messageDataBudget.size())
+        return;
+    TreeItemMailbox *mailbox = dynamic_cast<TreeItemMailbox *>(message->parent()->parent());
+    Q_ASSERT(mailbox);
+    m_messageDataBudget.touch(mailbox->mailbox(), message->uid());
+}
+
+/** @short Drop data of the least recently used messages until their total size fits within the budget
+
+Messages which are referenced through a persistent index, be it the message itself or any of its parts, are in use by some
+view or task, and therefore they are left alone.
+*/
+void Model::enforceMessageDataBudget()
+{
+    m_messageDataBudgetCheckPending = false;
+    QSet<MessageDataBudget::Key> pinned;
+    Q_FOREACH(const QModelIndex &index, persistentIndexList()) {
+        TreeItem *item = static_cast<TreeItem *>(index.internalPointer());
+        TreeItemMessage *message = 0;
+        while (item && !(message = dynamic_cast<TreeItemMessage *>(item)))
+            item = item->parent();
+        if (!message || !message->uid())
+            continue;
+        TreeItemMailbox *mailbox = dynamic_cast<TreeItemMailbox *>(message->parent()->parent());
+        Q_ASSERT(mailbox);
+        pinned.insert(qMakePair(mailbox->mailbox(), message->uid()));
+    }
+
+    Q_FOREACH(const MessageDataBudget::Key &key, m_messageDataBudget.evictionCandidates(pinned)) {
+        TreeItemMailbox *mailbox = findMailboxByName(key.first);
+        TreeItemMessage *message = 0;
+        if (mailbox) {
+            TreeItemMsgList *list = dynamic_cast<TreeItemMsgList *>(mailbox->m_children[0]);
+            Q_ASSERT(list);
+            auto it = findMessageOrNextOneByUid(list, key.second);
+            if (it != list->m_children.end() && static_cast<TreeItemMessage *>(*it)->uid() == key.second)
+                message = static_cast<TreeItemMessage *>(*it);
+        }
+        if (!message) {
+            // The message is gone already
+            m_messageDataBudget.forget(key.first, key.second);
+            continue;
+        }
+        if (message->loading() || message->isLoadingParts()) {
+            // Some data are still on their way and we would not know where to put them, so let's try again later
+            continue;
+        }
+        releaseMessageData(message->toIndex(this));
+    }
+}
+
+/** @short Schedule a downloaded textual part for the full-text index
+
+Converting the data from their charset, stripping the markup and updating the index are much more expensive than the rest
+of the response processing, so none of that happens right away.  The parts are collected, their texts are extracted in a
+worker thread and the cache gets them all in one batch.
+*/
+void Model::indexPartTextLater(const QString &mailbox, const uint uid, TreeItemPart *part)
+{
+    if (!uid || !part->mimeType().startsWith("text/") || dynamic_cast<TreeItemModifiedPart*>(part))
+        return;
+    PendingPartText item;
+    item.mailbox = mailbox;
+    item.uid = uid;
+    item.partId = part->partId();
+    item.mimeType = part->mimeType();
+    item.charset = part->charset();
+    // This is an implicitly shared copy, so it stays valid no matter what happens to the part in the meanwhile
+    item.data = *part->dataPtr();
+    m_pendingPartTexts << item;
+    if (!m_partTextIndexingPending && !m_partTextExtractionInFlight) {
+        m_partTextIndexingPending = true;
+        QTimer::singleShot(0, this, SLOT(startPartTextExtraction()));
+    }
+}
+
+/** @short Make sure that the texts of a message which is gone from the cache do not end up in its full-text index
+
+A zero @arg uid refers to all messages in the @arg mailbox.  The texts which are being extracted right now get filtered out
+once the job finishes.
+*/
+void Model::forgetPartTexts(const QString &mailbox, const uint uid)
+{
+    for (QList<PendingPartText>::iterator it = m_pendingPartTexts.begin(); it != m_pendingPartTexts.end(); /* nothing */) {
+        if (it->mailbox == mailbox && (!uid || it->uid == uid))
+            it = m_pendingPartTexts.erase(it);
+        else
+            ++it;
+    }
+    if (m_partTextExtractionInFlight)
+        m_partTextsClearedInFlight.insert(qMakePair(mailbox, uid));
+}
+
+void Model::clearCachedMessage(const QString &mailbox, const uint uid)
+{
+    m_cache->clearMessage(mailbox, uid);
+    forgetPartTexts(mailbox, uid);
+}
+
+void Model::clearAllCachedMessages(const QString &mailbox)
+{
+    m_cache->clearAllMessages(mailbox);
+    forgetPartTexts(mailbox, 0);
+}
+
+void Model::startPartTextExtraction()
+{
+    m_partTextIndexingPending = false;
+    if (m_partTextExtractionInFlight || m_pendingPartTexts.isEmpty())
+        return;
+    m_partTextExtractionInFlight = true;
+    PartTextExtractionJob *job = new PartTextExtractionJob(m_pendingPartTexts);
+    m_pendingPartTexts.clear();
+    connect(job, SIGNAL(finished()), this, SLOT(slotPartTextsExtracted()));
+    QThreadPool::globalInstance()->start(job);
+}
+
+void Model::slotPartTextsExtracted()
+{
+    PartTextExtractionJob *job = qobject_cast<PartTextExtractionJob*>(sender());
+    Q_ASSERT(job);
+    m_partTextExtractionInFlight = false;
+    QList<AbstractCache::MessagePartText> texts = job->result();
+    if (!m_partTextsClearedInFlight.isEmpty()) {
+        for (QList<AbstractCache::MessagePartText>::iterator it = texts.begin(); it != texts.end(); /* nothing */) {
+            if (m_partTextsClearedInFlight.contains(qMakePair(it->mailbox, 0u)) ||
+                    m_partTextsClearedInFlight.contains(qMakePair(it->mailbox, it->uid))) {
+                it = texts.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        m_partTextsClearedInFlight.clear();
+    }
+    m_cache->setMsgPartTexts(texts);
+    // Whatever has arrived in the meanwhile goes into the next batch
+    startPartTextExtraction();
+}
+
 }
 }
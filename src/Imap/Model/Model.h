@@ -27,20 +27,27 @@
 
 #include <QAbstractItemModel>
 #include <QPointer>
+#include <QSet>
 #include <QTimer>
 #include "Cache.h"
 #include "../ConnectionState.h"
 #include "../Parser/Parser.h"
 #include "CacheLoadingMode.h"
+#include "ConnectionPool.h"
 #include "CopyMoveOperation.h"
+#include "FetchPriority.h"
 #include "FlagsOperation.h"
+#include "MessageDataBudget.h"
 #include "NetworkPolicy.h"
 #include "ParserState.h"
+#include "PartTextExtraction.h"
 #include "TaskFactory.h"
+#include "../Tasks/TaskTrace.h"
 
 #include "Common/Logging.h"
 
 class QAuthenticator;
+class QElapsedTimer;
 class QNetworkSession;
 class QSslError;
 
@@ -73,6 +80,7 @@ class TreeItemMessage;
 class TreeItemPart;
 class MsgListModel;
 class MailboxModel;
+class OfflineMirror;
 class DummyNetworkWatcher;
 class SystemNetworkWatcher;
 
@@ -111,7 +119,7 @@ class Model: public QAbstractItemModel
     mutable SocketFactoryPtr m_socketFactory;
     TaskFactoryPtr m_taskFactory;
     mutable QMap<Parser *,ParserState> m_parsers;
-    int m_maxParsers;
+    ConnectionPool m_connectionPool;
     mutable TreeItemMailbox *m_mailboxes;
     mutable NetworkPolicy m_netPolicy;
     bool m_startTls;
@@ -200,6 +208,9 @@ public:
     AppendTask* appendIntoMailbox(const QString &mailbox, const QList<CatenatePair> &data, const QStringList &flags,
                                   const QDateTime &timestamp);
 
+    /** @short Upload all messages from the @arg source into a mailbox, taking ownership of the source */
+    BulkAppendTask* importIntoMailbox(const QString &mailbox, ImportSource *source);
+
     /** @short Issue the GENURLAUTH command for a specified part/section */
     GenUrlAuthTask *generateUrlAuthForMessage(const QString &host, const QString &user, const QString &mailbox,
                                               const uint uidValidity, const uint uid, const QString &part, const QString &access);
@@ -273,6 +284,8 @@ public:
 
     /** @short Return an index for the message specified by the mailbox name and the message UID */
     QModelIndex messageIndexByUid(const QString &mailboxName, const uint uid);
+    /** @short Return an index of the mailbox with the specified name, or an invalid index if there's no such mailbox */
+    QModelIndex mailboxIndexByName(const QString &name);
 
     /** @short Provide a list of capabilities to not use
 
@@ -281,12 +294,63 @@ public:
     */
     void setCapabilitiesBlacklist(const QStringList &blacklist);
 
+    /** @short Provide the capabilities which the server has announced during a previous connection
+
+    When these are available, a new connection skips the CAPABILITY commands before and after the LOGIN, which saves a
+    couple of round trips when reconnecting. The @arg beforeLogin are the capabilities which apply right before sending
+    the LOGIN (i.e. after the STARTTLS, if any), the @arg afterLogin ones are valid in the authenticated state.
+
+    The capabilities which are passed in here might be out of date, so the first connection still asks for the
+    capabilities after LOGIN and refreshes the cache.
+    */
+    void setCachedCapabilities(const QStringList &beforeLogin, const QStringList &afterLogin);
+    QStringList cachedCapabilitiesBeforeLogin() const;
+    QStringList cachedCapabilitiesAfterLogin() const;
+
     bool isCatenateSupported() const;
     bool isGenUrlAuthSupported() const;
     bool isImapSubmissionSupported() const;
 
     void setNumberRefreshInterval(const int interval);
 
+    /** @short Set for how long the Model may keep processing the incoming responses before returning to the event loop
+
+    The budget is specified in milliseconds. A value of zero disables the limit, i.e. all responses which are available
+    get processed at once.
+    */
+    void setResponseProcessingBudget(const int msecs);
+
+    /** @short Set how much memory the downloaded message data may occupy
+
+    When the limit is exceeded, data of the least recently used messages are dropped from memory. They will be reloaded
+    from the cache when needed again. Messages which some view or task refers to through a persistent index are kept.
+    A value of zero disables the limit.
+    */
+    void setMessageDataMemoryBudget(const qint64 bytes);
+
+    void setVisibleMessages(const QModelIndexList &messages);
+
+    /** @short Set which mailboxes shall be downloaded completely in the background for offline use */
+    void setOfflineMirrorMailboxes(const QStringList &mailboxes);
+    QStringList offlineMirrorMailboxes() const;
+    void setMailboxKeptOffline(const QString &mailbox, const bool keepOffline);
+    bool isMailboxKeptOffline(const QString &mailbox) const;
+
+    void setConnectionLimits(const int minimum, const int maximum);
+    void setServerConnectionLimit(const QString &server, const int maximum);
+
+    /** @short Return counters describing how the responses were routed to tasks, summed over all connections */
+    ResponseRoutingStats responseRoutingStats() const;
+
+    /** @short Return the current state of the adaptive FETCH batching of each connection */
+    QList<FetchBatchStats> fetchBatchStats() const;
+
+    /** @short Export the timing of the recently finished tasks in the Chrome trace-event JSON format
+
+    Only tasks which have used the connection identified by @arg parserId are included, unless it is zero.
+    */
+    QByteArray taskTraceJson(const uint parserId = 0) const;
+
 public slots:
     /** @short Ask for an updated list of mailboxes on the server */
     void reloadMailboxList();
@@ -322,6 +386,9 @@ private slots:
     /** @short The parser has sent a block of data */
     void slotParserLineSent(Imap::Parser *parser, const QByteArray &line);
 
+    /** @short The parser has assigned a tag to a new command */
+    void slotParserCommandTagged(Imap::Parser *parser, const QByteArray &tag);
+
     /** @short There's been a change in the state of various tasks */
     void slotTasksChanged();
 
@@ -383,6 +450,9 @@ signals:
     /** @short Inform the user that it is advised to enable STARTTLS in future connection attempts */
     void requireStartTlsInFuture();
 
+    /** @short The capabilities remembered for the next connection have changed and could be saved */
+    void cachedCapabilitiesChanged();
+
     /** @short The amount of messages in the indicated mailbox might have changed */
     void messageCountPossiblyChanged(const QModelIndex &mailbox);
 
@@ -405,6 +475,9 @@ signals:
 
     void mailboxSyncingProgress(const QModelIndex &mailbox, Imap::Mailbox::MailboxSyncingProgress state);
 
+    /** @short Progress of a windowed FLAGS resync which continues in background after the mailbox has become usable */
+    void mailboxFlagsSyncingProgress(const QModelIndex &mailbox, int windowsDone, int windowsTotal);
+
     void mailboxFirstUnseenMessage(const QModelIndex &maillbox, const QModelIndex &message);
 
     /** @short Threading has arrived */
@@ -458,11 +531,13 @@ private:
     friend class Fake_ListChildMailboxesTask;
     friend class Fake_OpenConnectionTask;
     friend class NoopTask;
+    friend class NotifyTask;
     friend class ThreadTask;
     friend class UnSelectTask;
     friend class OfflineConnectionTask;
     friend class SortTask;
     friend class AppendTask;
+    friend class BulkAppendTask;
     friend class SubscribeUnsubscribeTask;
     friend class GenUrlAuthTask;
     friend class UidSubmitTask;
@@ -475,6 +550,8 @@ private:
     friend class ::FakeCapabilitiesInjector; // for injecting fake capabilities
     friend class ::ImapModelIdleTest; // needs access to findTaskResponsibleFor() for IDLE testing
     friend class TaskPresentationModel; // needs access to the ParserState
+    friend class ConnectionPool; // needs access to the ParserState
+    friend class OfflineMirror; // needs access to the askForMsg* and the ConnectionPool
     friend class ::LibMailboxSync; // needs access to accessParser/ParserState
 
     friend class Composer::ImapMessageAttachmentItem; // needs access to findMailboxByName and findMessagesByUids
@@ -487,8 +564,9 @@ private:
 
     typedef enum {PRELOAD_PER_POLICY, PRELOAD_DISABLED} PreloadingMode;
 
-    void askForMsgMetadata(TreeItemMessage *item, PreloadingMode preloadMode);
-    void askForMsgPart(TreeItemPart *item, bool onlyFromCache=false);
+    void askForMsgMetadata(TreeItemMessage *item, PreloadingMode preloadMode,
+                           const FetchPriority priority=FETCH_PRIORITY_VISIBLE);
+    void askForMsgPart(TreeItemPart *item, bool onlyFromCache=false, const FetchPriority priority=FETCH_PRIORITY_VISIBLE);
 
     void finalizeList(Parser *parser, TreeItemMailbox *const mailboxPtr);
     void finalizeIncrementalList(Parser *parser, const QString &parentMailboxName);
@@ -497,6 +575,7 @@ private:
 
     void replaceChildMailboxes(TreeItemMailbox *mailboxPtr, const TreeItemChildrenList &mailboxes);
     void updateCapabilities(Parser *parser, const QStringList capabilities);
+    void updateCachedCapabilities(const QStringList &beforeLogin, const QStringList &afterLogin);
 
     TreeItem *translatePtr(const QModelIndex &index) const;
 
@@ -504,6 +583,8 @@ private:
 
     TreeItemMailbox *findMailboxByName(const QString &name) const;
     TreeItemMailbox *findMailboxByName(const QString &name, const TreeItemMailbox *const root) const;
+    void indexMailboxes(const TreeItemChildrenList &mailboxes);
+    void unindexMailboxes(const TreeItemChildrenList &mailboxes);
     TreeItemMailbox *findParentMailboxByName(const QString &name) const;
     QList<TreeItemMessage *> findMessagesByUids(const TreeItemMailbox *const mailbox, const Imap::Uids &uids);
     TreeItemChildrenList::iterator findMessageOrNextOneByUid(TreeItemMsgList *list, const uint uid);
@@ -512,6 +593,19 @@ private:
 
     void saveUidMap(TreeItemMsgList *list);
 
+    void recordTaskTrace(const TaskTrace &trace);
+
+    void accountMessageData(TreeItemMessage *message);
+    void touchMessageData(TreeItemMessage *message);
+
+    void indexPartTextLater(const QString &mailbox, const uint uid, TreeItemPart *part);
+    void forgetPartTexts(const QString &mailbox, const uint uid);
+
+    /** @short Remove a message from the cache, including its texts which are still waiting for the full-text index */
+    void clearCachedMessage(const QString &mailbox, const uint uid);
+    /** @short Remove all messages of a mailbox from the cache, including their texts which are still waiting for the index */
+    void clearAllCachedMessages(const QString &mailbox);
+
     /** @short Return a corresponding KeepMailboxOpenTask for a given mailbox */
     KeepMailboxOpenTask *findTaskResponsibleFor(const QModelIndex &mailbox);
     KeepMailboxOpenTask *findTaskResponsibleFor(TreeItemMailbox *mailboxPtr);
@@ -542,11 +636,15 @@ private:
     void killParser(Parser *parser, ParserKillingMethod method=PARSER_KILL_HARD);
 
     ParserState &accessParser(Parser *parser);
+    bool hasNotifyConnection() const;
 
     /** @short Helper for the slotParseError() */
     void broadcastParseError(const uint parser, const QString &exceptionClass, const QString &errorMessage, const QByteArray &line, int position);
 
-    void responseReceived(const QMap<Parser *,ParserState>::iterator it);
+    bool responseReceived(const QMap<Parser *,ParserState>::iterator it, const QElapsedTimer &turnTimer);
+    Parser *preferredParser() const;
+    ImapTask *routingTarget(ParserState &parserState, const Responses::AbstractResponse *const resp);
+    bool offerResponseToTask(ParserState &parserState, const Responses::AbstractResponse *const resp, ImapTask *task);
 
     /** @short Remove deleted Tasks from the activeTasks list */
     void removeDeletedTasks(const QList<ImapTask *> &deletedTasks, QList<ImapTask *> &activeTasks);
@@ -574,8 +672,42 @@ private:
 
     QTimer *m_periodicMailboxNumbersRefresh;
 
+    /** @short For how many milliseconds to process the responses before returning to the event loop */
+    int m_responseProcessingBudget;
+    /** @short The mailbox which the user is looking at; responses for it are processed before the other ones */
+    QPersistentModelIndex m_preferredMailbox;
+
+    /** @short Traces of the recently finished tasks, the oldest ones go first */
+    QList<TaskTrace> m_taskTraces;
+
+    /** @short Mapping of mailbox names to the corresponding tree items
+
+    All mailboxes which are present in the tree are listed here, with the exception of the invisible root item.
+    */
+    QHash<QString, TreeItemMailbox *> m_mailboxIndex;
+
+    /** @short LRU tracking of the memory occupied by the downloaded message data */
+    MessageDataBudget m_messageDataBudget;
+    bool m_messageDataBudgetCheckPending;
+
+    /** @short Downloaded textual parts which shall be put into the cache's full-text index */
+    QList<PendingPartText> m_pendingPartTexts;
+    bool m_partTextIndexingPending;
+    bool m_partTextExtractionInFlight;
+    /** @short Messages removed from the cache while their texts were being extracted; a zero UID means the whole mailbox */
+    QSet<QPair<QString, uint> > m_partTextsClearedInFlight;
+
+    /** @short Background download of the mailboxes which shall be available offline */
+    OfflineMirror *m_offlineMirror;
+
     QStringList m_capabilitiesBlacklist;
 
+    /** @short Capabilities seen by the last successful connection, see setCachedCapabilities() */
+    QStringList m_cachedCapabilitiesBeforeLogin;
+    QStringList m_cachedCapabilitiesAfterLogin;
+    /** @short Have the cached capabilities been obtained from the server by this Model, or were they provided from outside? */
+    bool m_cachedCapabilitiesVerified;
+
 protected slots:
     void responseReceived();
     void responseReceived(Imap::Parser *parser);
@@ -584,6 +716,11 @@ protected slots:
 
     void runReadyTasks();
 
+    void enforceMessageDataBudget();
+
+    void startPartTextExtraction();
+    void slotPartTextsExtracted();
+
 #ifdef TROJITA_DEBUG_TASK_TREE
     void checkTaskTreeConsistency();
     void checkDependentTasksConsistency(Parser *parser, ImapTask *task, ImapTask *expectedParentTask, int depth);
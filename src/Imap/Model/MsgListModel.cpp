@@ -102,6 +102,10 @@ QHash<int, QByteArray> MsgListModel::roleNames() const
         roleNames[RoleMessageSize] = "size";
         roleNames[RoleMessageFuzzyDate] = "fuzzyDate";
         roleNames[RoleMessageHasAttachments] = "hasAttachments";
+        roleNames[RoleThreadUnreadCount] = "threadUnreadCount";
+        roleNames[RoleThreadFlaggedCount] = "threadFlaggedCount";
+        roleNames[RoleThreadNewestDate] = "threadNewestDate";
+        roleNames[RoleThreadMessageCount] = "threadMessageCount";
     }
     return roleNames;
 }
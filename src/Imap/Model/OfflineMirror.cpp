@@ -0,0 +1,217 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QTimer>
+#include "OfflineMirror.h"
+#include "MailboxTree.h"
+#include "Model.h"
+#include "Imap/Tasks/KeepMailboxOpenTask.h"
+
+namespace {
+
+/** @short Messages to look at during a single step, so that walking over the cached ones does not block the GUI */
+const int maxMessagesPerStep = 500;
+
+}
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+OfflineMirror::OfflineMirror(Model *model):
+    QObject(model), m_model(model), m_timer(new QTimer(this)), m_current(0)
+{
+    connect(m_timer, SIGNAL(timeout()), this, SLOT(step()));
+}
+
+void OfflineMirror::setMailboxes(const QStringList &mailboxes)
+{
+    m_mailboxes = mailboxes;
+    m_mailboxes.removeDuplicates();
+    Q_FOREACH(const QString &mailbox, m_progress.keys()) {
+        if (!m_mailboxes.contains(mailbox))
+            m_progress.remove(mailbox);
+    }
+    m_current = 0;
+    updateTimer();
+}
+
+QStringList OfflineMirror::mailboxes() const
+{
+    return m_mailboxes;
+}
+
+void OfflineMirror::setMirrored(const QString &mailbox, const bool mirrored)
+{
+    if (mirrored == isMirrored(mailbox))
+        return;
+
+    if (mirrored) {
+        m_mailboxes << mailbox;
+    } else {
+        m_mailboxes.removeAll(mailbox);
+        m_progress.remove(mailbox);
+        m_current = 0;
+    }
+    updateTimer();
+}
+
+bool OfflineMirror::isMirrored(const QString &mailbox) const
+{
+    return m_mailboxes.contains(mailbox);
+}
+
+void OfflineMirror::updateTimer()
+{
+    if (m_mailboxes.isEmpty()) {
+        m_timer->stop();
+        return;
+    }
+    bool ok;
+    int interval = m_model->property("trojita-imap-offline-mirror-interval").toInt(&ok);
+    if (!ok)
+        interval = 1000;
+    m_timer->setInterval(interval);
+    if (!m_timer->isActive())
+        m_timer->start();
+}
+
+/** @short Do a bit of work on the first mailbox which is not complete yet */
+void OfflineMirror::step()
+{
+    if (m_model->networkPolicy() != NETWORK_ONLINE)
+        return;
+
+    for (int i = 0; i < m_mailboxes.size(); ++i) {
+        const int current = (m_current + i) % m_mailboxes.size();
+        TreeItemMailbox *mailbox = m_model->findMailboxByName(m_mailboxes[current]);
+        if (!mailbox) {
+            // Either the list of mailboxes has not been loaded yet, or the mailbox is gone
+            continue;
+        }
+        if (mirrorMailbox(mailbox, m_progress[m_mailboxes[current]])) {
+            m_current = current;
+            return;
+        }
+    }
+}
+
+/** @short Ask for the next batch of data of the given mailbox, return false when everything is already available */
+bool OfflineMirror::mirrorMailbox(TreeItemMailbox *mailbox, Progress &progress)
+{
+    TreeItemMsgList *list = dynamic_cast<TreeItemMsgList *>(mailbox->m_children[0]);
+    Q_ASSERT(list);
+
+    if (list->fetched() && progress.completeAt == list->m_children.size())
+        return false;
+
+    if (!mailbox->maintainingTask) {
+        // Opening a mailbox which is not kept open by anybody could take the connection away from the user
+        if (!m_model->m_connectionPool.hasBackgroundCapacity())
+            return true;
+        if (list->fetched())
+            m_model->findTaskResponsibleFor(mailbox);
+        else
+            list->fetch(m_model);
+        return true;
+    }
+
+    KeepMailboxOpenTask *keepTask = mailbox->maintainingTask;
+    if (!list->fetched() || keepTask->isBusy()) {
+        // Let the synchronization, the user's requests or our previous batch finish first
+        return true;
+    }
+
+    bool ok;
+    uint maxMessageSize = m_model->property("trojita-imap-offline-mirror-max-message-size").toUInt(&ok);
+    if (!ok)
+        maxMessageSize = 10 * 1024 * 1024;
+
+    int budget = keepTask->fetchBatchSize();
+    int scanned = 0;
+    while (progress.row < list->m_children.size() && budget > 0 && scanned < maxMessagesPerStep) {
+        TreeItemMessage *message = static_cast<TreeItemMessage *>(list->m_children[progress.row]);
+        ++progress.row;
+        ++scanned;
+
+        if (!message->uid()) {
+            // The mailbox is still being synced; this message will get its chance during the next pass
+            progress.incomplete = true;
+            continue;
+        }
+
+        if (!message->fetched()) {
+            if (!message->loading() && !message->isUnavailable())
+                m_model->askForMsgMetadata(message, Model::PRELOAD_DISABLED, FETCH_PRIORITY_BACKGROUND);
+            if (!message->fetched()) {
+                // The body parts can only be requested once the BODYSTRUCTURE arrives
+                progress.incomplete = true;
+                --budget;
+                continue;
+            }
+        }
+
+        if (message->size(m_model) <= maxMessageSize)
+            budget -= requestParts(message, progress.incomplete);
+    }
+
+    if (progress.row >= list->m_children.size()) {
+        if (!progress.incomplete) {
+            progress.completeAt = list->m_children.size();
+            progress.row = 0;
+            return false;
+        }
+        // Some data were requested during this pass, so go over the mailbox once again to pick up the rest
+        progress.row = 0;
+        progress.incomplete = false;
+    }
+    return true;
+}
+
+/** @short Ask for all leaf body parts below the given item which are not available yet, return the number of requests */
+int OfflineMirror::requestParts(TreeItem *item, bool &incomplete)
+{
+    int requested = 0;
+    Q_FOREACH(TreeItem *child, item->m_children) {
+        TreeItemPart *part = dynamic_cast<TreeItemPart *>(child);
+        Q_ASSERT(part);
+        if (!part->m_children.isEmpty()) {
+            requested += requestParts(part, incomplete);
+            continue;
+        }
+        if (part->fetched() || part->isUnavailable())
+            continue;
+        if (!part->loading()) {
+            part->setFetchStatus(TreeItem::LOADING);
+            m_model->askForMsgPart(part, false, FETCH_PRIORITY_BACKGROUND);
+        }
+        if (!part->fetched()) {
+            incomplete = true;
+            ++requested;
+        }
+    }
+    return requested;
+}
+
+}
+}
@@ -0,0 +1,95 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAP_MODEL_OFFLINEMIRROR_H
+#define IMAP_MODEL_OFFLINEMIRROR_H
+
+#include <QHash>
+#include <QObject>
+#include <QStringList>
+
+class QTimer;
+
+namespace Imap {
+namespace Mailbox {
+
+class Model;
+class TreeItem;
+class TreeItemMailbox;
+
+/** @short Download complete mailboxes in the background so that they are available offline
+
+The mirror walks the selected mailboxes one at a time and asks for the message metadata and for all leaf body parts of
+each message which is not bigger than a configurable limit. The requests go through the usual fetching machinery of the
+mailbox's KeepMailboxOpenTask with the lowest priority, which means that they are batched by the adaptive FETCH batch
+sizing and that the received data end up in the persistent cache.
+
+The mirror only does its work while the network policy allows unrestricted access. It never competes with the user:
+each step waits until the mailbox's connection has nothing else to do, and a mailbox which is not open yet only gets
+opened when that is possible without stealing a connection of some other mailbox.
+
+Nothing has to be remembered for resuming an interrupted download; the data which were already fetched are found in
+the cache, so walking over them again does not generate any network traffic.
+*/
+class OfflineMirror : public QObject
+{
+    Q_OBJECT
+public:
+    explicit OfflineMirror(Model *model);
+
+    void setMailboxes(const QStringList &mailboxes);
+    QStringList mailboxes() const;
+    void setMirrored(const QString &mailbox, const bool mirrored);
+    bool isMirrored(const QString &mailbox) const;
+
+private slots:
+    void step();
+
+private:
+    /** @short How far did we get when walking a mailbox */
+    struct Progress {
+        /** @short Offset of the next message to look at */
+        int row;
+        /** @short Did we have to ask for anything during the current pass over the mailbox? */
+        bool incomplete;
+        /** @short Number of messages at the time the mailbox was found to be complete, or -1 */
+        int completeAt;
+
+        Progress(): row(0), incomplete(false), completeAt(-1) {}
+    };
+
+    bool mirrorMailbox(TreeItemMailbox *mailbox, Progress &progress);
+    int requestParts(TreeItem *item, bool &incomplete);
+    void updateTimer();
+
+    Model *m_model;
+    QTimer *m_timer;
+    QStringList m_mailboxes;
+    QHash<QString, Progress> m_progress;
+    /** @short Index of the mailbox which is being worked on */
+    int m_current;
+};
+
+}
+}
+
+#endif // IMAP_MODEL_OFFLINEMIRROR_H
@@ -26,13 +26,18 @@
 namespace Imap {
 namespace Mailbox {
 
+ResponseRoutingStats::ResponseRoutingStats():
+    taggedHits(0), untaggedHits(0), misses(0), fullScans(0)
+{
+}
+
 ParserState::ParserState(Parser *_parser):
-    parser(_parser), connState(CONN_STATE_NONE), maintainingTask(0), capabilitiesFresh(false), processingDepth(false)
+    parser(_parser), connState(CONN_STATE_NONE), maintainingTask(0), capabilitiesFresh(false), notifyActive(false), processingDepth(false)
 {
 }
 
 ParserState::ParserState():
-    connState(CONN_STATE_NONE), maintainingTask(0), capabilitiesFresh(false), processingDepth(false)
+    connState(CONN_STATE_NONE), maintainingTask(0), capabilitiesFresh(false), notifyActive(false), processingDepth(false)
 {
 }
 
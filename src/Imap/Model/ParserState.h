@@ -23,9 +23,11 @@
 #ifndef IMAP_MODEL_PARSERSTATE_H
 #define IMAP_MODEL_PARSERSTATE_H
 
+#include <QHash>
 #include <QPointer>
 #include "../ConnectionState.h"
 #include "../Parser/Parser.h"
+#include "FetchBatchController.h"
 
 namespace Imap {
 class Parser;
@@ -33,6 +35,20 @@ namespace Mailbox {
 class ImapTask;
 class KeepMailboxOpenTask;
 
+/** @short Counters describing how the responses got dispatched to the active tasks */
+struct ResponseRoutingStats {
+    /** @short Tagged responses which went straight to the task which has issued the command */
+    uint taggedHits;
+    /** @short Untagged responses which went straight to the task maintaining the selected mailbox */
+    uint untaggedHits;
+    /** @short Responses which were routed to a task which has refused to handle them */
+    uint misses;
+    /** @short Responses which had to be offered to all active tasks in turn */
+    uint fullScans;
+
+    ResponseRoutingStats();
+};
+
 /** @short Helper structure for keeping track of each parser's state */
 struct ParserState {
     /** @short Which parser are we talking about here */
@@ -49,9 +65,22 @@ struct ParserState {
     QStringList capabilities;
     /** @short Is the @arg capabilities usable? */
     bool capabilitiesFresh;
+    /** @short Has this connection been asked to report changes in all mailboxes through NOTIFY? */
+    bool notifyActive;
     /** @short LIST responses which were not processed yet */
     QList<Responses::List> listResponses;
 
+    /** @short The task which is about to queue a command through ImapTask::commandParser(), if any */
+    QPointer<ImapTask> commandIssuer;
+    /** @short Tasks which have issued the commands which are still in progress, indexed by the command tag */
+    QHash<CommandHandle, QPointer<ImapTask> > commandOwners;
+    /** @short The task whose command is being written to the socket, for the traffic accounting */
+    QPointer<ImapTask> commandWriter;
+    /** @short Statistics of the response routing */
+    ResponseRoutingStats routingStats;
+    /** @short Adaptive sizing of the FETCH batches, fed by the timing of the tagged responses */
+    FetchBatchController fetchBatching;
+
     /** @short Is the connection currently being processed? */
     int processingDepth;
 
@@ -0,0 +1,68 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QRegExp>
+#include "PartTextExtraction.h"
+#include "Imap/Encoders.h"
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+QString extractPartText(const PendingPartText &part)
+{
+    QString text = Imap::decodeByteArray(part.data, part.charset);
+    if (part.mimeType == "text/html") {
+        // Good enough for finding words, there's no point in a full-blown HTML parser here
+        text.replace(QRegExp(QLatin1String("<[^>]*>")), QLatin1String(" "));
+    }
+    return text;
+}
+
+PartTextExtractionJob::PartTextExtractionJob(const QList<PendingPartText> &parts):
+    m_parts(parts)
+{
+}
+
+void PartTextExtractionJob::run()
+{
+    Q_FOREACH(const PendingPartText &part, m_parts) {
+        AbstractCache::MessagePartText item;
+        item.mailbox = part.mailbox;
+        item.uid = part.uid;
+        item.partId = part.partId;
+        item.text = extractPartText(part);
+        m_result << item;
+    }
+    // The raw data are no longer needed, so there's no point in keeping them around until the main thread gets to us
+    m_parts.clear();
+    emit finished();
+}
+
+QList<AbstractCache::MessagePartText> PartTextExtractionJob::result() const
+{
+    return m_result;
+}
+
+}
+}
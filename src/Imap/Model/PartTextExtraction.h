@@ -0,0 +1,71 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAP_MODEL_PARTTEXTEXTRACTION_H
+#define IMAP_MODEL_PARTTEXTEXTRACTION_H
+
+#include <QList>
+#include "Cache.h"
+#include "WorkerJob.h"
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+/** @short A downloaded message part waiting to be put into the full-text index
+
+The data are already free of any Content-Transfer-Encoding, but they have not been converted from their charset yet.
+*/
+struct PendingPartText {
+    QString mailbox;
+    uint uid;
+    QByteArray partId;
+    QByteArray mimeType;
+    QByteArray charset;
+    QByteArray data;
+
+    PendingPartText(): uid(0) {}
+};
+
+/** @short Decode the part into a plain text which is suitable for indexing */
+QString extractPartText(const PendingPartText &part);
+
+/** @short Extract the text of the message parts in a worker thread */
+class PartTextExtractionJob : public WorkerJob
+{
+    Q_OBJECT
+public:
+    explicit PartTextExtractionJob(const QList<PendingPartText> &parts);
+    virtual void run();
+
+    QList<AbstractCache::MessagePartText> result() const;
+
+private:
+    QList<PendingPartText> m_parts;
+    QList<AbstractCache::MessagePartText> m_result;
+};
+
+}
+}
+
+#endif // IMAP_MODEL_PARTTEXTEXTRACTION_H
@@ -34,7 +34,8 @@ namespace Imap
 namespace Mailbox
 {
 
-PrettyMsgListModel::PrettyMsgListModel(QObject *parent): QSortFilterProxyModel(parent), m_hideRead(false)
+PrettyMsgListModel::PrettyMsgListModel(QObject *parent): QSortFilterProxyModel(parent), m_hideRead(false),
+    m_quickFilterMode(QUICKFILTER_EXACT), m_quickFilterServerDone(false)
 {
     setDynamicSortFilter(true);
 }
@@ -206,13 +207,165 @@ void PrettyMsgListModel::setHideRead(bool value)
     invalidateFilter();
 }
 
+void PrettyMsgListModel::setQuickFilter(const QString &text, const AbstractCache::TextFields fields, const QuickFilterMode mode,
+                                        const QStringList &serverConditions)
+{
+    if (text == m_quickFilterText && fields == m_quickFilterFields && mode == m_quickFilterMode &&
+            serverConditions == m_quickFilterServerConditions)
+        return;
+    if (fields != m_quickFilterFields || mode != m_quickFilterMode)
+        m_filterTexts.clear();
+    m_quickFilterText = text;
+    m_quickFilterFields = fields;
+    m_quickFilterMode = mode;
+    m_quickFilterServerConditions = serverConditions;
+
+    m_quickFilterMatchers.clear();
+    const QString folded = foldFilterText(text);
+    if (mode == QUICKFILTER_FUZZY) {
+        Q_FOREACH(const QString &word, folded.split(QLatin1Char(' '), QString::SkipEmptyParts))
+            m_quickFilterMatchers << QStringMatcher(word, Qt::CaseSensitive);
+    } else {
+        m_quickFilterMatchers << QStringMatcher(folded, Qt::CaseSensitive);
+    }
+
+    checkServerSearch();
+    invalidateFilter();
+}
+
+void PrettyMsgListModel::setSourceModel(QAbstractItemModel *sourceModel)
+{
+    if (this->sourceModel())
+        disconnect(this->sourceModel(), 0, this, 0);
+    m_filterTexts.clear();
+    // These have to be connected before the QSortFilterProxyModel's own slots, otherwise it would filter using stale texts
+    if (sourceModel) {
+        connect(sourceModel, SIGNAL(dataChanged(QModelIndex,QModelIndex)), this, SLOT(forgetFilterTexts(QModelIndex,QModelIndex)));
+        connect(sourceModel, SIGNAL(layoutAboutToBeChanged()), this, SLOT(forgetAllFilterTexts()));
+        connect(sourceModel, SIGNAL(modelAboutToBeReset()), this, SLOT(forgetAllFilterTexts()));
+        connect(sourceModel, SIGNAL(layoutChanged()), this, SLOT(checkServerSearch()));
+        connect(sourceModel, SIGNAL(modelReset()), this, SLOT(checkServerSearch()));
+    }
+    QSortFilterProxyModel::setSourceModel(sourceModel);
+}
+
+void PrettyMsgListModel::forgetFilterTexts(const QModelIndex &topLeft, const QModelIndex &bottomRight)
+{
+    if (m_filterTexts.isEmpty())
+        return;
+    for (int row = topLeft.row(); row <= bottomRight.row(); ++row)
+        m_filterTexts.remove(topLeft.sibling(row, 0).internalId());
+}
+
+void PrettyMsgListModel::forgetAllFilterTexts()
+{
+    m_filterTexts.clear();
+}
+
+/** @short Find out whether the source has already been filtered by the server-side search matching the quick filter
+
+The source model only changes its search result along with its layout, and the QSortFilterProxyModel re-checks all rows after
+that, so there is no need to invalidate the filter from here.
+*/
+void PrettyMsgListModel::checkServerSearch()
+{
+    ThreadingMsgListModel *threadingModel = qobject_cast<ThreadingMsgListModel*>(sourceModel());
+    m_quickFilterServerDone = threadingModel && !m_quickFilterServerConditions.isEmpty() &&
+            threadingModel->appliedSearchCondition() == m_quickFilterServerConditions;
+}
+
+/** @short Build the searchable text of a message; it only gets called for messages whose envelope is known */
+QString PrettyMsgListModel::filterText(const QModelIndex &sourceIndex) const
+{
+    QString text;
+    if (m_quickFilterFields & AbstractCache::TEXT_SUBJECT) {
+        text += sourceIndex.data(RoleMessageSubject).toString();
+    }
+    QList<int> addressRoles;
+    if (m_quickFilterFields & AbstractCache::TEXT_FROM)
+        addressRoles << RoleMessageFrom;
+    if (m_quickFilterFields & AbstractCache::TEXT_RECIPIENTS)
+        addressRoles << RoleMessageTo << RoleMessageCc << RoleMessageBcc;
+    Q_FOREACH(const int role, addressRoles) {
+        // The quick search never contains a newline, so it cannot match across the fields
+        text += QLatin1Char('\n');
+        text += Imap::Message::MailAddress::prettyList(sourceIndex.data(role).toList(), Imap::Message::MailAddress::FORMAT_READABLE);
+    }
+    return foldFilterText(text);
+}
+
+/** @short Bring the text into the form in which the quick filter compares it */
+QString PrettyMsgListModel::foldFilterText(const QString &text) const
+{
+    QString folded = text.toCaseFolded();
+    if (m_quickFilterMode != QUICKFILTER_FUZZY)
+        return folded;
+
+    // Get rid of the accents, so that "cafe" finds a "Café"
+    folded = folded.normalized(QString::NormalizationForm_D);
+    QString res;
+    res.reserve(folded.size());
+    for (int i = 0; i < folded.size(); ++i) {
+        if (folded[i].category() != QChar::Mark_NonSpacing)
+            res += folded[i];
+    }
+    return res;
+}
+
+bool PrettyMsgListModel::quickFilterAccepts(const QModelIndex &sourceIndex) const
+{
+    QHash<quint64, QString>::const_iterator it = m_filterTexts.constFind(sourceIndex.internalId());
+    // Asking for anything else than RoleIsFetched would make the model fetch the envelope
+    if (it == m_filterTexts.constEnd() && sourceIndex.data(RoleIsFetched).toBool())
+        it = m_filterTexts.insert(sourceIndex.internalId(), filterText(sourceIndex));
+
+    // A message without an envelope cannot match until the server says so
+    if (it != m_filterTexts.constEnd()) {
+        bool matches = true;
+        Q_FOREACH(const QStringMatcher &matcher, m_quickFilterMatchers) {
+            if (matcher.indexIn(*it) == -1) {
+                matches = false;
+                break;
+            }
+        }
+        if (matches)
+            return true;
+    }
+
+    // A thread has to remain visible when any of its messages matches
+    const QAbstractItemModel *model = sourceIndex.model();
+    const int children = model->rowCount(sourceIndex);
+    for (int i = 0; i < children; ++i) {
+        if (quickFilterAccepts(model->index(i, 0, sourceIndex)))
+            return true;
+    }
+    return false;
+}
+
+bool PrettyMsgListModel::hasUnfetchedMessages(const QModelIndex &parent) const
+{
+    const QAbstractItemModel *model = sourceModel();
+    if (!model)
+        return false;
+    for (int i = 0; i < model->rowCount(parent); ++i) {
+        QModelIndex index = model->index(i, 0, parent);
+        // Asking for anything else than RoleIsFetched would make the model fetch the envelope
+        if (!index.data(RoleIsFetched).toBool() || hasUnfetchedMessages(index))
+            return true;
+    }
+    return false;
+}
+
 bool PrettyMsgListModel::filterAcceptsRow(int source_row, const QModelIndex &source_parent) const
 {
+    QModelIndex source_index = sourceModel()->index(source_row, 0, source_parent);
+
+    if (!m_quickFilterText.isEmpty() && !m_quickFilterServerDone && !quickFilterAccepts(source_index))
+        return false;
+
     if (!m_hideRead)
         return true;
 
-    QModelIndex source_index = sourceModel()->index(source_row, 0, source_parent);
-
     for (QModelIndex test = source_index; test.isValid(); test = test.parent())
         if (test.data(RoleThreadRootWithUnreadMessages).toBool() || test.data(RoleMessageWasUnread).toBool())
             return true;
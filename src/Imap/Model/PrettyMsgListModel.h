@@ -23,6 +23,8 @@
 #define PRETTYMSGLISTMODEL_H
 
 #include <QSortFilterProxyModel>
+#include <QStringMatcher>
+#include "Imap/Model/Cache.h"
 #include "Imap/Model/MailboxModel.h"
 
 namespace Imap
@@ -39,14 +41,59 @@ public:
     explicit PrettyMsgListModel(QObject *parent=0);
     virtual QVariant data(const QModelIndex &index, int role) const;
     void setHideRead(bool value);
+    /** @short How shall the quick filter compare the texts */
+    typedef enum {
+        QUICKFILTER_EXACT, /**< The envelope has to contain the whole text */
+        QUICKFILTER_FUZZY /**< Each word of the text has to be present somewhere, ignoring any accents */
+    } QuickFilterMode;
+
+    /** @short Only show messages whose envelope contains the @arg text in any of the @arg fields
+
+    The filtering happens on the client side and only looks at the envelopes which are already loaded.  A thread remains visible
+    when any of its messages matches.  Messages whose envelope is not known yet are hidden until the source model has applied the
+    server-side search for the same text, as given by the @arg serverConditions; from then on, the server's result is what
+    decides, and the local filter steps aside.  Searching in message bodies is not supported, an empty @arg text disables the
+    filter.
+    */
+    void setQuickFilter(const QString &text, const AbstractCache::TextFields fields, const QuickFilterMode mode,
+                        const QStringList &serverConditions);
+    /** @short Are there any messages below the @arg parent of the source model whose envelope is not known yet?
+
+    As long as there are some, the quick filter cannot tell whether they match.
+    */
+    bool hasUnfetchedMessages(const QModelIndex &parent = QModelIndex()) const;
     virtual bool filterAcceptsRow(int source_row, const QModelIndex &source_parent) const;
     virtual void sort(int column, Qt::SortOrder order);
+    virtual void setSourceModel(QAbstractItemModel *sourceModel);
 
 signals:
     void sortingPreferenceChanged(int column, Qt::SortOrder order);
 
+private slots:
+    void forgetFilterTexts(const QModelIndex &topLeft, const QModelIndex &bottomRight);
+    void forgetAllFilterTexts();
+    void checkServerSearch();
+
 private:
+    bool quickFilterAccepts(const QModelIndex &sourceIndex) const;
+    QString filterText(const QModelIndex &sourceIndex) const;
+    QString foldFilterText(const QString &text) const;
+
     bool m_hideRead;
+    QString m_quickFilterText;
+    AbstractCache::TextFields m_quickFilterFields;
+    QuickFilterMode m_quickFilterMode;
+    /** @short Each of these has to match the message's text */
+    QList<QStringMatcher> m_quickFilterMatchers;
+    /** @short Conditions of the server-side search which corresponds to the quick filter */
+    QStringList m_quickFilterServerConditions;
+    /** @short Has the source model already applied the m_quickFilterServerConditions? */
+    bool m_quickFilterServerDone;
+    /** @short Folded text of the envelope for each source item the quick filter has looked at
+
+    The key is the internalId() of the source index, which remains stable until the source model's layout changes.
+    */
+    mutable QHash<quint64, QString> m_filterTexts;
 };
 
 }
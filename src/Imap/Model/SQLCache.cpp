@@ -129,6 +129,18 @@ if ( ! q.exec( QLatin1String("CREATE TABLE mailbox_sync_state ( " \
         return false; \
     }
 
+#define TROJITA_SQL_CACHE_CREATE_SEARCH_RESULTS \
+    if (! q.exec(QLatin1String("CREATE TABLE search_results (" \
+                               "mailbox STRING NOT NULL, " \
+                               "state BINARY, " \
+                               "criteria BINARY NOT NULL, " \
+                               "result BINARY, " \
+                               "PRIMARY KEY (mailbox, criteria)" \
+                               ")"))) { \
+        emitError(SQLCache::tr("Can't create table search_results"), q); \
+        return false; \
+    }
+
 bool SQLCache::open(const QString &name, const QString &fileName)
 {
 #ifdef CACHE_DEBUG
@@ -207,7 +219,17 @@ bool SQLCache::open(const QString &name, const QString &fileName)
         }
     }
 
-    if (version != 6) {
+    if (version == 6) {
+        // V7 adds a table with cached results of searching and sorting
+        TROJITA_SQL_CACHE_CREATE_SEARCH_RESULTS;
+        version = 7;
+        if (! q.exec(QLatin1String("UPDATE trojita SET version = 7;"))) {
+            emitError(tr("Failed to update cache DB scheme from v6 to v7"), q);
+            return false;
+        }
+    }
+
+    if (version != 7) {
         emitError(tr("Unknown version"));
         return false;
     }
@@ -232,7 +254,7 @@ bool SQLCache::createTables()
         emitError(tr("Failed to prepare table structures"), q);
         return false;
     }
-    if (! q.exec(QLatin1String("INSERT INTO trojita ( version ) VALUES ( 6 )"))) {
+    if (! q.exec(QLatin1String("INSERT INTO trojita ( version ) VALUES ( 7 )"))) {
         emitError(tr("Can't store version info"), q);
         return false;
     }
@@ -279,6 +301,7 @@ bool SQLCache::createTables()
 
     TROJITA_SQL_CACHE_CREATE_THREADING;
     TROJITA_SQL_CACHE_CREATE_SYNC_STATE;
+    TROJITA_SQL_CACHE_CREATE_SEARCH_RESULTS;
 
     return true;
 }
@@ -395,6 +418,12 @@ bool SQLCache::prepareQueries()
         return false;
     }
 
+    queryClearAllMessages5 = QSqlQuery(db);
+    if (! queryClearAllMessages5.prepare(QLatin1String("DELETE FROM search_results WHERE mailbox = ?"))) {
+        emitError(tr("Failed to prepare queryClearAllMessages5"), queryClearAllMessages5);
+        return false;
+    }
+
     queryClearMessage1 = QSqlQuery(db);
     if (! queryClearMessage1.prepare(QLatin1String("DELETE FROM msg_metadata WHERE mailbox = ? AND uid = ?"))) {
         emitError(tr("Failed to prepare queryClearMessage1"), queryClearMessage1);
@@ -443,6 +472,24 @@ bool SQLCache::prepareQueries()
         return false;
     }
 
+    querySearchResult = QSqlQuery(db);
+    if (! querySearchResult.prepare(QLatin1String("SELECT result FROM search_results WHERE mailbox = ? AND state = ? AND criteria = ?"))) {
+        emitError(tr("Failed to prepare querySearchResult"), querySearchResult);
+        return false;
+    }
+
+    queryForgetSearchResults = QSqlQuery(db);
+    if (! queryForgetSearchResults.prepare(QLatin1String("DELETE FROM search_results WHERE mailbox = ? AND state != ?"))) {
+        emitError(tr("Failed to prepare queryForgetSearchResults"), queryForgetSearchResults);
+        return false;
+    }
+
+    querySetSearchResult = QSqlQuery(db);
+    if (! querySetSearchResult.prepare(QLatin1String("INSERT OR REPLACE INTO search_results (mailbox, state, criteria, result) VALUES (?, ?, ?, ?)"))) {
+        emitError(tr("Failed to prepare querySetSearchResult"), querySetSearchResult);
+        return false;
+    }
+
 #ifdef CACHE_DEBUG
     qDebug() << "SQLCache::_prepareQueries() succeeded";
 #endif
@@ -622,6 +669,7 @@ void SQLCache::clearAllMessages(const QString &mailbox)
     queryClearAllMessages2.bindValue(0, mailboxName(mailbox));
     queryClearAllMessages3.bindValue(0, mailboxName(mailbox));
     queryClearAllMessages4.bindValue(0, mailboxName(mailbox));
+    queryClearAllMessages5.bindValue(0, mailboxName(mailbox));
     if (! queryClearAllMessages1.exec()) {
         emitError(tr("Query queryClearAllMessages1 failed"), queryClearAllMessages1);
     }
@@ -634,6 +682,9 @@ void SQLCache::clearAllMessages(const QString &mailbox)
     if (! queryClearAllMessages4.exec()) {
         emitError(tr("Query queryClearAllMessages4 failed"), queryClearAllMessages4);
     }
+    if (! queryClearAllMessages5.exec()) {
+        emitError(tr("Query queryClearAllMessages5 failed"), queryClearAllMessages5);
+    }
     clearUidMapping(mailbox);
 }
 
@@ -830,6 +881,56 @@ void SQLCache::setMessageThreading(const QString &mailbox, const QVector<Imap::R
 
 }
 
+bool SQLCache::searchResult(const QString &mailbox, const QByteArray &mailboxState, const QByteArray &key, Imap::Uids &result) const
+{
+    querySearchResult.bindValue(0, mailboxName(mailbox));
+    querySearchResult.bindValue(1, mailboxState);
+    querySearchResult.bindValue(2, key);
+    if (! querySearchResult.exec()) {
+        emitError(tr("Query querySearchResult failed"), querySearchResult);
+        return false;
+    }
+    if (! querySearchResult.first()) {
+        // Nothing was cached for this particular state of the mailbox
+        return false;
+    }
+    QDataStream stream(qUncompress(querySearchResult.value(0).toByteArray()));
+    stream.setVersion(streamVersion);
+    Imap::Uids res;
+    stream >> res;
+    if (stream.status() != QDataStream::Ok) {
+        emitError(tr("Corrupt search result for mailbox %1").arg(mailbox));
+        return false;
+    }
+    result = res;
+    return true;
+}
+
+void SQLCache::setSearchResult(const QString &mailbox, const QByteArray &mailboxState, const QByteArray &key, const Imap::Uids &result)
+{
+#ifdef CACHE_DEBUG
+    qDebug() << "Setting search result for" << mailbox << key;
+#endif
+    touchingDB();
+    queryForgetSearchResults.bindValue(0, mailboxName(mailbox));
+    queryForgetSearchResults.bindValue(1, mailboxState);
+    if (! queryForgetSearchResults.exec()) {
+        emitError(tr("Query queryForgetSearchResults failed"), queryForgetSearchResults);
+        return;
+    }
+    querySetSearchResult.bindValue(0, mailboxName(mailbox));
+    querySetSearchResult.bindValue(1, mailboxState);
+    querySetSearchResult.bindValue(2, key);
+    QByteArray buf;
+    QDataStream stream(&buf, QIODevice::ReadWrite);
+    stream.setVersion(streamVersion);
+    stream << result;
+    querySetSearchResult.bindValue(3, qCompress(buf));
+    if (! querySetSearchResult.exec()) {
+        emitError(tr("Query querySetSearchResult failed"), querySetSearchResult);
+    }
+}
+
 void SQLCache::touchingDB()
 {
     delayedCommit->start();
@@ -92,6 +92,9 @@ public:
     virtual QVector<Imap::Responses::ThreadingNode> messageThreading(const QString &mailbox);
     virtual void setMessageThreading(const QString &mailbox, const QVector<Imap::Responses::ThreadingNode> &threading);
 
+    virtual bool searchResult(const QString &mailbox, const QByteArray &mailboxState, const QByteArray &key, Imap::Uids &result) const;
+    virtual void setSearchResult(const QString &mailbox, const QByteArray &mailboxState, const QByteArray &key, const Imap::Uids &result);
+
     /** @short Open a connection to the cache */
     bool open(const QString &name, const QString &fileName);
 
@@ -143,6 +146,7 @@ private:
     mutable QSqlQuery queryClearAllMessages2;
     mutable QSqlQuery queryClearAllMessages3;
     mutable QSqlQuery queryClearAllMessages4;
+    mutable QSqlQuery queryClearAllMessages5;
     mutable QSqlQuery queryClearMessage1;
     mutable QSqlQuery queryClearMessage2;
     mutable QSqlQuery queryClearMessage3;
@@ -151,6 +155,9 @@ private:
     mutable QSqlQuery queryForgetMessagePart;
     mutable QSqlQuery queryMessageThreading;
     mutable QSqlQuery querySetMessageThreading;
+    mutable QSqlQuery querySearchResult;
+    mutable QSqlQuery queryForgetSearchResults;
+    mutable QSqlQuery querySetSearchResult;
 
     QTimer *delayedCommit;
     QTimer *tooMuchTimeWithoutCommit;
@@ -25,6 +25,7 @@
 #include "Imap/Model/TaskPresentationModel.h"
 #include "Imap/Parser/Parser.h"
 #include "Imap/Tasks/AppendTask.h"
+#include "Imap/Tasks/BulkAppendTask.h"
 #include "Imap/Tasks/CopyMoveMessagesTask.h"
 #include "Imap/Tasks/CreateMailboxTask.h"
 #include "Imap/Tasks/DeleteMailboxTask.h"
@@ -46,6 +47,7 @@
 #include "Imap/Tasks/UpdateFlagsOfAllMessagesTask.h"
 #include "Imap/Tasks/ThreadTask.h"
 #include "Imap/Tasks/NoopTask.h"
+#include "Imap/Tasks/NotifyTask.h"
 #include "Imap/Tasks/UnSelectTask.h"
 #include "Imap/Tasks/SortTask.h"
 #include "Imap/Tasks/SubscribeUnsubscribeTask.h"
@@ -111,6 +113,11 @@ IdTask *TaskFactory::createIdTask(Model *model, ImapTask *dependingTask)
     return new IdTask(model, dependingTask);
 }
 
+NotifyTask *TaskFactory::createNotifyTask(Model *model, ImapTask *dependingTask)
+{
+    return new NotifyTask(model, dependingTask);
+}
+
 EnableTask *TaskFactory::createEnableTask(Model *model, ImapTask *dependingTask, const QList<QByteArray> &extensions)
 {
     return new EnableTask(model, dependingTask, extensions);
@@ -126,6 +133,11 @@ NumberOfMessagesTask *TaskFactory::createNumberOfMessagesTask(Model *model, cons
     return new NumberOfMessagesTask(model, mailbox);
 }
 
+NumberOfMessagesTask *TaskFactory::createNumberOfMessagesTask(Model *model, const QList<QPersistentModelIndex> &mailboxes)
+{
+    return new NumberOfMessagesTask(model, mailboxes);
+}
+
 ObtainSynchronizedMailboxTask *TaskFactory::createObtainSynchronizedMailboxTask(Model *model, const QModelIndex &mailboxIndex,
         ImapTask *parentTask, KeepMailboxOpenTask *keepTask)
 {
@@ -185,6 +197,11 @@ AppendTask *TaskFactory::createAppendTask(Model *model, const QString &targetMai
     return new AppendTask(model, targetMailbox, data, flags, timestamp);
 }
 
+BulkAppendTask *TaskFactory::createBulkAppendTask(Model *model, const QString &targetMailbox, ImportSource *source)
+{
+    return new BulkAppendTask(model, targetMailbox, source);
+}
+
 SubscribeUnsubscribeTask *TaskFactory::createSubscribeUnsubscribeTask(Model *model, const QModelIndex &mailbox,
                                                                       const SubscribeUnsubscribeOperation operation)
 {
@@ -214,6 +231,7 @@ Parser *TestingTaskFactory::newParser(Model *model)
     QObject::connect(parser, SIGNAL(connectionStateChanged(Imap::Parser*,Imap::ConnectionState)), model, SLOT(handleSocketStateChanged(Imap::Parser*,Imap::ConnectionState)));
     QObject::connect(parser, SIGNAL(lineReceived(Imap::Parser*,QByteArray)), model, SLOT(slotParserLineReceived(Imap::Parser*,QByteArray)));
     QObject::connect(parser, SIGNAL(lineSent(Imap::Parser*,QByteArray)), model, SLOT(slotParserLineSent(Imap::Parser*,QByteArray)));
+    QObject::connect(parser, SIGNAL(commandTagged(Imap::Parser*,QByteArray)), model, SLOT(slotParserCommandTagged(Imap::Parser*,QByteArray)));
     model->m_parsers[ parser ] = parserState;
     model->m_taskModel->slotParserCreated(parser);
     return parser;
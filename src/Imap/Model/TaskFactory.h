@@ -40,6 +40,7 @@ namespace Mailbox
 {
 
 class AppendTask;
+class BulkAppendTask;
 class CopyMoveMessagesTask;
 class CreateMailboxTask;
 class DeleteMailboxTask;
@@ -59,6 +60,7 @@ class UpdateFlagsTask;
 class UpdateFlagsOfAllMessagesTask;
 class ThreadTask;
 class NoopTask;
+class NotifyTask;
 class UnSelectTask;
 class SortTask;
 class SubscribeUnsubscribeTask;
@@ -68,6 +70,7 @@ class UidSubmitTask;
 class Model;
 class TreeItemMailbox;
 class TreeItemPart;
+class ImportSource;
 
 class TaskFactory
 {
@@ -84,9 +87,11 @@ public:
     virtual FetchMsgPartTask *createFetchMsgPartTask(Model *model, const QModelIndex &mailbox, const Imap::Uids &uids, const QList<QByteArray> &parts);
     virtual GetAnyConnectionTask *createGetAnyConnectionTask(Model *model);
     virtual IdTask *createIdTask(Model *model, ImapTask *dependingTask);
+    virtual NotifyTask *createNotifyTask(Model *model, ImapTask *dependingTask);
     virtual KeepMailboxOpenTask *createKeepMailboxOpenTask(Model *model, const QModelIndex &mailbox, Parser *oldParser);
     virtual ListChildMailboxesTask *createListChildMailboxesTask(Model *model, const QModelIndex &mailbox);
     virtual NumberOfMessagesTask *createNumberOfMessagesTask(Model *model, const QModelIndex &mailbox);
+    virtual NumberOfMessagesTask *createNumberOfMessagesTask(Model *model, const QList<QPersistentModelIndex> &mailboxes);
     virtual ObtainSynchronizedMailboxTask *createObtainSynchronizedMailboxTask(Model *model, const QModelIndex &mailboxIndex,
             ImapTask *parentTask, KeepMailboxOpenTask *keepTask);
     virtual OpenConnectionTask *createOpenConnectionTask(Model *model);
@@ -106,6 +111,7 @@ public:
                                          const QStringList &flags, const QDateTime &timestamp);
     virtual AppendTask *createAppendTask(Model *model, const QString &targetMailbox, const QList<CatenatePair> &data,
                                          const QStringList &flags, const QDateTime &timestamp);
+    virtual BulkAppendTask *createBulkAppendTask(Model *model, const QString &targetMailbox, ImportSource *source);
     virtual SubscribeUnsubscribeTask *createSubscribeUnsubscribeTask(Model *model, const QModelIndex &mailbox,
                                                                      const SubscribeUnsubscribeOperation operation);
     virtual GenUrlAuthTask *createGenUrlAuthTask(Model *model, const QString &host, const QString &user, const QString &mailbox,
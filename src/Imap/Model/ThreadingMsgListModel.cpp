@@ -23,10 +23,14 @@
 #include "ThreadingMsgListModel.h"
 #include <algorithm>
 #include <QBuffer>
+#include <QDataStream>
 #include <QDebug>
+#include <QElapsedTimer>
+#include <QThreadPool>
 #include "Imap/Tasks/SortTask.h"
 #include "Imap/Tasks/ThreadTask.h"
 #include "ItemRoles.h"
+#include "LocalThreading.h"
 #include "MailboxTree.h"
 #include "MsgListModel.h"
 #include "QAIM_reset.h"
@@ -35,13 +39,13 @@
 namespace
 {
 using Imap::Mailbox::ThreadNodeInfo;
-QByteArray dumpThreadNodeInfo(const QHash<uint,ThreadNodeInfo> &mapping, const uint nodeId, const uint offset)
+QByteArray dumpThreadNodeInfo(const Imap::Mailbox::ThreadNodeStorage &mapping, const uint nodeId, const uint offset)
 {
     QByteArray res;
     QByteArray prefix(offset, ' ');
     QTextStream ss(&res);
     Q_ASSERT(mapping.contains(nodeId));
-    const ThreadNodeInfo &node = mapping[nodeId];
+    const ThreadNodeInfo node = mapping.value(nodeId);
     ss << prefix << "ThreadNodeInfo intId " << node.internalId << " UID " << node.uid << " ptr " << node.ptr <<
           " parentIntId " << node.parent << "\n";
     Q_FOREACH(const uint childId, node.children) {
@@ -57,24 +61,103 @@ namespace Imap
 namespace Mailbox
 {
 
+void ThreadNodeStorage::clear()
+{
+    std::vector<ThreadNodeInfo>().swap(m_nodes);
+    std::vector<bool>().swap(m_present);
+    m_count = 0;
+}
+
+void ThreadNodeStorage::reserve(const int size)
+{
+    // The root node has ID 0, the others are numbered from one
+    m_nodes.reserve(size + 1);
+    m_present.reserve(size + 1);
+}
+
+void ThreadNodeStorage::swap(ThreadNodeStorage &other)
+{
+    m_nodes.swap(other.m_nodes);
+    m_present.swap(other.m_present);
+    std::swap(m_count, other.m_count);
+}
+
+ThreadNodeInfo &ThreadNodeStorage::operator[](const uint id)
+{
+    if (id >= m_nodes.size()) {
+        m_nodes.resize(id + 1);
+        m_present.resize(id + 1, false);
+    }
+    if (!m_present[id]) {
+        m_present[id] = true;
+        ++m_count;
+    }
+    return m_nodes[id];
+}
+
+QList<uint> ThreadNodeStorage::keys() const
+{
+    QList<uint> res;
+#if QT_VERSION >= 0x040700
+    res.reserve(m_count);
+#endif
+    for (uint id = nextPresent(0); id < m_nodes.size(); id = nextPresent(id + 1))
+        res << id;
+    return res;
+}
+
+ThreadNodeStorage::iterator ThreadNodeStorage::erase(iterator it)
+{
+    const uint id = it.key();
+    Q_ASSERT(contains(id));
+    m_present[id] = false;
+    // Release the list of children right now
+    m_nodes[id] = ThreadNodeInfo();
+    --m_count;
+    return iterator(this, nextPresent(id + 1));
+}
+
+uint ThreadNodeStorage::nextPresent(uint id) const
+{
+    while (id < m_present.size() && !m_present[id])
+        ++id;
+    return id;
+}
+
 ThreadingMsgListModel::ThreadingMsgListModel(QObject *parent):
     QAbstractProxyModel(parent), threadingHelperLastId(0), modelResetInProgress(false), threadingInFlight(false),
     m_shallBeThreading(false), m_sortTask(0), m_sortReverse(false), m_currentSortingCriteria(SORT_NONE),
-    m_searchValidity(RESULT_INVALIDATED)
+    m_currentSortResultFiltered(false), m_searchValidity(RESULT_INVALIDATED), m_localThreadingDirty(false),
+    m_localThreadingAppliedUpTo(0), m_sortLocally(false), m_localSortGeneration(0),
+    m_localSortHighestUid(0)
 {
     m_delayedPrune = new QTimer(this);
     m_delayedPrune->setSingleShot(true);
     m_delayedPrune->setInterval(0);
     connect(m_delayedPrune, SIGNAL(timeout()), this, SLOT(delayedPrune()));
+
+    // Headers of messages usually arrive in batches, so there's no point in re-threading after each of them
+    m_delayedLocalThreading = new QTimer(this);
+    m_delayedLocalThreading->setSingleShot(true);
+    m_delayedLocalThreading->setInterval(500);
+    connect(m_delayedLocalThreading, SIGNAL(timeout()), this, SLOT(delayedLocalThreading()));
+
+    m_delayedLocalSort = new QTimer(this);
+    m_delayedLocalSort->setSingleShot(true);
+    m_delayedLocalSort->setInterval(0);
+    connect(m_delayedLocalSort, SIGNAL(timeout()), this, SLOT(delayedLocalSort()));
 }
 
 void ThreadingMsgListModel::setSourceModel(QAbstractItemModel *sourceModel)
 {
     threading.clear();
+    m_threadAggregates.clear();
     ptrToInternal.clear();
     unknownUids.clear();
     threadedRootIds.clear();
     m_currentSortResult.clear();
+    m_currentSortResultFiltered = false;
+    m_appliedSearchConditions.clear();
     m_searchValidity = RESULT_INVALIDATED;
 
     if (this->sourceModel()) {
@@ -125,18 +208,18 @@ void ThreadingMsgListModel::handleDataChanged(const QModelIndex &topLeft, const
     Q_ASSERT(topLeft.row() == bottomRight.row());
     QModelIndex translated = mapFromSource(topLeft);
 
+    if (translated.isValid())
+        invalidateThreadAggregates(translated.internalId());
+
     emit dataChanged(translated, translated.sibling(translated.row(), bottomRight.column()));
 
-    // We provide funny data like "does this thread contain unread messages?". Now the original signal might mean that flags of a
-    // nested message have changed. In order to always be consistent, we have to find the thread root and emit dataChanged() on that
-    // as well.
-    QModelIndex rootCandidate = translated;
-    while (rootCandidate.parent().isValid()) {
-        rootCandidate = rootCandidate.parent();
-    }
-    if (rootCandidate != translated) {
-        // We're really an embedded message
-        emit dataChanged(rootCandidate, rootCandidate.sibling(rootCandidate.row(), bottomRight.column()));
+    // We provide funny data like "does this thread contain unread messages?" or the per-subtree counters. Now the original
+    // signal might mean that flags of a nested message have changed. In order to always be consistent, we have to emit
+    // dataChanged() on all of its ancestors as well.
+    QModelIndex ancestor = translated.parent();
+    while (ancestor.isValid()) {
+        emit dataChanged(ancestor, ancestor.sibling(ancestor.row(), bottomRight.column()));
+        ancestor = ancestor.parent();
     }
 
     auto message = dynamic_cast<TreeItemMessage*>(static_cast<TreeItemMessage*>(topLeft.internalPointer()));
@@ -155,6 +238,15 @@ void ThreadingMsgListModel::handleDataChanged(const QModelIndex &topLeft, const
             wantThreading();
         }
     }
+
+    if (message->fetched() && m_localThreadingMissingMetadata.remove(message->uid())) {
+        // The client-side threading has only seen a placeholder for this message so far
+        m_localThreadingLateMetadata.insert(message->uid());
+        m_delayedLocalThreading->start();
+    }
+
+    if (m_sortLocally && m_searchValidity == RESULT_FRESH)
+        updateLocalSortKey(message);
 }
 
 QModelIndex ThreadingMsgListModel::index(int row, int column, const QModelIndex &parent) const
@@ -176,7 +268,7 @@ QModelIndex ThreadingMsgListModel::index(int row, int column, const QModelIndex
 
     uint parentId = parent.isValid() ? parent.internalId() : 0;
 
-    QHash<uint,ThreadNodeInfo>::const_iterator it = threading.constFind(parentId);
+    ThreadNodeStorage::const_iterator it = threading.constFind(parentId);
     Q_ASSERT(it != threading.constEnd());
 
     if (it->children.size() <= row)
@@ -196,11 +288,11 @@ QModelIndex ThreadingMsgListModel::parent(const QModelIndex &index) const
     if (index.row() < 0 || index.column() < 0 || index.column() >= MsgListModel::COLUMN_COUNT)
         return QModelIndex();
 
-    QHash<uint,ThreadNodeInfo>::const_iterator node = threading.constFind(index.internalId());
+    ThreadNodeStorage::const_iterator node = threading.constFind(index.internalId());
     if (node == threading.constEnd())
         return QModelIndex();
 
-    QHash<uint,ThreadNodeInfo>::const_iterator parentNode = threading.constFind(node->parent);
+    ThreadNodeStorage::const_iterator parentNode = threading.constFind(node->parent);
     Q_ASSERT(parentNode != threading.constEnd());
     Q_ASSERT(parentNode->internalId == node->parent);
 
@@ -215,7 +307,8 @@ bool ThreadingMsgListModel::hasChildren(const QModelIndex &parent) const
     if (parent.isValid() && parent.column() != 0)
         return false;
 
-    return ! threading.isEmpty() && ! threading.value(parent.internalId()).children.isEmpty();
+    ThreadNodeStorage::const_iterator it = threading.constFind(parent.internalId());
+    return it != threading.constEnd() && !it->children.isEmpty();
 }
 
 int ThreadingMsgListModel::rowCount(const QModelIndex &parent) const
@@ -226,7 +319,8 @@ int ThreadingMsgListModel::rowCount(const QModelIndex &parent) const
     if (parent.isValid() && parent.column() != 0)
         return 0;
 
-    return threading.value(parent.internalId()).children.size();
+    ThreadNodeStorage::const_iterator it = threading.constFind(parent.internalId());
+    return it != threading.constEnd() ? it->children.size() : 0;
 }
 
 int ThreadingMsgListModel::columnCount(const QModelIndex &parent) const
@@ -248,7 +342,7 @@ QModelIndex ThreadingMsgListModel::mapToSource(const QModelIndex &proxyIndex) co
     Imap::Mailbox::MsgListModel *msgList = qobject_cast<Imap::Mailbox::MsgListModel *>(sourceModel());
     Q_ASSERT(msgList);
 
-    QHash<uint,ThreadNodeInfo>::const_iterator node = threading.constFind(proxyIndex.internalId());
+    ThreadNodeStorage::const_iterator node = threading.constFind(proxyIndex.internalId());
     if (node == threading.constEnd())
         return QModelIndex();
 
@@ -273,7 +367,7 @@ QModelIndex ThreadingMsgListModel::mapFromSource(const QModelIndex &sourceIndex)
 
     const uint internalId = *it;
 
-    QHash<uint,ThreadNodeInfo>::const_iterator node = threading.constFind(internalId);
+    ThreadNodeStorage::const_iterator node = threading.constFind(internalId);
     if (node == threading.constEnd()) {
         // The filtering criteria say that this index shall not be visible
         return QModelIndex();
@@ -288,9 +382,23 @@ QVariant ThreadingMsgListModel::data(const QModelIndex &proxyIndex, int role) co
     if (! proxyIndex.isValid() || proxyIndex.model() != this)
         return QVariant();
 
-    QHash<uint,ThreadNodeInfo>::const_iterator it = threading.constFind(proxyIndex.internalId());
+    ThreadNodeStorage::const_iterator it = threading.constFind(proxyIndex.internalId());
     Q_ASSERT(it != threading.constEnd());
 
+    switch (role) {
+    case RoleThreadUnreadCount:
+        return threadAggregate(it->internalId).unreadCount;
+    case RoleThreadFlaggedCount:
+        return threadAggregate(it->internalId).flaggedCount;
+    case RoleThreadNewestDate:
+    {
+        const QDateTime newestDate = threadAggregate(it->internalId).newestDate;
+        return newestDate.isValid() ? QVariant(newestDate) : QVariant();
+    }
+    case RoleThreadMessageCount:
+        return threadAggregate(it->internalId).messageCount;
+    }
+
     if (it->ptr) {
         // It's a real item which exists in the underlying model
         if (role == RoleThreadRootWithUnreadMessages) {
@@ -324,7 +432,7 @@ Qt::ItemFlags ThreadingMsgListModel::flags(const QModelIndex &index) const
     if (! index.isValid() || index.model() != this)
         return Qt::NoItemFlags;
 
-    QHash<uint,ThreadNodeInfo>::const_iterator it = threading.constFind(index.internalId());
+    ThreadNodeStorage::const_iterator it = threading.constFind(index.internalId());
     Q_ASSERT(it != threading.constEnd());
     if (it->ptr && it->uid)
         return Qt::ItemIsSelectable | Qt::ItemIsDragEnabled | Qt::ItemIsEnabled;
@@ -350,10 +458,11 @@ void ThreadingMsgListModel::handleRowsAboutToBeRemoved(const QModelIndex &parent
         }
 
         Q_ASSERT(translated.isValid());
-        QHash<uint,ThreadNodeInfo>::iterator it = threading.find(translated.internalId());
+        ThreadNodeStorage::iterator it = threading.find(translated.internalId());
         Q_ASSERT(it != threading.end());
         it->uid = 0;
         it->ptr = 0;
+        invalidateThreadAggregates(translated.internalId());
     }
 }
 
@@ -368,11 +477,29 @@ void ThreadingMsgListModel::handleRowsRemoved(const QModelIndex &parent, int sta
 
 void ThreadingMsgListModel::delayedPrune()
 {
+    QElapsedTimer phaseTimer;
+    phaseTimer.start();
     emit layoutAboutToBeChanged();
     updatePersistentIndexesPhase1();
+    const qint64 savingTime = phaseTimer.restart();
     pruneTree();
+    const qint64 pruningTime = phaseTimer.restart();
     updatePersistentIndexesPhase2();
+    const qint64 remappingTime = phaseTimer.elapsed();
     emit layoutChanged();
+    logPhaseTimes(QLatin1String("Pruning"), savingTime, 0, pruningTime, remappingTime);
+}
+
+/** @short Report how long did the individual phases of a layout change take, if it took long enough to be interesting */
+void ThreadingMsgListModel::logPhaseTimes(const QString &operation, const qint64 savingTime, const qint64 buildingTime,
+                                          const qint64 pruningTime, const qint64 remappingTime)
+{
+    if (savingTime + buildingTime + pruningTime + remappingTime < 10)
+        return;
+    logTrace(QString::fromUtf8("%1: %2 ms saving %3 persistent indexes, %4 ms building the tree, %5 ms pruning, "
+                               "%6 ms updating the persistent indexes").arg(
+                 operation, QString::number(savingTime), QString::number(persistentIndexList().size()),
+                 QString::number(buildingTime), QString::number(pruningTime), QString::number(remappingTime)));
 }
 
 void ThreadingMsgListModel::handleRowsAboutToBeInserted(const QModelIndex &parent, int start, int end)
@@ -407,8 +534,10 @@ void ThreadingMsgListModel::handleRowsInserted(const QModelIndex &parent, int st
     }
     endInsertRows();
 
-    if (!m_sortTask || !m_sortTask->isPersistent()) {
+    if ((!m_sortTask || !m_sortTask->isPersistent()) && (!m_sortLocally || !m_currentSearchConditions.isEmpty())) {
+        // Without any search, the client-side sorting picks the new arrivals up as soon as their UIDs are known
         m_currentSortResult.clear();
+        m_currentSortResultFiltered = false;
         if (m_searchValidity == RESULT_FRESH)
             m_searchValidity = RESULT_INVALIDATED;
     }
@@ -425,11 +554,28 @@ void ThreadingMsgListModel::resetMe()
 
     modelResetInProgress = true;
     threading.clear();
+    m_threadAggregates.clear();
     ptrToInternal.clear();
     unknownUids.clear();
     threadedRootIds.clear();
     m_currentSortResult.clear();
+    m_currentSortResultFiltered = false;
+    m_appliedSearchConditions.clear();
     m_searchValidity = RESULT_INVALIDATED;
+    m_localThreadingMissingMetadata.clear();
+    m_localThreadingLateMetadata.clear();
+    m_localThreadingMapping.clear();
+    m_localThreadingMailbox.clear();
+    m_delayedLocalThreading->stop();
+    m_localThreadingIndex = LocalThreadingIndex();
+    m_localThreadingAppliedUpTo = 0;
+    ++m_localSortGeneration;
+    m_localSortKeys.clear();
+    m_localSortMissingMetadata.clear();
+    m_localSortPendingUids.clear();
+    m_delayedLocalSort->stop();
+    m_cachedMetadata.clear();
+    m_cachedMetadataMailbox.clear();
     RESET_MODEL;
     updateNoThreading();
     modelResetInProgress = false;
@@ -441,12 +587,14 @@ void ThreadingMsgListModel::resetMe()
 void ThreadingMsgListModel::updateNoThreading()
 {
     threadingHelperLastId = 0;
+    m_localThreadingAppliedUpTo = 0;
 
     if (!sourceModel()) {
         // Maybe we got reset because the parent model is no longer here...
         if (! threading.isEmpty()) {
             beginRemoveRows(QModelIndex(), 0, rowCount() - 1);
             threading.clear();
+            m_threadAggregates.clear();
             ptrToInternal.clear();
             endRemoveRows();
         }
@@ -457,16 +605,18 @@ void ThreadingMsgListModel::updateNoThreading()
     emit layoutAboutToBeChanged();
     updatePersistentIndexesPhase1();
     threading.clear();
+    m_threadAggregates.clear();
     ptrToInternal.clear();
     unknownUids.clear();
     threadedRootIds.clear();
 
     int upstreamMessages = sourceModel()->rowCount();
     QList<uint> allIds;
-    QHash<uint,ThreadNodeInfo> newThreading;
+    ThreadNodeStorage newThreading;
     QHash<void *,uint> newPtrToInternal;
 
     if (upstreamMessages) {
+        newThreading.reserve(upstreamMessages);
         // Prefer the direct pointer access instead of going through the MVC API -- similar to how applyThreading() works.
         // This improves the speed of the testSortingPerformance benchmark by 18%.
         QModelIndex firstMessageIndex = sourceModel()->index(0, 0);
@@ -497,11 +647,11 @@ void ThreadingMsgListModel::updateNoThreading()
     }
 
     if (newThreading.size()) {
-        threading = newThreading;
+        threading.swap(newThreading);
         ptrToInternal = newPtrToInternal;
         threading[ 0 ].children = allIds;
         threading[ 0 ].ptr = 0;
-        threadingHelperLastId = newThreading.size();
+        threadingHelperLastId = upstreamMessages;
         threadedRootIds = threading[0].children;
     }
     updatePersistentIndexesPhase2();
@@ -551,7 +701,7 @@ void ThreadingMsgListModel::wantThreading(const SkipSortSearch skipSortSearch)
     Q_ASSERT(list);
 
     // Something has happened and we want to process the THREAD response
-    QVector<Imap::Responses::ThreadingNode> mapping = realModel->cache()->messageThreading(mailbox.data(RoleMailboxName).toString());
+    QVector<Imap::Responses::ThreadingNode> mapping = threadingMapping(realModel, mailbox.data(RoleMailboxName).toString());
 
     // Find the UID of the last message in the mailbox
     uint highestUidInMailbox = findHighestUidInMailbox(list);
@@ -563,6 +713,17 @@ void ThreadingMsgListModel::wantThreading(const SkipSortSearch skipSortSearch)
     if (highestUidInThreadingLowerBound >= highestUidInMailbox) {
         // There's no point asking for data at this point, we shall just apply threading
         applyThreading(mapping);
+    } else if (m_localThreadingAppliedUpTo && m_localThreadingAppliedUpTo == highestUidInThreadingLowerBound) {
+        // The client-side threading might be able to take care of the new arrivals without starting from scratch
+        QList<TreeItemMessage *> arrivals;
+        for (int i = list->m_children.size() - 1; i >= 0; --i) {
+            TreeItemMessage *message = static_cast<TreeItemMessage *>(list->m_children[i]);
+            if (message->uid() && message->uid() <= highestUidInThreadingLowerBound)
+                break;
+            arrivals.prepend(message);
+        }
+        if (!attachLocally(arrivals))
+            askForThreading();
     } else {
         // There's apparently at least one known UID whose threading info we do not know; that means that we have to ask the
         // server here.
@@ -654,6 +815,350 @@ void ThreadingMsgListModel::askForThreading(const uint firstUnknownUid)
             connect(realModel, SIGNAL(threadingFailed(QModelIndex,QByteArray,QStringList)),
                     this, SLOT(slotThreadingFailed(QModelIndex,QByteArray,QStringList)));
         }
+    } else {
+        threadLocally();
+    }
+}
+
+void ThreadingMsgListModel::threadLocally()
+{
+    const Imap::Mailbox::Model *realModel;
+    QModelIndex someMessage = sourceModel()->index(0,0);
+    QModelIndex realIndex;
+    Imap::Mailbox::Model::realTreeItem(someMessage, &realModel, &realIndex);
+    const QString mailbox = realIndex.parent().parent().data(RoleMailboxName).toString();
+    TreeItemMsgList *list = dynamic_cast<TreeItemMsgList*>(static_cast<TreeItem*>(realIndex.parent().internalPointer()));
+    Q_ASSERT(list);
+
+    // The tree is only ever accessed from the main thread, so all data are copied before handing them over to the worker
+    QVector<LocalThreadingInput> messages;
+    messages.reserve(list->m_children.size());
+    m_localThreadingMissingMetadata.clear();
+    m_localThreadingLateMetadata.clear();
+    for (auto it = list->m_children.constBegin(); it != list->m_children.constEnd(); ++it) {
+        TreeItemMessage *message = static_cast<TreeItemMessage*>(*it);
+        if (!message->uid())
+            continue;
+
+        LocalThreadingInput input;
+        if (!localThreadingInput(realModel, mailbox, message, input)) {
+            // This message will be a standalone one until its headers arrive
+            m_localThreadingMissingMetadata.insert(input.uid);
+        }
+        messages << input;
+    }
+
+    logTrace(QString::fromUtf8("ThreadingMsgListModel::threadLocally: %1 messages, %2 of them without metadata")
+             .arg(QString::number(messages.size()), QString::number(m_localThreadingMissingMetadata.size())));
+
+    threadingInFlight = true;
+    m_localThreadingDirty = false;
+    LocalThreadingJob *job = new LocalThreadingJob(mailbox, messages);
+    connect(job, SIGNAL(finished()), this, SLOT(slotLocalThreadingFinished()));
+    QThreadPool::globalInstance()->start(job);
+}
+
+bool ThreadingMsgListModel::localThreadingInput(const Model *realModel, const QString &mailbox, TreeItemMessage *message,
+                                                LocalThreadingInput &input)
+{
+    input.uid = message->uid();
+    if (message->fetched()) {
+        input.messageId = message->m_data->m_envelope.messageId;
+        input.references = message->m_data->m_hdrReferences;
+        if (input.references.isEmpty())
+            input.references = message->m_data->m_envelope.inReplyTo;
+        input.subject = message->m_data->m_envelope.subject;
+        input.date = message->m_data->m_envelope.date;
+        m_cachedMetadata.remove(input.uid);
+        return true;
+    }
+
+    const AbstractCache::MessageDataBundle *cached = cachedMetadata(realModel, mailbox, input.uid);
+    if (!cached)
+        return false;
+    input.messageId = cached->envelope.messageId;
+    input.references = cached->hdrReferences.isEmpty() ? cached->envelope.inReplyTo : cached->hdrReferences;
+    input.subject = cached->envelope.subject;
+    input.date = cached->envelope.date;
+    return true;
+}
+
+const AbstractCache::MessageDataBundle *ThreadingMsgListModel::cachedMetadata(const Model *realModel, const QString &mailbox,
+                                                                              const uint uid)
+{
+    if (m_cachedMetadataMailbox != mailbox) {
+        m_cachedMetadata.clear();
+        m_cachedMetadataMailbox = mailbox;
+    }
+
+    QHash<uint, AbstractCache::MessageDataBundle>::iterator it = m_cachedMetadata.find(uid);
+    if (it == m_cachedMetadata.end()) {
+        AbstractCache::MessageDataBundle bundle = realModel->cache()->messageMetadata(mailbox, uid);
+        if (bundle.uid != uid) {
+            bundle = AbstractCache::MessageDataBundle();
+        } else {
+            // Neither the threading nor the sorting needs these, and they can be pretty big
+            bundle.serializedBodyStructure.clear();
+        }
+        it = m_cachedMetadata.insert(uid, bundle);
+    }
+    return it->uid ? &*it : 0;
+}
+
+QVector<Responses::ThreadingNode> ThreadingMsgListModel::threadingMapping(const Model *realModel, const QString &mailbox) const
+{
+    if (!m_localThreadingMailbox.isEmpty() && m_localThreadingMailbox == mailbox)
+        return m_localThreadingMapping;
+    return realModel->cache()->messageThreading(mailbox);
+}
+
+void ThreadingMsgListModel::storeLocalThreading(const Model *realModel, const QString &mailbox,
+                                                const QVector<Responses::ThreadingNode> &mapping)
+{
+    if (m_localThreadingMissingMetadata.isEmpty() && m_localThreadingLateMetadata.isEmpty()) {
+        m_localThreadingMapping.clear();
+        m_localThreadingMailbox.clear();
+        realModel->cache()->setMessageThreading(mailbox, mapping);
+    } else {
+        m_localThreadingMapping = mapping;
+        m_localThreadingMailbox = mailbox;
+        // Whatever the cache contains is older than this, and the next session shall thread from scratch
+        realModel->cache()->setMessageThreading(mailbox, QVector<Responses::ThreadingNode>());
+    }
+}
+
+/** @short Find the node with UID @arg uid in the @arg mapping; returns 0 if there's no such node */
+static Responses::ThreadingNode *findThreadingNode(QVector<Responses::ThreadingNode> &mapping, const uint uid)
+{
+    for (QVector<Responses::ThreadingNode>::iterator it = mapping.begin(); it != mapping.end(); ++it) {
+        if (it->num == uid)
+            return &*it;
+        if (Responses::ThreadingNode *child = findThreadingNode(it->children, uid))
+            return child;
+    }
+    return 0;
+}
+
+/** @short Does the @arg input go after the @arg node among its siblings?
+
+RFC 5256 orders the siblings by their sent date, with the messages lacking any date going first.  A node without a message of
+its own is placed by its first child.  Ties are broken by the UID, just like in the threadByReferences().
+*/
+bool ThreadingMsgListModel::localThreadingGoesAfter(const Model *realModel, const QString &mailbox, TreeItemMailbox *mailboxPtr,
+                                                    const LocalThreadingInput &input, const Responses::ThreadingNode &node)
+{
+    const Responses::ThreadingNode *first = &node;
+    while (!first->num && !first->children.isEmpty())
+        first = &first->children.front();
+    qint64 date = 0;
+    if (first->num) {
+        QList<TreeItemMessage *> messages = const_cast<Model *>(realModel)->findMessagesByUids(mailboxPtr, Imap::Uids() << first->num);
+        LocalThreadingInput sibling;
+        if (!messages.isEmpty() && localThreadingInput(realModel, mailbox, messages.front(), sibling) && sibling.date.isValid())
+            date = sibling.date.toMSecsSinceEpoch();
+    }
+    const qint64 inputDate = input.date.isValid() ? input.date.toMSecsSinceEpoch() : 0;
+    if (inputDate != date)
+        return inputDate > date;
+    return input.uid > first->num;
+}
+
+bool ThreadingMsgListModel::attachLocally(const QList<TreeItemMessage *> &messages)
+{
+    if (!m_localThreadingAppliedUpTo || m_localThreadingAppliedUpTo != m_localThreadingIndex.highestUid || threadingInFlight ||
+            !unknownUids.isEmpty() || !m_currentSearchConditions.isEmpty()) {
+        // The tree might not be the one described by the index, or some of its nodes are hidden by the search
+        return false;
+    }
+
+    const Imap::Mailbox::Model *realModel;
+    QModelIndex someMessage = sourceModel()->index(0,0);
+    QModelIndex realIndex;
+    Imap::Mailbox::Model::realTreeItem(someMessage, &realModel, &realIndex);
+    Q_FOREACH(const QString &capability, supportedCapabilities()) {
+        if (realModel->capabilities().contains(capability))
+            return false;
+    }
+    TreeItemMailbox *mailboxPtr = static_cast<TreeItemMailbox*>(realIndex.parent().parent().internalPointer());
+    const QString mailbox = realIndex.parent().parent().data(RoleMailboxName).toString();
+    QVector<Responses::ThreadingNode> mapping = threadingMapping(realModel, mailbox);
+
+    // At first, find a place for each of the messages without touching anything. It's only safe to move the rows around
+    // once it's clear that all of them can be placed; otherwise, the whole mailbox gets threaded again anyway.
+    LocalThreadingIndex additions;
+    QList<QPair<uint, uint> > placements;
+    QList<uint> newRootIds;
+    QList<uint> missingMetadata;
+    Q_FOREACH(TreeItemMessage *message, messages) {
+        if (!message->uid())
+            return false;
+        // Anything above the applied threading is a new arrival, the rest has been a standalone message without any headers
+        const bool isArrival = message->uid() > m_localThreadingAppliedUpTo;
+        QHash<void *,uint>::const_iterator ptrIt = ptrToInternal.constFind(message);
+        if (ptrIt == ptrToInternal.constEnd())
+            return false;
+        ThreadNodeStorage::const_iterator node = threading.constFind(*ptrIt);
+        if (node == threading.constEnd() || node->parent != 0 || !node->children.isEmpty())
+            return false;
+
+        LocalThreadingInput input;
+        if (!localThreadingInput(realModel, mailbox, message, input))
+            missingMetadata << input.uid;
+        uint parentUid;
+        if (!attachToLocalThreads(m_localThreadingIndex, additions, input, parentUid))
+            return false;
+
+        Responses::ThreadingNode threadingNode;
+        threadingNode.num = input.uid;
+        if (!isArrival) {
+            // The message is a childless thread root in the mapping, just like in the tree
+            int i = 0;
+            while (i < mapping.size() && mapping[i].num != input.uid)
+                ++i;
+            if (i == mapping.size() || !mapping[i].children.isEmpty())
+                return false;
+            if (!parentUid)
+                continue;
+            mapping.remove(i);
+        }
+
+        if (!parentUid) {
+            mapping << threadingNode;
+            newRootIds << node->internalId;
+            continue;
+        }
+
+        QList<TreeItemMessage *> parents = const_cast<Model *>(realModel)->findMessagesByUids(mailboxPtr, Imap::Uids() << parentUid);
+        if (parents.isEmpty())
+            return false;
+        QHash<void *,uint>::const_iterator parentPtrIt = ptrToInternal.constFind(parents.front());
+        if (parentPtrIt == ptrToInternal.constEnd() || !threading.contains(*parentPtrIt))
+            return false;
+        Responses::ThreadingNode *parentNode = findThreadingNode(mapping, parentUid);
+        if (!parentNode)
+            return false;
+        if (!parentNode->children.isEmpty() &&
+                !localThreadingGoesAfter(realModel, mailbox, mailboxPtr, input, parentNode->children.last())) {
+            // The siblings are ordered by their date, and moving the older ones around is left to the full threading
+            return false;
+        }
+        parentNode->children << threadingNode;
+        placements << qMakePair(node->internalId, *parentPtrIt);
+    }
+
+    // Everything has its place, so let's apply that
+    mergeLocalThreadingIndex(m_localThreadingIndex, additions);
+    Q_FOREACH(const uint uid, missingMetadata) {
+        m_localThreadingMissingMetadata.insert(uid);
+    }
+    Q_FOREACH(const uint nodeId, newRootIds) {
+        if (!threadedRootIds.contains(nodeId))
+            threadedRootIds << nodeId;
+    }
+    for (QList<QPair<uint, uint> >::const_iterator it = placements.constBegin(); it != placements.constEnd(); ++it) {
+        attachNode(it->first, it->second);
+    }
+
+    m_localThreadingAppliedUpTo = m_localThreadingIndex.highestUid;
+    storeLocalThreading(realModel, mailbox, mapping);
+    logTrace(QString::fromUtf8("ThreadingMsgListModel::attachLocally: %1 messages placed without threading everything again")
+             .arg(QString::number(messages.size())));
+
+    if (!newRootIds.isEmpty() && (m_currentSortingCriteria != SORT_NONE || m_sortReverse)) {
+        // The new threads have been appended to the end, which is not necessarily their place
+        searchSortPreferenceImplementation(m_currentSearchConditions, m_currentSortingCriteria,
+                                           m_sortReverse ? Qt::DescendingOrder : Qt::AscendingOrder);
+    }
+    return true;
+}
+
+void ThreadingMsgListModel::attachNode(const uint nodeId, const uint parentId)
+{
+    ThreadNodeStorage::iterator node = threading.find(nodeId);
+    ThreadNodeStorage::iterator parent = threading.find(parentId);
+    Q_ASSERT(node != threading.end());
+    Q_ASSERT(parent != threading.end());
+    Q_ASSERT(node->parent == 0);
+    Q_ASSERT(node->children.isEmpty());
+
+    QList<uint> &roots = threading[0].children;
+    const int row = node->offset;
+    Q_ASSERT(roots[row] == nodeId);
+    const QModelIndex parentIndex = parentId ? createIndex(parent->offset, 0, parentId) : QModelIndex();
+
+    beginMoveRows(QModelIndex(), row, row, parentIndex, parent->children.size());
+    roots.removeAt(row);
+    for (int i = row; i < roots.size(); ++i)
+        threading[roots[i]].offset = i;
+    threadedRootIds.removeOne(nodeId);
+    node->parent = parentId;
+    node->offset = parent->children.size();
+    parent->children.append(nodeId);
+    endMoveRows();
+
+    // The thread might have got some unread messages
+    invalidateThreadAggregates(parentId);
+    QModelIndex ancestor = parentIndex;
+    while (ancestor.isValid()) {
+        emit dataChanged(ancestor, ancestor.sibling(ancestor.row(), MsgListModel::COLUMN_COUNT - 1));
+        ancestor = ancestor.parent();
+    }
+}
+
+void ThreadingMsgListModel::delayedLocalThreading()
+{
+    if (threadingInFlight) {
+        m_localThreadingDirty = true;
+        return;
+    }
+    if (!m_shallBeThreading || !sourceModel() || !sourceModel()->rowCount())
+        return;
+
+    if (m_localThreadingLateMetadata.isEmpty())
+        return;
+    Imap::Uids uids = m_localThreadingLateMetadata.toList().toVector();
+    m_localThreadingLateMetadata.clear();
+    qSort(uids);
+    const Imap::Mailbox::Model *realModel;
+    QModelIndex someMessage = sourceModel()->index(0,0);
+    QModelIndex realIndex;
+    Imap::Mailbox::Model::realTreeItem(someMessage, &realModel, &realIndex);
+    QList<TreeItemMessage *> messages = const_cast<Model *>(realModel)->findMessagesByUids(
+                static_cast<TreeItemMailbox*>(realIndex.parent().parent().internalPointer()), uids);
+    if (!attachLocally(messages))
+        threadLocally();
+}
+
+void ThreadingMsgListModel::slotLocalThreadingFinished()
+{
+    LocalThreadingJob *job = qobject_cast<LocalThreadingJob*>(sender());
+    Q_ASSERT(job);
+    threadingInFlight = false;
+
+    QModelIndex someMessage = sourceModel() ? sourceModel()->index(0,0) : QModelIndex();
+    if (!someMessage.isValid())
+        return;
+    const Imap::Mailbox::Model *realModel;
+    QModelIndex realIndex;
+    Imap::Mailbox::Model::realTreeItem(someMessage, &realModel, &realIndex);
+    const QString mailbox = realIndex.parent().parent().data(RoleMailboxName).toString();
+
+    if (job->mailbox() == mailbox) {
+        storeLocalThreading(realModel, mailbox, job->result());
+        m_localThreadingIndex = job->index();
+    } else {
+        // The user has switched to another mailbox in the meanwhile
+        m_localThreadingDirty = false;
+    }
+
+    if (!m_shallBeThreading)
+        return;
+
+    if (m_localThreadingDirty) {
+        threadLocally();
+    } else {
+        // Messages which have arrived since the job was started will trigger another round of threading from here
+        wantThreading();
     }
 }
 
@@ -693,7 +1198,7 @@ void ThreadingMsgListModel::slotIncrementalThreadingAvailable(const Responses::E
     for (QList<TreeItemMessage*>::const_iterator it = affectedMessages.constBegin(); it != affectedMessages.constEnd(); ++it) {
         QHash<void *,uint>::const_iterator ptrMappingIt = ptrToInternal.constFind(*it);
         Q_ASSERT(ptrMappingIt != ptrToInternal.constEnd());
-        QHash<uint,ThreadNodeInfo>::iterator threadIt = threading.find(*ptrMappingIt);
+        ThreadNodeStorage::iterator threadIt = threading.find(*ptrMappingIt);
         Q_ASSERT(threadIt != threading.end());
         uidToPtrCache[(*it)->uid()] = threadIt->ptr;
         threadIt->ptr = 0;
@@ -706,6 +1211,7 @@ void ThreadingMsgListModel::slotIncrementalThreadingAvailable(const Responses::E
     QSet<uint> usedNodes;
     emit layoutAboutToBeChanged();
     updatePersistentIndexesPhase1();
+    m_threadAggregates.clear();
     for (Responses::ESearch::IncrementalThreadingData_t::const_iterator it = data.constBegin(); it != data.constEnd(); ++it) {
         registerThreading(it->thread, 0, uidToPtrCache, usedNodes);
         int actualOffset = threading[0].children.size() - 1;
@@ -796,6 +1302,9 @@ void ThreadingMsgListModel::slotThreadingAvailable(const QModelIndex &mailbox, c
                SLOT(slotThreadingFailed(QModelIndex,QByteArray,QStringList)));
 
     model->cache()->setMessageThreading(mailbox.data(RoleMailboxName).toString(), mapping);
+    // The server knows better than the client-side threading
+    m_localThreadingMapping.clear();
+    m_localThreadingMailbox.clear();
 
     // Indirect processing here -- the wantThreading() will check that the received response really contains everything we need
     // and if it does, simply applyThreading() that.  If there's something missing, it will ask for the threading again.
@@ -805,6 +1314,36 @@ void ThreadingMsgListModel::slotThreadingAvailable(const QModelIndex &mailbox, c
 
 void ThreadingMsgListModel::slotSortingAvailable(const Imap::Uids &uids)
 {
+    if (sender() != m_sortTask.data()) {
+        // A leftover from a request which has been replaced by another one in the meanwhile
+        return;
+    }
+
+    if (!m_pendingSearchKey.isEmpty() && sourceModel()->rowCount()) {
+        const Model *realModel;
+        QModelIndex realIndex;
+        Model::realTreeItem(sourceModel()->index(0, 0), &realModel, &realIndex);
+        QModelIndex mailboxIndex = realIndex.parent().parent();
+        // Anything which has happened to the mailbox in the meanwhile might or might not be reflected in this result
+        if (searchResultMailboxState(mailboxIndex) == m_pendingSearchState) {
+            realModel->cache()->setSearchResult(mailboxIndex.data(RoleMailboxName).toString(), m_pendingSearchState,
+                                                m_pendingSearchKey, uids);
+        }
+    }
+    m_pendingSearchKey.clear();
+    m_pendingSearchState.clear();
+
+    if (m_sortLocally) {
+        // This is a result of a plain SEARCH which we have to sort ourselves, so any further updates are useless
+        if (m_sortTask->isPersistent())
+            m_sortTask->cancelSortingUpdates();
+        disconnect(m_sortTask, 0, this, SLOT(slotSortingAvailable(Imap::Uids)));
+        disconnect(m_sortTask, 0, this, SLOT(slotSortingFailed()));
+        m_sortTask = 0;
+        sortLocally(&uids);
+        return;
+    }
+
     if (!m_sortTask->isPersistent()) {
         disconnect(m_sortTask, 0, this, SLOT(slotSortingAvailable(Imap::Uids)));
         disconnect(m_sortTask, 0, this, SLOT(slotSortingFailed()));
@@ -814,6 +1353,7 @@ void ThreadingMsgListModel::slotSortingAvailable(const Imap::Uids &uids)
     }
 
     m_currentSortResult = uids;
+    m_currentSortResultFiltered = true;
     if (m_searchValidity == RESULT_ASKED)
         m_searchValidity = RESULT_FRESH;
     wantThreading();
@@ -821,6 +1361,11 @@ void ThreadingMsgListModel::slotSortingAvailable(const Imap::Uids &uids)
 
 void ThreadingMsgListModel::slotSortingFailed()
 {
+    if (sender() != m_sortTask.data())
+        return;
+
+    m_pendingSearchKey.clear();
+    m_pendingSearchState.clear();
     disconnect(m_sortTask, 0, this, SLOT(slotSortingAvailable(QList<uint>)));
     disconnect(m_sortTask, 0, this, SLOT(slotSortingFailed()));
     disconnect(m_sortTask, 0, this, SLOT(slotSortingIncrementalUpdate(Imap::Responses::ESearch::IncrementalContextData_t)));
@@ -834,6 +1379,9 @@ void ThreadingMsgListModel::slotSortingFailed()
 
 void ThreadingMsgListModel::slotSortingIncrementalUpdate(const Responses::ESearch::IncrementalContextData_t &updates)
 {
+    if (sender() != m_sortTask.data())
+        return;
+
     for (Responses::ESearch::IncrementalContextData_t::const_iterator it = updates.constBegin(); it != updates.constEnd(); ++it) {
         switch (it->modification) {
         case Responses::ESearch::ContextIncrementalItem::ADDTO:
@@ -882,12 +1430,13 @@ void ThreadingMsgListModel::calculateNullSort()
     m_currentSortResult.reserve(threadedRootIds.size());
 #endif
     Q_FOREACH(const uint internalId, threadedRootIds) {
-        QHash<uint,ThreadNodeInfo>::const_iterator it = threading.constFind(internalId);
+        ThreadNodeStorage::const_iterator it = threading.constFind(internalId);
         if (it == threading.constEnd())
             continue;
         if (it->uid)
             m_currentSortResult.append(it->uid);
     }
+    m_currentSortResultFiltered = false;
     m_searchValidity = RESULT_FRESH;
 }
 
@@ -899,11 +1448,16 @@ void ThreadingMsgListModel::applyThreading(const QVector<Imap::Responses::Thread
         return;
     }
 
+    QElapsedTimer phaseTimer;
+    phaseTimer.start();
+
     emit layoutAboutToBeChanged();
 
     updatePersistentIndexesPhase1();
+    const qint64 savingTime = phaseTimer.restart();
 
     threading.clear();
+    m_threadAggregates.clear();
     ptrToInternal.clear();
     // Default-construct the root node
     threading[ 0 ].ptr = 0;
@@ -955,7 +1509,7 @@ void ThreadingMsgListModel::applyThreading(const QVector<Imap::Responses::Thread
     registerThreading(mapping, 0, uidToPtrCache, usedNodes);
 
     // Now remove all messages which were not referenced in the THREAD response from our mapping
-    QHash<uint,ThreadNodeInfo>::iterator it = threading.begin();
+    ThreadNodeStorage::iterator it = threading.begin();
     while (it != threading.end()) {
         if (usedNodes.contains(it.key())) {
             // this message should be shown
@@ -966,11 +1520,18 @@ void ThreadingMsgListModel::applyThreading(const QVector<Imap::Responses::Thread
             it = threading.erase(it);
         }
     }
+    const qint64 buildingTime = phaseTimer.restart();
     pruneTree();
+    const qint64 pruningTime = phaseTimer.restart();
     updatePersistentIndexesPhase2();
+    const qint64 remappingTime = phaseTimer.elapsed();
     if (rowCount())
         threadedRootIds = threading[0].children;
+    // New arrivals can be attached to this threading locally only if it is the one the client-side threading has produced
+    m_localThreadingAppliedUpTo = m_localThreadingIndex.highestUid ?
+                findHighEnoughNumber(mapping, m_localThreadingIndex.highestUid) : 0;
     emit layoutChanged();
+    logPhaseTimes(QLatin1String("Threading"), savingTime, buildingTime, pruningTime, remappingTime);
 
     // If the sorting was active before, we shall reactivate it now
     searchSortPreferenceImplementation(m_currentSearchConditions, m_currentSortingCriteria, m_sortReverse ? Qt::DescendingOrder : Qt::AscendingOrder);
@@ -1013,41 +1574,47 @@ void ThreadingMsgListModel::registerThreading(const QVector<Imap::Responses::Thr
     }
 }
 
-/** @short Gather a list of persistent indexes which we have to transform after out layout change */
+/** @short Gather a list of persistent indexes which we have to transform after out layout change
+
+Only the messages the indexes point to are remembered; they are looked up straight in the threading mapping, without going
+through the source model.
+*/
 void ThreadingMsgListModel::updatePersistentIndexesPhase1()
 {
     oldPersistentIndexes = persistentIndexList();
     oldPtrs.clear();
+    if (oldPersistentIndexes.isEmpty())
+        return;
+    oldPtrs.reserve(oldPersistentIndexes.size());
     Q_FOREACH(const QModelIndex &idx, oldPersistentIndexes) {
         // the index could get invalidated by the pruneTree() or something else manipulating our threading
-        bool isOk = idx.isValid() && threading.contains(idx.internalId());
-        if (!isOk) {
-            oldPtrs << 0;
-            continue;
-        }
-        QModelIndex translated = mapToSource(idx);
-        if (!translated.isValid()) {
-            // another stale item
-            oldPtrs << 0;
-            continue;
-        }
-        oldPtrs << translated.internalPointer();
+        ThreadNodeStorage::const_iterator it = idx.isValid() ? threading.constFind(idx.internalId()) : threading.constEnd();
+        // fake messages have no pointer, so they will die, too
+        oldPtrs << (it == threading.constEnd() ? 0 : it->ptr);
     }
 }
 
-/** @short Update the gathered persistent indexes after our change in the layout */
+/** @short Update the gathered persistent indexes after our change in the layout
+
+The ptrToInternal already describes the new tree, so it serves as the map from the old nodes to the new ones.
+*/
 void ThreadingMsgListModel::updatePersistentIndexesPhase2()
 {
     Q_ASSERT(oldPersistentIndexes.size() == oldPtrs.size());
-    QList<QModelIndex> updatedIndexes;
+    if (oldPersistentIndexes.isEmpty())
+        return;
+    QModelIndexList updatedIndexes;
+#if QT_VERSION >= 0x040700
+    updatedIndexes.reserve(oldPersistentIndexes.size());
+#endif
     for (int i = 0; i < oldPersistentIndexes.size(); ++i) {
-        QHash<void *,uint>::const_iterator ptrIt = ptrToInternal.constFind(oldPtrs[i]);
+        QHash<void *,uint>::const_iterator ptrIt = oldPtrs[i] ? ptrToInternal.constFind(oldPtrs[i]) : ptrToInternal.constEnd();
         if (ptrIt == ptrToInternal.constEnd()) {
             // That message is no longer there
             updatedIndexes.append(QModelIndex());
             continue;
         }
-        QHash<uint,ThreadNodeInfo>::const_iterator it = threading.constFind(*ptrIt);
+        ThreadNodeStorage::const_iterator it = threading.constFind(*ptrIt);
         if (it == threading.constEnd()) {
             // Filtering doesn't accept this index, let's declare it dead
             updatedIndexes.append(QModelIndex());
@@ -1061,116 +1628,102 @@ void ThreadingMsgListModel::updatePersistentIndexesPhase2()
     oldPtrs.clear();
 }
 
+/** @short One level of the bottom-up walk through the tree in pruneTree() */
+struct PruneTreeFrame {
+    uint id;
+    int nextChild;
+    /** @short Children of this node which remain after their own subtrees got pruned */
+    QList<uint> keptChildren;
+
+    explicit PruneTreeFrame(const uint id): id(id), nextChild(0) {}
+};
+
 void ThreadingMsgListModel::pruneTree()
 {
-    // Our mapping (threading) is completely unsorted, which means that we simply don't have any way of walking the tree from
-    // the top. Instead, we got to work with a random walk, processing nodes in an unspecified order.  If we iterated on the QHash
-    // directly, we'd hit an issue with iterator ordering (basically, we want to be able to say "hey, I don't care at which point
-    // of the iteration I'm right now, the next node to process should be that one, and then we should resume with the rest").
-    QList<uint> pending = threading.keys();
-
-    // These are the parents whose children will have to be renumbered later on
-    QSet<uint> parentsForRenumbering;
-
-    for (QList<uint>::iterator id = pending.begin(); id != pending.end(); /* nothing */) {
-        // Convert to the hashmap
-        // The "it" iterator point to the current node in the threading mapping
-        QHash<uint, ThreadNodeInfo>::iterator it = threading.find(*id);
-        if (it == threading.end()) {
-            // We've already seen this node, that's due to promoting
-            ++id;
+    m_threadAggregates.clear();
+
+    // The tree is walked from the bottom up, so by the time we get to a node, all of its children have already been pruned.
+    // A fake node without any children simply disappears.  A fake node with some children gets replaced by its first child
+    // which adopts the rest of them; the promoted child is never a fake one, because these are gone already.
+    // Each node's children are renumbered exactly once, when we leave that node.
+    QHash<uint, uint> replacedRoots;
+    std::vector<PruneTreeFrame> stack;
+    stack.push_back(PruneTreeFrame(0));
+    while (!stack.empty()) {
+        PruneTreeFrame &frame = stack.back();
+        ThreadNodeStorage::iterator node = threading.find(frame.id);
+        Q_ASSERT(node != threading.end());
+
+        if (frame.nextChild < node->children.size()) {
+            const uint childId = node->children[frame.nextChild++];
+            // this invalidates the frame reference
+            stack.push_back(PruneTreeFrame(childId));
             continue;
         }
 
-        if (it->internalId == 0) {
-            // A special root item; we should not delete that one :)
-            ++id;
-            continue;
+        node->children.swap(frame.keptChildren);
+        for (int i = 0; i < node->children.size(); ++i) {
+            ThreadNodeStorage::iterator child = threading.find(node->children[i]);
+            Q_ASSERT(child != threading.end());
+            child->parent = node->internalId;
+            child->offset = i;
         }
-        if (it->ptr) {
-            // regular and valid message -> skip
-            ++id;
-        } else {
-            // a fake one
-
-            // each node has a parent
-            QHash<uint, ThreadNodeInfo>::iterator parent = threading.find(it->parent);
-            Q_ASSERT(parent != threading.end());
-
-            // and the node itself has to be found in its parent's children
-            QList<uint>::iterator childIt = qFind(parent->children.begin(), parent->children.end(), it->internalId);
-            Q_ASSERT(childIt != parent->children.end());
-            // The offset of this child might no longer be correct, though -- we're postponing the actual deletion until later
-
-            if (it->children.isEmpty()) {
-                // This is a leaf node, so we can just remove it
-                childIt = parent->children.erase(childIt);
-                // We do not perform the renumbering immediately, that would lead to an O(n^2) performance when deleting nodes.
-                parentsForRenumbering.insert(it->parent);
-                parentsForRenumbering.remove(it->internalId);
-
-                if (it->parent == 0) {
-                    threadedRootIds.removeOne(it->internalId);
-                }
-                threading.erase(it);
-                ++id;
 
-            } else {
-                // This node has some children, so we can't just delete it. Instead of that, we promote its first child
-                // to replace this node.
-                QHash<uint, ThreadNodeInfo>::iterator replaceWith = threading.find(it->children.first());
-                Q_ASSERT(replaceWith != threading.end());
-
-                // The offsets will, again, be updated later on
-                parentsForRenumbering.insert(it->parent);
-                parentsForRenumbering.insert(replaceWith.key());
-                parentsForRenumbering.remove(it->internalId);
-
-                // Replace the node
-                *childIt = it->children.first();
-                replaceWith->parent = parent->internalId;
-
-                // Now merge the lists of children
-                it->children.removeFirst();
-                replaceWith->children = replaceWith->children + it->children;
-
-                // Fix parent information of all children of the replacement node
-                for (int i = 0; i < replaceWith->children.size(); ++i) {
-                    QHash<uint, ThreadNodeInfo>::iterator sibling = threading.find(replaceWith->children[i]);
-                    Q_ASSERT(sibling != threading.end());
-                    sibling->parent = replaceWith.key();
-                }
+        const uint id = frame.id;
+        stack.pop_back();
+        if (stack.empty()) {
+            // That was the root item; we should not delete that one :)
+            break;
+        }
+        PruneTreeFrame &parentFrame = stack.back();
 
-                if (parent->internalId == 0) {
-                    // Update the list of all thread roots
-                    QList<uint>::iterator rootIt = qFind(threadedRootIds.begin(), threadedRootIds.end(), it->internalId);
-                    if (rootIt != threadedRootIds.end())
-                        *rootIt = replaceWith->internalId;
-                }
+        if (node->ptr) {
+            // regular and valid message -> keep it
+            parentFrame.keptChildren.append(id);
+            continue;
+        }
 
-                // Now that all references are gone, remove the original node
-                threading.erase(it);
+        if (node->children.isEmpty()) {
+            // This is a leaf node, so we can just remove it
+            if (parentFrame.id == 0)
+                replacedRoots[id] = 0;
+            threading.erase(node);
+            continue;
+        }
 
-                if (!replaceWith->ptr) {
-                    // If the just-promoted item is also a fake one, we'll have to visit it as well. This assignment is safe,
-                    // because we've already processed the current item and are completely done with it. The worst which can
-                    // happen is that we'll visit the same node twice, which is reasonably acceptable.
-                    *id = replaceWith.key();
-                }
-            }
+        // Promote the first child to replace this node
+        QList<uint> orphans;
+        orphans.swap(node->children);
+        const uint replacementId = orphans.takeFirst();
+        ThreadNodeStorage::iterator replaceWith = threading.find(replacementId);
+        Q_ASSERT(replaceWith != threading.end());
+        Q_ASSERT(replaceWith->ptr);
+        int offset = replaceWith->children.size();
+        Q_FOREACH(const uint orphanId, orphans) {
+            ThreadNodeStorage::iterator orphan = threading.find(orphanId);
+            Q_ASSERT(orphan != threading.end());
+            orphan->parent = replacementId;
+            orphan->offset = offset++;
+            replaceWith->children.append(orphanId);
         }
+        if (parentFrame.id == 0)
+            replacedRoots[id] = replacementId;
+        // Its own parent and offset get set when we leave the parent
+        parentFrame.keptChildren.append(replacementId);
+        threading.erase(node);
     }
 
-    // Now fix the sequential numbering of all siblings of deleted children
-    Q_FOREACH(const auto parentId, parentsForRenumbering) {
-        auto parentIt = threading.constFind(parentId);
-        Q_ASSERT(parentIt != threading.constEnd());
-        int offset = 0;
-        for (auto childNumber = parentIt->children.constBegin(); childNumber != parentIt->children.constEnd(); ++childNumber, ++offset) {
-            auto childIt = threading.find(*childNumber);
-            Q_ASSERT(childIt != threading.end());
-            childIt->offset = offset;
+    if (!replacedRoots.isEmpty()) {
+        // Update the list of all thread roots
+        QList<uint> roots;
+        Q_FOREACH(const uint id, threadedRootIds) {
+            QHash<uint, uint>::const_iterator it = replacedRoots.constFind(id);
+            if (it == replacedRoots.constEnd())
+                roots.append(id);
+            else if (*it)
+                roots.append(*it);
         }
+        threadedRootIds.swap(roots);
     }
 }
 
@@ -1198,23 +1751,71 @@ QMimeData *ThreadingMsgListModel::mimeData(const QModelIndexList &indexes) const
 
 bool ThreadingMsgListModel::threadContainsUnreadMessages(const uint root) const
 {
-    // FIXME: cache the value somewhere...
-    QList<uint> queue;
-    queue.append(root);
-    while (! queue.isEmpty()) {
-        uint current = queue.takeFirst();
-        QHash<uint,ThreadNodeInfo>::const_iterator it = threading.constFind(current);
+    return threadAggregate(root).unreadCount > 0;
+}
+
+ThreadAggregate ThreadingMsgListModel::threadAggregate(const uint id) const
+{
+    QHash<uint, ThreadAggregate>::const_iterator cached = m_threadAggregates.constFind(id);
+    if (cached != m_threadAggregates.constEnd())
+        return *cached;
+
+    // Walk the subtree in post-order so that each node is computed from the already known aggregates of its children.
+    // The threads can get pretty deep, so let's not recurse here.
+    std::vector<uint> stack;
+    stack.push_back(id);
+    while (!stack.empty()) {
+        const uint current = stack.back();
+        ThreadNodeStorage::const_iterator it = threading.constFind(current);
         Q_ASSERT(it != threading.constEnd());
+        bool childrenKnown = true;
+        Q_FOREACH(const uint child, it->children) {
+            if (!m_threadAggregates.contains(child)) {
+                stack.push_back(child);
+                childrenKnown = false;
+            }
+        }
+        if (!childrenKnown)
+            continue;
+        stack.pop_back();
+
+        ThreadAggregate aggregate;
         if (it->ptr) {
             // Because of the delayed delete via pruneTree, we can hit a null pointer here
             TreeItemMessage *message = dynamic_cast<TreeItemMessage *>(it->ptr);
             Q_ASSERT(message);
-            if (! message->isMarkedAsRead())
-                return true;
+            aggregate.messageCount = 1;
+            if (!message->isMarkedAsRead())
+                aggregate.unreadCount = 1;
+            if (message->isMarkedAsFlagged())
+                aggregate.flaggedCount = 1;
+            // Don't use internalDate() here, we do not want to trigger fetching of metadata for the whole thread
+            if (message->fetched())
+                aggregate.newestDate = message->data()->m_internalDate;
         }
-        queue.append(it->children);
+        Q_FOREACH(const uint child, it->children) {
+            const ThreadAggregate &childAggregate = *m_threadAggregates.constFind(child);
+            aggregate.messageCount += childAggregate.messageCount;
+            aggregate.unreadCount += childAggregate.unreadCount;
+            aggregate.flaggedCount += childAggregate.flaggedCount;
+            if (childAggregate.newestDate.isValid() &&
+                    (!aggregate.newestDate.isValid() || childAggregate.newestDate > aggregate.newestDate)) {
+                aggregate.newestDate = childAggregate.newestDate;
+            }
+        }
+        m_threadAggregates.insert(current, aggregate);
+    }
+    return m_threadAggregates.value(id);
+}
+
+void ThreadingMsgListModel::invalidateThreadAggregates(uint id)
+{
+    // The ancestors of a node which is not cached are not cached either, see m_threadAggregates
+    while (id && m_threadAggregates.remove(id)) {
+        ThreadNodeStorage::const_iterator it = threading.constFind(id);
+        Q_ASSERT(it != threading.constEnd());
+        id = it->parent;
     }
-    return false;
 }
 
 /** @short Pass a debugging message to the real Model, if possible
@@ -1260,6 +1861,54 @@ bool ThreadingMsgListModel::setUserSearchingSortingPreference(const QStringList
     return searchSortPreferenceImplementation(searchConditions, criterium, order);
 }
 
+/** @short Recognize the conditions built by the GUI's quick search and extract the searched text and the fields */
+static bool parseQuickSearch(const QStringList &searchConditions, QString &text, AbstractCache::TextFields &fields)
+{
+    // The terms are joined through the OR operator in the reverse Polish notation, and they all look for the same text
+    int i = 0;
+    while (i < searchConditions.size() && searchConditions[i] == QLatin1String("OR"))
+        ++i;
+    text.clear();
+    fields = AbstractCache::TextFields();
+    while (i < searchConditions.size()) {
+        if (searchConditions[i] == QLatin1String("FUZZY"))
+            ++i;
+        if (i + 1 >= searchConditions.size())
+            return false;
+        const QString &key = searchConditions[i];
+        if (key == QLatin1String("SUBJECT")) {
+            fields |= AbstractCache::TEXT_SUBJECT;
+        } else if (key == QLatin1String("BODY")) {
+            fields |= AbstractCache::TEXT_BODY;
+        } else if (key == QLatin1String("FROM")) {
+            fields |= AbstractCache::TEXT_FROM;
+        } else if (key == QLatin1String("TO") || key == QLatin1String("CC") || key == QLatin1String("BCC")) {
+            fields |= AbstractCache::TEXT_RECIPIENTS;
+        } else {
+            return false;
+        }
+        if (!text.isEmpty() && searchConditions[i + 1] != text)
+            return false;
+        text = searchConditions[i + 1];
+        i += 2;
+    }
+    return fields && !text.isEmpty();
+}
+
+/** @short Shall the search be answered from the cache's full-text index? */
+static bool localSearchApplicable(const Model *realModel, const QStringList &searchConditions, QString *text = 0,
+                                  AbstractCache::TextFields *fields = 0)
+{
+    if (searchConditions.isEmpty())
+        return false;
+    QVariant preference = realModel->property("trojita-imap-local-search");
+    if (realModel->isNetworkOnline() && !(preference.isValid() && preference.toBool()))
+        return false;
+    QString dummyText;
+    AbstractCache::TextFields dummyFields;
+    return parseQuickSearch(searchConditions, text ? *text : dummyText, fields ? *fields : dummyFields);
+}
+
 /** @short The workhorse behind setUserSearchingSortingPreference() */
 bool ThreadingMsgListModel::searchSortPreferenceImplementation(const QStringList &searchConditions, const SortCriterium criterium, const Qt::SortOrder order)
 {
@@ -1309,6 +1958,7 @@ bool ThreadingMsgListModel::searchSortPreferenceImplementation(const QStringList
         sortOptions << (hasDisplaySort ? QLatin1String("DISPLAYTO") : QLatin1String("TO"));
         break;
     case SORT_NONE:
+        m_sortLocally = false;
         if (m_sortTask && m_sortTask->isPersistent() &&
                 (m_currentSearchConditions != searchConditions || m_currentSortingCriteria != criterium)) {
             // Any change shall result in us killing that sort task
@@ -1325,12 +1975,27 @@ bool ThreadingMsgListModel::searchSortPreferenceImplementation(const QStringList
             return true;
         } else if (searchConditions != m_currentSearchConditions || m_searchValidity != RESULT_FRESH) {
             // We have to update our search conditions
-            m_sortTask = realModel->m_taskFactory->createSortTask(const_cast<Model *>(realModel), mailboxIndex, searchConditions,
-                                                                  QStringList());
-            connect(m_sortTask, SIGNAL(sortingAvailable(Imap::Uids)), this, SLOT(slotSortingAvailable(Imap::Uids)));
-            connect(m_sortTask, SIGNAL(sortingFailed()), this, SLOT(slotSortingFailed()));
-            connect(m_sortTask, SIGNAL(incrementalSortUpdate(Imap::Responses::ESearch::IncrementalContextData_t)),
-                    this, SLOT(slotSortingIncrementalUpdate(Imap::Responses::ESearch::IncrementalContextData_t)));
+            Imap::Uids found;
+            if (searchLocally(realModel, mailboxIndex, searchConditions, found)) {
+                // The full-text index returns the best matches first, which is a reasonable order in the absence of sorting
+                m_currentSearchConditions = searchConditions;
+                m_currentSortResult = found;
+                m_currentSortResultFiltered = true;
+                m_searchValidity = RESULT_FRESH;
+                applySort();
+                return true;
+            }
+            if (cachedSearchResult(realModel, mailboxIndex, searchConditions, QStringList(), found)) {
+                m_currentSearchConditions = searchConditions;
+                m_currentSortResult = found;
+                m_currentSortResultFiltered = true;
+                m_searchValidity = RESULT_FRESH;
+                applySort();
+                if (serverSendsSortUpdates(realModel, QStringList()))
+                    startSortTask(realModel, mailboxIndex, searchConditions, QStringList());
+                return true;
+            }
+            startSortTask(realModel, mailboxIndex, searchConditions, QStringList());
             m_currentSearchConditions = searchConditions;
             m_searchValidity = RESULT_ASKED;
         } else {
@@ -1342,30 +2007,68 @@ bool ThreadingMsgListModel::searchSortPreferenceImplementation(const QStringList
         return true;
     }
 
-    if (!hasSort) {
-        // sorting is completely unsupported
-        return false;
+    if (!hasSort || localSearchApplicable(realModel, searchConditions)) {
+        if (m_sortLocally && m_currentSortingCriteria == criterium && m_currentSearchConditions == searchConditions &&
+                m_searchValidity != RESULT_INVALIDATED) {
+            applySort();
+        } else {
+            m_currentSearchConditions = searchConditions;
+            m_currentSortingCriteria = criterium;
+            calculateNullSort();
+            applySort();
+
+            if (m_sortTask && m_sortTask->isPersistent())
+                m_sortTask->cancelSortingUpdates();
+
+            m_sortLocally = true;
+            Imap::Uids found;
+            if (searchConditions.isEmpty()) {
+                sortLocally();
+            } else if (searchLocally(realModel, mailboxIndex, searchConditions, found) ||
+                       cachedSearchResult(realModel, mailboxIndex, searchConditions, QStringList(), found)) {
+                sortLocally(&found);
+            } else {
+                // The server still has to search; the result gets sorted in slotSortingAvailable()
+                rememberPendingSearch(mailboxIndex, searchConditions, QStringList());
+                m_sortTask = realModel->m_taskFactory->createSortTask(const_cast<Model *>(realModel), mailboxIndex, searchConditions,
+                                                                      QStringList());
+                connect(m_sortTask, SIGNAL(sortingAvailable(Imap::Uids)), this, SLOT(slotSortingAvailable(Imap::Uids)));
+                connect(m_sortTask, SIGNAL(sortingFailed()), this, SLOT(slotSortingFailed()));
+                m_searchValidity = RESULT_ASKED;
+            }
+        }
+        return true;
     }
 
     Q_ASSERT(!sortOptions.isEmpty());
 
-    if (m_currentSortingCriteria == criterium && m_currentSearchConditions == searchConditions &&
+    if (!m_sortLocally && m_currentSortingCriteria == criterium && m_currentSearchConditions == searchConditions &&
             m_searchValidity != RESULT_INVALIDATED) {
         applySort();
     } else {
+        m_sortLocally = false;
         m_currentSearchConditions = searchConditions;
         m_currentSortingCriteria = criterium;
-        calculateNullSort();
-        applySort();
 
         if (m_sortTask && m_sortTask->isPersistent())
             m_sortTask->cancelSortingUpdates();
 
-        m_sortTask = realModel->m_taskFactory->createSortTask(const_cast<Model *>(realModel), mailboxIndex, searchConditions, sortOptions);
-        connect(m_sortTask, SIGNAL(sortingAvailable(Imap::Uids)), this, SLOT(slotSortingAvailable(Imap::Uids)));
-        connect(m_sortTask, SIGNAL(sortingFailed()), this, SLOT(slotSortingFailed()));
-        connect(m_sortTask, SIGNAL(incrementalSortUpdate(Imap::Responses::ESearch::IncrementalContextData_t)),
-                this, SLOT(slotSortingIncrementalUpdate(Imap::Responses::ESearch::IncrementalContextData_t)));
+        Imap::Uids found;
+        if (cachedSearchResult(realModel, mailboxIndex, searchConditions, sortOptions, found)) {
+            // The server has already sorted the messages this way and nothing has changed since
+            m_currentSortResult = found;
+            m_currentSortResultFiltered = true;
+            m_searchValidity = RESULT_FRESH;
+            applySort();
+            if (serverSendsSortUpdates(realModel, sortOptions))
+                startSortTask(realModel, mailboxIndex, searchConditions, sortOptions);
+            return true;
+        }
+
+        calculateNullSort();
+        applySort();
+
+        startSortTask(realModel, mailboxIndex, searchConditions, sortOptions);
         m_searchValidity = RESULT_ASKED;
     }
 
@@ -1379,64 +2082,329 @@ void ThreadingMsgListModel::applySort()
         return;
     }
 
-    const Imap::Mailbox::Model *realModel;
-    QModelIndex someMessage = sourceModel()->index(0,0);
-    QModelIndex realIndex;
-    Model::realTreeItem(someMessage, &realModel, &realIndex);
-    TreeItemMailbox *mailbox = dynamic_cast<TreeItemMailbox*>(static_cast<TreeItem*>(realIndex.parent().parent().internalPointer()));
-    Q_ASSERT(mailbox);
+    if (m_sortLocally && m_searchValidity == RESULT_FRESH)
+        mergePendingLocalSortKeys();
+
+    // Only the thread roots can be sorted, so there's no need to look at the other messages at all
+    QHash<uint, uint> rootsByUid;
+    rootsByUid.reserve(threadedRootIds.size());
+    Q_FOREACH(const uint id, threadedRootIds) {
+        ThreadNodeStorage::const_iterator node = threading.constFind(id);
+        // The roots which did not match a previous search are gone from the mapping until the whole tree gets rebuilt
+        if (node == threading.constEnd() || !node->ptr)
+            continue;
+        const uint uid = static_cast<TreeItemMessage*>(node->ptr)->uid();
+        if (uid)
+            rootsByUid[uid] = id;
+    }
 
     emit layoutAboutToBeChanged();
     updatePersistentIndexesPhase1();
-    QSet<uint> newlyUnreachable(threading[0].children.toSet());
-    threading[0].children.clear();
+    QList<uint> previousRoots;
+    previousRoots.swap(threading[0].children);
 #if QT_VERSION >= 0x040700
     threading[0].children.reserve(m_currentSortResult.size());
 #endif
 
-    QSet<uint> allRootIds(threadedRootIds.toSet());
-
     for (int i = 0; i < m_currentSortResult.size(); ++i) {
         int offset = m_sortReverse ? m_currentSortResult.size() - 1 - i : i;
-        QList<TreeItemMessage *> messages = const_cast<Model*>(realModel)
-                ->findMessagesByUids(mailbox, Imap::Uids() << m_currentSortResult[offset]);
-        if (messages.isEmpty()) {
-            // wrong UID, weird
-            continue;
-        }
-        Q_ASSERT(messages.size() == 1);
-        QHash<void *,uint>::const_iterator it = ptrToInternal.constFind(messages.front());
-        Q_ASSERT(it != ptrToInternal.constEnd());
-        if (!allRootIds.contains(*it)) {
-            // not a thread root, so don't show it
+        QHash<uint, uint>::const_iterator it = rootsByUid.constFind(m_currentSortResult[offset]);
+        if (it == rootsByUid.constEnd()) {
+            // either a wrong UID, or not a thread root, so don't show it
             continue;
         }
         threading[*it].offset = threading[0].children.size();
         threading[0].children.append(*it);
     }
-
-    // Now remove everything which is no longer reachable from the root of the thread mapping
-    // Start working on the top-level orphans
-    Q_FOREACH(const uint uid, threading[0].children) {
-        newlyUnreachable.remove(uid);
+    const QList<uint> &currentRoots = threading[0].children;
+
+    // Now remove everything which is no longer reachable from the root of the thread mapping.
+    // The offsets of the nodes which are still there have just been updated, so the stale ones do not point back to themselves.
+    std::vector<uint> queue;
+    Q_FOREACH(const uint id, previousRoots) {
+        const int position = threading[id].offset;
+        if (position < 0 || position >= currentRoots.size() || currentRoots[position] != id)
+            queue.push_back(id);
     }
-    std::vector<uint> queue(newlyUnreachable.constBegin(), newlyUnreachable.constEnd());
     for (std::vector<uint>::size_type i = 0; i < queue.size(); ++i) {
-        QHash<uint,ThreadNodeInfo>::iterator threadingIt = threading.find(queue[i]);
+        ThreadNodeStorage::iterator threadingIt = threading.find(queue[i]);
         Q_ASSERT(threadingIt != threading.end());
         queue.insert(queue.end(), threadingIt->children.constBegin(), threadingIt->children.constEnd());
+        m_threadAggregates.remove(queue[i]);
         threading.erase(threadingIt);
     }
 
+    // The proxies re-check their filters upon the layoutChanged(), so they have to see the new value already
+    m_appliedSearchConditions = m_currentSortResultFiltered && m_searchValidity == RESULT_FRESH ?
+                m_currentSearchConditions : QStringList();
+
     updatePersistentIndexesPhase2();
     emit layoutChanged();
 }
 
+bool ThreadingMsgListModel::searchLocally(const Model *realModel, const QModelIndex &mailbox, const QStringList &searchConditions,
+                                          Imap::Uids &result)
+{
+    QString text;
+    AbstractCache::TextFields fields;
+    if (!localSearchApplicable(realModel, searchConditions, &text, &fields))
+        return false;
+    return realModel->cache()->searchText(mailbox.data(RoleMailboxName).toString(), text, fields, result);
+}
+
+QByteArray ThreadingMsgListModel::searchResultKey(const QStringList &searchConditions, const QStringList &sortOptions)
+{
+    QByteArray buf;
+    QDataStream stream(&buf, QIODevice::WriteOnly);
+    stream << sortOptions << searchConditions;
+    return buf;
+}
+
+QByteArray ThreadingMsgListModel::searchResultMailboxState(const QModelIndex &mailbox)
+{
+    TreeItemMailbox *item = dynamic_cast<TreeItemMailbox *>(static_cast<TreeItem *>(mailbox.internalPointer()));
+    if (!item || !item->syncState.highestModSeq() || !item->syncState.uidValidity())
+        return QByteArray();
+
+    // The HIGHESTMODSEQ alone is not enough, it need not change when messages get expunged or before the new arrivals are
+    // FETCHed for the first time
+    QByteArray buf;
+    QDataStream stream(&buf, QIODevice::WriteOnly);
+    stream << item->syncState.uidValidity() << item->syncState.highestModSeq() << item->syncState.uidNext()
+           << item->syncState.exists();
+    return buf;
+}
+
+bool ThreadingMsgListModel::cachedSearchResult(const Model *realModel, const QModelIndex &mailbox, const QStringList &searchConditions,
+                                               const QStringList &sortOptions, Imap::Uids &result)
+{
+    const QByteArray state = searchResultMailboxState(mailbox);
+    if (state.isNull())
+        return false;
+    return realModel->cache()->searchResult(mailbox.data(RoleMailboxName).toString(), state,
+                                            searchResultKey(searchConditions, sortOptions), result);
+}
+
+bool ThreadingMsgListModel::serverSendsSortUpdates(const Model *realModel, const QStringList &sortOptions)
+{
+    // This has to match what the SortTask asks for
+    if (sortOptions.isEmpty())
+        return realModel->capabilities().contains(QLatin1String("ESEARCH")) &&
+                realModel->capabilities().contains(QLatin1String("CONTEXT=SEARCH"));
+    return realModel->capabilities().contains(QLatin1String("ESORT")) &&
+            realModel->capabilities().contains(QLatin1String("CONTEXT=SORT"));
+}
+
+void ThreadingMsgListModel::startSortTask(const Model *realModel, const QModelIndex &mailbox, const QStringList &searchConditions,
+                                          const QStringList &sortOptions)
+{
+    rememberPendingSearch(mailbox, searchConditions, sortOptions);
+    m_sortTask = realModel->m_taskFactory->createSortTask(const_cast<Model *>(realModel), mailbox, searchConditions, sortOptions);
+    connect(m_sortTask, SIGNAL(sortingAvailable(Imap::Uids)), this, SLOT(slotSortingAvailable(Imap::Uids)));
+    connect(m_sortTask, SIGNAL(sortingFailed()), this, SLOT(slotSortingFailed()));
+    connect(m_sortTask, SIGNAL(incrementalSortUpdate(Imap::Responses::ESearch::IncrementalContextData_t)),
+            this, SLOT(slotSortingIncrementalUpdate(Imap::Responses::ESearch::IncrementalContextData_t)));
+}
+
+void ThreadingMsgListModel::rememberPendingSearch(const QModelIndex &mailbox, const QStringList &searchConditions,
+                                                  const QStringList &sortOptions)
+{
+    m_pendingSearchState = searchResultMailboxState(mailbox);
+    if (m_pendingSearchState.isNull())
+        m_pendingSearchKey.clear();
+    else
+        m_pendingSearchKey = searchResultKey(searchConditions, sortOptions);
+}
+
+/** @short Text of the first address in the list according to RFC 5957's DISPLAYFROM and DISPLAYTO */
+static QString displayAddressSortKey(const QList<Imap::Message::MailAddress> &addresses)
+{
+    if (addresses.isEmpty())
+        return QString();
+    const Imap::Message::MailAddress &address = addresses.front();
+    if (!address.name.isEmpty())
+        return address.name.toCaseFolded();
+    return (address.mailbox + QLatin1Char('@') + address.host).toCaseFolded();
+}
+
+LocalSortKey ThreadingMsgListModel::localSortKey(const Model *realModel, const QString &mailbox, TreeItemMessage *message)
+{
+    Imap::Message::Envelope envelope;
+    QDateTime internalDate;
+    uint size = 0;
+    if (message->fetched()) {
+        envelope = message->m_data->m_envelope;
+        internalDate = message->m_data->m_internalDate;
+        size = message->m_data->m_size;
+        m_cachedMetadata.remove(message->uid());
+    } else if (const AbstractCache::MessageDataBundle *cached = cachedMetadata(realModel, mailbox, message->uid())) {
+        envelope = cached->envelope;
+        internalDate = cached->internalDate;
+        size = cached->size;
+    } else {
+        // Messages without metadata are sorted as if all of their fields were empty
+        m_localSortMissingMetadata.insert(message->uid());
+    }
+
+    LocalSortKey key;
+    key.uid = message->uid();
+    switch (m_currentSortingCriteria) {
+    case SORT_NONE:
+        break;
+    case SORT_ARRIVAL:
+        key.number = internalDate.isValid() ? internalDate.toMSecsSinceEpoch() : 0;
+        break;
+    case SORT_CC:
+        key.text = displayAddressSortKey(envelope.cc);
+        break;
+    case SORT_DATE:
+        // RFC 5256 says to use the INTERNALDATE when there's no usable Date header
+        if (envelope.date.isValid())
+            key.number = envelope.date.toMSecsSinceEpoch();
+        else if (internalDate.isValid())
+            key.number = internalDate.toMSecsSinceEpoch();
+        break;
+    case SORT_FROM:
+        key.text = displayAddressSortKey(envelope.from);
+        break;
+    case SORT_SIZE:
+        key.number = size;
+        break;
+    case SORT_SUBJECT:
+        key.text = threadingBaseSubject(envelope.subject).toCaseFolded();
+        break;
+    case SORT_TO:
+        key.text = displayAddressSortKey(envelope.to);
+        break;
+    }
+    return key;
+}
+
+void ThreadingMsgListModel::sortLocally(const Imap::Uids *searchResult)
+{
+    const Imap::Mailbox::Model *realModel;
+    QModelIndex someMessage = sourceModel()->index(0,0);
+    QModelIndex realIndex;
+    Model::realTreeItem(someMessage, &realModel, &realIndex);
+    const QString mailbox = realIndex.parent().parent().data(RoleMailboxName).toString();
+    TreeItemMsgList *list = dynamic_cast<TreeItemMsgList*>(static_cast<TreeItem*>(realIndex.parent().internalPointer()));
+    Q_ASSERT(list);
+
+    // The keys are built once in the main thread; the worker thread only compares them
+    QVector<LocalSortKey> keys;
+    keys.reserve(list->m_children.size());
+    m_localSortMissingMetadata.clear();
+    m_localSortPendingUids.clear();
+    m_localSortHighestUid = 0;
+    QSet<uint> matching;
+    if (searchResult)
+        matching = searchResult->toList().toSet();
+    for (auto it = list->m_children.constBegin(); it != list->m_children.constEnd(); ++it) {
+        TreeItemMessage *message = static_cast<TreeItemMessage*>(*it);
+        if (!message->uid())
+            continue;
+        m_localSortHighestUid = qMax(m_localSortHighestUid, message->uid());
+        if (searchResult && !matching.contains(message->uid()))
+            continue;
+        keys << localSortKey(realModel, mailbox, message);
+    }
+
+    m_searchValidity = RESULT_ASKED;
+    LocalSortingJob *job = new LocalSortingJob(++m_localSortGeneration, keys);
+    connect(job, SIGNAL(finished()), this, SLOT(slotLocalSortingFinished()));
+    QThreadPool::globalInstance()->start(job);
+}
+
+void ThreadingMsgListModel::slotLocalSortingFinished()
+{
+    LocalSortingJob *job = qobject_cast<LocalSortingJob*>(sender());
+    Q_ASSERT(job);
+    if (!m_sortLocally || job->generation() != m_localSortGeneration) {
+        // There was another request in the meanwhile
+        return;
+    }
+
+    m_localSortKeys = job->result();
+    m_currentSortResult = uidsFromSortKeys(m_localSortKeys);
+    m_currentSortResultFiltered = true;
+    m_searchValidity = RESULT_FRESH;
+    wantThreading();
+}
+
+void ThreadingMsgListModel::updateLocalSortKey(TreeItemMessage *message)
+{
+    const uint uid = message->uid();
+    if (uid > m_localSortHighestUid) {
+        m_localSortHighestUid = uid;
+        if (!m_currentSearchConditions.isEmpty()) {
+            // Whether the new arrival matches the search is for the server to say
+            return;
+        }
+    } else if (!message->fetched() || !m_localSortMissingMetadata.remove(uid)) {
+        return;
+    }
+
+    // The metadata typically arrive for many messages at once, so their keys get merged into the sorted list in one go
+    m_localSortPendingUids.insert(uid);
+    m_delayedLocalSort->start();
+}
+
+void ThreadingMsgListModel::mergePendingLocalSortKeys()
+{
+    if (m_localSortPendingUids.isEmpty())
+        return;
+    QSet<uint> pending;
+    pending.swap(m_localSortPendingUids);
+
+    const Imap::Mailbox::Model *realModel;
+    QModelIndex realIndex;
+    Model::realTreeItem(sourceModel()->index(0,0), &realModel, &realIndex);
+    const QString mailbox = realIndex.parent().parent().data(RoleMailboxName).toString();
+    TreeItemMsgList *list = dynamic_cast<TreeItemMsgList*>(static_cast<TreeItem*>(realIndex.parent().internalPointer()));
+    Q_ASSERT(list);
+
+    QVector<LocalSortKey> updated;
+    updated.reserve(pending.size());
+    for (auto it = list->m_children.constBegin(); it != list->m_children.constEnd(); ++it) {
+        TreeItemMessage *message = static_cast<TreeItemMessage*>(*it);
+        if (message->uid() && pending.contains(message->uid()))
+            updated << localSortKey(realModel, mailbox, message);
+    }
+    std::sort(updated.begin(), updated.end());
+
+    // Drop the outdated keys and merge the new ones in a single pass over the sorted list
+    QVector<LocalSortKey> merged;
+    merged.reserve(m_localSortKeys.size() + updated.size());
+    QVector<LocalSortKey>::const_iterator next = updated.constBegin();
+    for (auto it = m_localSortKeys.constBegin(); it != m_localSortKeys.constEnd(); ++it) {
+        if (pending.contains(it->uid))
+            continue;
+        while (next != updated.constEnd() && *next < *it)
+            merged << *next++;
+        merged << *it;
+    }
+    while (next != updated.constEnd())
+        merged << *next++;
+    m_localSortKeys = merged;
+    m_currentSortResult = uidsFromSortKeys(m_localSortKeys);
+}
+
+void ThreadingMsgListModel::delayedLocalSort()
+{
+    if (m_sortLocally && m_searchValidity == RESULT_FRESH)
+        applySort();
+}
+
 QStringList ThreadingMsgListModel::currentSearchCondition() const
 {
     return m_currentSearchConditions;
 }
 
+QStringList ThreadingMsgListModel::appliedSearchCondition() const
+{
+    return m_appliedSearchConditions;
+}
+
 ThreadingMsgListModel::SortCriterium ThreadingMsgListModel::currentSortCriterium() const
 {
     return m_currentSortingCriteria;
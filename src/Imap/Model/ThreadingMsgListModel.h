@@ -24,8 +24,13 @@
 #define IMAP_THREADINGMSGLISTMODEL_H
 
 #include <QAbstractProxyModel>
+#include <QDateTime>
 #include <QPointer>
 #include <QSet>
+#include <vector>
+#include "Imap/Model/Cache.h"
+#include "Imap/Model/LocalSorting.h"
+#include "Imap/Model/LocalThreading.h"
 #include "Imap/Parser/Response.h"
 
 class QTimer;
@@ -41,6 +46,8 @@ namespace Mailbox
 
 class SortTask;
 class TreeItem;
+class TreeItemMailbox;
+class TreeItemMessage;
 class TreeItemMsgList;
 
 /** @short A node in tree structure used for threading representation */
@@ -62,6 +69,94 @@ struct ThreadNodeInfo {
 
 QDebug operator<<(QDebug debug, const ThreadNodeInfo &node);
 
+/** @short Aggregated state of all messages in a subtree of the threading */
+struct ThreadAggregate {
+    /** @short Number of messages which actually exist in the mailbox */
+    uint messageCount;
+    /** @short How many of them are not marked as read */
+    uint unreadCount;
+    /** @short How many of them are marked as flagged */
+    uint flaggedCount;
+    /** @short The newest INTERNALDATE among the messages whose metadata are already available */
+    QDateTime newestDate;
+    ThreadAggregate(): messageCount(0), unreadCount(0), flaggedCount(0) {}
+};
+
+class ThreadNodeStorage;
+
+/** @short Iterator over the ThreadNodeStorage
+
+It refers to the nodes through their internal IDs, so it remains valid even when the storage grows.
+*/
+template <typename Storage, typename Node>
+class ThreadNodeIterator
+{
+public:
+    ThreadNodeIterator(): m_storage(0), m_id(0) {}
+    ThreadNodeIterator(Storage *storage, const uint id): m_storage(storage), m_id(id) {}
+    template <typename OtherStorage, typename OtherNode>
+    ThreadNodeIterator(const ThreadNodeIterator<OtherStorage, OtherNode> &other): m_storage(other.m_storage), m_id(other.m_id) {}
+
+    uint key() const { return m_id; }
+    Node &value() const { return m_storage->m_nodes[m_id]; }
+    Node &operator*() const { return value(); }
+    Node *operator->() const { return &value(); }
+    ThreadNodeIterator &operator++() { m_id = m_storage->nextPresent(m_id + 1); return *this; }
+    bool operator==(const ThreadNodeIterator &other) const { return m_id == other.m_id; }
+    bool operator!=(const ThreadNodeIterator &other) const { return m_id != other.m_id; }
+
+private:
+    Storage *m_storage;
+    uint m_id;
+
+    template <typename OtherStorage, typename OtherNode> friend class ThreadNodeIterator;
+};
+
+/** @short Nodes of the thread tree indexed by their internal ID
+
+The internal IDs are handed out sequentially and they start from one again whenever the whole tree is rebuilt, which means that
+the nodes can live in a contiguous array instead of a hash.  The lookups on each index(), parent() and data() are then just
+a matter of indexing that array.  The interface mimics the subset of QHash which is used by the ThreadingMsgListModel.
+*/
+class ThreadNodeStorage
+{
+public:
+    typedef ThreadNodeIterator<ThreadNodeStorage, ThreadNodeInfo> iterator;
+    typedef ThreadNodeIterator<const ThreadNodeStorage, const ThreadNodeInfo> const_iterator;
+
+    ThreadNodeStorage(): m_count(0) {}
+
+    bool isEmpty() const { return m_count == 0; }
+    int size() const { return m_count; }
+    void clear();
+    void reserve(const int size);
+    void swap(ThreadNodeStorage &other);
+    bool contains(const uint id) const { return id < m_present.size() && m_present[id]; }
+
+    /** @short Return the node with the given ID, creating a default-constructed one if it isn't there yet */
+    ThreadNodeInfo &operator[](const uint id);
+    ThreadNodeInfo value(const uint id) const { return contains(id) ? m_nodes[id] : ThreadNodeInfo(); }
+    QList<uint> keys() const;
+
+    iterator begin() { return iterator(this, nextPresent(0)); }
+    iterator end() { return iterator(this, static_cast<uint>(m_nodes.size())); }
+    const_iterator constBegin() const { return const_iterator(this, nextPresent(0)); }
+    const_iterator constEnd() const { return const_iterator(this, static_cast<uint>(m_nodes.size())); }
+    iterator find(const uint id) { return contains(id) ? iterator(this, id) : end(); }
+    const_iterator constFind(const uint id) const { return contains(id) ? const_iterator(this, id) : constEnd(); }
+    /** @short Remove the node and return an iterator pointing to the next one */
+    iterator erase(iterator it);
+
+private:
+    uint nextPresent(uint id) const;
+
+    std::vector<ThreadNodeInfo> m_nodes;
+    std::vector<bool> m_present;
+    int m_count;
+
+    template <typename Storage, typename Node> friend class ThreadNodeIterator;
+};
+
 /** @short A model implementing view of the whole IMAP server
 
 The problem with threading is that due to the extremely asynchronous nature of the IMAP Model, we often get informed about indexes
@@ -146,11 +241,17 @@ public:
 
     /** @short List of capabilities which could be used for threading
 
-    If any of them are present in server's capabilities, at least some level of threading will be possible.
+    If any of them are present in server's capabilities, the threading is performed by the server.  Otherwise, the messages are
+    threaded on the client side through the REFERENCES algorithm.
     */
     static QStringList supportedCapabilities();
 
     QStringList currentSearchCondition() const;
+    /** @short Search conditions which the visible messages have already been filtered by
+
+    This is empty while the model waits for the result of a new search, or when no search is in effect at all.
+    */
+    QStringList appliedSearchCondition() const;
     SortCriterium currentSortCriterium() const;
     Q_INVOKABLE Qt::SortOrder currentSortOrder() const;
 
@@ -190,6 +291,16 @@ public slots:
 
     void delayedPrune();
 
+    /** @short The client-side threading has finished */
+    void slotLocalThreadingFinished();
+    /** @short Thread the messages on the client side once the missing metadata have arrived */
+    void delayedLocalThreading();
+
+    /** @short The client-side sorting has finished */
+    void slotLocalSortingFinished();
+    /** @short Show the messages whose sort keys were updated */
+    void delayedLocalSort();
+
 signals:
     void sortingFailed();
 
@@ -203,6 +314,91 @@ private:
     */
     void askForThreading(const uint firstUnknownUid = 0);
 
+    /** @short Thread the messages on the client side in a worker thread, for servers without the THREAD extension */
+    void threadLocally();
+
+    /** @short Gather the headers used by the client-side threading; returns false if they aren't available */
+    bool localThreadingInput(const Model *realModel, const QString &mailbox, TreeItemMessage *message,
+                             LocalThreadingInput &input);
+
+    /** @short Metadata of a message which is not loaded in the tree, as remembered by the cache
+
+    Returns the null pointer when the cache does not know them either. See m_cachedMetadata for why this is not just a call
+    to AbstractCache::messageMetadata().
+    */
+    const AbstractCache::MessageDataBundle *cachedMetadata(const Model *realModel, const QString &mailbox, const uint uid);
+
+    /** @short The threading of the @arg mailbox, either the one which is kept in memory or the cached one */
+    QVector<Responses::ThreadingNode> threadingMapping(const Model *realModel, const QString &mailbox) const;
+
+    /** @short Remember a threading produced by the client-side threading
+
+    Messages whose headers are not known yet are just placeholders in there. Such a threading is only kept in memory,
+    because nothing would fix these messages if it got reused from the cache later on.
+    */
+    void storeLocalThreading(const Model *realModel, const QString &mailbox, const QVector<Responses::ThreadingNode> &mapping);
+
+    /** @short Place new arrivals and messages whose headers have just arrived into the client-side threads
+
+    Only the affected nodes are moved around.  Returns false when that is not possible and the whole mailbox has to be threaded
+    again.
+    */
+    bool attachLocally(const QList<TreeItemMessage *> &messages);
+
+    bool localThreadingGoesAfter(const Model *realModel, const QString &mailbox, TreeItemMailbox *mailboxPtr,
+                                 const LocalThreadingInput &input, const Responses::ThreadingNode &node);
+
+    /** @short Move a thread root without any children below another node, as its last child */
+    void attachNode(const uint nodeId, const uint parentId);
+
+    /** @short Sort the messages on the client side, for servers without the SORT extension
+
+    If the @arg searchResult is given, only these UIDs are sorted; otherwise the whole mailbox is.
+    */
+    void sortLocally(const Imap::Uids *searchResult = 0);
+
+    /** @short Build the sort key of a message for the current sorting criterium */
+    LocalSortKey localSortKey(const Model *realModel, const QString &mailbox, TreeItemMessage *message);
+
+    /** @short Answer the search from the cache's full-text index when offline or when configured to do so
+
+    Returns false when the search has to be performed by the server.
+    */
+    bool searchLocally(const Model *realModel, const QModelIndex &mailbox, const QStringList &searchConditions, Imap::Uids &result);
+
+    /** @short Identify the result of a SEARCH or SORT command for the cache */
+    static QByteArray searchResultKey(const QStringList &searchConditions, const QStringList &sortOptions);
+
+    /** @short Describe the state of the mailbox for the purpose of caching the search results
+
+    Returns a null QByteArray when the server does not provide the HIGHESTMODSEQ, in which case there is no reliable way of
+    telling whether anything has changed since the result was obtained.
+    */
+    static QByteArray searchResultMailboxState(const QModelIndex &mailbox);
+
+    /** @short Look for a result of the same SEARCH or SORT which the server has sent for the current state of the mailbox */
+    bool cachedSearchResult(const Model *realModel, const QModelIndex &mailbox, const QStringList &searchConditions,
+                            const QStringList &sortOptions, Imap::Uids &result);
+
+    /** @short Will the server keep the result of this SEARCH or SORT up-to-date through the CONTEXT extension? */
+    static bool serverSendsSortUpdates(const Model *realModel, const QStringList &sortOptions);
+
+    /** @short Ask the server for a SEARCH or SORT, and remember the request so that its result can be saved into the cache
+
+    A result found in the cache still does not make the server's updates arrive, so for servers with the CONTEXT extension,
+    this is needed even after a cache hit.
+    */
+    void startSortTask(const Model *realModel, const QModelIndex &mailbox, const QStringList &searchConditions,
+                       const QStringList &sortOptions);
+
+    /** @short Remember which SEARCH or SORT is being asked for, so that its result can be saved into the cache */
+    void rememberPendingSearch(const QModelIndex &mailbox, const QStringList &searchConditions, const QStringList &sortOptions);
+
+    /** @short Schedule a new message for the client-side sort order, or a message whose metadata have arrived for moving */
+    void updateLocalSortKey(TreeItemMessage *message);
+    /** @short Put the messages queued by updateLocalSortKey() into their place in the client-side sort order */
+    void mergePendingLocalSortKeys();
+
     void updatePersistentIndexesPhase1();
     void updatePersistentIndexesPhase2();
 
@@ -225,9 +421,19 @@ private:
     /** @short Remove fake messages from the threading tree */
     void pruneTree();
 
+    /** @short Log the time spent in the individual phases of a layout change */
+    void logPhaseTimes(const QString &operation, const qint64 savingTime, const qint64 buildingTime,
+                       const qint64 pruningTime, const qint64 remappingTime);
+
     /** @short Check current thread for "unread messages" */
     bool threadContainsUnreadMessages(const uint root) const;
 
+    /** @short Return the aggregated state of the subtree rooted at the node @arg id, computing it if it isn't cached yet */
+    ThreadAggregate threadAggregate(const uint id) const;
+
+    /** @short Forget the cached aggregates of the node @arg id and of all its ancestors */
+    void invalidateThreadAggregates(uint id);
+
     /** @short Is this someone else's THREAD response? */
     bool shouldIgnoreThisThreadingResponse(const QModelIndex &mailbox, const QByteArray &algorithm,
                                            const QStringList &searchCriteria, const Model **realModel=0);
@@ -252,7 +458,14 @@ private:
 
     This tree is indexed by our internal ID.
     */
-    QHash<uint,ThreadNodeInfo> threading;
+    ThreadNodeStorage threading;
+
+    /** @short Cached aggregates of the subtrees, indexed by our internal ID
+
+    Whenever a node is present here, all of its descendants are present as well. The changes of flags and metadata therefore
+    only drop the affected node and its ancestors, while any change to the shape of the tree drops everything.
+    */
+    mutable QHash<uint, ThreadAggregate> m_threadAggregates;
 
     /** @short Last assigned internal ID */
     uint threadingHelperLastId;
@@ -272,7 +485,7 @@ private:
     bool modelResetInProgress;
 
     QModelIndexList oldPersistentIndexes;
-    QList<void *> oldPtrs;
+    QVector<void *> oldPtrs;
 
     /** @short There's a pending THREAD command for which we haven't received data yet */
     bool threadingInFlight;
@@ -301,6 +514,12 @@ private:
     */
     Imap::Uids m_currentSortResult;
 
+    /** @short Does the m_currentSortResult come from a search, or is it just the list of all thread roots? */
+    bool m_currentSortResultFiltered;
+
+    /** @short Search criteria which were in effect when the sort result got applied for the last time */
+    QStringList m_appliedSearchConditions;
+
     /** @short Is the cached result of SEARCH/SORT fresh enough? */
     typedef enum {
         RESULT_ASKED, /**< We've asked for the data */
@@ -310,8 +529,65 @@ private:
 
     ResultValidity m_searchValidity;
 
+    /** @short Cache key of the SEARCH or SORT which we're waiting for, or an empty QByteArray if it shall not be cached */
+    QByteArray m_pendingSearchKey;
+
+    /** @short State of the mailbox at the time the m_pendingSearchKey was asked for */
+    QByteArray m_pendingSearchState;
+
     QTimer *m_delayedPrune;
 
+    /** @short UIDs of messages which were threaded by the client without knowing their headers */
+    QSet<uint> m_localThreadingMissingMetadata;
+
+    /** @short UIDs from the m_localThreadingMissingMetadata whose headers have arrived since */
+    QSet<uint> m_localThreadingLateMetadata;
+
+    /** @short The incomplete client-side threading of the m_localThreadingMailbox, see storeLocalThreading() */
+    QVector<Responses::ThreadingNode> m_localThreadingMapping;
+    QString m_localThreadingMailbox;
+
+    /** @short The messages have changed while the client-side threading was running */
+    bool m_localThreadingDirty;
+
+    /** @short What the client-side threading knows about the messages, including the ones attached since then */
+    LocalThreadingIndex m_localThreadingIndex;
+
+    /** @short Highest UID in the applied threading if it is the one described by the m_localThreadingIndex, zero otherwise */
+    uint m_localThreadingAppliedUpTo;
+
+    QTimer *m_delayedLocalThreading;
+
+    /** @short Is the current sort order computed on the client side? */
+    bool m_sortLocally;
+
+    /** @short Incremented with each client-side sorting request, so that the outdated results are ignored */
+    uint m_localSortGeneration;
+
+    /** @short Sort keys of the m_currentSortResult when sorting on the client side, in the same order */
+    QVector<LocalSortKey> m_localSortKeys;
+
+    /** @short Highest UID which has a sort key; anything higher is a new arrival */
+    uint m_localSortHighestUid;
+
+    /** @short UIDs of messages which were sorted by the client without knowing their metadata */
+    QSet<uint> m_localSortMissingMetadata;
+
+    /** @short UIDs of messages whose sort keys have to be computed again by mergePendingLocalSortKeys() */
+    QSet<uint> m_localSortPendingUids;
+
+    QTimer *m_delayedLocalSort;
+
+    /** @short What the cache says about those messages of the m_cachedMetadataMailbox which were not loaded in the tree
+
+    The client-side threading and sorting are repeated whenever some headers arrive. Asking the cache about each message
+    without loaded metadata all over again would block the GUI for a long time in big mailboxes, so each message is only
+    looked up once. A bundle with zero UID means that the cache does not know that message. Messages get dropped from here
+    once their data are loaded in the tree, so that they are looked up again if the tree forgets them later on.
+    */
+    QHash<uint, AbstractCache::MessageDataBundle> m_cachedMetadata;
+    QString m_cachedMetadataMailbox;
+
     friend class ::ImapModelThreadingTest; // needs access to wantThreading();
 };
 
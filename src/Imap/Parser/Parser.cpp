@@ -241,6 +241,25 @@ CommandHandle Parser::list(const QString &reference, const QString &mailbox, con
     return queueCommand(cmd);
 }
 
+CommandHandle Parser::list(const QString &reference, const QStringList &mailboxes, const QStringList &returnOptions)
+{
+    Commands::Command cmd("LIST");
+    cmd << reference.toUtf8();
+    cmd << Commands::PartOfCommand(Commands::ATOM_NO_SPACE_AROUND, " (");
+    Q_FOREACH(const QString &mailbox, mailboxes) {
+        cmd << encodeImapFolderName(mailbox);
+    }
+    cmd << Commands::PartOfCommand(Commands::ATOM_NO_SPACE_AROUND, ")");
+    if (!returnOptions.isEmpty()) {
+        cmd << Commands::PartOfCommand(Commands::ATOM_NO_SPACE_AROUND, " RETURN (");
+        Q_FOREACH(const QString &option, returnOptions) {
+            cmd << Commands::PartOfCommand(Commands::ATOM, option.toUtf8());
+        }
+        cmd << Commands::PartOfCommand(Commands::ATOM_NO_SPACE_AROUND, ")");
+    }
+    return queueCommand(cmd);
+}
+
 CommandHandle Parser::lSub(const QString &reference, const QString &mailbox)
 {
     return queueCommand(Commands::Command("LSUB") << reference.toUtf8() << encodeImapFolderName(mailbox));
@@ -293,6 +312,21 @@ CommandHandle Parser::appendCatenate(const QString &mailbox, const QList<Imap::M
     return queueCommand(command);
 }
 
+CommandHandle Parser::multiAppend(const QString &mailbox, const QList<Imap::Mailbox::AppendData> &messages)
+{
+    Commands::Command command("APPEND");
+    command << encodeImapFolderName(mailbox);
+    Q_FOREACH(const Imap::Mailbox::AppendData &message, messages) {
+        if (message.flags.count())
+            command << Commands::PartOfCommand(Commands::ATOM, "(" + message.flags.join(QLatin1String(" ")).toUtf8() + ")");
+        if (message.timestamp.isValid())
+            command << Commands::PartOfCommand(Imap::dateTimeToInternalDate(message.timestamp).toUtf8());
+        command << Commands::PartOfCommand(Commands::LITERAL, message.data);
+    }
+
+    return queueCommand(command);
+}
+
 CommandHandle Parser::check()
 {
     return queueCommand(Commands::ATOM, "CHECK");
@@ -343,6 +377,13 @@ CommandHandle Parser::uidESearchUid(const QByteArray &sequence)
     return queueCommand(command);
 }
 
+CommandHandle Parser::uidESearchUidStatistics(const QByteArray &sequence)
+{
+    Commands::Command command("UID SEARCH RETURN (MIN MAX COUNT)");
+    command << Commands::PartOfCommand(Commands::ATOM, sequence);
+    return queueCommand(command);
+}
+
 CommandHandle Parser::sortHelper(const QByteArray &command, const QStringList &sortCriteria, const QByteArray &charset, const QStringList &searchCriteria)
 {
     Q_ASSERT(! sortCriteria.isEmpty());
@@ -568,6 +609,16 @@ CommandHandle Parser::enable(const QList<QByteArray> &extensions)
     return queueCommand(cmd);
 }
 
+CommandHandle Parser::notifySet(const QList<QByteArray> &eventGroups)
+{
+    Commands::Command cmd("NOTIFY");
+    cmd << Commands::PartOfCommand(Commands::ATOM, "SET");
+    Q_FOREACH(const QByteArray &item, eventGroups) {
+        cmd << Commands::PartOfCommand(Commands::ATOM, item);
+    }
+    return queueCommand(cmd);
+}
+
 CommandHandle Parser::genUrlAuth(const QByteArray &url, const QByteArray mechanism)
 {
     Commands::Command cmd("GENURLAUTH");
@@ -612,6 +663,7 @@ CommandHandle Parser::queueCommand(Commands::Command command)
     CommandHandle tag = generateTag();
     command.addTag(tag);
     cmdQueue.append(command);
+    emit commandTagged(this, tag);
     QTimer::singleShot(0, this, SLOT(executeCommands()));
     return tag;
 }
@@ -941,7 +993,9 @@ void Parser::processLine(QByteArray line)
         throw NotAnImapServerError(std::string(), line, -1);
     } else if (line.startsWith("* ")) {
         m_expectsInitialGreeting = false;
-        queueResponse(parseUntagged(line));
+        QSharedPointer<Responses::AbstractResponse> resp = parseUntagged(line);
+        resp->rawSize = line.size();
+        queueResponse(resp);
     } else if (line.startsWith("+ ")) {
         if (waitingForContinuation) {
             waitingForContinuation = false;
@@ -954,7 +1008,9 @@ void Parser::processLine(QByteArray line)
             throw ContinuationRequest(line.constData());
         }
     } else {
-        queueResponse(parseTagged(line));
+        QSharedPointer<Responses::AbstractResponse> resp = parseTagged(line);
+        resp->rawSize = line.size();
+        queueResponse(resp);
     }
 }
 
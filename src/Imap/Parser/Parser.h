@@ -28,6 +28,7 @@
 #include "Sequence.h"
 #include "../ConnectionState.h"
 #include "../Exceptions.h"
+#include "Imap/Model/AppendData.h"
 #include "Imap/Model/CatenateData.h"
 #include "Imap/Model/UidSubmitData.h"
 
@@ -132,6 +133,8 @@ public slots:
 
     /** @short LIST, RFC3501 section 6.3.8, as extended by RFC5258 */
     CommandHandle list(const QString &reference, const QString &mailbox, const QStringList &returnOptions = QStringList());
+    /** @short LIST with multiple mailbox patterns, RFC5258 section 3 */
+    CommandHandle list(const QString &reference, const QStringList &mailboxes, const QStringList &returnOptions = QStringList());
 
     /** @short LSUB, RFC3501 section 6.3.9 */
     CommandHandle lSub(const QString &reference, const QString &mailbox);
@@ -147,6 +150,8 @@ public slots:
     CommandHandle appendCatenate(const QString &mailbox, const QList<Imap::Mailbox::CatenatePair> &data,
                                  const QStringList &flags = QStringList(), const QDateTime &timestamp = QDateTime());
 
+    /** @short APPEND of several messages at once, RFC 3502 */
+    CommandHandle multiAppend(const QString &mailbox, const QList<Imap::Mailbox::AppendData> &messages);
 
     /** @short CHECK, RFC3501 sect 6.4.1 */
     CommandHandle check();
@@ -198,6 +203,9 @@ public slots:
     /** @short Perform the UID ESEARCH command with the specified UID set */
     CommandHandle uidESearchUid(const QByteArray &sequence);
 
+    /** @short Perform the UID ESEARCH command with the specified UID set, asking just for the MIN, MAX and COUNT */
+    CommandHandle uidESearchUidStatistics(const QByteArray &sequence);
+
 
     /** @short X<atom>, RFC3501 sect 6.5.1 */
     CommandHandle xAtom(const Commands::Command &commands);
@@ -263,6 +271,12 @@ public slots:
     /** @short ENABLE command, RFC 6151 */
     CommandHandle enable(const QList<QByteArray> &extensions);
 
+    /** @short NOTIFY SET, RFC 5465
+
+    Each of the @arg eventGroups is sent verbatim, including its parentheses.
+    */
+    CommandHandle notifySet(const QList<QByteArray> &eventGroups);
+
     /** @short COMPRESS DEFLATE, RFC 4978 */
     CommandHandle compressDeflate();
 
@@ -303,6 +317,9 @@ signals:
 
     void commandQueued();
 
+    /** @short A new command has been queued for execution and got assigned the @arg tag */
+    void commandTagged(Imap::Parser *parser, const QByteArray &tag);
+
     /** @short The socket's state has changed */
     void connectionStateChanged(Imap::Parser *parser, Imap::ConnectionState);
 
@@ -209,7 +209,7 @@ enum Code {
 class AbstractResponse
 {
 public:
-    AbstractResponse() {}
+    AbstractResponse(): rawSize(0) {}
     virtual ~AbstractResponse();
     /** @short Helper for operator<<() */
     virtual QTextStream &dump(QTextStream &) const = 0;
@@ -219,6 +219,9 @@ public:
      * dynamic_cast<>s */
     virtual void plug(Imap::Parser *parser, Imap::Mailbox::Model *model) const = 0;
     virtual bool plug(Imap::Mailbox::ImapTask *task) const = 0;
+
+    /** @short Size of the raw data, including any literals, which this response was parsed from */
+    int rawSize;
 };
 
 /** @short Structure storing OK/NO/BAD/PREAUTH/BYE responses */
@@ -56,9 +56,9 @@ void AppendTask::perform()
     IMAP_TASK_CHECK_ABORT_DIE;
 
     if (data.isEmpty()) {
-        tag = parser->append(targetMailbox, rawMessageData, flags, timestamp);
+        tag = commandParser()->append(targetMailbox, rawMessageData, flags, timestamp);
     } else {
-        tag = parser->appendCatenate(targetMailbox, data, flags, timestamp);
+        tag = commandParser()->appendCatenate(targetMailbox, data, flags, timestamp);
     }
 }
 
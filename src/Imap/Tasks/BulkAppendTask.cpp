@@ -0,0 +1,200 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "BulkAppendTask.h"
+#include "Imap/Model/ImportSource.h"
+#include "Imap/Model/ItemRoles.h"
+#include "Imap/Model/Model.h"
+#include "Imap/Model/TaskPresentationModel.h"
+#include "GetAnyConnectionTask.h"
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+BulkAppendTask::BulkAppendTask(Model *model, const QString &targetMailbox, ImportSource *source):
+    ImapTask(model), targetMailbox(targetMailbox), source(source), sourceExhausted(false), useMultiAppend(false),
+    messagesInFlight(0), bytesInFlight(0), appended(0), failed(0), bytesAppended(0)
+{
+    bool ok;
+    maxMessagesPerBatch = model->property("trojita-imap-multiappend-messages-per-batch").toInt(&ok);
+    if (!ok || maxMessagesPerBatch < 1)
+        maxMessagesPerBatch = 100;
+    maxBytesPerBatch = model->property("trojita-imap-multiappend-bytes-per-batch").toLongLong(&ok);
+    if (!ok || maxBytesPerBatch < 1)
+        maxBytesPerBatch = 4 * 1024 * 1024;
+
+    conn = model->m_taskFactory->createGetAnyConnectionTask(model);
+    conn->addDependentTask(this);
+}
+
+BulkAppendTask::~BulkAppendTask()
+{
+}
+
+void BulkAppendTask::perform()
+{
+    parser = conn->parser;
+    Q_ASSERT(parser);
+    markAsActiveTask();
+
+    IMAP_TASK_CHECK_ABORT_DIE;
+
+    useMultiAppend = model->accessParser(parser).capabilities.contains(QLatin1String("MULTIAPPEND"));
+    timer.start();
+    sendMore();
+    finishIfDone();
+}
+
+/** @short Read the next batch of messages from the source
+
+At least one message is always returned unless the source has been exhausted, even if that message is bigger than the
+configured limit.
+*/
+QList<AppendData> BulkAppendTask::readBatch()
+{
+    QList<AppendData> batch;
+    qint64 bytes = 0;
+    while (!sourceExhausted && batch.size() < maxMessagesPerBatch && bytes < maxBytesPerBatch) {
+        AppendData message;
+        ImportSource::Result result = source->next(message);
+        if (result == ImportSource::RESULT_SKIPPED) {
+            ++failed;
+            lastError = source->errorString();
+            log(QLatin1String("Import source: skipped a message: ") + lastError);
+            emit appendFailed(lastError, 1);
+            continue;
+        } else if (result == ImportSource::RESULT_END) {
+            sourceExhausted = true;
+            if (!source->errorString().isEmpty()) {
+                lastError = source->errorString();
+                log(QLatin1String("Import source: ") + lastError);
+            }
+            break;
+        }
+        bytes += message.data.size();
+        batch << message;
+    }
+    return batch;
+}
+
+/** @short Keep up to two batches worth of data in flight
+
+This bounds the amount of memory which is needed for the import while still making sure that the server always has
+something to work on while we wait for the tagged responses.
+*/
+void BulkAppendTask::sendMore()
+{
+    while (!sourceExhausted && messagesInFlight < 2 * maxMessagesPerBatch && bytesInFlight < 2 * maxBytesPerBatch) {
+        QList<AppendData> batch = readBatch();
+        if (batch.isEmpty())
+            break;
+
+        if (useMultiAppend) {
+            InFlight item;
+            Q_FOREACH(const AppendData &message, batch) {
+                ++item.messages;
+                item.bytes += message.data.size();
+            }
+            inFlight[commandParser()->multiAppend(targetMailbox, batch)] = item;
+            messagesInFlight += item.messages;
+            bytesInFlight += item.bytes;
+        } else {
+            Q_FOREACH(const AppendData &message, batch) {
+                InFlight item;
+                item.messages = 1;
+                item.bytes = message.data.size();
+                inFlight[commandParser()->append(targetMailbox, message.data, message.flags, message.timestamp)] = item;
+                ++messagesInFlight;
+                bytesInFlight += item.bytes;
+            }
+        }
+    }
+}
+
+void BulkAppendTask::finishIfDone()
+{
+    if (!sourceExhausted || !inFlight.isEmpty())
+        return;
+
+    if (lastError.isEmpty()) {
+        _completed();
+    } else if (!appended) {
+        _failed(lastError);
+    } else {
+        // A partial import is still a failure, otherwise the user would never learn about the missing messages
+        _failed(tr("Imported %1 messages, %2 failed: %3").arg(
+                    QString::number(appended), QString::number(failed), lastError));
+    }
+}
+
+bool BulkAppendTask::handleStateHelper(const Imap::Responses::State *const resp)
+{
+    if (resp->tag.isEmpty())
+        return false;
+
+    auto it = inFlight.find(resp->tag);
+    if (it == inFlight.end())
+        return false;
+
+    InFlight item = *it;
+    inFlight.erase(it);
+    messagesInFlight -= item.messages;
+    bytesInFlight -= item.bytes;
+
+    if (resp->kind == Responses::OK) {
+        appended += item.messages;
+        bytesAppended += item.bytes;
+    } else {
+        failed += item.messages;
+        lastError = resp->message;
+        emit appendFailed(resp->message, item.messages);
+    }
+    emit progress(appended, failed, bytesAppended, timer.elapsed());
+    model->m_taskModel->slotTaskMighHaveChanged(this);
+
+    sendMore();
+    finishIfDone();
+    return true;
+}
+
+QVariant BulkAppendTask::taskData(const int role) const
+{
+    if (role != RoleTaskCompactName)
+        return QVariant();
+
+    const qint64 elapsed = timer.isValid() ? timer.elapsed() : 0;
+    return tr("Importing messages (%1 done, %2/s)").arg(QString::number(appended),
+                                                        QString::number(elapsed ? appended * 1000 / elapsed : 0));
+}
+
+QString BulkAppendTask::debugIdentification() const
+{
+    return QString::fromUtf8("%1: %2 appended, %3 failed, %4 in flight%5").arg(
+                targetMailbox, QString::number(appended), QString::number(failed), QString::number(messagesInFlight),
+                sourceExhausted ? QLatin1String(" [source exhausted]") : QString());
+}
+
+}
+}
@@ -0,0 +1,95 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAP_BULKAPPENDTASK_H
+#define IMAP_BULKAPPENDTASK_H
+
+#include <memory>
+#include <QElapsedTimer>
+#include "Imap/Model/AppendData.h"
+#include "ImapTask.h"
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+class ImportSource;
+
+/** @short Upload a large number of messages into a single mailbox
+
+The messages are read lazily from the ImportSource, at most a few batches at a time.  When the server supports
+MULTIAPPEND (RFC 3502), each batch is uploaded through a single APPEND command; otherwise, the individual APPEND commands
+are pipelined, which is most efficient with the LITERAL+ extension.
+*/
+class BulkAppendTask : public ImapTask
+{
+    Q_OBJECT
+public:
+    BulkAppendTask(Model *model, const QString &targetMailbox, ImportSource *source);
+    ~BulkAppendTask();
+    virtual void perform();
+
+    virtual bool handleStateHelper(const Imap::Responses::State *const resp);
+    virtual bool needsMailbox() const {return false;}
+    virtual QVariant taskData(const int role) const;
+    virtual QString debugIdentification() const;
+
+signals:
+    /** @short Some messages were uploaded, or failed to upload; the elapsed time is in milliseconds */
+    void progress(const int appended, const int failed, const qint64 bytes, const qint64 elapsedMsecs);
+    /** @short The server has refused to store @arg count messages, or they could not be read from the source */
+    void appendFailed(const QString &message, const int count);
+
+private:
+    void sendMore();
+    QList<AppendData> readBatch();
+    void finishIfDone();
+
+    /** @short Number of messages and their total size which were sent through one command */
+    struct InFlight {
+        int messages;
+        qint64 bytes;
+        InFlight(): messages(0), bytes(0) {}
+    };
+
+    ImapTask *conn;
+    QString targetMailbox;
+    std::unique_ptr<ImportSource> source;
+    bool sourceExhausted;
+    bool useMultiAppend;
+    QMap<CommandHandle, InFlight> inFlight;
+    int messagesInFlight;
+    qint64 bytesInFlight;
+    int maxMessagesPerBatch;
+    qint64 maxBytesPerBatch;
+    int appended;
+    int failed;
+    qint64 bytesAppended;
+    QString lastError;
+    QElapsedTimer timer;
+};
+
+}
+}
+
+#endif // IMAP_BULKAPPENDTASK_H
@@ -85,9 +85,9 @@ void CopyMoveMessagesTask::perform()
     }
 
     if (shouldDelete && model->accessParser(parser).capabilities.contains(QLatin1String("MOVE"))) {
-        moveTag = parser->uidMove(seq, targetMailbox);
+        moveTag = commandParser()->uidMove(seq, targetMailbox);
     } else {
-        copyTag = parser->uidCopy(seq, targetMailbox);
+        copyTag = commandParser()->uidCopy(seq, targetMailbox);
     }
 }
 
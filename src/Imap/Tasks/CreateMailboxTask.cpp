@@ -48,7 +48,7 @@ void CreateMailboxTask::perform()
 
     IMAP_TASK_CHECK_ABORT_DIE;
 
-    tagCreate = parser->create(mailbox);
+    tagCreate = commandParser()->create(mailbox);
 }
 
 bool CreateMailboxTask::handleStateHelper(const Imap::Responses::State *const resp)
@@ -64,7 +64,7 @@ bool CreateMailboxTask::handleStateHelper(const Imap::Responses::State *const re
                 _failed(tr("Asked to die"));
                 return true;
             }
-            tagList = parser->list(QLatin1String(""), mailbox);
+            tagList = commandParser()->list(QLatin1String(""), mailbox);
             // Don't call _completed() yet, we're going to update mbox list before that
         } else {
             EMIT_LATER(model, mailboxCreationFailed, Q_ARG(QString, mailbox), Q_ARG(QString, resp->message));
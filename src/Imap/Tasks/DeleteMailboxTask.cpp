@@ -65,7 +65,7 @@ void DeleteMailboxTask::perform()
 
     IMAP_TASK_CHECK_ABORT_DIE;
 
-    tag = parser->deleteMailbox(mailbox);
+    tag = commandParser()->deleteMailbox(mailbox);
 }
 
 bool DeleteMailboxTask::handleStateHelper(const Imap::Responses::State *const resp)
@@ -83,6 +83,7 @@ bool DeleteMailboxTask::handleStateHelper(const Imap::Responses::State *const re
                 model->beginRemoveRows(parentIndex, mailboxPtr->row(), mailboxPtr->row());
                 mailboxPtr->parent()->m_children.erase(mailboxPtr->parent()->m_children.begin() + mailboxPtr->row());
                 model->endRemoveRows();
+                model->unindexMailboxes(TreeItemChildrenList() << mailboxPtr);
                 delete mailboxPtr;
             } else {
                 QString buf;
@@ -48,7 +48,7 @@ void EnableTask::perform()
 
     IMAP_TASK_CHECK_ABORT_DIE;
 
-    tag = parser->enable(extensions);
+    tag = commandParser()->enable(extensions);
 }
 
 bool EnableTask::handleEnabled(const Responses::Enabled *const resp)
@@ -53,7 +53,7 @@ void ExpungeMailboxTask::perform()
 
     IMAP_TASK_CHECK_ABORT_DIE;
 
-    tag = parser->expunge();
+    tag = commandParser()->expunge();
 }
 
 bool ExpungeMailboxTask::handleStateHelper(const Imap::Responses::State *const resp)
@@ -80,7 +80,7 @@ void ExpungeMessagesTask::perform()
         _failed(tr("The IMAP server doesn't support the UIDPLUS extension"));
     }
 
-    tag = parser->uidExpunge(seq);
+    tag = commandParser()->uidExpunge(seq);
 }
 
 bool ExpungeMessagesTask::handleStateHelper(const Imap::Responses::State *const resp)
@@ -50,8 +50,8 @@ void FetchMsgMetadataTask::perform()
     Sequence seq = Sequence::fromVector(uids);
 
     // we do not want to use _onlineMessageFetch because it contains UID and FLAGS
-    tag = parser->uidFetch(seq, QList<QByteArray>() << "ENVELOPE" << "INTERNALDATE" <<
-                           "BODYSTRUCTURE" << "RFC822.SIZE" << "BODY.PEEK[HEADER.FIELDS (References List-Post)]");
+    tag = commandParser()->uidFetch(seq, QList<QByteArray>() << "ENVELOPE" << "INTERNALDATE" <<
+                                    "BODYSTRUCTURE" << "RFC822.SIZE" << "BODY.PEEK[HEADER.FIELDS (References List-Post)]");
 }
 
 bool FetchMsgMetadataTask::handleFetch(const Imap::Responses::Fetch *const resp)
@@ -49,7 +49,7 @@ void FetchMsgPartTask::perform()
     IMAP_TASK_CHECK_ABORT_DIE;
 
     Sequence seq = Sequence::fromVector(uids);
-    tag = parser->uidFetch(seq, parts);
+    tag = commandParser()->uidFetch(seq, parts);
 }
 
 bool FetchMsgPartTask::handleFetch(const Imap::Responses::Fetch *const resp)
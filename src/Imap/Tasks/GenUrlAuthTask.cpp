@@ -53,7 +53,7 @@ void GenUrlAuthTask::perform()
 
     IMAP_TASK_CHECK_ABORT_DIE;
 
-    tag = parser->genUrlAuth(req, "INTERNAL");
+    tag = commandParser()->genUrlAuth(req, "INTERNAL");
 }
 
 bool GenUrlAuthTask::handleStateHelper(const Imap::Responses::State *const resp)
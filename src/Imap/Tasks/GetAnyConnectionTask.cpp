@@ -35,16 +35,9 @@ namespace Mailbox
 GetAnyConnectionTask::GetAnyConnectionTask(Model *model) :
     ImapTask(model), newConn(0)
 {
-    QMap<Parser *,ParserState>::iterator it = model->m_parsers.begin();
-    while (it != model->m_parsers.end()) {
-        if (it->connState == CONN_STATE_LOGOUT) {
-            // We cannot possibly use this connection
-            ++it;
-        } else {
-            // we've found it
-            break;
-        }
-    }
+    // The pool prefers an idle connection which is not used by the mailbox the user is looking at
+    Parser *pooledParser = model->m_connectionPool.parserForBackgroundWork();
+    QMap<Parser *,ParserState>::iterator it = pooledParser ? model->m_parsers.find(pooledParser) : model->m_parsers.end();
 
     if (it == model->m_parsers.end()) {
         // We're creating a completely new connection
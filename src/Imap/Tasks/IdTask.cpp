@@ -51,7 +51,7 @@ void IdTask::perform()
         identification["version"] = Common::Application::version.toUtf8();
         identification["os"] = systemPlatformVersion().toUtf8();
     }
-    tag = parser->idCommand(identification);
+    tag = commandParser()->idCommand(identification);
 }
 
 bool IdTask::handleStateHelper(const Imap::Responses::State *const resp)
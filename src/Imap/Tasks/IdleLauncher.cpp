@@ -70,7 +70,7 @@ void IdleLauncher::slotEnterIdleNow()
     Q_ASSERT(! m_idling);
     Q_ASSERT(! m_idleCommandRunning);
     Q_ASSERT(task->tagIdle.isEmpty());
-    task->tagIdle = task->parser->idle();
+    task->tagIdle = task->commandParser()->idle();
     renewal->start();
     m_idling = true;
     m_idleCommandRunning = true;
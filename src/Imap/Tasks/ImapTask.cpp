@@ -35,6 +35,9 @@ ImapTask::ImapTask(Model *model) :
     QObject(model), parser(0), parentTask(0), model(model), _finished(false), _dead(false), _aborted(false)
 {
     connect(this, SIGNAL(destroyed(QObject *)), model, SLOT(slotTaskDying(QObject *)));
+    static quint64 lastTraceId = 0;
+    trace.id = ++lastTraceId;
+    trace.created = TaskTrace::now();
     CHECK_TASK_TREE;
 }
 
@@ -91,6 +94,9 @@ void ImapTask::markAsActiveTask(const TaskActivatingPosition place)
     // As we're an active task, we no longer have a parent task
     parentTask = 0;
     model->m_taskModel->slotTaskGotReparented(this);
+    trace.parserId = parser->parserId();
+    if (trace.activated < 0)
+        trace.activated = TaskTrace::now();
 
     if (model->accessParser(parser).maintainingTask && model->accessParser(parser).maintainingTask != this) {
         // Got to inform the currently responsible maintaining task about our demise
@@ -224,6 +230,7 @@ bool ImapTask::handleParseErrorResponse(const Imap::Responses::ParseErrorRespons
 void ImapTask::_completed()
 {
     _finished = true;
+    finishTrace(false);
     log(QLatin1String("Completed"));
     Q_FOREACH(ImapTask* task, dependentTasks) {
         if (!task->isFinished())
@@ -235,6 +242,7 @@ void ImapTask::_completed()
 void ImapTask::_failed(const QString &errorMessage)
 {
     _finished = true;
+    finishTrace(true);
     killAllPendingTasks(errorMessage);
     log(QString::fromUtf8("Failed: %1").arg(errorMessage));
     emit failed(errorMessage);
@@ -293,11 +301,31 @@ void ImapTask::abort()
     }
 }
 
+/** @short Record the end of the task's life and hand over its trace to the Model */
+void ImapTask::finishTrace(const bool failed)
+{
+    if (trace.finished >= 0)
+        return;
+    trace.finished = TaskTrace::now();
+    trace.failed = failed;
+    trace.name = QString::fromUtf8(metaObject()->className());
+    trace.identification = debugIdentification();
+    if (model)
+        model->recordTaskTrace(trace);
+}
+
 QString ImapTask::debugIdentification() const
 {
     return QString();
 }
 
+Parser *ImapTask::commandParser()
+{
+    Q_ASSERT(parser);
+    model->accessParser(parser).commandIssuer = this;
+    return parser;
+}
+
 void ImapTask::log(const QString &message, const Common::LogKind kind)
 {
     Q_ASSERT(model);
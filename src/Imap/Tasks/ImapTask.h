@@ -30,6 +30,7 @@
 #include "Common/Logging.h"
 #include "../Parser/Parser.h"
 #include "../Model/FlagsOperation.h"
+#include "TaskTrace.h"
 
 namespace Imap
 {
@@ -136,6 +137,13 @@ public:
     /** @short Implemente fetching of data for TaskPresentationModel */
     virtual QVariant taskData(const int role) const = 0;
 
+    /** @short Access the parser for sending a command on behalf of this task
+
+    The Model routes the tagged response of the command which gets queued through the returned parser straight back to this task
+    and accounts its traffic to it, no matter whether the command is sent from perform(), from a response handler or from a timer.
+    */
+    Imap::Parser *commandParser();
+
 protected:
     void _completed();
 
@@ -161,6 +169,7 @@ protected:
 
 private:
     void handleResponseCode(const Imap::Responses::State *const resp);
+    void finishTrace(const bool failed);
 
 signals:
     /** @short This signal is emitted if the job failed in some way */
@@ -171,6 +180,8 @@ signals:
 public:
     Imap::Parser *parser;
     QPointer<ImapTask> parentTask;
+    /** @short Timing of the task's lifetime for latency analysis */
+    TaskTrace trace;
 
 protected:
     QPointer<Model> model;
@@ -46,7 +46,7 @@ namespace Mailbox
 
 KeepMailboxOpenTask::KeepMailboxOpenTask(Model *model, const QModelIndex &mailboxIndex, Parser *oldParser) :
     ImapTask(model), mailboxIndex(mailboxIndex), synchronizeConn(0), shouldExit(false), isRunning(Running::NOT_YET),
-    shouldRunNoop(false), shouldRunIdle(false), idleLauncher(0), unSelectTask(0),
+    shouldRunNoop(false), shouldRunIdle(false), idleLauncher(0), flagsWindowsTotal(0), unSelectTask(0),
     m_skippedStateSynces(0), m_performedStateSynces(0), m_syncingTimer(nullptr)
 {
     Q_ASSERT(mailboxIndex.isValid());
@@ -151,6 +151,13 @@ KeepMailboxOpenTask::KeepMailboxOpenTask(Model *model, const QModelIndex &mailbo
     if (! ok)
         limitActiveTasks = 100;
 
+    QVariant adaptive = model->property("trojita-imap-adaptive-fetch-batching");
+    adaptiveFetchBatching = adaptive.isValid() ? adaptive.toBool() : true;
+
+    fetchBatchTargetDuration = model->property("trojita-imap-fetch-batch-target-duration").toInt(&ok) * Q_INT64_C(1000);
+    if (! ok || fetchBatchTargetDuration <= 0)
+        fetchBatchTargetDuration = 1000 * 1000;
+
     CHECK_TASK_TREE
     emit model->mailboxSyncingProgress(mailboxIndex, STATE_WAIT_FOR_CONN);
 
@@ -377,6 +384,7 @@ void KeepMailboxOpenTask::perform()
     }
 
     activateTasks();
+    fetchNextFlagsWindow();
 
     if (model->accessParser(parser).capabilitiesFresh && model->accessParser(parser).capabilities.contains(QLatin1String("IDLE"))) {
         shouldRunIdle = true;
@@ -463,17 +471,17 @@ bool KeepMailboxOpenTask::handleNumberResponse(const Imap::Responses::NumberResp
             //qDebug() << "UID disco: trying seq" << i << highestKnownUid;
         }
         breakOrCancelPossibleIdle();
-        newArrivalsFetch.append(parser->uidFetch(Sequence::startingAt(
-                                                // Did the UID walk return a usable number?
-                                                highestKnownUid ?
-                                                // Yes, we've got at least one message with a UID known -> ask for higher
-                                                // but don't forget to compensate for an pre-existing UIDNEXT value
-                                                qMax(mailbox->syncState.uidNext(), highestKnownUid + 1)
-                                                :
-                                                // No messages, or no messages with valid UID -> use the UIDNEXT from the syncing state
-                                                // but prevent a possible invalid 0:*
-                                                qMax(mailbox->syncState.uidNext(), 1u)
-                                            ), QList<QByteArray>() << "FLAGS"));
+        newArrivalsFetch.append(commandParser()->uidFetch(Sequence::startingAt(
+                                                         // Did the UID walk return a usable number?
+                                                         highestKnownUid ?
+                                                         // Yes, we've got at least one message with a UID known -> ask for higher
+                                                         // but don't forget to compensate for an pre-existing UIDNEXT value
+                                                         qMax(mailbox->syncState.uidNext(), highestKnownUid + 1)
+                                                         :
+                                                         // No messages, or no messages with valid UID -> use the UIDNEXT from the syncing state
+                                                         // but prevent a possible invalid 0:*
+                                                         qMax(mailbox->syncState.uidNext(), 1u)
+                                                     ), QList<QByteArray>() << "FLAGS"));
         model->m_taskModel->slotTaskMighHaveChanged(this);
         return true;
     } else if (resp->kind == Imap::Responses::RECENT) {
@@ -601,6 +609,31 @@ bool KeepMailboxOpenTask::handleStateHelper(const Imap::Responses::State *const
         slotTaskDeleted(0);
         model->m_taskModel->slotTaskMighHaveChanged(this);
         return true;
+    } else if (resp->tag == tagFlagsWindow) {
+        tagFlagsWindow.clear();
+
+        if (resp->kind != Responses::OK) {
+            // The mailbox is still usable, so there's no reason to kill the whole task. The flags of this window just stay
+            // as they were in the cache and get refreshed by the next resync.
+            log(QString::fromUtf8("FETCH of FLAGS for UIDs %1 failed, skipping them: %2")
+                .arg(QString::fromUtf8(flagsWindowInFlight.toByteArray()), resp->message), Common::LOG_MAILBOX_SYNC);
+        }
+        flagsWindowInFlight = Sequence();
+        if (mailboxIndex.isValid()) {
+            emit model->mailboxFlagsSyncingProgress(mailboxIndex, flagsWindowsTotal - pendingFlagsWindows.size(), flagsWindowsTotal);
+            if (pendingFlagsWindows.isEmpty()) {
+                flagsWindowsTotal = 0;
+                log(QLatin1String("Flags synchronized"), Common::LOG_MAILBOX_SYNC);
+                emit model->mailboxSyncingProgress(mailboxIndex, STATE_DONE);
+            } else {
+                emit model->mailboxSyncingProgress(mailboxIndex, STATE_SYNCING_FLAGS);
+            }
+        }
+        fetchNextFlagsWindow();
+        // Just as with the new arrivals, this could unblock IDLE or our own termination
+        slotTaskDeleted(0);
+        model->m_taskModel->slotTaskMighHaveChanged(this);
+        return true;
     } else if (resp->tag == tagClose) {
         tagClose.clear();
         if (m_deleteCurrentMailboxTask) {
@@ -769,23 +802,85 @@ void KeepMailboxOpenTask::activateTasks()
         idleLauncher->enterIdleLater();
 }
 
-void KeepMailboxOpenTask::requestPartDownload(const uint uid, const QByteArray &partId, const uint estimatedSize)
+void KeepMailboxOpenTask::requestPartDownload(const uint uid, const QByteArray &partId, const uint estimatedSize,
+                                              const FetchPriority priority)
 {
     requestedParts[uid].insert(partId);
     requestedPartSizes[uid] += estimatedSize;
+    auto it = requestedPartPriorities.find(uid);
+    if (it == requestedPartPriorities.end())
+        requestedPartPriorities.insert(uid, priority);
+    else if (priority < *it)
+        *it = priority;
     if (!fetchPartTimer->isActive()) {
         fetchPartTimer->start();
     }
 }
 
-void KeepMailboxOpenTask::requestEnvelopeDownload(const uint uid)
+void KeepMailboxOpenTask::requestEnvelopeDownload(const uint uid, const FetchPriority priority)
 {
-    requestedEnvelopes.append(uid);
+    auto it = requestedEnvelopePriorities.find(uid);
+    if (it == requestedEnvelopePriorities.end()) {
+        requestedEnvelopes.append(uid);
+        requestedEnvelopePriorities.insert(uid, priority);
+    } else if (priority < *it) {
+        *it = priority;
+    }
     if (!fetchEnvelopeTimer->isActive()) {
         fetchEnvelopeTimer->start();
     }
 }
 
+/** @short Re-evaluate the pending requests after the user has scrolled somewhere else
+
+The envelopes of the @arg visible messages are fetched first, followed by those which are @arg nearby.  Requests for
+envelopes of messages which were requested by a view but which are far away from what the user is looking at now are
+cancelled; their UIDs are returned so that the Model can ask again when they get shown. Message parts are never
+cancelled because nobody would re-request them, they just yield to those of the visible messages.
+*/
+Imap::Uids KeepMailboxOpenTask::updateFetchPriorities(const QSet<uint> &visible, const QSet<uint> &nearby)
+{
+    Imap::Uids cancelled;
+    Imap::Uids stillRequested;
+    Q_FOREACH(const uint uid, requestedEnvelopes) {
+        FetchPriority &priority = requestedEnvelopePriorities[uid];
+        if (visible.contains(uid)) {
+            priority = FETCH_PRIORITY_VISIBLE;
+        } else if (nearby.contains(uid)) {
+            priority = FETCH_PRIORITY_PRELOAD;
+        } else if (priority != FETCH_PRIORITY_BACKGROUND) {
+            requestedEnvelopePriorities.remove(uid);
+            cancelled << uid;
+            continue;
+        }
+        stillRequested << uid;
+    }
+    requestedEnvelopes = stillRequested;
+
+    for (auto it = requestedPartPriorities.begin(); it != requestedPartPriorities.end(); ++it) {
+        if (visible.contains(it.key()))
+            *it = FETCH_PRIORITY_VISIBLE;
+        else if (*it == FETCH_PRIORITY_VISIBLE)
+            *it = FETCH_PRIORITY_BACKGROUND;
+    }
+
+    return cancelled;
+}
+
+bool KeepMailboxOpenTask::isBusy() const
+{
+    return isRunning != Running::RUNNING || !requestedEnvelopes.isEmpty() || !requestedParts.isEmpty() ||
+            !fetchMetadataTasks.isEmpty() || !fetchPartTasks.isEmpty() ||
+            !dependingTasksForThisMailbox.isEmpty() || !runningTasksForThisMailbox.isEmpty() ||
+            !dependingTasksNoMailbox.isEmpty();
+}
+
+int KeepMailboxOpenTask::fetchBatchSize()
+{
+    FetchBatchController &batching = fetchBatching();
+    return batching.messagesPerBatch() * batching.parallelBatches();
+}
+
 void KeepMailboxOpenTask::slotFetchRequestedParts()
 {
     // FIXME: abort/die
@@ -795,25 +890,44 @@ void KeepMailboxOpenTask::slotFetchRequestedParts()
 
     breakOrCancelPossibleIdle();
 
+    // Only the most urgent requests are considered; the rest will get their chance when these finish
+    FetchPriority priority = FETCH_PRIORITY_BACKGROUND;
+    Q_FOREACH(const FetchPriority requestPriority, requestedPartPriorities) {
+        priority = qMin(priority, requestPriority);
+    }
     auto it = requestedParts.begin();
+    while (requestedPartPriorities.value(it.key()) != priority)
+        ++it;
     auto parts = *it;
 
+    FetchBatchController &batching = fetchBatching();
+    const int parallelBatches = batching.parallelBatches();
+    const int messagesPerBatch = batching.messagesPerBatch();
+    const uint bytesPerBatch = batching.bytesPerBatch();
+
     // When asked to exit, do as much as possible and die
-    while (shouldExit || fetchPartTasks.size() < limitParallelFetchTasks) {
+    while (shouldExit || fetchPartTasks.size() < parallelBatches) {
         Imap::Uids uids;
         uint totalSize = 0;
-        while (uids.size() < limitMessagesAtOnce && it != requestedParts.end() && totalSize < limitBytesAtOnce) {
+        while (uids.size() < messagesPerBatch && it != requestedParts.end() && totalSize < bytesPerBatch) {
+            if (requestedPartPriorities.value(it.key()) != priority) {
+                ++it;
+                continue;
+            }
             if (parts != *it)
                 break;
             parts = *it;
             uids << it.key();
             totalSize += requestedPartSizes.take(it.key());
+            requestedPartPriorities.remove(it.key());
             it = requestedParts.erase(it);
         }
         if (uids.isEmpty())
             return;
 
-        fetchPartTasks << model->m_taskFactory->createFetchMsgPartTask(model, mailboxIndex, uids, parts.toList());
+        FetchMsgPartTask *task = model->m_taskFactory->createFetchMsgPartTask(model, mailboxIndex, uids, parts.toList());
+        watchFetchBatch(task);
+        fetchPartTasks << task;
     }
 }
 
@@ -830,12 +944,64 @@ void KeepMailboxOpenTask::slotFetchRequestedEnvelopes()
     if (shouldExit) {
         fetchNow = requestedEnvelopes;
         requestedEnvelopes.clear();
+        requestedEnvelopePriorities.clear();
     } else {
-        const int amount = qMin(requestedEnvelopes.size(), limitMessagesAtOnce); // FIXME: add an extra limit?
-        fetchNow = requestedEnvelopes.mid(0, amount);
-        requestedEnvelopes.erase(requestedEnvelopes.begin(), requestedEnvelopes.begin() + amount);
+        const int amount = qMin(requestedEnvelopes.size(), fetchBatching().messagesPerBatch()); // FIXME: add an extra limit?
+        // The most urgent requests go first, the order of the requests is preserved within each priority
+        for (int priority = FETCH_PRIORITY_VISIBLE; priority <= FETCH_PRIORITY_BACKGROUND && fetchNow.size() < amount; ++priority) {
+            Q_FOREACH(const uint uid, requestedEnvelopes) {
+                if (fetchNow.size() == amount)
+                    break;
+                if (requestedEnvelopePriorities.value(uid) == priority)
+                    fetchNow << uid;
+            }
+        }
+        Q_FOREACH(const uint uid, fetchNow) {
+            requestedEnvelopePriorities.remove(uid);
+        }
+        Imap::Uids stillRequested;
+        Q_FOREACH(const uint uid, requestedEnvelopes) {
+            if (requestedEnvelopePriorities.contains(uid))
+                stillRequested << uid;
+        }
+        requestedEnvelopes = stillRequested;
+    }
+    FetchMsgMetadataTask *task = model->m_taskFactory->createFetchMsgMetadataTask(model, mailboxIndex, fetchNow);
+    watchFetchBatch(task);
+    fetchMetadataTasks << task;
+}
+
+/** @short The adaptive sizing of the FETCH batches on our connection, using our limits as the starting point */
+FetchBatchController &KeepMailboxOpenTask::fetchBatching()
+{
+    // Before we get our connection, the limits have to come from somewhere
+    FetchBatchController &batching = (parser && model->m_parsers.contains(parser)) ?
+                model->accessParser(parser).fetchBatching : detachedFetchBatching;
+    if (!batching.isConfigured()) {
+        // Only the first task on the connection sets the starting point, the later ones must not throw away what has been
+        // learned about the connection so far
+        batching.setInitialLimits(limitMessagesAtOnce, limitBytesAtOnce, limitParallelFetchTasks);
+        batching.setAdaptive(adaptiveFetchBatching);
+        batching.setTargetBatchDuration(fetchBatchTargetDuration);
     }
-    fetchMetadataTasks << model->m_taskFactory->createFetchMsgMetadataTask(model, mailboxIndex, fetchNow);
+    return batching;
+}
+
+/** @short Let the FetchBatchController know how long did the batch take */
+void KeepMailboxOpenTask::watchFetchBatch(ImapTask *task)
+{
+    connect(task, SIGNAL(completed(Imap::Mailbox::ImapTask*)), this, SLOT(slotFetchBatchCompleted(Imap::Mailbox::ImapTask*)));
+    connect(task, SIGNAL(failed(QString)), this, SLOT(slotFetchBatchFailed()));
+}
+
+void KeepMailboxOpenTask::slotFetchBatchCompleted(ImapTask *task)
+{
+    fetchBatching().batchCompleted(task->trace.activated >= 0 ? task->trace.activated : task->trace.created, TaskTrace::now());
+}
+
+void KeepMailboxOpenTask::slotFetchBatchFailed()
+{
+    fetchBatching().batchFailed();
 }
 
 void KeepMailboxOpenTask::breakOrCancelPossibleIdle()
@@ -970,7 +1136,30 @@ bool KeepMailboxOpenTask::hasPendingInternalActions() const
 {
     bool hasToWaitForIdleTermination = idleLauncher ? idleLauncher->waitingForIdleTaggedTermination() : false;
     return !(dependingTasksForThisMailbox.isEmpty() && dependingTasksNoMailbox.isEmpty() && runningTasksForThisMailbox.isEmpty() &&
-             requestedParts.isEmpty() && requestedEnvelopes.isEmpty() && newArrivalsFetch.isEmpty()) || hasToWaitForIdleTermination;
+             requestedParts.isEmpty() && requestedEnvelopes.isEmpty() && newArrivalsFetch.isEmpty() && tagFlagsWindow.isEmpty())
+            || hasToWaitForIdleTermination;
+}
+
+void KeepMailboxOpenTask::fetchNextFlagsWindow()
+{
+    if (!tagFlagsWindow.isEmpty())
+        return;
+
+    if (shouldExit && !pendingFlagsWindows.isEmpty()) {
+        // Somebody wants this connection; there's no point in finishing the resync as the next one will have to fetch
+        // all FLAGS anyway.
+        log(QString::fromUtf8("Abandoning %1 windows of flag resync").arg(QString::number(pendingFlagsWindows.size())),
+            Common::LOG_MAILBOX_SYNC);
+        pendingFlagsWindows.clear();
+        flagsWindowsTotal = 0;
+    }
+
+    if (pendingFlagsWindows.isEmpty())
+        return;
+
+    breakOrCancelPossibleIdle();
+    flagsWindowInFlight = pendingFlagsWindows.takeFirst();
+    tagFlagsWindow = commandParser()->uidFetch(flagsWindowInFlight, QList<QByteArray>() << "FLAGS");
 }
 
 /** @short Returns true if this task can be safely terminated
@@ -986,7 +1175,7 @@ bool KeepMailboxOpenTask::isReadyToTerminate() const
 bool KeepMailboxOpenTask::canRunIdleRightNow() const
 {
     bool res = shouldRunIdle && dependingTasksForThisMailbox.isEmpty() &&
-            dependingTasksNoMailbox.isEmpty() && newArrivalsFetch.isEmpty();
+            dependingTasksNoMailbox.isEmpty() && newArrivalsFetch.isEmpty() && tagFlagsWindow.isEmpty();
 
     // If there's just one active tasks, it's the "this" one. If there are more of them, let's see if it's just one more
     // and that one more thing is a SortTask which is in the "just updating" mode.
@@ -1106,7 +1295,7 @@ void KeepMailboxOpenTask::saveSyncStateIfPossible(TreeItemMailbox *mailbox)
 
 void KeepMailboxOpenTask::closeMailboxDestructively()
 {
-    tagClose = parser->close();
+    tagClose = commandParser()->close();
 }
 
 /** @short Let the model know that a mailbox synchronization has failed */
@@ -1133,7 +1322,7 @@ Right now, only fetching of new arrivals is being done in the context of this Ke
 */
 bool KeepMailboxOpenTask::hasItsOwnActivity() const
 {
-    return !newArrivalsFetch.isEmpty();
+    return !newArrivalsFetch.isEmpty() || !tagFlagsWindow.isEmpty();
 }
 
 /** @short Signal the final termination of this task */
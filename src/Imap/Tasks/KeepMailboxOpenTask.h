@@ -23,9 +23,12 @@
 #ifndef IMAP_KEEPMAILBOXOPENTASK_H
 #define IMAP_KEEPMAILBOXOPENTASK_H
 
+#include <QHash>
 #include <QModelIndex>
 #include <QSet>
 #include "ImapTask.h"
+#include "Imap/Model/FetchBatchController.h"
+#include "Imap/Model/FetchPriority.h"
 
 class QTimer;
 class ImapModelIdleTest;
@@ -145,9 +148,15 @@ public:
 
     QString debugIdentification() const;
 
-    void requestPartDownload(const uint uid, const QByteArray &partId, const uint estimatedSize);
+    void requestPartDownload(const uint uid, const QByteArray &partId, const uint estimatedSize,
+                             const FetchPriority priority=FETCH_PRIORITY_VISIBLE);
     /** @short Request a delayed loading of a message envelope */
-    void requestEnvelopeDownload(const uint uid);
+    void requestEnvelopeDownload(const uint uid, const FetchPriority priority=FETCH_PRIORITY_VISIBLE);
+    Imap::Uids updateFetchPriorities(const QSet<uint> &visible, const QSet<uint> &nearby);
+    /** @short Is anything besides keeping the mailbox open going on, or queued for later? */
+    bool isBusy() const;
+    /** @short How many messages can be fetched in one go over our connection */
+    int fetchBatchSize();
 
     virtual QVariant taskData(const int role) const;
 
@@ -187,6 +196,8 @@ private slots:
     void slotFetchRequestedParts();
     /** @short Fetch the ENVELOPEs which were queued for later retrieval */
     void slotFetchRequestedEnvelopes();
+    void slotFetchBatchCompleted(Imap::Mailbox::ImapTask *task);
+    void slotFetchBatchFailed();
 
     /** @short Something bad has happened to the connection, and we're no longer in that mailbox */
     void slotUnselected();
@@ -225,6 +236,9 @@ private:
     */
     void closeMailboxDestructively();
 
+    /** @short Continue with the windowed FLAGS resync started by the ObtainSynchronizedMailboxTask */
+    void fetchNextFlagsWindow();
+
     /** @short Return true if this has a list of stuff to do */
     bool hasPendingInternalActions() const;
 
@@ -235,6 +249,9 @@ private:
     void saveSyncStateNowOrLater(Imap::Mailbox::TreeItemMailbox *mailbox);
     void saveSyncStateIfPossible(Imap::Mailbox::TreeItemMailbox *mailbox);
 
+    FetchBatchController &fetchBatching();
+    void watchFetchBatch(ImapTask *task);
+
 protected:
     virtual void killAllPendingTasks(const QString &message);
 
@@ -280,6 +297,14 @@ protected:
     CommandHandle tagIdle;
     QList<CommandHandle> newArrivalsFetch;
     CommandHandle tagClose;
+    /** @short The FETCH FLAGS of a window of the windowed flag resync which is currently in flight */
+    CommandHandle tagFlagsWindow;
+    /** @short UIDs covered by tagFlagsWindow */
+    Sequence flagsWindowInFlight;
+    /** @short UID ranges whose FLAGS are yet to be resynced, see ObtainSynchronizedMailboxTask::planFlagsWindows */
+    QList<Sequence> pendingFlagsWindows;
+    /** @short Total number of windows of the current flag resync, including those already fetched */
+    int flagsWindowsTotal;
     friend class IdleLauncher;
     friend class ObtainSynchronizedMailboxTask; // needs access to slotUnSelectCompleted()
     friend class SortTask; // needs access to breakOrCancelPossibleIdle()
@@ -291,17 +316,25 @@ protected:
 
     QMap<uint, QSet<QByteArray> > requestedParts;
     QMap<uint, uint> requestedPartSizes;
+    QHash<uint, FetchPriority> requestedPartPriorities;
     /** @short UIDs of messages with pending FetchMsgMetadataTask request
 
     QList is used in preference to the QSet in an attempt to maintain the order of requests. Simply ordering via UID is
     not enough because of output sorting, threads etc etc.
     */
     Imap::Uids requestedEnvelopes;
+    QHash<uint, FetchPriority> requestedEnvelopePriorities;
 
+    /** @short Initial limits of the FETCH batches, the FetchBatchController adapts them to the connection */
     uint limitBytesAtOnce;
     int limitMessagesAtOnce;
     int limitParallelFetchTasks;
     int limitActiveTasks;
+    bool adaptiveFetchBatching;
+    /** @short How long shall a single FETCH batch take, in microseconds */
+    qint64 fetchBatchTargetDuration;
+    /** @short Batch sizing used while we do not have a connection of our own yet */
+    FetchBatchController detachedFetchBatching;
 
     /** @short An UNSELECT task, if active */
     UnSelectTask *unSelectTask;
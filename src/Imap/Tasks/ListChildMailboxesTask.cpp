@@ -78,7 +78,7 @@ void ListChildMailboxesTask::perform()
         }
     }
     // empty string, not a null string
-    tag = parser->list(QLatin1String(""), mailboxName, returnOptions);
+    tag = commandParser()->list(QLatin1String(""), mailboxName, returnOptions);
 }
 
 bool ListChildMailboxesTask::handleStateHelper(const Imap::Responses::State *const resp)
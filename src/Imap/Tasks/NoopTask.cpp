@@ -46,7 +46,7 @@ void NoopTask::perform()
 
     IMAP_TASK_CHECK_ABORT_DIE;
 
-    tag = parser->noop();
+    tag = commandParser()->noop();
 }
 
 bool NoopTask::handleStateHelper(const Imap::Responses::State *const resp)
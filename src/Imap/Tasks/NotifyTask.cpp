@@ -0,0 +1,82 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "NotifyTask.h"
+#include "Imap/Model/ItemRoles.h"
+#include "Imap/Model/Model.h"
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+NotifyTask::NotifyTask(Model *model, ImapTask *parentTask) :
+    ImapTask(model)
+{
+    parentTask->addDependentTask(this);
+}
+
+void NotifyTask::perform()
+{
+    parser = parentTask->parser;
+    markAsActiveTask();
+
+    IMAP_TASK_CHECK_ABORT_DIE;
+
+    // Claim the role right now so that another connection which finishes logging in meanwhile won't do the same
+    model->accessParser(parser).notifyActive = true;
+
+    // The FlagChange is what keeps the number of unread messages up-to-date, but it's only allowed along with the other two
+    tag = commandParser()->notifySet(QList<QByteArray>()
+                                     << "(selected (MessageNew MessageExpunge FlagChange))"
+                                     << "(personal (MessageNew MessageExpunge FlagChange))");
+}
+
+bool NotifyTask::handleStateHelper(const Imap::Responses::State *const resp)
+{
+    if (resp->tag.isEmpty())
+        return false;
+
+    if (resp->tag == tag) {
+
+        if (resp->kind == Responses::OK) {
+            _completed();
+        } else {
+            // Perhaps the server does not like some of the events; the polling will have to do
+            model->accessParser(parser).notifyActive = false;
+            _failed(tr("NOTIFY failed"));
+        }
+        return true;
+    } else {
+        return false;
+    }
+}
+
+QVariant NotifyTask::taskData(const int role) const
+{
+    return role == RoleTaskCompactName ? QVariant(tr("Subscribing to mailbox changes")) : QVariant();
+}
+
+
+}
+}
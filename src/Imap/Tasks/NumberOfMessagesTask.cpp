@@ -26,6 +26,7 @@
 #include "Imap/Model/Model.h"
 #include "Imap/Model/MailboxTree.h"
 #include "GetAnyConnectionTask.h"
+#include "ListChildMailboxesTask.h"
 
 namespace Imap
 {
@@ -34,9 +35,18 @@ namespace Mailbox
 
 
 NumberOfMessagesTask::NumberOfMessagesTask(Model *model, const QModelIndex &mailbox):
-    ImapTask(model), mailboxIndex(mailbox)
+    ImapTask(model), failed(false)
 {
     Q_ASSERT(dynamic_cast<TreeItemMailbox *>(static_cast<TreeItem *>(mailbox.internalPointer())));
+    mailboxIndexes << mailbox;
+    conn = model->m_taskFactory->createGetAnyConnectionTask(model);
+    conn->addDependentTask(this);
+}
+
+NumberOfMessagesTask::NumberOfMessagesTask(Model *model, const QList<QPersistentModelIndex> &mailboxes):
+    ImapTask(model), mailboxIndexes(mailboxes), failed(false)
+{
+    Q_ASSERT(!mailboxes.isEmpty());
     conn = model->m_taskFactory->createGetAnyConnectionTask(model);
     conn->addDependentTask(this);
 }
@@ -48,16 +58,36 @@ void NumberOfMessagesTask::perform()
 
     IMAP_TASK_CHECK_ABORT_DIE;
 
-    if (! mailboxIndex.isValid()) {
-        // FIXME: add proper fix
-        log(QLatin1String("Mailbox vanished before we could ask for number of messages inside"));
-        _completed();
-        return;
+    QStringList forList;
+    Q_FOREACH(const QPersistentModelIndex &index, mailboxIndexes) {
+        if (!index.isValid()) {
+            // FIXME: add proper fix
+            log(QLatin1String("Mailbox vanished before we could ask for number of messages inside"));
+            continue;
+        }
+        TreeItemMailbox *mailbox = dynamic_cast<TreeItemMailbox *>(static_cast<TreeItem *>(index.internalPointer()));
+        Q_ASSERT(mailbox);
+        // The wildcards would make the LIST match more than we have asked for
+        if (mailboxIndexes.size() > 1 && !mailbox->mailbox().contains(QLatin1Char('%')) && !mailbox->mailbox().contains(QLatin1Char('*')))
+            forList << mailbox->mailbox();
+        else
+            askForStatus(mailbox->mailbox());
+    }
+
+    if (!forList.isEmpty()) {
+        if (canUseListStatus()) {
+            listedMailboxes = forList.toSet();
+            listTag = commandParser()->list(QLatin1String(""), forList,
+                                            QStringList() << QString::fromUtf8("STATUS (%1)").arg(requestedStatusOptions().join(QLatin1String(" "))));
+            tags.insert(listTag);
+        } else {
+            Q_FOREACH(const QString &mailbox, forList) {
+                askForStatus(mailbox);
+            }
+        }
     }
-    TreeItemMailbox *mailbox = dynamic_cast<TreeItemMailbox *>(static_cast<TreeItem *>(mailboxIndex.internalPointer()));
-    Q_ASSERT(mailbox);
 
-    tag = parser->status(mailbox->mailbox(), requestedStatusOptions());
+    finishIfDone();
 }
 
 /** @short What kind of information are we interested in? */
@@ -66,32 +96,96 @@ QStringList NumberOfMessagesTask::requestedStatusOptions()
     return QStringList() << QLatin1String("MESSAGES") << QLatin1String("UNSEEN") << QLatin1String("RECENT");
 }
 
+/** @short Is it possible to get the numbers of the whole batch through a single LIST-STATUS command?
+
+Asking for several mailbox names at once is a feature of the LIST-EXTENDED (RFC 5258).
+*/
+bool NumberOfMessagesTask::canUseListStatus() const
+{
+    const ParserState &state = model->accessParser(parser);
+    return state.capabilitiesFresh && state.capabilities.contains(QLatin1String("LIST-EXTENDED")) &&
+            state.capabilities.contains(QLatin1String("LIST-STATUS"));
+}
+
+void NumberOfMessagesTask::askForStatus(const QString &mailbox)
+{
+    tags.insert(commandParser()->status(mailbox, requestedStatusOptions()));
+}
+
+void NumberOfMessagesTask::finishIfDone()
+{
+    if (!tags.isEmpty())
+        return;
+
+    if (failed) {
+        _failed(tr("STATUS has failed"));
+        // FIXME: error handling
+    } else {
+        _completed();
+    }
+}
+
 bool NumberOfMessagesTask::handleStateHelper(const Imap::Responses::State *const resp)
 {
     if (resp->tag.isEmpty())
         return false;
 
-    if (resp->tag == tag) {
-        if (resp->kind == Responses::OK) {
-            _completed();
-        } else {
-            _failed(tr("STATUS has failed"));
-            // FIXME: error handling
+    if (!tags.remove(resp->tag))
+        return false;
+
+    if (resp->kind != Responses::OK) {
+        failed = true;
+    } else if (resp->tag == listTag) {
+        // The server won't send STATUS for mailboxes which cannot be selected, or which went away in the meanwhile.
+        // Try these the old way so that their numbers do not remain in the "loading" state forever.
+        Q_FOREACH(const QPersistentModelIndex &index, mailboxIndexes) {
+            if (!index.isValid())
+                continue;
+            TreeItemMailbox *mailbox = static_cast<TreeItemMailbox *>(index.internalPointer());
+            TreeItemMsgList *list = dynamic_cast<TreeItemMsgList *>(mailbox->m_children[0]);
+            Q_ASSERT(list);
+            if (listedMailboxes.contains(mailbox->mailbox()) && !list->numbersFetched())
+                askForStatus(mailbox->mailbox());
         }
-        return true;
-    } else {
+    }
+    if (resp->tag == listTag) {
+        listTag.clear();
+        listedMailboxes.clear();
+    }
+    finishIfDone();
+    return true;
+}
+
+/** @short Eat the LIST responses which were triggered by our LIST-STATUS
+
+The mailbox tree is not touched by these, we only care about the STATUS responses which come along. However, they cannot be
+told apart from the responses to a concurrent listing of mailboxes, so we have to step aside in that case.
+*/
+bool NumberOfMessagesTask::handleList(const Imap::Responses::List *const resp)
+{
+    if (listTag.isEmpty() || !listedMailboxes.contains(resp->mailbox))
         return false;
+
+    Q_FOREACH(ImapTask *task, model->accessParser(parser).activeTasks) {
+        if (dynamic_cast<ListChildMailboxesTask *>(task))
+            return false;
     }
+    return true;
 }
 
 QString NumberOfMessagesTask::debugIdentification() const
 {
-    if (! mailboxIndex.isValid())
-        return QLatin1String("[invalid mailboxIndex]");
-
-    TreeItemMailbox *mailbox = dynamic_cast<TreeItemMailbox *>(static_cast<TreeItem *>(mailboxIndex.internalPointer()));
-    Q_ASSERT(mailbox);
-    return QString::fromUtf8("attached to %1").arg(mailbox->mailbox());
+    QStringList names;
+    Q_FOREACH(const QPersistentModelIndex &index, mailboxIndexes) {
+        if (!index.isValid()) {
+            names << QLatin1String("[invalid mailboxIndex]");
+            continue;
+        }
+        TreeItemMailbox *mailbox = dynamic_cast<TreeItemMailbox *>(static_cast<TreeItem *>(index.internalPointer()));
+        Q_ASSERT(mailbox);
+        names << mailbox->mailbox();
+    }
+    return QString::fromUtf8("attached to %1").arg(names.join(QLatin1String(", ")));
 }
 
 QVariant NumberOfMessagesTask::taskData(const int role) const
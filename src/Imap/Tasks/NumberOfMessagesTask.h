@@ -24,6 +24,7 @@
 #define IMAP_NUMBEROFMESSAGES_TASK_H
 
 #include <QPersistentModelIndex>
+#include <QSet>
 #include "ImapTask.h"
 
 namespace Imap
@@ -31,15 +32,21 @@ namespace Imap
 namespace Mailbox
 {
 
-/** @short Ask for number of messages in a certain mailbox */
+/** @short Ask for number of messages in a certain mailbox, or in a batch of them
+
+A batch is served by a single LIST command when the server supports the LIST-STATUS extension (RFC 5819). Otherwise, all
+STATUS commands of the batch are pipelined.
+*/
 class NumberOfMessagesTask : public ImapTask
 {
     Q_OBJECT
 public:
     NumberOfMessagesTask(Model *model, const QModelIndex &mailbox);
+    NumberOfMessagesTask(Model *model, const QList<QPersistentModelIndex> &mailboxes);
     virtual void perform();
 
     virtual bool handleStateHelper(const Imap::Responses::State *const resp);
+    virtual bool handleList(const Imap::Responses::List *const resp);
 
     virtual QString debugIdentification() const;
     virtual QVariant taskData(const int role) const;
@@ -47,9 +54,17 @@ public:
 
     static QStringList requestedStatusOptions();
 private:
-    CommandHandle tag;
+    bool canUseListStatus() const;
+    void askForStatus(const QString &mailbox);
+    void finishIfDone();
+
+    QSet<CommandHandle> tags;
+    CommandHandle listTag;
+    /** @short Mailboxes whose LIST responses we have asked for, and therefore shall not leak into the mailbox tree */
+    QSet<QString> listedMailboxes;
     ImapTask *conn;
-    QPersistentModelIndex mailboxIndex;
+    QList<QPersistentModelIndex> mailboxIndexes;
+    bool failed;
 };
 
 }
@@ -22,6 +22,7 @@
 
 #include "ObtainSynchronizedMailboxTask.h"
 #include <algorithm>
+#include <functional>
 #include <sstream>
 #include <QTimer>
 #include "Common/InvokeMethod.h"
@@ -39,7 +40,8 @@ namespace Mailbox
 ObtainSynchronizedMailboxTask::ObtainSynchronizedMailboxTask(Model *model, const QModelIndex &mailboxIndex, ImapTask *parentTask,
         KeepMailboxOpenTask *keepTask):
     ImapTask(model), conn(parentTask), mailboxIndex(mailboxIndex), status(STATE_WAIT_FOR_CONN), uidSyncingMode(UID_SYNC_ALL),
-    firstUnknownUidOffset(0), m_usingQresync(false), unSelectTask(0), keepTaskChild(keepTask)
+    firstUnknownUidOffset(0), m_usingQresync(false), m_arrivalsLowestUid(0), m_uidPartitionBroken(false), unSelectTask(0),
+    keepTaskChild(keepTask)
 {
     // The Parser* is not provided by our parent task, but instead through the keepTaskChild.  The reason is simple, the parent
     // task might not even exist, but there's always an KeepMailboxOpenTask in the game.
@@ -96,8 +98,8 @@ void ObtainSynchronizedMailboxTask::perform()
         m_usingQresync = true;
         auto oldUidMap = model->cache()->uidMapping(mailbox->mailbox());
         if (oldUidMap.isEmpty()) {
-            selectCmd = parser->selectQresync(mailbox->mailbox(), oldSyncState.uidValidity(),
-                                              oldSyncState.highestModSeq());
+            selectCmd = commandParser()->selectQresync(mailbox->mailbox(), oldSyncState.uidValidity(),
+                                                       oldSyncState.highestModSeq());
         } else {
             Sequence knownSeq, knownUid;
             int i = oldUidMap.size() / 2;
@@ -109,13 +111,13 @@ void ObtainSynchronizedMailboxTask::perform()
             }
             // We absolutely want to maintain a complete UID->seq mapping at all times, which is why the known-uids shall remain
             // empty to indicate "anything".
-            selectCmd = parser->selectQresync(mailbox->mailbox(), oldSyncState.uidValidity(),
-                                              oldSyncState.highestModSeq(), Sequence(), knownSeq, knownUid);
+            selectCmd = commandParser()->selectQresync(mailbox->mailbox(), oldSyncState.uidValidity(),
+                                                       oldSyncState.highestModSeq(), Sequence(), knownSeq, knownUid);
         }
     } else if (model->accessParser(parser).capabilities.contains(QLatin1String("CONDSTORE"))) {
-        selectCmd = parser->select(mailbox->mailbox(), QList<QByteArray>() << "CONDSTORE");
+        selectCmd = commandParser()->select(mailbox->mailbox(), QList<QByteArray>() << "CONDSTORE");
     } else {
-        selectCmd = parser->select(mailbox->mailbox());
+        selectCmd = commandParser()->select(mailbox->mailbox());
     }
     if (hasQresync && model->accessParser(parser).connState > CONN_STATE_AUTHENTICATED) {
         // The CLOSED response code is defined in RFC 5162. It should be sent out even if the client does not actually use
@@ -186,6 +188,7 @@ bool ObtainSynchronizedMailboxTask::handleStateHelper(const Imap::Responses::Sta
         return true;
     } else if (resp->tag == flagsCmd) {
 
+        bool moreFlagsWindows = false;
         if (resp->kind == Responses::OK) {
             //qDebug() << "received OK for flagsCmd";
             Q_ASSERT(status == STATE_SYNCING_FLAGS);
@@ -197,6 +200,17 @@ bool ObtainSynchronizedMailboxTask::handleStateHelper(const Imap::Responses::Sta
             notifyInterestingMessages(mailbox);
             flagsCmd.clear();
 
+            moreFlagsWindows = !m_pendingFlagsWindows.isEmpty();
+            if (moreFlagsWindows) {
+                // Only the first window is done; the mailbox is usable now and the rest will be fetched in background
+                log(QString::fromUtf8("First window of flags synchronized, %1 more to go")
+                    .arg(QString::number(m_pendingFlagsWindows.size())), Common::LOG_MAILBOX_SYNC);
+                keepTaskChild->pendingFlagsWindows = m_pendingFlagsWindows;
+                keepTaskChild->flagsWindowsTotal = m_pendingFlagsWindows.size() + 1;
+                m_pendingFlagsWindows.clear();
+                emit model->mailboxFlagsSyncingProgress(mailboxIndex, 1, keepTaskChild->flagsWindowsTotal);
+            }
+
             if (newArrivalsFetch.isEmpty()) {
                 mailbox->saveSyncStateAndUids(model);
                 model->changeConnectionState(parser, CONN_STATE_SELECTED);
@@ -209,7 +223,31 @@ bool ObtainSynchronizedMailboxTask::handleStateHelper(const Imap::Responses::Sta
             _failed(QLatin1String("Flags synchronization failed: ") + resp->message);
             // FIXME: UNSELECT?
         }
-        emit model->mailboxSyncingProgress(mailboxIndex, status);
+        // With a windowed sync in progress, the flags are not fully up-to-date yet
+        emit model->mailboxSyncingProgress(mailboxIndex, moreFlagsWindows ? STATE_SYNCING_FLAGS : status);
+        return true;
+    } else if (m_uidPartitionCmds.contains(resp->tag)) {
+
+        m_uidPartitionCmds.removeOne(resp->tag);
+        if (resp->kind != Responses::OK) {
+            _failed(QLatin1String("UID syncing failed: ") + resp->message);
+            return true;
+        }
+
+        // The ESEARCH responses have been processed already. If there was none, nothing has matched.
+        if (m_uidRangeChecks.contains(resp->tag)) {
+            const QPair<int, int> range = m_uidRangeChecks.take(resp->tag);
+            processUidRangeCheck(range.first, range.second, 0);
+        } else if (m_uidRangeDownloads.contains(resp->tag)) {
+            const QPair<int, int> range = m_uidRangeDownloads.take(resp->tag);
+            processUidRangeDownload(range.first, range.second, 0);
+        } else if (resp->tag == m_uidArrivalsCmd) {
+            m_uidArrivalsCmd.clear();
+        }
+
+        if (m_uidPartitionCmds.isEmpty()) {
+            finalizePartitionedUidSync();
+        }
         return true;
     } else if (newArrivalsFetch.contains(resp->tag)) {
 
@@ -271,7 +309,7 @@ void ObtainSynchronizedMailboxTask::finalizeSelect()
                     // Looks like a corrupted cache or a server's bug
                     log(QLatin1String("Yuck, recycled HIGHESTMODSEQ when trying to use QRESYNC"), Common::LOG_MAILBOX_SYNC);
                     mailbox->syncState.setHighestModSeq(0);
-                    model->cache()->clearAllMessages(mailbox->mailbox());
+                    model->clearAllCachedMessages(mailbox->mailbox());
                     m_usingQresync = false;
                     fullMboxSync(mailbox, list);
                 } else {
@@ -279,13 +317,13 @@ void ObtainSynchronizedMailboxTask::finalizeSelect()
                         if (oldSyncState.exists() != syncState.exists()) {
                             log(QLatin1String("Sync error: QRESYNC says no changes but EXISTS has changed"), Common::LOG_MAILBOX_SYNC);
                             mailbox->syncState.setHighestModSeq(0);
-                            model->cache()->clearAllMessages(mailbox->mailbox());
+                            model->clearAllCachedMessages(mailbox->mailbox());
                             m_usingQresync = false;
                             fullMboxSync(mailbox, list);
                         } else if (oldSyncState.uidNext() != syncState.uidNext()) {
                             log(QLatin1String("Sync error: QRESYNC says no changes but UIDNEXT has changed"), Common::LOG_MAILBOX_SYNC);
                             mailbox->syncState.setHighestModSeq(0);
-                            model->cache()->clearAllMessages(mailbox->mailbox());
+                            model->clearAllCachedMessages(mailbox->mailbox());
                             m_usingQresync = false;
                             fullMboxSync(mailbox, list);
                         } else if (syncState.exists() != static_cast<uint>(list->m_children.size())) {
@@ -294,7 +332,7 @@ void ObtainSynchronizedMailboxTask::finalizeSelect()
                                 .arg(QString::number(mailbox->syncState.exists()), QString::number(list->m_children.size())),
                                 Common::LOG_MAILBOX_SYNC);
                             mailbox->syncState.setHighestModSeq(0);
-                            model->cache()->clearAllMessages(mailbox->mailbox());
+                            model->clearAllCachedMessages(mailbox->mailbox());
                             m_usingQresync = false;
                             fullMboxSync(mailbox, list);
                         } else {
@@ -312,7 +350,7 @@ void ObtainSynchronizedMailboxTask::finalizeSelect()
                         log(QString::fromUtf8("Sync error: EXISTS says %1 messages, msgList has %2")
                             .arg(QString::number(mailbox->syncState.exists()), QString::number(list->m_children.size())));
                         mailbox->syncState.setHighestModSeq(0);
-                        model->cache()->clearAllMessages(mailbox->mailbox());
+                        model->clearAllCachedMessages(mailbox->mailbox());
                         m_usingQresync = false;
                         fullMboxSync(mailbox, list);
                         return;
@@ -331,8 +369,8 @@ void ObtainSynchronizedMailboxTask::finalizeSelect()
                         }
                         if (seqWithLowestUnknownUid >= 0) {
                             // We've got some new arrivals, but unfortunately QRESYNC won't report them just yet :(
-                            CommandHandle fetchCmd = parser->uidFetch(Sequence::startingAt(qMax(oldSyncState.uidNext(), 1u)),
-                                                                      QList<QByteArray>() << "FLAGS");
+                            CommandHandle fetchCmd = commandParser()->uidFetch(Sequence::startingAt(qMax(oldSyncState.uidNext(), 1u)),
+                                                                               QList<QByteArray>() << "FLAGS");
                             newArrivalsFetch.append(fetchCmd);
                             status = STATE_DONE;
                         } else {
@@ -390,7 +428,7 @@ void ObtainSynchronizedMailboxTask::finalizeSelect()
                 Q_ASSERT(syncState.uidNext() < oldSyncState.uidNext());
                 Q_ASSERT(syncState.uidValidity() == oldSyncState.uidValidity());
                 log(QLatin1String("Yuck, UIDVALIDITY remains same but UIDNEXT decreased"), Common::LOG_MAILBOX_SYNC);
-                model->cache()->clearAllMessages(mailbox->mailbox());
+                model->clearAllCachedMessages(mailbox->mailbox());
                 fullMboxSync(mailbox, list);
             }
         } else if (oldSyncState.isUsableForSyncingWithoutUidNext() && syncState.isUsableForSyncingWithoutUidNext() && oldSyncState.uidValidity() == syncState.uidValidity()) {
@@ -398,7 +436,7 @@ void ObtainSynchronizedMailboxTask::finalizeSelect()
             syncGeneric(mailbox, list);
         } else {
             // Forget everything, do a dumb sync
-            model->cache()->clearAllMessages(mailbox->mailbox());
+            model->clearAllCachedMessages(mailbox->mailbox());
             fullMboxSync(mailbox, list);
         }
     }
@@ -528,7 +566,21 @@ void ObtainSynchronizedMailboxTask::syncGeneric(TreeItemMailbox *mailbox, TreeIt
     list->m_numberFetchingStatus = TreeItem::LOADING;
     list->m_unreadMessageCount = 0;
     uidSyncingMode = UID_SYNC_ALL;
-    syncUids(mailbox);
+
+    bool ok;
+    int partitionThreshold = model->property("trojita-imap-uid-partition-threshold").toInt(&ok);
+    if (!ok)
+        partitionThreshold = 5000;
+
+    // Downloading all UIDs of a huge mailbox just because a single message got deleted is wasteful; with ESEARCH, we can
+    // locate the changes much more cheaply. The cached UID map has to be sorted for that, though.
+    if (partitionThreshold > 0 && uidMap.size() >= partitionThreshold &&
+            model->accessParser(parser).capabilities.contains(QLatin1String("ESEARCH")) &&
+            std::adjacent_find(uidMap.constBegin(), uidMap.constEnd(), std::greater_equal<uint>()) == uidMap.constEnd()) {
+        syncUidsPartitioned(mailbox);
+    } else {
+        syncUids(mailbox);
+    }
 }
 
 void ObtainSynchronizedMailboxTask::syncUids(TreeItemMailbox *mailbox, const uint lowestUidToQuery)
@@ -543,13 +595,184 @@ void ObtainSynchronizedMailboxTask::syncUids(TreeItemMailbox *mailbox, const uin
     }
     uidMap.clear();
     if (model->accessParser(parser).capabilities.contains(QLatin1String("ESEARCH"))) {
-        uidSyncingCmd = parser->uidESearchUid(uidSpecification);
+        uidSyncingCmd = commandParser()->uidESearchUid(uidSpecification);
     } else {
-        uidSyncingCmd = parser->uidSearchUid(uidSpecification);
+        uidSyncingCmd = commandParser()->uidSearchUid(uidSpecification);
+    }
+    emit model->mailboxSyncingProgress(mailboxIndex, status);
+}
+
+/** @short Reconcile the cached UID map with the server by comparing ranges of UIDs instead of downloading all of them
+
+IMAP guarantees that the new arrivals get UIDs which are higher than UIDs of any message which was in the mailbox before.
+The range of the previously known UIDs can therefore only lose some messages, and that's something which can be detected by
+comparing the COUNT of messages in a UID range with the number of cached UIDs in that range. Ranges which match are kept as-is,
+ranges without any surviving message are dropped, and the other ones are split into smaller parts. Once a range is small
+enough, its surviving UIDs are downloaded. The new arrivals are always downloaded.
+
+Should the server's responses contradict the cached state, we fall back to the full UID (E)SEARCH ALL.
+*/
+void ObtainSynchronizedMailboxTask::syncUidsPartitioned(TreeItemMailbox *mailbox)
+{
+    Q_ASSERT(!uidMap.isEmpty());
+    status = STATE_SYNCING_UIDS;
+    log(QString::fromUtf8("Syncing UIDs by comparing ranges of %1 cached UIDs").arg(QString::number(uidMap.size())),
+        Common::LOG_MAILBOX_SYNC);
+
+    m_cachedUids = uidMap;
+    uidMap.clear();
+    m_survivingCachedUids = QBitArray(m_cachedUids.size());
+    m_arrivedUids.clear();
+    m_uidPartitionBroken = false;
+
+    checkUidRange(0, m_cachedUids.size() - 1);
+
+    m_arrivalsLowestUid = qMax(oldSyncState.uidNext(), m_cachedUids.last() + 1);
+    if (!mailbox->syncState.uidNext() || mailbox->syncState.uidNext() > m_arrivalsLowestUid) {
+        m_uidArrivalsCmd = commandParser()->uidESearchUid("UID " + QByteArray::number(m_arrivalsLowestUid) + ":*");
+        m_uidPartitionCmds << m_uidArrivalsCmd;
     }
     emit model->mailboxSyncingProgress(mailboxIndex, status);
 }
 
+/** @short Return a UID set spanning the cached UIDs at offsets from @arg first to @arg last */
+QByteArray ObtainSynchronizedMailboxTask::cachedUidRange(const int first, const int last) const
+{
+    return "UID " + QByteArray::number(m_cachedUids[first]) + ':' + QByteArray::number(m_cachedUids[last]);
+}
+
+void ObtainSynchronizedMailboxTask::checkUidRange(const int first, const int last)
+{
+    CommandHandle cmd = commandParser()->uidESearchUidStatistics(cachedUidRange(first, last));
+    m_uidRangeChecks[cmd] = qMakePair(first, last);
+    m_uidPartitionCmds << cmd;
+}
+
+/** @short Compare the server's idea about a range of the cached UIDs with what we've got in the cache
+
+The @arg resp could be null, in which case no messages in the range have survived.
+*/
+void ObtainSynchronizedMailboxTask::processUidRangeCheck(const int first, const int last, const Responses::ESearch *const resp)
+{
+    // Once we're going to fall back to the full sync, there's no point in issuing further commands
+    if (m_uidPartitionBroken)
+        return;
+
+    uint count = 0, min = 0, max = 0;
+    if (resp) {
+        for (auto it = resp->listData.constBegin(); it != resp->listData.constEnd(); ++it) {
+            if (it->second.size() != 1)
+                continue;
+            if (it->first == "COUNT")
+                count = it->second.front();
+            else if (it->first == "MIN")
+                min = it->second.front();
+            else if (it->first == "MAX")
+                max = it->second.front();
+        }
+    }
+
+    // These values do not change throughout the life of this function
+    const uint cachedCount = last - first + 1;
+    const int leafSize = 256;
+    const int fanOut = 8;
+
+    if (count == 0) {
+        // All of these are gone
+    } else if (count > cachedCount || (min && min < m_cachedUids[first]) || (max && max > m_cachedUids[last])) {
+        log(QLatin1String("The server reports more messages in a UID range than we've got in cache"), Common::LOG_MAILBOX_SYNC);
+        m_uidPartitionBroken = true;
+    } else if (count == cachedCount) {
+        // Nothing has changed in this range
+        for (int i = first; i <= last; ++i) {
+            m_survivingCachedUids.setBit(i);
+        }
+    } else if (cachedCount <= static_cast<uint>(leafSize)) {
+        CommandHandle cmd = commandParser()->uidESearchUid(cachedUidRange(first, last));
+        m_uidRangeDownloads[cmd] = qMakePair(first, last);
+        m_uidPartitionCmds << cmd;
+    } else {
+        const int step = (cachedCount + fanOut - 1) / fanOut;
+        for (int i = first; i <= last; i += step) {
+            checkUidRange(i, qMin(last, i + step - 1));
+        }
+    }
+}
+
+/** @short Remember which cached UIDs from a range have survived
+
+The @arg resp could be null, in which case no messages in the range have survived.
+*/
+void ObtainSynchronizedMailboxTask::processUidRangeDownload(const int first, const int last, const Responses::ESearch *const resp)
+{
+    if (!resp || m_uidPartitionBroken)
+        return;
+
+    Responses::ESearch::CompareListDataIdentifier<Responses::ESearch::ListData_t> allComparator("ALL");
+    auto listIterator = std::find_if(resp->listData.constBegin(), resp->listData.constEnd(), allComparator);
+    if (listIterator == resp->listData.constEnd())
+        return;
+
+    auto rangeBegin = m_cachedUids.constBegin() + first;
+    auto rangeEnd = m_cachedUids.constBegin() + last + 1;
+    Q_FOREACH(const uint uid, listIterator->second) {
+        auto it = std::lower_bound(rangeBegin, rangeEnd, uid);
+        if (it == rangeEnd || *it != uid) {
+            log(QString::fromUtf8("UID %1 is not in our cache").arg(QString::number(uid)), Common::LOG_MAILBOX_SYNC);
+            m_uidPartitionBroken = true;
+            return;
+        }
+        m_survivingCachedUids.setBit(it - m_cachedUids.constBegin());
+    }
+}
+
+/** @short The mailbox has changed while the partitioned UID syncing was running
+
+The individual commands of the partitioned syncing look at the mailbox at different moments, so their results cannot be
+combined once a message has arrived or disappeared in between. Once the pending commands finish, the whole UID map gets
+downloaded instead.
+*/
+void ObtainSynchronizedMailboxTask::interruptPartitionedUidSync(const QString &reason)
+{
+    if (m_uidPartitionCmds.isEmpty() || m_uidPartitionBroken)
+        return;
+    log(QString::fromUtf8("%1 during the partitioned UID syncing").arg(reason), Common::LOG_MAILBOX_SYNC);
+    m_uidPartitionBroken = true;
+}
+
+/** @short All commands of the partitioned UID syncing have finished, let's build the UID map */
+void ObtainSynchronizedMailboxTask::finalizePartitionedUidSync()
+{
+    TreeItemMailbox *mailbox = Model::mailboxForSomeItem(mailboxIndex);
+    Q_ASSERT(mailbox);
+
+    uidMap.clear();
+    if (!m_uidPartitionBroken) {
+        for (int i = 0; i < m_cachedUids.size(); ++i) {
+            if (m_survivingCachedUids.testBit(i))
+                uidMap << m_cachedUids[i];
+        }
+        qSort(m_arrivedUids);
+        uidMap += m_arrivedUids;
+    }
+    m_cachedUids.clear();
+    m_survivingCachedUids.clear();
+    m_arrivedUids.clear();
+
+    if (m_uidPartitionBroken || static_cast<uint>(uidMap.size()) != mailbox->syncState.exists()) {
+        log(QString::fromUtf8("Partitioned UID syncing has produced %1 UIDs for %2 messages, falling back to a full UID sync")
+            .arg(QString::number(uidMap.size()), QString::number(mailbox->syncState.exists())), Common::LOG_MAILBOX_SYNC);
+        m_uidPartitionBroken = false;
+        syncUids(mailbox);
+        return;
+    }
+
+    log(QLatin1String("UIDs synchronized"), Common::LOG_MAILBOX_SYNC);
+    finalizeSearch();
+    Q_ASSERT(status == STATE_SYNCING_FLAGS);
+    syncFlags(mailbox);
+}
+
 void ObtainSynchronizedMailboxTask::syncFlags(TreeItemMailbox *mailbox)
 {
     status = STATE_SYNCING_FLAGS;
@@ -559,9 +782,9 @@ void ObtainSynchronizedMailboxTask::syncFlags(TreeItemMailbox *mailbox)
 
     // 0 => don't use it; >0 => use that as the old value
     quint64 useModSeq = 0;
-    if ((model->accessParser(parser).capabilities.contains(QLatin1String("CONDSTORE")) ||
-         model->accessParser(parser).capabilities.contains(QLatin1String("QRESYNC"))) &&
-            oldSyncState.highestModSeq() > 0 && mailbox->syncState.isUsableForCondstore() &&
+    const bool hasCondstore = model->accessParser(parser).capabilities.contains(QLatin1String("CONDSTORE")) ||
+            model->accessParser(parser).capabilities.contains(QLatin1String("QRESYNC"));
+    if (hasCondstore && oldSyncState.highestModSeq() > 0 && mailbox->syncState.isUsableForCondstore() &&
             oldSyncState.uidValidity() == mailbox->syncState.uidValidity()) {
         // The CONDSTORE is available, UIDVALIDITY has not changed and the HIGHESTMODSEQ suggests that
         // it will be useful
@@ -602,14 +825,74 @@ void ObtainSynchronizedMailboxTask::syncFlags(TreeItemMailbox *mailbox)
     if (useModSeq > 0) {
         QMap<QByteArray, quint64> fetchModifier;
         fetchModifier["CHANGEDSINCE"] = oldSyncState.highestModSeq();
-        flagsCmd = parser->fetch(Sequence(1, mailbox->syncState.exists()), QStringList() << QLatin1String("FLAGS"), fetchModifier);
+        flagsCmd = commandParser()->fetch(Sequence(1, mailbox->syncState.exists()), QStringList() << QLatin1String("FLAGS"), fetchModifier);
     } else {
-        flagsCmd = parser->fetch(Sequence(1, mailbox->syncState.exists()), QStringList() << QLatin1String("FLAGS"));
+        bool ok;
+        int windowSize = model->property("trojita-imap-flags-sync-window").toInt(&ok);
+        if (!ok)
+            windowSize = 5000;
+
+        // Without CONDSTORE, we have to ask for FLAGS of each and every message. In huge mailboxes that takes ages, so
+        // we split the work into windows. The first one gets fetched right now and the rest is left to our KeepMailboxOpenTask
+        // which will fetch the remaining FLAGS in background while the mailbox is already usable.
+        // The CONDSTORE-capable servers are excluded on purpose -- we would have saved an updated HIGHESTMODSEQ before
+        // all windows got fetched.
+        m_pendingFlagsWindows.clear();
+        if (!hasCondstore && windowSize > 0 && mailbox->syncState.exists() > static_cast<uint>(windowSize)
+                && planFlagsWindows(mailbox, list, windowSize)) {
+            log(QString::fromUtf8("Syncing flags in %1 windows").arg(QString::number(m_pendingFlagsWindows.size())),
+                Common::LOG_MAILBOX_SYNC);
+            flagsCmd = commandParser()->uidFetch(m_pendingFlagsWindows.takeFirst(), QList<QByteArray>() << "FLAGS");
+        } else {
+            flagsCmd = commandParser()->fetch(Sequence(1, mailbox->syncState.exists()), QStringList() << QLatin1String("FLAGS"));
+        }
     }
     list->m_numberFetchingStatus = TreeItem::LOADING;
     emit model->mailboxSyncingProgress(mailboxIndex, status);
 }
 
+/** @short Split the FLAGS resync into UID windows, the most interesting one going first
+
+The first window covers those messages which the user is going to see right after the mailbox gets opened. That's the area
+around the first unseen message (see notifyInterestingMessages()), or the newest messages when the server has not told us
+about any unseen message. The rest of the mailbox follows, proceeding from the newest messages towards the oldest ones.
+
+UIDs are used instead of sequence numbers because the windows are fetched over a longer period of time and the sequence
+numbers could get shifted by EXPUNGEs in the meanwhile.
+
+@returns false when the windows could not be planned because some UIDs are still unknown
+*/
+bool ObtainSynchronizedMailboxTask::planFlagsWindows(TreeItemMailbox *mailbox, TreeItemMsgList *list, const int windowSize)
+{
+    const int total = list->m_children.size();
+    for (int i = 0; i < total; ++i) {
+        if (!static_cast<TreeItemMessage *>(list->m_children[i])->uid())
+            return false;
+    }
+    if (total <= windowSize)
+        return false;
+
+    auto uidRange = [list](const int from, const int to) {
+        return Sequence(static_cast<TreeItemMessage *>(list->m_children[from])->uid(),
+                        static_cast<TreeItemMessage *>(list->m_children[to])->uid());
+    };
+
+    // remember, the offset has one-based indexing
+    const int unSeenOffset = mailbox->syncState.unSeenOffset();
+    int first = (unSeenOffset > 0 && unSeenOffset <= total) ? unSeenOffset - 1 - windowSize / 2 : total - windowSize;
+    first = qBound(0, first, total - windowSize);
+    const int last = first + windowSize - 1;
+
+    m_pendingFlagsWindows << uidRange(first, last);
+    for (int to = total - 1; to > last; to -= windowSize) {
+        m_pendingFlagsWindows << uidRange(qMax(last + 1, to - windowSize + 1), to);
+    }
+    for (int to = first - 1; to >= 0; to -= windowSize) {
+        m_pendingFlagsWindows << uidRange(qMax(0, to - windowSize + 1), to);
+    }
+    return true;
+}
+
 bool ObtainSynchronizedMailboxTask::handleResponseCodeInsideState(const Imap::Responses::State *const resp)
 {
     if (dieIfInvalidMailbox())
@@ -745,6 +1028,7 @@ bool ObtainSynchronizedMailboxTask::handleNumberResponse(const Imap::Responses::
             return true;
 
         case STATE_SYNCING_UIDS:
+            interruptPartitionedUidSync(QLatin1String("EXISTS"));
             mailbox->handleExists(model, *resp);
             updateHighestKnownUid(mailbox, list);
             return true;
@@ -758,10 +1042,10 @@ bool ObtainSynchronizedMailboxTask::handleNumberResponse(const Imap::Responses::
             mailbox->handleExists(model, *resp);
             Q_ASSERT(list->m_children.size());
             updateHighestKnownUid(mailbox, list);
-            CommandHandle fetchCmd = parser->uidFetch(Sequence::startingAt(
-                                                    // prevent a possible invalid 0:*
-                                                    qMax(mailbox->syncState.uidNext(), 1u)
-                                                ), QList<QByteArray>() << "FLAGS");
+            CommandHandle fetchCmd = commandParser()->uidFetch(Sequence::startingAt(
+                                                             // prevent a possible invalid 0:*
+                                                             qMax(mailbox->syncState.uidNext(), 1u)
+                                                         ), QList<QByteArray>() << "FLAGS");
             newArrivalsFetch.append(fetchCmd);
             return true;
         }
@@ -817,6 +1101,7 @@ bool ObtainSynchronizedMailboxTask::handleNumberResponse(const Imap::Responses::
         case STATE_SYNCING_UIDS:
             // We shouldn't delete stuff at this point, it will be handled by the UID syncing.
             // The response shall be consumed, though.
+            interruptPartitionedUidSync(QLatin1String("EXPUNGE"));
             return true;
 
         case STATE_SYNCING_FLAGS:
@@ -852,8 +1137,10 @@ bool ObtainSynchronizedMailboxTask::handleVanished(const Imap::Responses::Vanish
         Q_ASSERT(false);
         return false;
 
-    case STATE_SELECTING:
     case STATE_SYNCING_UIDS:
+        interruptPartitionedUidSync(QLatin1String("VANISHED"));
+        // fall through
+    case STATE_SELECTING:
     case STATE_SYNCING_FLAGS:
     case STATE_DONE:
         mailbox->handleVanished(model, *resp);
@@ -896,6 +1183,31 @@ bool ObtainSynchronizedMailboxTask::handleESearch(const Imap::Responses::ESearch
     if (dieIfInvalidMailbox())
         return true;
 
+    if (!resp->tag.isEmpty() && m_uidPartitionCmds.contains(resp->tag)) {
+        if (resp->seqOrUids != Imap::Responses::ESearch::UIDS)
+            throw UnexpectedResponseReceived("ESEARCH response with matching tag uses sequence numbers instead of UIDs", *resp);
+
+        if (m_uidRangeChecks.contains(resp->tag)) {
+            const QPair<int, int> range = m_uidRangeChecks.take(resp->tag);
+            processUidRangeCheck(range.first, range.second, resp);
+        } else if (m_uidRangeDownloads.contains(resp->tag)) {
+            const QPair<int, int> range = m_uidRangeDownloads.take(resp->tag);
+            processUidRangeDownload(range.first, range.second, resp);
+        } else if (resp->tag == m_uidArrivalsCmd) {
+            m_uidArrivalsCmd.clear();
+            Responses::ESearch::CompareListDataIdentifier<Responses::ESearch::ListData_t> allComparator("ALL");
+            auto listIterator = std::find_if(resp->listData.constBegin(), resp->listData.constEnd(), allComparator);
+            if (listIterator != resp->listData.constEnd()) {
+                Q_FOREACH(const uint uid, listIterator->second) {
+                    // The "*" matches the highest UID in the mailbox even if it's an old message
+                    if (uid >= m_arrivalsLowestUid)
+                        m_arrivedUids << uid;
+                }
+            }
+        }
+        return true;
+    }
+
     if (resp->tag.isEmpty() || resp->tag != uidSyncingCmd)
         return false;
 
@@ -1078,7 +1390,7 @@ void ObtainSynchronizedMailboxTask::applyUids(TreeItemMailbox *mailbox)
                 // messages due to that one out-of-place arrival -- but we'd still remain correct and not crash.
                 TreeItemMessage *otherMessage = static_cast<TreeItemMessage*>(list->m_children[pos]);
                 if (otherMessage->m_uid != 0 && otherMessage->m_uid != uidMap[uidOffset]) {
-                    model->cache()->clearMessage(mailbox->mailbox(), otherMessage->uid());
+                    model->clearCachedMessage(mailbox->mailbox(), otherMessage->uid());
                     ++pos;
                 } else {
                     break;
@@ -24,6 +24,7 @@
 #define IMAP_OBTAINSYNCHRONIZEDMAILBOXTASK_H
 
 #include "ImapTask.h"
+#include <QBitArray>
 #include <QModelIndex>
 #include "../Model/Model.h"
 
@@ -75,7 +76,15 @@ private:
     void finalizeSearch();
 
     void syncUids(TreeItemMailbox *mailbox, const uint lowestUidToQuery=0);
+    void syncUidsPartitioned(TreeItemMailbox *mailbox);
+    QByteArray cachedUidRange(const int first, const int last) const;
+    void checkUidRange(const int first, const int last);
+    void processUidRangeCheck(const int first, const int last, const Responses::ESearch *const resp);
+    void processUidRangeDownload(const int first, const int last, const Responses::ESearch *const resp);
+    void finalizePartitionedUidSync();
+    void interruptPartitionedUidSync(const QString &reason);
     void syncFlags(TreeItemMailbox *mailbox);
+    bool planFlagsWindows(TreeItemMailbox *mailbox, TreeItemMsgList *list, const int windowSize);
     void updateHighestKnownUid(TreeItemMailbox *mailbox, const TreeItemMsgList *list) const;
 
     void notifyInterestingMessages(TreeItemMailbox *mailbox);
@@ -114,6 +123,28 @@ private:
     SyncState oldSyncState;
     bool m_usingQresync;
 
+    /** @short Pending commands of the partitioned UID syncing, see syncUidsPartitioned() */
+    QList<CommandHandle> m_uidPartitionCmds;
+    /** @short Commands checking whether a range of the cached UIDs (given as offsets into m_cachedUids) is intact */
+    QMap<CommandHandle, QPair<int, int> > m_uidRangeChecks;
+    /** @short Commands downloading the surviving UIDs of a range of the cached UIDs */
+    QMap<CommandHandle, QPair<int, int> > m_uidRangeDownloads;
+    /** @short Command asking for UIDs of the messages which have arrived since the last sync */
+    CommandHandle m_uidArrivalsCmd;
+    /** @short The UID map as it was when this mailbox got synced the last time */
+    Imap::Uids m_cachedUids;
+    /** @short Which of the m_cachedUids are still present in the mailbox */
+    QBitArray m_survivingCachedUids;
+    /** @short UIDs of the new arrivals */
+    Imap::Uids m_arrivedUids;
+    /** @short The lowest UID which a new arrival could have */
+    uint m_arrivalsLowestUid;
+    /** @short The server's responses do not fit our cached data, so we will have to fall back to a full UID sync */
+    bool m_uidPartitionBroken;
+
+    /** @short UID ranges whose FLAGS shall be fetched after the first window, in the order of their priority */
+    QList<Sequence> m_pendingFlagsWindows;
+
     /** @short An UNSELECT task, if active */
     UnSelectTask *unSelectTask;
 
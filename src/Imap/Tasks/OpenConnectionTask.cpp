@@ -37,7 +37,7 @@ namespace Mailbox
 {
 
 OpenConnectionTask::OpenConnectionTask(Model *model) :
-    ImapTask(model)
+    ImapTask(model), usingCachedCapabilities(false), encryptedSinceStart(false), capabilitiesAfterLoginCached(false)
 {
     // Offline mode shall be checked by the caller who decides to create the connection
     Q_ASSERT(model->networkPolicy() != NETWORK_OFFLINE);
@@ -47,13 +47,14 @@ OpenConnectionTask::OpenConnectionTask(Model *model) :
     connect(parser, SIGNAL(connectionStateChanged(Imap::Parser *,Imap::ConnectionState)), model, SLOT(handleSocketStateChanged(Imap::Parser *,Imap::ConnectionState)));
     connect(parser, SIGNAL(lineReceived(Imap::Parser *,QByteArray)), model, SLOT(slotParserLineReceived(Imap::Parser *,QByteArray)));
     connect(parser, SIGNAL(lineSent(Imap::Parser *,QByteArray)), model, SLOT(slotParserLineSent(Imap::Parser *,QByteArray)));
+    connect(parser, SIGNAL(commandTagged(Imap::Parser *,QByteArray)), model, SLOT(slotParserCommandTagged(Imap::Parser *,QByteArray)));
     model->m_parsers[ parser ] = parserState;
     model->m_taskModel->slotParserCreated(parser);
     markAsActiveTask();
 }
 
 OpenConnectionTask::OpenConnectionTask(Model *model, void *dummy):
-    ImapTask(model)
+    ImapTask(model), usingCachedCapabilities(false), encryptedSinceStart(false), capabilitiesAfterLoginCached(false)
 {
     Q_UNUSED(dummy);
 }
@@ -169,7 +170,7 @@ bool OpenConnectionTask::handleStateHelper(const Imap::Responses::State *const r
             if (model->accessParser(parser).capabilitiesFresh) {
                 // We're alsmost done here, apart from compression
                 if (TROJITA_COMPRESS_DEFLATE && model->accessParser(parser).capabilities.contains(QLatin1String("COMPRESS=DEFLATE"))) {
-                    compressCmd = parser->compressDeflate();
+                    compressCmd = commandParser()->compressDeflate();
                     model->changeConnectionState(parser, CONN_STATE_COMPRESS_DEFLATE);
                 } else {
                     // really done
@@ -178,14 +179,27 @@ bool OpenConnectionTask::handleStateHelper(const Imap::Responses::State *const r
                 }
             } else {
                 model->changeConnectionState(parser, CONN_STATE_POSTAUTH_PRECAPS);
-                capabilityCmd = parser->capability();
+                capabilityCmd = commandParser()->capability();
             }
             return true;
 
         case OK:
             if (!model->accessParser(parser).capabilitiesFresh) {
-                model->changeConnectionState(parser, CONN_STATE_CONNECTED_PRETLS);
-                capabilityCmd = parser->capability();
+                if (encryptedSinceStart && applyCachedCapabilities(model->m_cachedCapabilitiesBeforeLogin)) {
+                    // Nobody could have tampered with what the server announces over this connection
+                    startTlsOrLoginNow();
+                } else if (model->m_startTls && cachedCapabilitiesAvailable(model->m_cachedCapabilitiesBeforeLogin)) {
+                    // STARTTLS worked the last time, and the pre-TLS capabilities cannot be trusted anyway. The remembered
+                    // capabilities will only be used once the connection is encrypted.
+                    usingCachedCapabilities = true;
+                    startTlsCmd = commandParser()->startTls();
+                    model->changeConnectionState(parser, CONN_STATE_STARTTLS_ISSUED);
+                } else {
+                    // A plaintext connection always asks, otherwise a stale cache could make us send the credentials
+                    // to a server which does not accept them without encryption anymore
+                    model->changeConnectionState(parser, CONN_STATE_CONNECTED_PRETLS);
+                    capabilityCmd = commandParser()->capability();
+                }
             } else {
                 startTlsOrLoginNow();
             }
@@ -279,10 +293,15 @@ bool OpenConnectionTask::handleStateHelper(const Imap::Responses::State *const r
             // The LOGIN command is finished
             if (resp->kind == OK) {
                 model->setImapAuthError(QString());
+                if (resp->respCode != CAPABILITIES && !model->accessParser(parser).capabilitiesFresh &&
+                        cachedCapabilitiesAfterLoginUsable()) {
+                    // Skip the CAPABILITY round trip when we know what the server said the last time
+                    capabilitiesAfterLoginCached = applyCachedCapabilities(model->m_cachedCapabilitiesAfterLogin);
+                }
                 if (resp->respCode == CAPABILITIES || model->accessParser(parser).capabilitiesFresh) {
                     // Capabilities are already known
                     if (TROJITA_COMPRESS_DEFLATE && model->accessParser(parser).capabilities.contains(QLatin1String("COMPRESS=DEFLATE"))) {
-                        compressCmd = parser->compressDeflate();
+                        compressCmd = commandParser()->compressDeflate();
                         model->changeConnectionState(parser, CONN_STATE_COMPRESS_DEFLATE);
                     } else {
                         model->changeConnectionState(parser, CONN_STATE_AUTHENTICATED);
@@ -291,8 +310,15 @@ bool OpenConnectionTask::handleStateHelper(const Imap::Responses::State *const r
                 } else {
                     // Got to ask for the capabilities
                     model->changeConnectionState(parser, CONN_STATE_POSTAUTH_PRECAPS);
-                    capabilityCmd = parser->capability();
+                    capabilityCmd = commandParser()->capability();
                 }
+            } else if (usingCachedCapabilities && resp->respCode != Responses::AUTHENTICATIONFAILED &&
+                       model->accessParser(parser).connState != CONN_STATE_LOGOUT) {
+                // The remembered capabilities might be out of date, so let's forget them and negotiate from scratch
+                usingCachedCapabilities = false;
+                model->setCachedCapabilities(QStringList(), QStringList());
+                model->changeConnectionState(parser, startTlsCmd.isEmpty() ? CONN_STATE_CONNECTED_PRETLS : CONN_STATE_ESTABLISHED_PRECAPS);
+                capabilityCmd = commandParser()->capability();
             } else {
                 // Login failed
                 QString message;
@@ -382,7 +408,7 @@ void OpenConnectionTask::startTlsOrLoginNow()
         if (!model->accessParser(parser).capabilities.contains(QLatin1String("STARTTLS"))) {
             abortConnection(tr("Server error: LOGINDISABLED but no STARTTLS capability. The login is effectively disabled entirely."));
         } else {
-            startTlsCmd = parser->startTls();
+            startTlsCmd = commandParser()->startTls();
             model->changeConnectionState(parser, CONN_STATE_STARTTLS_ISSUED);
         }
     } else {
@@ -414,6 +440,12 @@ bool OpenConnectionTask::checkCapabilitiesResult(const Responses::State *const r
 
 void OpenConnectionTask::onComplete()
 {
+    // Remember what the server supports so that the next connection can skip asking for that. Saving the capabilities
+    // which came from the cache in the first place would make them look fresh, and they would never get refreshed.
+    if (!capabilitiesBeforeLogin.isEmpty() && !capabilitiesAfterLoginCached) {
+        model->updateCachedCapabilities(capabilitiesBeforeLogin, model->accessParser(parser).capabilities);
+    }
+
     // Optionally issue the ID command
     if (model->accessParser(parser).capabilities.contains(QLatin1String("ID"))) {
         Imap::Mailbox::ImapTask *task = model->m_taskFactory->createIdTask(model, this);
@@ -431,6 +463,10 @@ void OpenConnectionTask::onComplete()
             model->m_taskFactory->createEnableTask(model, this, extensions)->perform();
         }
     }
+    // One connection reporting changes in all mailboxes is enough
+    if (model->accessParser(parser).capabilities.contains(QLatin1String("NOTIFY")) && !model->hasNotifyConnection()) {
+        model->m_taskFactory->createNotifyTask(model, this)->perform();
+    }
 
     // But do terminate this task
     _completed();
@@ -447,19 +483,57 @@ void OpenConnectionTask::askForAuth()
 {
     if (model->m_hasImapPassword) {
         Q_ASSERT(loginCmd.isEmpty());
-        loginCmd = parser->login(model->m_imapUser, model->m_imapPassword);
-        model->accessParser(parser).capabilitiesFresh = false;
+        login();
     } else {
         EMIT_LATER_NOARG(model, authRequested);
     }
 }
 
+void OpenConnectionTask::login()
+{
+    // When the STARTTLS was forced by LOGINDISABLED and not by the configuration, the next connection has to find out
+    // about that on its own, so these capabilities are not worth remembering
+    if (startTlsCmd.isEmpty() || model->m_startTls) {
+        capabilitiesBeforeLogin = model->accessParser(parser).capabilities;
+    }
+    loginCmd = commandParser()->login(model->m_imapUser, model->m_imapPassword);
+    model->accessParser(parser).capabilitiesFresh = false;
+}
+
+/** @short Are there any capabilities remembered from a previous connection which we are allowed to use? */
+bool OpenConnectionTask::cachedCapabilitiesAvailable(const QStringList &capabilities) const
+{
+    QVariant enabled = model->property("trojita-imap-cached-capabilities");
+    return !capabilities.isEmpty() && (!enabled.isValid() || enabled.toBool());
+}
+
+/** @short Use the capabilities which were remembered from a previous connection, if any */
+bool OpenConnectionTask::applyCachedCapabilities(const QStringList &capabilities)
+{
+    if (!cachedCapabilitiesAvailable(capabilities))
+        return false;
+
+    model->updateCapabilities(parser, capabilities);
+    usingCachedCapabilities = true;
+    return true;
+}
+
+/** @short Can the remembered capabilities of the authenticated state be used instead of asking the server?
+
+The cache is only valid for the capabilities before LOGIN it was recorded with. When the server has announced something
+else this time, it has probably been upgraded or reconfigured. The capabilities which have not been obtained by this
+Model (i.e. the ones restored from a previous session) are verified once, so that a stale cache gets refreshed.
+*/
+bool OpenConnectionTask::cachedCapabilitiesAfterLoginUsable() const
+{
+    return model->m_cachedCapabilitiesVerified && capabilitiesBeforeLogin == model->m_cachedCapabilitiesBeforeLogin;
+}
+
 void OpenConnectionTask::authCredentialsNowAvailable()
 {
     if (model->accessParser(parser).connState == CONN_STATE_LOGIN && loginCmd.isEmpty()) {
         if (model->m_hasImapPassword) {
-            loginCmd = parser->login(model->m_imapUser, model->m_imapPassword);
-            model->accessParser(parser).capabilitiesFresh = false;
+            login();
         } else {
             abortConnection(tr("Cannot login, you have not provided any credentials yet."));
         }
@@ -486,6 +560,7 @@ void OpenConnectionTask::sslConnectionPolicyDecided(bool ok)
     switch (model->accessParser(parser).connState) {
     case CONN_STATE_SSL_VERIFYING:
         if (ok) {
+            encryptedSinceStart = true;
             model->changeConnectionState(parser, CONN_STATE_CONNECTED_PRETLS_PRECAPS);
         } else {
             abortConnection(tr("The security state of the SSL connection got rejected"));
@@ -493,9 +568,14 @@ void OpenConnectionTask::sslConnectionPolicyDecided(bool ok)
         break;
     case CONN_STATE_STARTTLS_VERIFYING:
         if (ok) {
-            model->changeConnectionState(parser, CONN_STATE_ESTABLISHED_PRECAPS);
-            model->accessParser(parser).capabilitiesFresh = false;
-            capabilityCmd = parser->capability();
+            if (usingCachedCapabilities && applyCachedCapabilities(model->m_cachedCapabilitiesBeforeLogin)) {
+                model->changeConnectionState(parser, CONN_STATE_LOGIN);
+                askForAuth();
+            } else {
+                model->changeConnectionState(parser, CONN_STATE_ESTABLISHED_PRECAPS);
+                model->accessParser(parser).capabilitiesFresh = false;
+                capabilityCmd = commandParser()->capability();
+            }
         } else {
             abortConnection(tr("The security state of the connection after a STARTTLS operation got rejected"));
         }
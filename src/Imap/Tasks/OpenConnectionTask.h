@@ -84,12 +84,25 @@ private:
     void abortConnection(const QString &message);
 
     void askForAuth();
+    void login();
+
+    bool cachedCapabilitiesAvailable(const QStringList &capabilities) const;
+    bool applyCachedCapabilities(const QStringList &capabilities);
+    bool cachedCapabilitiesAfterLoginUsable() const;
 
 private:
     CommandHandle startTlsCmd;
     CommandHandle capabilityCmd;
     CommandHandle loginCmd;
     CommandHandle compressCmd;
+    /** @short Were the capabilities before LOGIN taken from the Model's cache instead of asking the server? */
+    bool usingCachedCapabilities;
+    /** @short Has the connection been encrypted right from the start, i.e. before the server's greeting? */
+    bool encryptedSinceStart;
+    /** @short Were the capabilities after LOGIN taken from the Model's cache? */
+    bool capabilitiesAfterLoginCached;
+    /** @short Capabilities which were valid when we sent the LOGIN command */
+    QStringList capabilitiesBeforeLogin;
     QList<QSslCertificate> m_sslChain;
     QList<QSslError> m_sslErrors;
 };
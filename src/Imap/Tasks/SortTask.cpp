@@ -68,19 +68,19 @@ void SortTask::perform()
             if (model->accessParser(parser).capabilities.contains(QLatin1String("CONTEXT=SEARCH"))) {
                 // Hurray, this IMAP server supports incremental ESEARCH updates
                 m_persistentSearch = true;
-                sortTag = parser->uidESearch("utf-8", searchConditions,
-                                             QStringList() << QLatin1String("ALL") << QLatin1String("UPDATE"));
+                sortTag = commandParser()->uidESearch("utf-8", searchConditions,
+                                                      QStringList() << QLatin1String("ALL") << QLatin1String("UPDATE"));
             } else {
                 // ESORT without CONTEXT is still worth the effort, if only for the tag reference
-                sortTag = parser->uidESearch("utf-8", searchConditions, QStringList() << QLatin1String("ALL"));
+                sortTag = commandParser()->uidESearch("utf-8", searchConditions, QStringList() << QLatin1String("ALL"));
             }
         } else {
             // Plain "old" SORT
-            sortTag = parser->uidSearch(searchConditions,
-                                        // It looks that Exchange 2003 does not support the UTF-8 charset in searches.
-                                        // That is, of course, insane, and only illustrates how useless its support of IMAP really is.
-                                        model->m_capabilitiesBlacklist.contains(QLatin1String("X-NO-UTF8-SEARCH")) ? QByteArray() : "utf-8"
-                                        );
+            sortTag = commandParser()->uidSearch(searchConditions,
+                                                 // It looks that Exchange 2003 does not support the UTF-8 charset in searches.
+                                                 // That is, of course, insane, and only illustrates how useless its support of IMAP really is.
+                                                 model->m_capabilitiesBlacklist.contains(QLatin1String("X-NO-UTF8-SEARCH")) ? QByteArray() : "utf-8"
+                                                 );
         }
     } else {
         // SEARCH and SORT combined
@@ -90,15 +90,15 @@ void SortTask::perform()
             if (model->accessParser(parser).capabilities.contains(QLatin1String("CONTEXT=SORT"))) {
                 // Hurray, this IMAP server supports incremental SORT updates
                 m_persistentSearch = true;
-                sortTag = parser->uidESort(sortCriteria, "utf-8", searchConditions,
-                                       QStringList() << QLatin1String("ALL") << QLatin1String("UPDATE"));
+                sortTag = commandParser()->uidESort(sortCriteria, "utf-8", searchConditions,
+                                                QStringList() << QLatin1String("ALL") << QLatin1String("UPDATE"));
             } else {
                 // ESORT without CONTEXT is still worth the effort, if only for the tag reference
-                sortTag = parser->uidESort(sortCriteria, "utf-8", searchConditions, QStringList() << QLatin1String("ALL"));
+                sortTag = commandParser()->uidESort(sortCriteria, "utf-8", searchConditions, QStringList() << QLatin1String("ALL"));
             }
         } else {
             // Plain "old" SORT
-            sortTag = parser->uidSort(sortCriteria, "utf-8", searchConditions);
+            sortTag = commandParser()->uidSort(sortCriteria, "utf-8", searchConditions);
         }
     }
 }
@@ -260,7 +260,7 @@ void SortTask::cancelSortingUpdates()
     KeepMailboxOpenTask *keepTask = dynamic_cast<KeepMailboxOpenTask*>(conn);
     Q_ASSERT(keepTask);
     keepTask->breakOrCancelPossibleIdle();
-    cancelUpdateTag = parser->cancelUpdate(sortTag);
+    cancelUpdateTag = commandParser()->cancelUpdate(sortTag);
 }
 
 void SortTask::abort()
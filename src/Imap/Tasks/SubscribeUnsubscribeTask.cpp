@@ -59,10 +59,10 @@ void SubscribeUnsubscribeTask::perform()
 
     switch (operation) {
     case SUBSCRIBE:
-        tag = parser->subscribe(mailbox->mailbox());
+        tag = commandParser()->subscribe(mailbox->mailbox());
         break;
     case UNSUBSCRIBE:
-        tag = parser->unSubscribe(mailbox->mailbox());
+        tag = commandParser()->unSubscribe(mailbox->mailbox());
         break;
     default:
         Q_ASSERT(false);
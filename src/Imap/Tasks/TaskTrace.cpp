@@ -0,0 +1,145 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <QElapsedTimer>
+#include "TaskTrace.h"
+
+namespace {
+
+QByteArray jsonString(const QString &str)
+{
+    QByteArray res = "\"";
+    Q_FOREACH(const QChar c, str) {
+        switch (c.unicode()) {
+        case '"':
+            res += "\\\"";
+            break;
+        case '\\':
+            res += "\\\\";
+            break;
+        default:
+            if (c.unicode() < 0x20) {
+                res += "\\u" + QByteArray::number(c.unicode(), 16).rightJustified(4, '0');
+            } else {
+                res += QString(c).toUtf8();
+            }
+        }
+    }
+    res += '"';
+    return res;
+}
+
+/** @short Produce one event of an asynchronous slice, see the Trace Event Format specification */
+QByteArray asyncEvent(const Imap::Mailbox::TaskTrace &trace, const QByteArray &name, const char phase, const qint64 ts,
+                      const QByteArray &args = QByteArray())
+{
+    QByteArray res = "{\"name\":" + name + ",\"cat\":\"imap-task\",\"ph\":\"" + phase + "\",\"ts\":" + QByteArray::number(ts) +
+            ",\"id\":" + QByteArray::number(trace.id) + ",\"pid\":" + QByteArray::number(trace.parserId) +
+            ",\"tid\":" + QByteArray::number(trace.parserId);
+    if (!args.isEmpty())
+        res += ",\"args\":" + args;
+    res += '}';
+    return res;
+}
+
+}
+
+namespace Imap
+{
+
+namespace Mailbox
+{
+
+TaskTrace::TaskTrace():
+    id(0), parserId(0), created(-1), activated(-1), firstResponse(-1), finished(-1), bytesIn(0), bytesOut(0), failed(false)
+{
+}
+
+/** @short Current time in microseconds since an arbitrary but fixed point */
+qint64 TaskTrace::now()
+{
+    static QElapsedTimer clock;
+    if (!clock.isValid())
+        clock.start();
+    return clock.nsecsElapsed() / 1000;
+}
+
+/** @short Serialize the task traces into the Chrome trace-event JSON format
+
+The result can be loaded into Chrome's about:tracing or into Perfetto. Each connection is shown as a separate process and each
+task as an asynchronous slice, split into the time spent waiting for activation, waiting for the server's first response and
+processing of the rest of the responses.
+*/
+QByteArray taskTracesToChromeJson(const QList<TaskTrace> &traces)
+{
+    QList<QByteArray> events;
+    QList<uint> connections;
+    Q_FOREACH(const TaskTrace &trace, traces) {
+        if (trace.created < 0 || trace.finished < 0)
+            continue;
+
+        if (!connections.contains(trace.parserId)) {
+            connections << trace.parserId;
+            events << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" + QByteArray::number(trace.parserId) +
+                      ",\"args\":{\"name\":" +
+                      jsonString(trace.parserId ? QString::fromUtf8("IMAP connection %1").arg(trace.parserId) :
+                                                  QString::fromUtf8("No connection")) + "}}";
+        }
+
+        QByteArray name = jsonString(trace.name);
+        QByteArray args = "{\"task\":" + jsonString(trace.identification) +
+                ",\"bytesIn\":" + QByteArray::number(trace.bytesIn) +
+                ",\"bytesOut\":" + QByteArray::number(trace.bytesOut) +
+                ",\"failed\":" + (trace.failed ? "true" : "false") + "}";
+        events << asyncEvent(trace, name, 'b', trace.created, args);
+
+        qint64 activated = trace.activated >= 0 ? trace.activated : trace.finished;
+        events << asyncEvent(trace, "\"queued\"", 'b', trace.created);
+        events << asyncEvent(trace, "\"queued\"", 'e', activated);
+        if (trace.activated >= 0) {
+            qint64 firstResponse = trace.firstResponse >= 0 ? trace.firstResponse : trace.finished;
+            events << asyncEvent(trace, "\"server\"", 'b', trace.activated);
+            events << asyncEvent(trace, "\"server\"", 'e', firstResponse);
+            if (trace.firstResponse >= 0) {
+                events << asyncEvent(trace, "\"processing\"", 'b', trace.firstResponse);
+                events << asyncEvent(trace, "\"processing\"", 'e', trace.finished);
+            }
+        }
+
+        events << asyncEvent(trace, name, 'e', trace.finished);
+    }
+
+    QByteArray res = "{\"traceEvents\":[\n";
+    for (int i = 0; i < events.size(); ++i) {
+        res += events[i];
+        if (i != events.size() - 1)
+            res += ',';
+        res += '\n';
+    }
+    res += "],\"displayTimeUnit\":\"ms\"}\n";
+    return res;
+}
+
+}
+
+}
@@ -0,0 +1,74 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef IMAP_TASKS_TASKTRACE_H
+#define IMAP_TASKS_TASKTRACE_H
+
+#include <QList>
+#include <QString>
+
+namespace Imap
+{
+
+namespace Mailbox
+{
+
+/** @short Timestamps and traffic counters describing the lifetime of a single ImapTask
+
+All timestamps are in microseconds of a monotonic clock shared by all tasks; events which have not happened are -1.
+*/
+struct TaskTrace {
+    /** @short Unique serial number of the task */
+    quint64 id;
+    /** @short Name of the task's class */
+    QString name;
+    /** @short The task's own description of what it is doing */
+    QString identification;
+    /** @short Identification of the connection the task was using, or zero if it never got one */
+    uint parserId;
+    /** @short When the task was instantiated */
+    qint64 created;
+    /** @short When the task became active, i.e. when it could start talking to the server */
+    qint64 activated;
+    /** @short When the task has processed the first response from the server */
+    qint64 firstResponse;
+    /** @short When the task has completed or failed */
+    qint64 finished;
+    /** @short Size of the responses processed by this task */
+    qint64 bytesIn;
+    /** @short Size of the commands sent by this task */
+    qint64 bytesOut;
+    bool failed;
+
+    TaskTrace();
+
+    static qint64 now();
+};
+
+QByteArray taskTracesToChromeJson(const QList<TaskTrace> &traces);
+
+}
+
+}
+
+#endif // IMAP_TASKS_TASKTRACE_H
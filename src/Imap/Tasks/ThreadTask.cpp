@@ -55,9 +55,9 @@ void ThreadTask::perform()
     }
 
     if (m_incrementalMode) {
-        tag = parser->uidEThread(algorithm, "utf-8", searchCriteria, QStringList() << QLatin1String("INCTHREAD"));
+        tag = commandParser()->uidEThread(algorithm, "utf-8", searchCriteria, QStringList() << QLatin1String("INCTHREAD"));
     } else {
-        tag = parser->uidThread(algorithm, "utf-8", searchCriteria);
+        tag = commandParser()->uidThread(algorithm, "utf-8", searchCriteria);
     }
 }
 
@@ -57,7 +57,7 @@ void UidSubmitTask::perform()
         return;
     }
 
-    tag = parser->uidSendmail(m_uid, m_options);
+    tag = commandParser()->uidSendmail(m_uid, m_options);
 }
 
 bool UidSubmitTask::handleStateHelper(const Imap::Responses::State *const resp)
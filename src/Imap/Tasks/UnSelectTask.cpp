@@ -55,7 +55,7 @@ void UnSelectTask::perform()
         model->accessParser(parser).maintainingTask->breakOrCancelPossibleIdle();
     }
     if (model->accessParser(parser).capabilities.contains(QLatin1String("UNSELECT"))) {
-        unSelectTag = parser->unSelect();
+        unSelectTag = commandParser()->unSelect();
     } else {
         doFakeSelect();
     }
@@ -73,7 +73,7 @@ void UnSelectTask::doFakeSelect()
         model->accessParser(parser).maintainingTask->breakOrCancelPossibleIdle();
     }
     // The server does not support UNSELECT. Let's construct an unlikely-to-exist mailbox, then.
-    selectMissingTag = parser->examine(QLatin1String("trojita non existing ") + QUuid::createUuid().toString());
+    selectMissingTag = commandParser()->examine(QLatin1String("trojita non existing ") + QUuid::createUuid().toString());
 }
 
 bool UnSelectTask::handleStateHelper(const Imap::Responses::State *const resp)
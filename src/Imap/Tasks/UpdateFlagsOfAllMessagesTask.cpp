@@ -51,7 +51,7 @@ void UpdateFlagsOfAllMessagesTask::perform()
     IMAP_TASK_CHECK_ABORT_DIE;
 
     Sequence seq = Sequence::startingAt(1);
-    tag = parser->store(seq, toImapString(flagOperation), flags);
+    tag = commandParser()->store(seq, toImapString(flagOperation), flags);
 }
 
 bool UpdateFlagsOfAllMessagesTask::handleStateHelper(const Imap::Responses::State *const resp)
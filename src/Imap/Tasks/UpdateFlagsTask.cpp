@@ -121,7 +121,7 @@ void UpdateFlagsTask::perform()
         _failed(tr("All messages got removed before we could've updated their flags"));
         return;
     }
-    tag = parser->uidStore(seq, toImapString(flagOperation), flags);
+    tag = commandParser()->uidStore(seq, toImapString(flagOperation), flags);
 }
 
 bool UpdateFlagsTask::handleStateHelper(const Imap::Responses::State *const resp)
@@ -48,6 +48,13 @@ void FakeSocket::slotEmitConnected()
         return;
     }
 
+    if (m_initialState == Imap::CONN_STATE_SSL_HANDSHAKE) {
+        // Implicit TLS: nothing gets through until the encryption is up
+        emit stateChanged(Imap::CONN_STATE_SSL_HANDSHAKE, QString());
+        QTimer::singleShot(0, this, SLOT(slotEmitEncrypted()));
+        return;
+    }
+
     // We have to use both conventions for letting the world know that "we're finally usable"
     if (m_initialState != Imap::CONN_STATE_CONNECTED_PRETLS_PRECAPS)
         emit stateChanged(Imap::CONN_STATE_CONNECTED_PRETLS_PRECAPS, QString());
@@ -127,6 +134,11 @@ void FakeSocket::close()
     writeChannel->write(QByteArray("[*** close ***]"));
 }
 
+bool FakeSocket::isConnectingEncryptedSinceStart() const
+{
+    return m_initialState == Imap::CONN_STATE_SSL_HANDSHAKE;
+}
+
 QByteArray FakeSocket::writtenStuff()
 {
     QByteArray res = w;
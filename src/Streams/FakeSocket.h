@@ -49,6 +49,7 @@ public:
     virtual void startDeflate();
     virtual bool isDead();
     virtual void close();
+    virtual bool isConnectingEncryptedSinceStart() const;
 
     /** @short Return data written since the last call to this function */
     QByteArray writtenStuff();
@@ -240,6 +240,13 @@ SslTlsSocket::SslTlsSocket(QSslSocket *sock, const QString &host, const quint16
     sock->setSslConfiguration(sslConf);
 #endif
 
+    // Reconnecting is much faster when the TLS handshake can be abbreviated through a session ticket (RFC 5077)
+#if QT_VERSION >= QT_VERSION_CHECK(5, 4, 0)
+    sslConf = sock->sslConfiguration();
+    sslConf.setSslOption(QSsl::SslOptionDisableSessionPersistence, false);
+    sock->setSslConfiguration(sslConf);
+#endif
+
     connect(sock, SIGNAL(encrypted()), this, SIGNAL(encrypted()));
     connect(sock, SIGNAL(stateChanged(QAbstractSocket::SocketState)), this, SLOT(handleStateChanged()));
     connect(sock, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(handleSocketError(QAbstractSocket::SocketError)));
@@ -251,6 +258,30 @@ void SslTlsSocket::setProxySettings(const ProxySettings proxySettings, const QSt
     m_protocolTag = protocolTag;
 }
 
+void SslTlsSocket::setSessionTicket(const QByteArray &ticket)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 4, 0)
+    QSslSocket *sock = qobject_cast<QSslSocket*>(d);
+    Q_ASSERT(sock);
+    QSslConfiguration sslConf = sock->sslConfiguration();
+    sslConf.setSessionTicket(ticket);
+    sock->setSslConfiguration(sslConf);
+#else
+    Q_UNUSED(ticket);
+#endif
+}
+
+QByteArray SslTlsSocket::sessionTicket() const
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 4, 0)
+    QSslSocket *sock = qobject_cast<QSslSocket*>(d);
+    Q_ASSERT(sock);
+    return sock->sslConfiguration().sessionTicket();
+#else
+    return QByteArray();
+#endif
+}
+
 void SslTlsSocket::close()
 {
     QSslSocket *sock = qobject_cast<QSslSocket*>(d);
@@ -97,6 +97,10 @@ public:
     virtual QList<QSslError> sslErrors() const;
     bool isConnectingEncryptedSinceStart() const;
     virtual void close();
+    /** @short Offer a TLS session ticket from an earlier connection for an abbreviated handshake */
+    void setSessionTicket(const QByteArray &ticket);
+    /** @short Return the TLS session ticket issued by the server, or an empty QByteArray if there is none */
+    QByteArray sessionTicket() const;
 private slots:
     void handleStateChanged();
     void handleSocketError(QAbstractSocket::SocketError);
@@ -43,6 +43,23 @@ bool SocketFactory::startTlsRequired()
     return m_startTls;
 }
 
+/** @short Let the new socket resume the TLS session of its predecessor, and remember its own session for the next one */
+void SocketFactory::resumeTlsSession(SslTlsSocket *sock)
+{
+    if (!m_tlsSessionTicket.isEmpty())
+        sock->setSessionTicket(m_tlsSessionTicket);
+    connect(sock, SIGNAL(encrypted()), this, SLOT(slotRememberTlsSession()));
+}
+
+void SocketFactory::slotRememberTlsSession()
+{
+    SslTlsSocket *sock = qobject_cast<SslTlsSocket*>(sender());
+    Q_ASSERT(sock);
+    QByteArray ticket = sock->sessionTicket();
+    if (!ticket.isEmpty())
+        m_tlsSessionTicket = ticket;
+}
+
 ProcessSocketFactory::ProcessSocketFactory(
     const QString &executable, const QStringList &args):
     executable(executable), args(args)
@@ -77,6 +94,7 @@ Socket *SslSocketFactory::create()
     QSslSocket *sslSock = new QSslSocket();
     SslTlsSocket *sock = new SslTlsSocket(sslSock, host, port, true);
     sock->setProxySettings(m_proxySettings, m_protocolTag);
+    resumeTlsSession(sock);
     return sock;
 }
 
@@ -97,6 +115,7 @@ Socket *TlsAbleSocketFactory::create()
     QSslSocket *sslSock = new QSslSocket();
     SslTlsSocket *sock = new SslTlsSocket(sslSock, host, port);
     sock->setProxySettings(m_proxySettings, m_protocolTag);
+    resumeTlsSession(sock);
     return sock;
 }
 
@@ -29,6 +29,8 @@
 
 namespace Streams {
 
+class SslTlsSocket;
+
 /** @short Specify preference for Proxy Settings */
 enum class ProxySettings
 {
@@ -52,6 +54,13 @@ public:
     bool startTlsRequired();
 signals:
     void error(const QString &);
+protected:
+    void resumeTlsSession(SslTlsSocket *sock);
+private slots:
+    void slotRememberTlsSession();
+private:
+    /** @short The TLS session ticket of the last encrypted connection, reused by the next one */
+    QByteArray m_tlsSessionTicket;
 };
 
 /** @short Manufacture sockets based on QProcess */
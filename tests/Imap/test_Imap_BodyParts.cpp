@@ -27,8 +27,10 @@
 #include "Utils/headless_test.h"
 #include "Utils/FakeCapabilitiesInjector.h"
 #include "Streams/FakeSocket.h"
+#include "Imap/Model/FullTextIndex.h"
 #include "Imap/Model/ItemRoles.h"
 #include "Imap/Model/MailboxTree.h"
+#include "Imap/Model/MemoryCache.h"
 
 struct Data {
     QString key;
@@ -52,6 +54,29 @@ struct Data {
 
 Q_DECLARE_METATYPE(QList<Data>)
 
+/** @short A MemoryCache which feeds a real full-text index, just like the CombinedCache does */
+class IndexedMemoryCache : public Imap::Mailbox::MemoryCache
+{
+public:
+    explicit IndexedMemoryCache(QObject *parent): MemoryCache(parent), index(0)
+    {
+        index.open(QLatin1String("test-fts"), QLatin1String(":memory:"));
+    }
+
+    virtual void setMsgPartTexts(const QList<MessagePartText> &texts)
+    {
+        index.indexTexts(texts);
+    }
+
+    virtual bool searchText(const QString &mailbox, const QString &query, const TextFields fields, Imap::Uids &result) const
+    {
+        result = index.search(mailbox, query, fields);
+        return true;
+    }
+
+    Imap::Mailbox::FullTextIndex index;
+};
+
 namespace QTest {
 template <>
 char *toString(const QModelIndex &index)
@@ -446,4 +471,177 @@ void BodyPartsTest::testFilenameExtraction_data()
     QTest::newRow("name-overwrites-empty-filename") << bsPlaintextEmptyFilename << QString::number(0) << QString::fromUtf8("actual");
 }
 
+/** @short Make sure that data of the least recently used messages are released when they occupy too much memory */
+void BodyPartsTest::testMessageDataBudget()
+{
+    model->setProperty("trojita-imap-delayed-fetch-part", 0);
+    initialMessages(2);
+    QModelIndex msg1 = msgListA.child(0, 0);
+    QModelIndex msg2 = msgListA.child(1, 0);
+    QCOMPARE(model->rowCount(msg1), 0);
+    cClient(t.mk("UID FETCH 1:2 (" FETCH_METADATA_ITEMS ")\r\n"));
+    cServer("* 1 FETCH (UID 1 BODYSTRUCTURE (" + bsPlaintext + "))\r\n"
+            "* 2 FETCH (UID 2 BODYSTRUCTURE (" + bsPlaintext + "))\r\n"
+            + t.last("OK fetched\r\n"));
+    QCOMPARE(model->rowCount(msg1), 1);
+    QCOMPARE(model->rowCount(msg2), 1);
+
+    QByteArray data1(2000, 'a');
+    QByteArray data2(2000, 'b');
+
+    QModelIndex part1 = msg1.child(0, 0);
+    QCOMPARE(part1.data(RolePartData).toByteArray(), QByteArray());
+    cClient(t.mk("UID FETCH 1 (BODY.PEEK[1])\r\n"));
+    cServer("* 1 FETCH (UID 1 BODY[1] \"" + data1 + "\")\r\n" + t.last("OK fetched\r\n"));
+    QCOMPARE(part1.data(RolePartData).toByteArray(), data1);
+
+    // Both messages fit, but not with their part data
+    model->setMessageDataMemoryBudget(3000);
+    QCoreApplication::processEvents();
+    QVERIFY(msg1.data(RoleIsFetched).toBool());
+
+    // Somebody is still looking at the first message, so its data have to stay even though they are the least recently used ones
+    QPersistentModelIndex pinnedPart1 = msg1.child(0, 0);
+    QPersistentModelIndex part2 = msg2.child(0, 0);
+    QCOMPARE(part2.data(RolePartData).toByteArray(), QByteArray());
+    cClient(t.mk("UID FETCH 2 (BODY.PEEK[1])\r\n"));
+    cServer("* 2 FETCH (UID 2 BODY[1] \"" + data2 + "\")\r\n" + t.last("OK fetched\r\n"));
+    QCoreApplication::processEvents();
+    QVERIFY(pinnedPart1.isValid());
+    QVERIFY(part2.isValid());
+
+    // Once nobody refers to the first message, the next check gets rid of its data. They are still in the cache, though.
+    pinnedPart1 = QModelIndex();
+    model->setMessageDataMemoryBudget(3000);
+    QCoreApplication::processEvents();
+    QVERIFY(!msg1.data(RoleIsFetched).toBool());
+    QVERIFY(msg2.data(RoleIsFetched).toBool());
+    QVERIFY(part2.isValid());
+    QCOMPARE(part2.data(RolePartData).toByteArray(), data2);
+    QCOMPARE(model->cache()->messagePart(QLatin1String("a"), 1, "1"), data1);
+}
+
+/** @short Make sure that a mailbox which is kept offline gets downloaded completely without anybody asking for the data */
+void BodyPartsTest::testOfflineMirror()
+{
+    model->setProperty("trojita-imap-delayed-fetch-part", 0);
+    model->setProperty("trojita-imap-offline-mirror-interval", 0);
+    initialMessages(2);
+    model->setMailboxKeptOffline(QLatin1String("a"), true);
+    QVERIFY(model->isMailboxKeptOffline(QLatin1String("a")));
+
+    // The metadata go first, they are needed for finding out which parts there are
+    cClient(t.mk("UID FETCH 1:2 (" FETCH_METADATA_ITEMS ")\r\n"));
+    cServer("* 1 FETCH (UID 1 BODYSTRUCTURE (" + bsPlaintext + "))\r\n"
+            "* 2 FETCH (UID 2 BODYSTRUCTURE (" + bsPlaintext + "))\r\n"
+            + t.last("OK fetched\r\n"));
+
+    // The body parts are fetched in one batch
+    cClient(t.mk("UID FETCH 1:2 (BODY.PEEK[1])\r\n"));
+    cServer("* 1 FETCH (UID 1 BODY[1] \"first\")\r\n"
+            "* 2 FETCH (UID 2 BODY[1] \"second\")\r\n"
+            + t.last("OK fetched\r\n"));
+    QCOMPARE(model->cache()->messagePart(QLatin1String("a"), 1, "1"), QByteArray("first"));
+    QCOMPARE(model->cache()->messagePart(QLatin1String("a"), 2, "1"), QByteArray("second"));
+
+    // Everything is available now, so there is nothing else to do
+    cEmpty();
+    justKeepTask();
+
+    model->setMailboxKeptOffline(QLatin1String("a"), false);
+    QVERIFY(model->offlineMirrorMailboxes().isEmpty());
+}
+
+/** @short The downloaded textual parts end up in the full-text index, decoded and without any markup */
+void BodyPartsTest::testFullTextIndexing()
+{
+    IndexedMemoryCache *cache = new IndexedMemoryCache(0);
+    QSignalSpy indexErrors(&cache->index, SIGNAL(error(QString)));
+    model->setCache(cache);
+    model->setProperty("trojita-imap-delayed-fetch-part", 0);
+    initialMessages(2);
+    QModelIndex msg1 = msgListA.child(0, 0);
+    QModelIndex msg2 = msgListA.child(1, 0);
+    QCOMPARE(model->rowCount(msg1), 0);
+    cClient(t.mk("UID FETCH 1:2 (" FETCH_METADATA_ITEMS ")\r\n"));
+    cServer("* 1 FETCH (UID 1 BODYSTRUCTURE (\"text\" \"plain\" (\"charset\" \"iso-8859-2\") NIL NIL \"8bit\" 20 1 NIL NIL NIL NIL))\r\n"
+            "* 2 FETCH (UID 2 BODYSTRUCTURE (\"text\" \"html\" (\"charset\" \"us-ascii\") NIL NIL \"7bit\" 48 1 NIL NIL NIL NIL))\r\n"
+            + t.last("OK fetched\r\n"));
+    QCOMPARE(model->rowCount(msg1), 1);
+    QCOMPARE(model->rowCount(msg2), 1);
+
+    const Imap::Mailbox::AbstractCache::TextFields body = Imap::Mailbox::AbstractCache::TEXT_BODY;
+    Imap::Uids result;
+
+    // The text has to be converted from its charset before it can be indexed
+    const QByteArray data1("P\xf8\xedli\xb9 \xbelu\xbbou\xe8k\xfd k\xf9\xf2");
+    QCOMPARE(msg1.child(0, 0).data(RolePartData).toByteArray(), QByteArray());
+    cClient(t.mk("UID FETCH 1 (BODY.PEEK[1])\r\n"));
+    cServer("* 1 FETCH (UID 1 BODY[1] {" + QByteArray::number(data1.size()) + "}\r\n" + data1 + ")\r\n"
+            + t.last("OK fetched\r\n"));
+    QThreadPool::globalInstance()->waitForDone();
+    QCoreApplication::processEvents();
+    QVERIFY(model->cache()->searchText(QLatin1String("a"), QString::fromUtf8("\xc5\xbdLU\xc5\xa4"), body, result));
+    QCOMPARE(result, Imap::Uids() << 1);
+
+    // The markup of HTML parts is not indexed
+    const QByteArray data2("<p><span class=\"greeting\">Hello</span> world</p>");
+    QCOMPARE(msg2.child(0, 0).data(RolePartData).toByteArray(), QByteArray());
+    cClient(t.mk("UID FETCH 2 (BODY.PEEK[1])\r\n"));
+    cServer("* 2 FETCH (UID 2 BODY[1] {" + QByteArray::number(data2.size()) + "}\r\n" + data2 + ")\r\n"
+            + t.last("OK fetched\r\n"));
+    QThreadPool::globalInstance()->waitForDone();
+    QCoreApplication::processEvents();
+    QVERIFY(model->cache()->searchText(QLatin1String("a"), QLatin1String("hello world"), body, result));
+    QCOMPARE(result, Imap::Uids() << 2);
+    QVERIFY(model->cache()->searchText(QLatin1String("a"), QLatin1String("greeting"), body, result));
+    QCOMPARE(result, Imap::Uids());
+    QVERIFY(model->cache()->searchText(QLatin1String("a"), QLatin1String("span"), body, result));
+    QCOMPARE(result, Imap::Uids());
+
+    cEmpty();
+    QVERIFY(indexErrors.isEmpty());
+}
+
+/** @short The texts of a message which gets removed from the cache before they are extracted do not end up in the index */
+void BodyPartsTest::testFullTextIndexingExpunged()
+{
+    IndexedMemoryCache *cache = new IndexedMemoryCache(0);
+    QSignalSpy indexErrors(&cache->index, SIGNAL(error(QString)));
+    model->setCache(cache);
+    model->setProperty("trojita-imap-delayed-fetch-part", 0);
+    initialMessages(2);
+    QModelIndex msg1 = msgListA.child(0, 0);
+    QModelIndex msg2 = msgListA.child(1, 0);
+    QCOMPARE(model->rowCount(msg1), 0);
+    cClient(t.mk("UID FETCH 1:2 (" FETCH_METADATA_ITEMS ")\r\n"));
+    cServer("* 1 FETCH (UID 1 BODYSTRUCTURE (\"text\" \"plain\" (\"charset\" \"us-ascii\") NIL NIL \"7bit\" 11 1 NIL NIL NIL NIL))\r\n"
+            "* 2 FETCH (UID 2 BODYSTRUCTURE (\"text\" \"plain\" (\"charset\" \"us-ascii\") NIL NIL \"7bit\" 11 1 NIL NIL NIL NIL))\r\n"
+            + t.last("OK fetched\r\n"));
+
+    const Imap::Mailbox::AbstractCache::TextFields body = Imap::Mailbox::AbstractCache::TEXT_BODY;
+    Imap::Uids result;
+
+    QCOMPARE(msg2.child(0, 0).data(RolePartData).toByteArray(), QByteArray());
+    cClient(t.mk("UID FETCH 2 (BODY.PEEK[1])\r\n"));
+    cServer("* 2 FETCH (UID 2 BODY[1] {11}\r\nhello world)\r\n" + t.last("OK fetched\r\n"));
+    QThreadPool::globalInstance()->waitForDone();
+    QCoreApplication::processEvents();
+
+    // The message is gone before the extraction of its text gets a chance to run
+    QCOMPARE(msg1.child(0, 0).data(RolePartData).toByteArray(), QByteArray());
+    cClient(t.mk("UID FETCH 1 (BODY.PEEK[1])\r\n"));
+    cServer("* 1 FETCH (UID 1 BODY[1] {11}\r\nhello again)\r\n" + t.last("OK fetched\r\n") + "* 1 EXPUNGE\r\n");
+    QThreadPool::globalInstance()->waitForDone();
+    QCoreApplication::processEvents();
+    QCOMPARE(model->rowCount(msgListA), 1);
+    QVERIFY(model->cache()->searchText(QLatin1String("a"), QLatin1String("again"), body, result));
+    QCOMPARE(result, Imap::Uids());
+    QVERIFY(model->cache()->searchText(QLatin1String("a"), QLatin1String("hello"), body, result));
+    QCOMPARE(result, Imap::Uids() << 2);
+
+    cEmpty();
+    QVERIFY(indexErrors.isEmpty());
+}
+
 TROJITA_HEADLESS_TEST(BodyPartsTest)
@@ -41,6 +41,11 @@ private slots:
 
     void testFilenameExtraction();
     void testFilenameExtraction_data();
+
+    void testMessageDataBudget();
+    void testOfflineMirror();
+    void testFullTextIndexing();
+    void testFullTextIndexingExpunged();
 };
 
 #endif
@@ -24,14 +24,50 @@
 #include "Utils/headless_test.h"
 #include "Utils/FakeCapabilitiesInjector.h"
 #include "Streams/FakeSocket.h"
+#include "Imap/Model/ImportSource.h"
 #include "Imap/Model/ItemRoles.h"
 #include "Imap/Model/MailboxTree.h"
 #include "Imap/Model/MsgListModel.h"
 #include "Imap/Model/ThreadingMsgListModel.h"
+#include "Imap/Tasks/BulkAppendTask.h"
 #include "Imap/Tasks/ObtainSynchronizedMailboxTask.h"
 
 using namespace Imap::Mailbox;
 
+namespace {
+
+/** @short Messages for the import which are already in memory
+
+An empty message stands for one which cannot be read, and a non-empty @arg endError simulates a source which breaks
+after all these messages.
+*/
+class ListImportSource : public ImportSource
+{
+public:
+    explicit ListImportSource(const QList<AppendData> &messages, const QString &endError = QString()):
+        m_messages(messages), m_endError(endError) {}
+    virtual Result next(AppendData &message)
+    {
+        if (m_messages.isEmpty()) {
+            m_errorString = m_endError;
+            return RESULT_END;
+        }
+        message = m_messages.takeFirst();
+        if (message.data.isEmpty()) {
+            m_errorString = QLatin1String("unreadable message");
+            return RESULT_SKIPPED;
+        }
+        return RESULT_MESSAGE;
+    }
+    virtual QString errorString() const { return m_errorString; }
+private:
+    QList<AppendData> m_messages;
+    QString m_endError;
+    QString m_errorString;
+};
+
+}
+
 void CopyAndFlagTest::testMoveRfc3501()
 {
     helperMove(JUST_3501);
@@ -167,4 +203,133 @@ void CopyAndFlagTest::testUpdateAllFlags()
     justKeepTask();
 }
 
+/** @short Test that a bulk import is split into several MULTIAPPEND commands which are sent at once */
+void CopyAndFlagTest::testBulkAppend()
+{
+    FakeCapabilitiesInjector injector(model);
+    injector.injectCapability(QLatin1String("MULTIAPPEND"));
+    injector.injectCapability(QLatin1String("LITERAL+"));
+    model->setProperty("trojita-imap-multiappend-messages-per-batch", 2);
+
+    QList<AppendData> messages;
+    messages << AppendData("first", QStringList() << QLatin1String("\\Seen"), QDateTime())
+             << AppendData("second", QStringList(), QDateTime())
+             << AppendData("third", QStringList(), QDateTime());
+    BulkAppendTask *task = model->importIntoMailbox(QLatin1String("a"), new ListImportSource(messages));
+    QSignalSpy progressSpy(task, SIGNAL(progress(int,int,qint64,qint64)));
+    QSignalSpy failedSpy(task, SIGNAL(appendFailed(QString,int)));
+    QSignalSpy completedSpy(task, SIGNAL(completed(Imap::Mailbox::ImapTask*)));
+    QSignalSpy taskFailedSpy(task, SIGNAL(failed(QString)));
+
+    QByteArray firstBatch = t.mk("APPEND a (\\Seen) {5+}\r\nfirst {6+}\r\nsecond\r\n");
+    QByteArray firstTag = t.last();
+    QByteArray secondBatch = t.mk("APPEND a {5+}\r\nthird\r\n");
+    QByteArray secondTag = t.last();
+    cClient(firstBatch + secondBatch);
+
+    cServer(firstTag + " OK [APPENDUID 666 10:11] appended\r\n");
+    QCOMPARE(progressSpy.size(), 1);
+    QCOMPARE(progressSpy[0][0].toInt(), 2);
+    QCOMPARE(progressSpy[0][1].toInt(), 0);
+    QCOMPARE(progressSpy[0][2].toLongLong(), qint64(11));
+    QCOMPARE(completedSpy.size(), 0);
+
+    cServer(secondTag + " NO [OVERQUOTA] too big\r\n");
+    QCOMPARE(progressSpy.size(), 2);
+    QCOMPARE(progressSpy[1][0].toInt(), 2);
+    QCOMPARE(progressSpy[1][1].toInt(), 1);
+    QCOMPARE(failedSpy.size(), 1);
+    QCOMPARE(failedSpy[0][1].toInt(), 1);
+    // Some messages are missing, so the import as a whole has failed
+    QCOMPARE(completedSpy.size(), 0);
+    QCOMPARE(taskFailedSpy.size(), 1);
+    QVERIFY(taskFailedSpy[0][0].toString().contains(QLatin1String("too big")));
+    cEmpty();
+}
+
+/** @short Without MULTIAPPEND, each message is uploaded through its own APPEND and these are pipelined */
+void CopyAndFlagTest::testBulkAppendPipelined()
+{
+    FakeCapabilitiesInjector injector(model);
+    injector.injectCapability(QLatin1String("LITERAL+"));
+    model->setProperty("trojita-imap-multiappend-messages-per-batch", 2);
+
+    QList<AppendData> messages;
+    messages << AppendData("first", QStringList() << QLatin1String("\\Seen"), QDateTime())
+             << AppendData("second", QStringList(), QDateTime())
+             << AppendData("third", QStringList(), QDateTime());
+    BulkAppendTask *task = model->importIntoMailbox(QLatin1String("a"), new ListImportSource(messages));
+    QSignalSpy progressSpy(task, SIGNAL(progress(int,int,qint64,qint64)));
+    QSignalSpy failedSpy(task, SIGNAL(appendFailed(QString,int)));
+    QSignalSpy completedSpy(task, SIGNAL(completed(Imap::Mailbox::ImapTask*)));
+
+    QByteArray first = t.mk("APPEND a (\\Seen) {5+}\r\nfirst\r\n");
+    QByteArray firstTag = t.last();
+    QByteArray second = t.mk("APPEND a {6+}\r\nsecond\r\n");
+    QByteArray secondTag = t.last();
+    QByteArray third = t.mk("APPEND a {5+}\r\nthird\r\n");
+    QByteArray thirdTag = t.last();
+    cClient(first + second + third);
+
+    cServer(firstTag + " OK appended\r\n" + secondTag + " OK appended\r\n");
+    QCOMPARE(progressSpy.size(), 2);
+    QCOMPARE(progressSpy[1][0].toInt(), 2);
+    QCOMPARE(completedSpy.size(), 0);
+
+    cServer(thirdTag + " OK appended\r\n");
+    QCOMPARE(progressSpy.size(), 3);
+    QCOMPARE(progressSpy[2][0].toInt(), 3);
+    QCOMPARE(progressSpy[2][1].toInt(), 0);
+    QCOMPARE(progressSpy[2][2].toLongLong(), qint64(16));
+    QCOMPARE(failedSpy.size(), 0);
+    QCOMPARE(completedSpy.size(), 1);
+    cEmpty();
+}
+
+/** @short Messages which cannot be read and a broken source are reported, and the import does not pretend success */
+void CopyAndFlagTest::testBulkAppendSourceErrors()
+{
+    FakeCapabilitiesInjector injector(model);
+    injector.injectCapability(QLatin1String("MULTIAPPEND"));
+    injector.injectCapability(QLatin1String("LITERAL+"));
+    model->setProperty("trojita-imap-multiappend-messages-per-batch", 2);
+
+    QList<AppendData> messages;
+    messages << AppendData("first", QStringList(), QDateTime())
+             << AppendData(QByteArray(), QStringList(), QDateTime())
+             << AppendData("second", QStringList(), QDateTime());
+    BulkAppendTask *task = model->importIntoMailbox(QLatin1String("a"),
+                                                    new ListImportSource(messages, QLatin1String("disk on fire")));
+    QSignalSpy progressSpy(task, SIGNAL(progress(int,int,qint64,qint64)));
+    QSignalSpy failedSpy(task, SIGNAL(appendFailed(QString,int)));
+    QSignalSpy completedSpy(task, SIGNAL(completed(Imap::Mailbox::ImapTask*)));
+    QSignalSpy taskFailedSpy(task, SIGNAL(failed(QString)));
+
+    // The unreadable message is skipped, and the messages after it are still uploaded
+    cClient(t.mk("APPEND a {5+}\r\nfirst {6+}\r\nsecond\r\n"));
+    QCOMPARE(failedSpy.size(), 1);
+    QCOMPARE(failedSpy[0][0].toString(), QString::fromUtf8("unreadable message"));
+    QCOMPARE(failedSpy[0][1].toInt(), 1);
+    QCOMPARE(taskFailedSpy.size(), 0);
+
+    cServer(t.last("OK appended\r\n"));
+    QCOMPARE(progressSpy.size(), 1);
+    QCOMPARE(progressSpy[0][0].toInt(), 2);
+    QCOMPARE(progressSpy[0][1].toInt(), 1);
+    QCOMPARE(completedSpy.size(), 0);
+    QCOMPARE(taskFailedSpy.size(), 1);
+    QVERIFY(taskFailedSpy[0][0].toString().contains(QLatin1String("disk on fire")));
+    cEmpty();
+
+    // A source which cannot be read at all fails the import without sending anything
+    task = model->importIntoMailbox(QLatin1String("a"), new ListImportSource(QList<AppendData>(),
+                                                                             QLatin1String("no such file")));
+    QSignalSpy completedSpy2(task, SIGNAL(completed(Imap::Mailbox::ImapTask*)));
+    QSignalSpy taskFailedSpy2(task, SIGNAL(failed(QString)));
+    cEmpty();
+    QCOMPARE(completedSpy2.size(), 0);
+    QCOMPARE(taskFailedSpy2.size(), 1);
+    QCOMPARE(taskFailedSpy2[0][0].toString(), QString::fromUtf8("no such file"));
+}
+
 TROJITA_HEADLESS_TEST(CopyAndFlagTest)
@@ -40,6 +40,9 @@ private slots:
     void testMoveRfcMove();
 
     void testUpdateAllFlags();
+    void testBulkAppend();
+    void testBulkAppendPipelined();
+    void testBulkAppendSourceErrors();
 };
 
 #endif
@@ -279,4 +279,32 @@ void ImapModelIdleTest::testIdleMailboxChange()
 }
 
 
+/** @short The IDLE is started from a timer, yet its tagged response shall still be routed straight to the right task */
+void ImapModelIdleTest::testIdleRouting()
+{
+    model->setProperty("trojita-imap-idle-delayedEnter", QVariant(30));
+    model->setProperty("trojita-imap-idle-renewal", QVariant(10));
+    FakeCapabilitiesInjector injector(model);
+    injector.injectCapability(QLatin1String("IDLE"));
+    existsA = 3;
+    uidValidityA = 6;
+    uidMapA << 1 << 7 << 9;
+    uidNextA = 16;
+    helperSyncAWithMessagesEmptyState();
+    QVERIFY(SOCK->writtenStuff().isEmpty());
+    waitForIdle();
+    SOCK->fakeReading(QByteArray("+ blah\r\n"));
+    QTest::qWait(50);
+    QCOMPARE(SOCK->writtenStuff(), QByteArray("DONE\r\n"));
+
+    Imap::Mailbox::ResponseRoutingStats before = model->responseRoutingStats();
+    SOCK->fakeReading(t.last("OK done\r\n"));
+    waitForIdle();
+    Imap::Mailbox::ResponseRoutingStats after = model->responseRoutingStats();
+    QCOMPARE(after.taggedHits, before.taggedHits + 1);
+    QCOMPARE(after.fullScans, before.fullScans);
+    QCOMPARE(after.misses, before.misses);
+    QVERIFY(errorSpy->isEmpty());
+}
+
 TROJITA_HEADLESS_TEST( ImapModelIdleTest )
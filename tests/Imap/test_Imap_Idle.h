@@ -39,6 +39,7 @@ private slots:
     void testIdleSlowResponses();
     void testIdleNoPerpetuateRenewal();
     void testIdleMailboxChange();
+    void testIdleRouting();
 };
 
 #endif
@@ -22,6 +22,11 @@
 
 #include <algorithm>
 #include <QtTest>
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#endif
 #include "test_Imap_SelectedMailboxUpdates.h"
 #include "Imap/Model/ItemRoles.h"
 #include "Imap/Parser/Uids.h"
@@ -1021,4 +1026,73 @@ void ImapModelSelectedMailboxUpdatesTest::helperDataChangedUidNonZero(const QMod
     }
 }
 
+/** @short Make sure that the responses get routed to the right tasks without asking all of them */
+void ImapModelSelectedMailboxUpdatesTest::testResponseRouting()
+{
+    existsA = 3;
+    uidValidityA = 666;
+    uidMapA << 3 << 9 << 10;
+    uidNextA = 33;
+    helperSyncAWithMessagesEmptyState();
+    cEmpty();
+
+    Imap::Mailbox::ResponseRoutingStats before = model->responseRoutingStats();
+
+    // An unsolicited update goes straight to the task which keeps the mailbox open
+    cServer("* 2 FETCH (FLAGS (\\Seen))\r\n");
+    Imap::Mailbox::ResponseRoutingStats afterFlags = model->responseRoutingStats();
+    QCOMPARE(afterFlags.untaggedHits, before.untaggedHits + 1);
+    QCOMPARE(afterFlags.fullScans, before.fullScans);
+    QCOMPARE(afterFlags.misses, before.misses);
+
+    // The data go to the mailbox keeper while the tagged OK belongs to the task which has asked for them
+    requestAndCheckSubject(0, "blah");
+    Imap::Mailbox::ResponseRoutingStats afterFetch = model->responseRoutingStats();
+    QCOMPARE(afterFetch.taggedHits, afterFlags.taggedHits + 1);
+    QCOMPARE(afterFetch.untaggedHits, afterFlags.untaggedHits + 1);
+    QCOMPARE(afterFetch.fullScans, afterFlags.fullScans);
+    QCOMPARE(afterFetch.misses, afterFlags.misses);
+
+    justKeepTask();
+    cEmpty();
+}
+
+/** @short Check that the finished tasks can be exported for viewing in Chrome's about:tracing */
+void ImapModelSelectedMailboxUpdatesTest::testTaskTracing()
+{
+    existsA = 3;
+    uidValidityA = 666;
+    uidMapA << 3 << 9 << 10;
+    uidNextA = 33;
+    helperSyncAWithMessagesEmptyState();
+    requestAndCheckSubject(0, "blah");
+    justKeepTask();
+    cEmpty();
+
+    QByteArray json = model->taskTraceJson();
+    QVERIFY(json.startsWith("{\"traceEvents\":["));
+    QVERIFY(json.contains("\"name\":\"Imap::Mailbox::ObtainSynchronizedMailboxTask\""));
+    QVERIFY(json.contains("\"name\":\"Imap::Mailbox::FetchMsgMetadataTask\""));
+    QVERIFY(!model->taskTraceJson(uint(-1)).contains("FetchMsgMetadataTask"));
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
+    QJsonParseError error;
+    QJsonDocument doc = QJsonDocument::fromJson(json, &error);
+    QCOMPARE(error.error, QJsonParseError::NoError);
+    bool found = false;
+    Q_FOREACH(const QJsonValue &value, doc.object().value(QLatin1String("traceEvents")).toArray()) {
+        QJsonObject event = value.toObject();
+        if (event.value(QLatin1String("name")).toString() != QLatin1String("Imap::Mailbox::FetchMsgMetadataTask")
+                || event.value(QLatin1String("ph")).toString() != QLatin1String("b"))
+            continue;
+        found = true;
+        QJsonObject args = event.value(QLatin1String("args")).toObject();
+        QVERIFY(args.value(QLatin1String("bytesIn")).toDouble() > 0);
+        QVERIFY(args.value(QLatin1String("bytesOut")).toDouble() > 0);
+        QCOMPARE(args.value(QLatin1String("failed")).toBool(), false);
+    }
+    QVERIFY(found);
+#endif
+}
+
 TROJITA_HEADLESS_TEST( ImapModelSelectedMailboxUpdatesTest )
@@ -49,6 +49,8 @@ private slots:
     void testFlagsRecalcOnExpunge();
     void testUid0();
     void testMarkAllConcurrentArrival();
+    void testResponseRouting();
+    void testTaskTracing();
 
     void helperDataChangedUidNonZero(const QModelIndex &a, const QModelIndex &b);
 private:
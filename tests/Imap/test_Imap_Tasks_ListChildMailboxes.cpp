@@ -24,6 +24,7 @@
 #include "test_Imap_Tasks_ListChildMailboxes.h"
 #include "Utils/headless_test.h"
 #include "Common/MetaTypes.h"
+#include "Utils/FakeCapabilitiesInjector.h"
 #include "Streams/FakeSocket.h"
 #include "Imap/Model/ItemRoles.h"
 #include "Imap/Model/MemoryCache.h"
@@ -230,4 +231,135 @@ void ImapModelListChildMailboxesTest::testNoStatusForCachedItems()
 }
 
 
+/** @short Make sure that the lookup of mailboxes by their names works even with huge numbers of folders */
+void ImapModelListChildMailboxesTest::testMailboxLookupByName()
+{
+    using namespace Imap::Mailbox;
+
+    const int count = 20000;
+    QByteArray response;
+    for (int i = 0; i < count; ++i) {
+        response += "* LIST (\\HasNoChildren) \".\" f" + QByteArray::number(i) + "\r\n";
+    }
+    response += "* LIST (\\HasChildren) \".\" nested\r\n";
+
+    QCOMPARE(model->rowCount(QModelIndex()), 1);
+    cClient(t.mk("LIST \"\" \"%\"\r\n"));
+    cServer(response + t.last("OK listed\r\n"));
+    QCOMPARE(model->rowCount(QModelIndex()), count + 2);
+
+    QModelIndex nested = model->mailboxIndexByName(QLatin1String("nested"));
+    QVERIFY(nested.isValid());
+    QCOMPARE(nested.data(RoleMailboxName).toString(), QString::fromUtf8("nested"));
+    model->rowCount(nested);
+    cClient(t.mk("LIST \"\" \"nested.%\"\r\n"));
+    cServer("* LIST (\\HasNoChildren) \".\" nested.child\r\n" + t.last("OK listed\r\n"));
+    QCOMPARE(model->rowCount(nested), 2);
+
+    QBENCHMARK {
+        for (int i = 0; i < count; i += 97) {
+            QString name = QString::fromUtf8("f%1").arg(i);
+            QModelIndex index = model->mailboxIndexByName(name);
+            QVERIFY(index.isValid());
+            QCOMPARE(index.data(RoleMailboxName).toString(), name);
+        }
+    }
+    QCOMPARE(model->mailboxIndexByName(QLatin1String("nested.child")).data(RoleMailboxName).toString(),
+             QString::fromUtf8("nested.child"));
+    QVERIFY(!model->mailboxIndexByName(QString::fromUtf8("f%1").arg(count)).isValid());
+    QVERIFY(!model->mailboxIndexByName(QString()).isValid());
+
+    // Deleted mailboxes shall disappear from the index
+    model->deleteMailbox(QLatin1String("nested.child"));
+    cClient(t.mk("DELETE nested.child\r\n"));
+    cServer(t.last("OK deleted\r\n"));
+    QVERIFY(!model->mailboxIndexByName(QLatin1String("nested.child")).isValid());
+    QVERIFY(model->mailboxIndexByName(QLatin1String("nested")).isValid());
+
+    // The whole tree gets replaced, including the nested mailboxes
+    model->reloadMailboxList();
+    cClient(t.mk("LIST \"\" \"%\"\r\n"));
+    cServer("* LIST (\\HasNoChildren) \".\" f1\r\n" + t.last("OK listed\r\n"));
+    QCOMPARE(model->rowCount(QModelIndex()), 2);
+    QVERIFY(model->mailboxIndexByName(QLatin1String("f1")).isValid());
+    QVERIFY(!model->mailboxIndexByName(QLatin1String("f2")).isValid());
+    QVERIFY(!model->mailboxIndexByName(QLatin1String("nested")).isValid());
+    cEmpty();
+}
+
+/** @short List two mailboxes and obtain their message counts */
+void ImapModelListChildMailboxesTest::helperListAndCountAB()
+{
+    QCOMPARE(model->rowCount(QModelIndex()), 1);
+    cClient(t.mk("LIST \"\" \"%\"\r\n"));
+    cServer("* LIST (\\HasNoChildren) \".\" a\r\n"
+            "* LIST (\\HasNoChildren) \".\" b\r\n"
+            + t.last("OK List done.\r\n"));
+    QCOMPARE(model->rowCount(QModelIndex()), 3);
+    idxA = model->index(1, 0, QModelIndex());
+    idxB = model->index(2, 0, QModelIndex());
+    QCOMPARE(idxA.data(Imap::Mailbox::RoleTotalMessageCount), QVariant());
+    QCOMPARE(idxB.data(Imap::Mailbox::RoleTotalMessageCount), QVariant());
+    QByteArray statusA = t.mk("STATUS a (MESSAGES UNSEEN RECENT)\r\n");
+    QByteArray respA = t.last("OK status\r\n");
+    QByteArray statusB = t.mk("STATUS b (MESSAGES UNSEEN RECENT)\r\n");
+    QByteArray respB = t.last("OK status\r\n");
+    cClient(statusA + statusB);
+    cServer("* STATUS a (MESSAGES 1 UNSEEN 0 RECENT 0)\r\n" + respA +
+            "* STATUS b (MESSAGES 2 UNSEEN 0 RECENT 0)\r\n" + respB);
+    QCOMPARE(idxA.data(Imap::Mailbox::RoleTotalMessageCount).toInt(), 1);
+    QCOMPARE(idxB.data(Imap::Mailbox::RoleTotalMessageCount).toInt(), 2);
+    cEmpty();
+}
+
+/** @short Without LIST-STATUS, the periodic refresh pipelines all STATUS commands from a single task */
+void ImapModelListChildMailboxesTest::testRefreshNumbersPipelined()
+{
+    helperListAndCountAB();
+
+    model->invalidateAllMessageCounts();
+    QByteArray statusA = t.mk("STATUS a (MESSAGES UNSEEN RECENT)\r\n");
+    QByteArray respA = t.last("OK status\r\n");
+    QByteArray statusB = t.mk("STATUS b (MESSAGES UNSEEN RECENT)\r\n");
+    QByteArray respB = t.last("OK status\r\n");
+    cClient(statusA + statusB);
+    cServer("* STATUS a (MESSAGES 3 UNSEEN 1 RECENT 0)\r\n" + respA +
+            "* STATUS b (MESSAGES 4 UNSEEN 0 RECENT 0)\r\n" + respB);
+    QCOMPARE(idxA.data(Imap::Mailbox::RoleTotalMessageCount).toInt(), 3);
+    QCOMPARE(idxA.data(Imap::Mailbox::RoleUnreadMessageCount).toInt(), 1);
+    QCOMPARE(idxB.data(Imap::Mailbox::RoleTotalMessageCount).toInt(), 4);
+    cEmpty();
+}
+
+/** @short With LIST-STATUS, a single LIST refreshes the whole batch */
+void ImapModelListChildMailboxesTest::testRefreshNumbersListStatus()
+{
+    helperListAndCountAB();
+
+    FakeCapabilitiesInjector injector(model);
+    injector.injectCapability(QLatin1String("LIST-EXTENDED"));
+    injector.injectCapability(QLatin1String("LIST-STATUS"));
+    model->invalidateAllMessageCounts();
+    cClient(t.mk("LIST \"\" (a b) RETURN (STATUS (MESSAGES UNSEEN RECENT))\r\n"));
+    // The server does not provide STATUS for mailbox b...
+    cServer("* LIST () \".\" a\r\n"
+            "* STATUS a (MESSAGES 3 UNSEEN 1 RECENT 0)\r\n"
+            "* LIST (\\NoSelect) \".\" b\r\n"
+            + t.last("OK listed\r\n"));
+    QCOMPARE(idxA.data(Imap::Mailbox::RoleTotalMessageCount).toInt(), 3);
+    // ...so it gets asked separately
+    cClient(t.mk("STATUS b (MESSAGES UNSEEN RECENT)\r\n"));
+    cServer("* STATUS b (MESSAGES 4 UNSEEN 0 RECENT 0)\r\n" + t.last("OK status\r\n"));
+    QCOMPARE(idxB.data(Imap::Mailbox::RoleTotalMessageCount).toInt(), 4);
+    cEmpty();
+
+    // The LIST responses must not have leaked into the next listing
+    model->reloadMailboxList();
+    cClient(t.mk("LIST \"\" \"%\" RETURN (SUBSCRIBED CHILDREN STATUS (MESSAGES UNSEEN RECENT))\r\n"));
+    cServer("* LIST (\\HasNoChildren) \".\" a\r\n"
+            + t.last("OK List done.\r\n"));
+    QCOMPARE(model->rowCount(QModelIndex()), 2);
+    cEmpty();
+}
+
 TROJITA_HEADLESS_TEST( ImapModelListChildMailboxesTest )
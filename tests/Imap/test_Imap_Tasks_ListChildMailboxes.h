@@ -44,6 +44,14 @@ private slots:
     void testNoStatusForCachedItems();
 
     void testFailingList();
+
+    void testMailboxLookupByName();
+
+    void testRefreshNumbersPipelined();
+    void testRefreshNumbersListStatus();
+
+private:
+    void helperListAndCountAB();
 };
 
 #endif
@@ -625,6 +625,117 @@ void ImapModelObtainSynchronizedMailboxTest::testCacheNoChange()
     justKeepTask();
 }
 
+/** @short Without CONDSTORE, the FLAGS of big mailboxes are synced in windows, the most interesting one first */
+void ImapModelObtainSynchronizedMailboxTest::testWindowedFlagSync()
+{
+    model->setProperty("trojita-imap-flags-sync-window", 4);
+    QSignalSpy progressSpy(model, SIGNAL(mailboxFlagsSyncingProgress(QModelIndex,int,int)));
+
+    Imap::Mailbox::SyncState sync;
+    sync.setExists(10);
+    sync.setUidValidity(666);
+    sync.setUidNext(30);
+    Imap::Uids uidMap;
+    for (uint i = 1; i <= sync.exists(); ++i) {
+        uidMap << i * 2;
+    }
+    model->cache()->setMailboxSyncState("a", sync);
+    model->cache()->setUidMapping("a", uidMap);
+    QCOMPARE(model->rowCount(msgListA), 10);
+    cClient(t.mk("SELECT a\r\n"));
+    cServer("* 10 EXISTS\r\n"
+            "* OK [UIDVALIDITY 666] .\r\n"
+            "* OK [UIDNEXT 30] .\r\n"
+            "* OK [UNSEEN 2] .\r\n");
+    cServer(t.last("OK selected\r\n"));
+
+    // The window around the first unseen message goes first
+    cClient(t.mk("UID FETCH 2:8 (FLAGS)\r\n"));
+    cServer("* 1 FETCH (UID 2 FLAGS (\\Seen))\r\n"
+            "* 2 FETCH (UID 4 FLAGS ())\r\n"
+            "* 3 FETCH (UID 6 FLAGS ())\r\n"
+            "* 4 FETCH (UID 8 FLAGS (\\Seen))\r\n");
+    cServer(t.last("OK fetch\r\n"));
+    // The mailbox is usable now, the rest gets synced in background, starting with the newest messages
+    QCOMPARE(progressSpy.size(), 1);
+    QCOMPARE(progressSpy.last()[1].toInt(), 1);
+    QCOMPARE(progressSpy.last()[2].toInt(), 3);
+    cClient(t.mk("UID FETCH 14:20 (FLAGS)\r\n"));
+    cServer("* 7 FETCH (UID 14 FLAGS (\\Seen))\r\n"
+            "* 8 FETCH (UID 16 FLAGS (\\Seen))\r\n"
+            "* 9 FETCH (UID 18 FLAGS (\\Seen))\r\n"
+            "* 10 FETCH (UID 20 FLAGS (\\Seen))\r\n");
+    cServer(t.last("OK fetch\r\n"));
+    QCOMPARE(progressSpy.size(), 2);
+    QCOMPARE(progressSpy.last()[1].toInt(), 2);
+    cClient(t.mk("UID FETCH 10:12 (FLAGS)\r\n"));
+    cServer("* 5 FETCH (UID 10 FLAGS (\\Seen))\r\n"
+            "* 6 FETCH (UID 12 FLAGS (foo))\r\n");
+    cServer(t.last("OK fetch\r\n"));
+    QCOMPARE(progressSpy.size(), 3);
+    QCOMPARE(progressSpy.last()[1].toInt(), 3);
+    QCOMPARE(progressSpy.last()[2].toInt(), 3);
+    cEmpty();
+
+    QCOMPARE(model->cache()->msgFlags("a", 4), QStringList());
+    QCOMPARE(model->cache()->msgFlags("a", 12), QStringList() << "foo");
+    QCOMPARE(model->cache()->msgFlags("a", 20), QStringList() << "\\Seen");
+    QCOMPARE(idxA.data(Imap::Mailbox::RoleUnreadMessageCount).toInt(), 3);
+    justKeepTask();
+}
+
+/** @short A failed window of the windowed flag resync is skipped, the rest of the resync goes on */
+void ImapModelObtainSynchronizedMailboxTest::testWindowedFlagSyncFailure()
+{
+    model->setProperty("trojita-imap-flags-sync-window", 4);
+    QSignalSpy progressSpy(model, SIGNAL(mailboxFlagsSyncingProgress(QModelIndex,int,int)));
+
+    Imap::Mailbox::SyncState sync;
+    sync.setExists(10);
+    sync.setUidValidity(666);
+    sync.setUidNext(30);
+    Imap::Uids uidMap;
+    for (uint i = 1; i <= sync.exists(); ++i) {
+        uidMap << i * 2;
+    }
+    model->cache()->setMailboxSyncState("a", sync);
+    model->cache()->setUidMapping("a", uidMap);
+    model->cache()->setMsgFlags("a", 16, QStringList() << "cached");
+    QCOMPARE(model->rowCount(msgListA), 10);
+    cClient(t.mk("SELECT a\r\n"));
+    cServer("* 10 EXISTS\r\n"
+            "* OK [UIDVALIDITY 666] .\r\n"
+            "* OK [UIDNEXT 30] .\r\n"
+            "* OK [UNSEEN 2] .\r\n");
+    cServer(t.last("OK selected\r\n"));
+    cClient(t.mk("UID FETCH 2:8 (FLAGS)\r\n"));
+    cServer("* 1 FETCH (UID 2 FLAGS (\\Seen))\r\n"
+            "* 2 FETCH (UID 4 FLAGS ())\r\n"
+            "* 3 FETCH (UID 6 FLAGS ())\r\n"
+            "* 4 FETCH (UID 8 FLAGS (\\Seen))\r\n");
+    cServer(t.last("OK fetch\r\n"));
+
+    // The server refuses one of the background windows; that's no reason for dropping the mailbox
+    cClient(t.mk("UID FETCH 14:20 (FLAGS)\r\n"));
+    cServer(t.last("NO go away\r\n"));
+    QCOMPARE(progressSpy.size(), 2);
+    QCOMPARE(progressSpy.last()[1].toInt(), 2);
+    cClient(t.mk("UID FETCH 10:12 (FLAGS)\r\n"));
+    cServer("* 5 FETCH (UID 10 FLAGS (\\Seen))\r\n"
+            "* 6 FETCH (UID 12 FLAGS (foo))\r\n");
+    cServer(t.last("OK fetch\r\n"));
+    QCOMPARE(progressSpy.size(), 3);
+    QCOMPARE(progressSpy.last()[1].toInt(), 3);
+    QCOMPARE(progressSpy.last()[2].toInt(), 3);
+    cEmpty();
+
+    // The skipped window keeps what was known before
+    QCOMPARE(model->cache()->msgFlags("a", 16), QStringList() << "cached");
+    QCOMPARE(model->cache()->msgFlags("a", 12), QStringList() << "foo");
+    QVERIFY(errorSpy->isEmpty());
+    justKeepTask();
+}
+
 /** @short Test UIDVALIDITY changes since the last cached state */
 void ImapModelObtainSynchronizedMailboxTest::testCacheUidValidity()
 {
@@ -979,6 +1090,263 @@ void ImapModelObtainSynchronizedMailboxTest::helperCacheExpunges(const ESearchMo
     justKeepTask();
 }
 
+/** @short With ESEARCH, deletions and arrivals in a big mailbox are found without downloading all UIDs */
+void ImapModelObtainSynchronizedMailboxTest::testCachePartitionedUidSync()
+{
+    FakeCapabilitiesInjector injector(model);
+    injector.injectCapability("ESEARCH");
+    model->setProperty("trojita-imap-uid-partition-threshold", 1000);
+
+    Imap::Mailbox::SyncState sync;
+    sync.setExists(1000);
+    sync.setUidValidity(666);
+    sync.setUidNext(1001);
+    Imap::Uids uidMap;
+    for (uint i = 1; i <= sync.exists(); ++i) {
+        uidMap << i;
+    }
+    model->cache()->setMailboxSyncState("a", sync);
+    model->cache()->setUidMapping("a", uidMap);
+    QCOMPARE(model->rowCount(msgListA), 1000);
+    cClient(t.mk("SELECT a\r\n"));
+    // One message got deleted and another one has arrived
+    cServer("* 1000 EXISTS\r\n"
+            "* OK [UIDVALIDITY 666] .\r\n"
+            "* OK [UIDNEXT 1002] .\r\n");
+    cServer(t.last("OK selected\r\n"));
+
+    QByteArray checkAll = t.mk("UID SEARCH RETURN (MIN MAX COUNT) UID 1:1000\r\n");
+    QByteArray checkAllTag = t.last();
+    QByteArray arrivals = t.mk("UID SEARCH RETURN (ALL) UID 1001:*\r\n");
+    QByteArray arrivalsTag = t.last();
+    cClient(checkAll + arrivals);
+    cServer("* ESEARCH (TAG " + checkAllTag + ") UID MIN 1 MAX 1000 COUNT 999\r\n" + checkAllTag + " OK searched\r\n"
+            "* ESEARCH (TAG " + arrivalsTag + ") UID ALL 1001\r\n" + arrivalsTag + " OK searched\r\n");
+
+    // The range with a mismatch is split into smaller parts
+    QByteArray checks, responses, downloadTag;
+    for (int i = 0; i < 8; ++i) {
+        const int first = i * 125 + 1;
+        const int last = (i + 1) * 125;
+        checks += t.mk(QString::fromUtf8("UID SEARCH RETURN (MIN MAX COUNT) UID %1:%2\r\n")
+                       .arg(QString::number(first), QString::number(last)).toUtf8().constData());
+        responses += "* ESEARCH (TAG " + t.last() + ") UID MIN " + QByteArray::number(first) + " MAX "
+                + QByteArray::number(last) + " COUNT " + QByteArray::number(i == 3 ? 124 : 125) + "\r\n"
+                + t.last() + " OK searched\r\n";
+    }
+    cClient(checks);
+    cServer(responses);
+
+    // Only the UIDs from the range which has changed get downloaded
+    cClient(t.mk("UID SEARCH RETURN (ALL) UID 376:500\r\n"));
+    cServer("* ESEARCH (TAG " + t.last() + ") UID ALL 376:449,451:500\r\n" + t.last() + " OK searched\r\n");
+
+    uidMap.remove(449);
+    uidMap << 1001;
+    QByteArray flags;
+    for (int i = 1; i <= 1000; ++i) {
+        flags += "* " + QByteArray::number(i) + " FETCH (FLAGS (\\Seen))\r\n";
+    }
+    cClient(t.mk("FETCH 1:1000 (FLAGS)\r\n"));
+    cServer(flags + t.last("OK fetch\r\n"));
+    cEmpty();
+    QCOMPARE(model->cache()->uidMapping("a"), uidMap);
+    QCOMPARE(model->rowCount(msgListA), 1000);
+    QCOMPARE(msgListA.child(448, 0).data(Imap::Mailbox::RoleMessageUid).toUInt(), 449u);
+    QCOMPARE(msgListA.child(449, 0).data(Imap::Mailbox::RoleMessageUid).toUInt(), 451u);
+    QCOMPARE(msgListA.child(999, 0).data(Imap::Mailbox::RoleMessageUid).toUInt(), 1001u);
+    justKeepTask();
+}
+
+/** @short Changes to the mailbox while the ranges are being compared make the partitioned UID sync fall back to a full one */
+void ImapModelObtainSynchronizedMailboxTest::testCachePartitionedUidSyncInterrupted()
+{
+    FakeCapabilitiesInjector injector(model);
+    injector.injectCapability("ESEARCH");
+    model->setProperty("trojita-imap-uid-partition-threshold", 1000);
+
+    Imap::Mailbox::SyncState sync;
+    sync.setExists(1000);
+    sync.setUidValidity(666);
+    sync.setUidNext(1001);
+    Imap::Uids uidMap;
+    for (uint i = 1; i <= sync.exists(); ++i) {
+        uidMap << i;
+    }
+    model->cache()->setMailboxSyncState("a", sync);
+    model->cache()->setUidMapping("a", uidMap);
+    QCOMPARE(model->rowCount(msgListA), 1000);
+    cClient(t.mk("SELECT a\r\n"));
+    cServer("* 1000 EXISTS\r\n"
+            "* OK [UIDVALIDITY 666] .\r\n"
+            "* OK [UIDNEXT 1002] .\r\n");
+    cServer(t.last("OK selected\r\n"));
+
+    QByteArray checkAll = t.mk("UID SEARCH RETURN (MIN MAX COUNT) UID 1:1000\r\n");
+    QByteArray checkAllTag = t.last();
+    QByteArray arrivals = t.mk("UID SEARCH RETURN (ALL) UID 1001:*\r\n");
+    QByteArray arrivalsTag = t.last();
+    cClient(checkAll + arrivals);
+    cServer("* ESEARCH (TAG " + checkAllTag + ") UID MIN 1 MAX 1000 COUNT 999\r\n" + checkAllTag + " OK searched\r\n"
+            "* ESEARCH (TAG " + arrivalsTag + ") UID ALL 1001\r\n" + arrivalsTag + " OK searched\r\n");
+
+    QByteArray checks, responses;
+    for (int i = 0; i < 8; ++i) {
+        const int first = i * 125 + 1;
+        const int last = (i + 1) * 125;
+        checks += t.mk(QString::fromUtf8("UID SEARCH RETURN (MIN MAX COUNT) UID %1:%2\r\n")
+                       .arg(QString::number(first), QString::number(last)).toUtf8().constData());
+        responses += "* ESEARCH (TAG " + t.last() + ") UID MIN " + QByteArray::number(first) + " MAX "
+                + QByteArray::number(last) + " COUNT " + QByteArray::number(i == 0 || i == 3 ? 124 : 125) + "\r\n"
+                + t.last() + " OK searched\r\n";
+    }
+    cClient(checks);
+    // Another message gets deleted and a new one arrives before the server gets to answer the checks of the smaller ranges
+    cServer("* 10 EXPUNGE\r\n"
+            "* 1000 EXISTS\r\n");
+    cServer(responses);
+
+    // The results of the range checks cannot be trusted anymore, so no ranges get downloaded
+    uidMap.clear();
+    for (uint i = 1; i <= 1002; ++i) {
+        if (i != 10 && i != 450)
+            uidMap << i;
+    }
+    cClient(t.mk("UID SEARCH RETURN (ALL) ALL\r\n"));
+    cServer("* ESEARCH (TAG " + t.last() + ") UID ALL 1:9,11:449,451:1002\r\n" + t.last() + " OK searched\r\n");
+
+    QByteArray flags;
+    for (int i = 1; i <= 1000; ++i) {
+        flags += "* " + QByteArray::number(i) + " FETCH (FLAGS (\\Seen))\r\n";
+    }
+    cClient(t.mk("FETCH 1:1000 (FLAGS)\r\n"));
+    cServer(flags + t.last("OK fetch\r\n"));
+    cEmpty();
+    QCOMPARE(model->cache()->uidMapping("a"), uidMap);
+    QCOMPARE(model->rowCount(msgListA), 1000);
+    QCOMPARE(msgListA.child(9, 0).data(Imap::Mailbox::RoleMessageUid).toUInt(), 11u);
+    QCOMPARE(msgListA.child(999, 0).data(Imap::Mailbox::RoleMessageUid).toUInt(), 1002u);
+    QVERIFY(errorSpy->isEmpty());
+    justKeepTask();
+}
+
+/** @short Make sure that the background work does not steal the connection of the mailbox which the user is looking at */
+void ImapModelObtainSynchronizedMailboxTest::testConnectionPool()
+{
+    model->setConnectionLimits(1, 2);
+    helperSyncBNoMessages();
+    QPointer<Streams::Socket> foregroundSocket(factory->lastSocket());
+
+    // The mailbox B is in the foreground, so asking for a STATUS of another mailbox opens a new connection
+    QCOMPARE(idxC.data(Imap::Mailbox::RoleTotalMessageCount), QVariant());
+    QVERIFY(factory->lastSocket() != foregroundSocket.data());
+    TagGenerator t2;
+    cClient(t2.mk("STATUS c (MESSAGES UNSEEN RECENT)\r\n"));
+    cServer("* STATUS c (MESSAGES 3 UNSEEN 0 RECENT 0)\r\n" + t2.last("OK status\r\n"));
+    QCOMPARE(idxC.data(Imap::Mailbox::RoleTotalMessageCount), QVariant(3));
+
+    // The background connection is idle now, so it gets reused
+    QPointer<Streams::Socket> backgroundSocket(factory->lastSocket());
+    QCOMPARE(idxA.data(Imap::Mailbox::RoleTotalMessageCount), QVariant());
+    QCOMPARE(factory->lastSocket(), backgroundSocket.data());
+    cClient(t2.mk("STATUS a (MESSAGES UNSEEN RECENT)\r\n"));
+    cServer("* STATUS a (MESSAGES 1 UNSEEN 1 RECENT 0)\r\n" + t2.last("OK status\r\n"));
+    QCOMPARE(idxA.data(Imap::Mailbox::RoleTotalMessageCount), QVariant(1));
+    cEmpty();
+
+    // Nothing went over the foreground connection
+    QVERIFY(foregroundSocket);
+    QCOMPARE(static_cast<Streams::FakeSocket *>(foregroundSocket.data())->writtenStuff(), QByteArray());
+}
+
+/** @short Make sure that a flood of responses is processed in several turns of the event loop, the foreground connection first */
+void ImapModelObtainSynchronizedMailboxTest::testResponseProcessingBudget()
+{
+    model->setConnectionLimits(1, 2);
+    helperSyncBNoMessages();
+    QPointer<Streams::Socket> foregroundSocket(factory->lastSocket());
+
+    // Get the numbers of two mailboxes through a background connection
+    QCOMPARE(idxC.data(Imap::Mailbox::RoleTotalMessageCount), QVariant());
+    QVERIFY(factory->lastSocket() != foregroundSocket.data());
+    QPointer<Streams::Socket> backgroundSocket(factory->lastSocket());
+    TagGenerator t2;
+    cClient(t2.mk("STATUS c (MESSAGES UNSEEN RECENT)\r\n"));
+    cServer("* STATUS c (MESSAGES 0 UNSEEN 0 RECENT 0)\r\n" + t2.last("OK status\r\n"));
+    QCOMPARE(idxA.data(Imap::Mailbox::RoleTotalMessageCount), QVariant());
+    cClient(t2.mk("STATUS a (MESSAGES UNSEEN RECENT)\r\n"));
+    cServer("* STATUS a (MESSAGES 0 UNSEEN 0 RECENT 0)\r\n" + t2.last("OK status\r\n"));
+    cEmpty();
+
+    model->setResponseProcessingBudget(1);
+
+    // Both connections get flooded with updates, the background one slightly sooner
+    const int num = 5000;
+    QByteArray background, foreground;
+    for (int i = 1; i <= num; ++i) {
+        background += "* STATUS c (MESSAGES " + QByteArray::number(i) + ")\r\n";
+        foreground += "* STATUS a (MESSAGES " + QByteArray::number(i) + ")\r\n";
+    }
+    static_cast<Streams::FakeSocket *>(backgroundSocket.data())->fakeReading(background);
+    static_cast<Streams::FakeSocket *>(foregroundSocket.data())->fakeReading(foreground);
+
+    bool seenPartialTurn = false;
+    for (int i = 0; i < 10 * num; ++i) {
+        QCoreApplication::processEvents();
+        int foregroundDone = idxA.data(Imap::Mailbox::RoleTotalMessageCount).toInt();
+        int backgroundDone = idxC.data(Imap::Mailbox::RoleTotalMessageCount).toInt();
+        if (foregroundDone > 0 && foregroundDone < num) {
+            // The GUI got a chance to run before all of the responses were processed...
+            seenPartialTurn = true;
+            // ...and the connection of the mailbox which the user is looking at gets served before the other one
+            QVERIFY(backgroundDone < foregroundDone);
+        }
+        if (foregroundDone == num && backgroundDone == num)
+            break;
+    }
+    QVERIFY(seenPartialTurn);
+    QCOMPARE(idxA.data(Imap::Mailbox::RoleTotalMessageCount), QVariant(num));
+    QCOMPARE(idxC.data(Imap::Mailbox::RoleTotalMessageCount), QVariant(num));
+
+    cEmpty();
+    QVERIFY(foregroundSocket);
+    QCOMPARE(static_cast<Streams::FakeSocket *>(foregroundSocket.data())->writtenStuff(), QByteArray());
+    QVERIFY(errorSpy->isEmpty());
+}
+
+/** @short Make sure that the envelopes of messages which the user has scrolled past do not delay the visible ones */
+void ImapModelObtainSynchronizedMailboxTest::testVisibleMessagesFirst()
+{
+    initialMessages(10);
+    // No automatic preloading, just what the view asks for
+    LibMailboxSync::setModelNetworkPolicy(model, Imap::Mailbox::NETWORK_EXPENSIVE);
+    model->setProperty("trojita-imap-preload-msg-metadata", 1);
+
+    // The view has shown the first few messages while scrolling...
+    for (int i = 0; i < 5; ++i) {
+        QCOMPARE(msgListA.child(i, 0).data(Imap::Mailbox::RoleMessageSubject).toString(), QString());
+    }
+    // ...and it has stopped at the very end of the list
+    QModelIndexList visible;
+    visible << msgListA.child(8, 0) << msgListA.child(9, 0);
+    Q_FOREACH(const QModelIndex &index, visible) {
+        QCOMPARE(index.data(Imap::Mailbox::RoleMessageSubject).toString(), QString());
+    }
+    model->setVisibleMessages(visible);
+
+    cClient(t.mk("UID FETCH 9:10 (" FETCH_METADATA_ITEMS ")\r\n"));
+    cServer(helperCreateTrivialEnvelope(9, 9, QLatin1String("subject 9")) +
+            helperCreateTrivialEnvelope(10, 10, QLatin1String("subject 10")) +
+            t.last("OK fetched\r\n"));
+    QCOMPARE(msgListA.child(8, 0).data(Imap::Mailbox::RoleMessageSubject).toString(), QString::fromUtf8("subject 9"));
+    QCOMPARE(msgListA.child(9, 0).data(Imap::Mailbox::RoleMessageSubject).toString(), QString::fromUtf8("subject 10"));
+    cEmpty();
+
+    // The requests for the rest were dropped, so they get requested once they are shown again
+    requestAndCheckSubject(0, "subject 1");
+    justKeepTask();
+}
+
 /** @short Test two expunges, once during normal sync and then once again during the UID syncing */
 void ImapModelObtainSynchronizedMailboxTest::testCacheExpungesDuringUid()
 {
@@ -58,6 +58,8 @@ private slots:
     void testMisingUidNextLess();
     void testReloadReadsFromCache();
     void testCacheNoChange();
+    void testWindowedFlagSync();
+    void testWindowedFlagSyncFailure();
     void testCacheUidValidity();
     void testCacheArrivals();
     void testCacheArrivalRaceDuringUid();
@@ -66,6 +68,11 @@ private slots:
     void testCacheArrivalRaceDuringFlags();
     void testCacheExpunges();
     void testCacheExpunges_ESearch();
+    void testCachePartitionedUidSync();
+    void testCachePartitionedUidSyncInterrupted();
+    void testConnectionPool();
+    void testResponseProcessingBudget();
+    void testVisibleMessagesFirst();
     void testCacheExpungesDuringUid();
     void testCacheExpungesDuringUid2();
     void testCacheExpungesDuringSelect();
@@ -131,6 +131,69 @@ void ImapModelOpenConnectionTest::testPreauthWithCapability()
     QVERIFY(startTlsUpgradeSpy->isEmpty());
 }
 
+/** @short A server with NOTIFY gets asked to report changes in all mailboxes */
+void ImapModelOpenConnectionTest::testPreauthWithNotify()
+{
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+    QVERIFY(SOCK->writtenStuff().isEmpty());
+    SOCK->fakeReading("* PREAUTH [CAPABILITY IMAP4rev1 NOTIFY] foo\r\n");
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+    QCOMPARE(SOCK->writtenStuff(), QByteArray("y0 NOTIFY SET (selected (MessageNew MessageExpunge FlagChange)) "
+                                              "(personal (MessageNew MessageExpunge FlagChange))\r\n"));
+    QCOMPARE(completedSpy->size(), 1);
+    SOCK->fakeReading("y0 OK notifications enabled\r\n");
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+
+    // Find out the numbers of some mailbox, so that there is something to poll
+    model->rowCount(QModelIndex());
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+    QCOMPARE(SOCK->writtenStuff(), QByteArray("y1 LIST \"\" \"%\"\r\n"));
+    SOCK->fakeReading("* LIST (\\HasNoChildren) \".\" \"a\"\r\ny1 OK listed\r\n");
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+    QModelIndex mailboxA = model->index(1, 0, QModelIndex());
+    QCOMPARE(mailboxA.data(Imap::Mailbox::RoleMailboxName).toString(), QString::fromUtf8("a"));
+    QCOMPARE(mailboxA.data(Imap::Mailbox::RoleTotalMessageCount), QVariant());
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+    QCOMPARE(SOCK->writtenStuff(), QByteArray("y2 STATUS a (MESSAGES UNSEEN RECENT)\r\n"));
+    SOCK->fakeReading("* STATUS a (MESSAGES 3 UNSEEN 1 RECENT 0)\r\ny2 OK status\r\n");
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+    QCOMPARE(mailboxA.data(Imap::Mailbox::RoleTotalMessageCount), QVariant(3));
+
+    // The polling is not needed anymore...
+    model->invalidateAllMessageCounts();
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+    QVERIFY(SOCK->writtenStuff().isEmpty());
+    // ...until the server gives up
+    SOCK->fakeReading("* OK [NOTIFICATIONOVERFLOW] too many changes\r\n");
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+    QCOMPARE(SOCK->writtenStuff(), QByteArray("y3 STATUS a (MESSAGES UNSEEN RECENT)\r\n"));
+    SOCK->fakeReading("* STATUS a (MESSAGES 4 UNSEEN 2 RECENT 1)\r\ny3 OK status\r\n");
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+    QCOMPARE(mailboxA.data(Imap::Mailbox::RoleTotalMessageCount), QVariant(4));
+
+    // From now on, the periodic polling does its job again
+    model->invalidateAllMessageCounts();
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+    QCOMPARE(SOCK->writtenStuff(), QByteArray("y4 STATUS a (MESSAGES UNSEEN RECENT)\r\n"));
+    SOCK->fakeReading("* STATUS a (MESSAGES 4 UNSEEN 2 RECENT 0)\r\ny4 OK status\r\n");
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+    QVERIFY(SOCK->writtenStuff().isEmpty());
+    QVERIFY(failedSpy->isEmpty());
+    QVERIFY(connErrorSpy->isEmpty());
+}
+
 /** @short What happens when the server responds with PREAUTH and we want STARTTLS? */
 void ImapModelOpenConnectionTest::testPreauthWithStartTlsWanted()
 {
@@ -777,6 +840,208 @@ void ImapModelOpenConnectionTest::testAuthFailureNoRespCode()
     QVERIFY(model->imapAuthError().contains("Derp"));
 }
 
+/** @short Connect for the first time and let the Model remember the capabilities */
+void ImapModelOpenConnectionTest::helperConnectAndCacheCapabilities()
+{
+    cEmpty();
+    cServer("* OK foo\r\n");
+    cClient("y0 CAPABILITY\r\n");
+    cServer("* CAPABILITY IMAP4rev1 AUTH=PLAIN\r\ny0 OK capability completed\r\n");
+    cClient("y1 LOGIN luzr sikrit\r\n");
+    cServer("y1 OK logged in\r\n");
+    cClient("y2 CAPABILITY\r\n");
+    cServer("* CAPABILITY IMAP4rev1 UIDPLUS\r\ny2 OK capability completed\r\n");
+    QCOMPARE(completedSpy->size(), 1);
+    QCOMPARE(model->cachedCapabilitiesBeforeLogin(), QStringList() << QLatin1String("IMAP4REV1") << QLatin1String("AUTH=PLAIN"));
+    QCOMPARE(model->cachedCapabilitiesAfterLogin(), QStringList() << QLatin1String("IMAP4REV1") << QLatin1String("UIDPLUS"));
+    cEmpty();
+}
+
+/** @short Test that a reconnect uses the capabilities remembered from the previous connection
+
+The number of server responses which have to arrive before the connection is usable is what determines the time it takes
+to get back to a selected mailbox after the network goes away for a while.
+*/
+void ImapModelOpenConnectionTest::testFastReconnect()
+{
+    helperConnectAndCacheCapabilities();
+
+    // Over plaintext, the capabilities have to be checked before sending the credentials, but the CAPABILITY after the
+    // LOGIN can be skipped
+    Imap::Mailbox::OpenConnectionTask *reconnect = new Imap::Mailbox::OpenConnectionTask(model);
+    QSignalSpy reconnectedSpy(reconnect, SIGNAL(completed(Imap::Mailbox::ImapTask*)));
+    cEmpty();
+    cServer("* OK foo\r\n");
+    cClient("y0 CAPABILITY\r\n");
+    cServer("* CAPABILITY IMAP4rev1 AUTH=PLAIN\r\ny0 OK capability completed\r\n");
+    cClient("y1 LOGIN luzr sikrit\r\n");
+    cServer("y1 OK logged in\r\n");
+    QCOMPARE(reconnectedSpy.size(), 1);
+    cEmpty();
+    QCOMPARE(model->cachedCapabilitiesAfterLogin(), QStringList() << QLatin1String("IMAP4REV1") << QLatin1String("UIDPLUS"));
+    QCOMPARE(authSpy->size(), 1);
+    QVERIFY(failedSpy->isEmpty());
+}
+
+/** @short Test that a reconnect over an implicitly encrypted connection skips both CAPABILITY commands */
+void ImapModelOpenConnectionTest::testFastReconnectImplicitTls()
+{
+    helperConnectAndCacheCapabilities();
+
+    factory->setInitialState(Imap::CONN_STATE_SSL_HANDSHAKE);
+    Imap::Mailbox::OpenConnectionTask *reconnect = new Imap::Mailbox::OpenConnectionTask(model);
+    QSignalSpy reconnectedSpy(reconnect, SIGNAL(completed(Imap::Mailbox::ImapTask*)));
+    cEmpty();
+    cServer("* OK foo\r\n");
+    cClient("y0 LOGIN luzr sikrit\r\n");
+    cServer("y0 OK logged in\r\n");
+    QCOMPARE(reconnectedSpy.size(), 1);
+    cEmpty();
+    QCOMPARE(authSpy->size(), 1);
+    QVERIFY(failedSpy->isEmpty());
+}
+
+/** @short Test that a reconnect with the configuration-enforced STARTTLS does not wait for the capabilities either */
+void ImapModelOpenConnectionTest::testFastReconnectStartTls()
+{
+    cleanup(); init(true);
+
+    cEmpty();
+    cServer("* OK foo\r\n");
+    cClient("y0 CAPABILITY\r\n");
+    cServer("* CAPABILITY imap4rev1 starttls\r\ny0 ok cap\r\n");
+    cClient("y1 STARTTLS\r\n");
+    cServer("y1 OK will establish secure layer immediately\r\n");
+    cClient("[*** STARTTLS ***]y2 CAPABILITY\r\n");
+    cServer("* CAPABILITY IMAP4rev1 AUTH=PLAIN\r\ny2 OK capability completed\r\n");
+    cClient("y3 LOGIN luzr sikrit\r\n");
+    cServer("y3 OK [CAPABILITY IMAP4rev1 UIDPLUS] logged in\r\n");
+    QCOMPARE(completedSpy->size(), 1);
+    cEmpty();
+
+    // STARTTLS goes out right after the greeting, and nothing waits for the CAPABILITY after that
+    Imap::Mailbox::OpenConnectionTask *reconnect = new Imap::Mailbox::OpenConnectionTask(model);
+    QSignalSpy reconnectedSpy(reconnect, SIGNAL(completed(Imap::Mailbox::ImapTask*)));
+    cEmpty();
+    cServer("* OK foo\r\n");
+    cClient("y0 STARTTLS\r\n");
+    cServer("y0 OK will establish secure layer immediately\r\n");
+    cClient("[*** STARTTLS ***]y1 LOGIN luzr sikrit\r\n");
+    cServer("y1 OK logged in\r\n");
+    QCOMPARE(reconnectedSpy.size(), 1);
+    cEmpty();
+    QVERIFY(failedSpy->isEmpty());
+    QVERIFY(startTlsUpgradeSpy->isEmpty());
+}
+
+/** @short The capabilities after LOGIN are not reused when the server announces different ones before the LOGIN */
+void ImapModelOpenConnectionTest::testFastReconnectServerChanged()
+{
+    helperConnectAndCacheCapabilities();
+
+    Imap::Mailbox::OpenConnectionTask *reconnect = new Imap::Mailbox::OpenConnectionTask(model);
+    QSignalSpy reconnectedSpy(reconnect, SIGNAL(completed(Imap::Mailbox::ImapTask*)));
+    cEmpty();
+    cServer("* OK [CAPABILITY IMAP4rev1 AUTH=PLAIN AUTH=GSSAPI] upgraded\r\n");
+    cClient("y0 LOGIN luzr sikrit\r\n");
+    cServer("y0 OK logged in\r\n");
+    cClient("y1 CAPABILITY\r\n");
+    QCOMPARE(reconnectedSpy.size(), 0);
+    cServer("* CAPABILITY IMAP4rev1 UIDPLUS MOVE\r\ny1 OK capability completed\r\n");
+    QCOMPARE(reconnectedSpy.size(), 1);
+    cEmpty();
+    QCOMPARE(model->cachedCapabilitiesBeforeLogin(),
+             QStringList() << QLatin1String("IMAP4REV1") << QLatin1String("AUTH=PLAIN") << QLatin1String("AUTH=GSSAPI"));
+    QCOMPARE(model->cachedCapabilitiesAfterLogin(),
+             QStringList() << QLatin1String("IMAP4REV1") << QLatin1String("UIDPLUS") << QLatin1String("MOVE"));
+    QVERIFY(failedSpy->isEmpty());
+}
+
+/** @short A LOGIN failure while relying on the cache drops it and negotiates from scratch */
+void ImapModelOpenConnectionTest::testFastReconnectFallback()
+{
+    helperConnectAndCacheCapabilities();
+
+    // The server does not accept plaintext logins anymore. The cache says otherwise, but the credentials must not leak.
+    Imap::Mailbox::OpenConnectionTask *plaintext = new Imap::Mailbox::OpenConnectionTask(model);
+    QSignalSpy plaintextDoneSpy(plaintext, SIGNAL(completed(Imap::Mailbox::ImapTask*)));
+    cEmpty();
+    cServer("* OK foo\r\n");
+    TROJITA_CLIENT_LOOP
+    QByteArray written = SOCK->writtenStuff();
+    QVERIFY(!written.contains("sikrit"));
+    QCOMPARE(written, QByteArray("y0 CAPABILITY\r\n"));
+    cServer("* CAPABILITY IMAP4rev1 STARTTLS LOGINDISABLED\r\ny0 OK capability completed\r\n");
+    cClient("y1 STARTTLS\r\n");
+    cServer("y1 OK will establish secure layer immediately\r\n");
+    cClient("[*** STARTTLS ***]y2 CAPABILITY\r\n");
+    cServer("* CAPABILITY IMAP4rev1 AUTH=PLAIN\r\ny2 OK capability completed\r\n");
+    cClient("y3 LOGIN luzr sikrit\r\n");
+    cServer("y3 OK logged in\r\n");
+    cClient("y4 CAPABILITY\r\n");
+    cServer("* CAPABILITY IMAP4rev1 UIDPLUS\r\ny4 OK capability completed\r\n");
+    QCOMPARE(plaintextDoneSpy.size(), 1);
+    cEmpty();
+    QCOMPARE(startTlsUpgradeSpy->size(), 1);
+
+    // With encryption the cache is trusted, and when it turns out to be stale, everything is negotiated from scratch
+    factory->setInitialState(Imap::CONN_STATE_SSL_HANDSHAKE);
+    Imap::Mailbox::OpenConnectionTask *reconnect = new Imap::Mailbox::OpenConnectionTask(model);
+    QSignalSpy reconnectedSpy(reconnect, SIGNAL(completed(Imap::Mailbox::ImapTask*)));
+    QSignalSpy reconnectFailedSpy(reconnect, SIGNAL(failed(QString)));
+    cEmpty();
+    cServer("* OK foo\r\n");
+    cClient("y0 LOGIN luzr sikrit\r\n");
+    cServer("y0 NO this account has moved to another backend\r\n");
+    QCOMPARE(model->cachedCapabilitiesBeforeLogin(), QStringList());
+    QCOMPARE(model->cachedCapabilitiesAfterLogin(), QStringList());
+    cClient("y1 CAPABILITY\r\n");
+    cServer("* CAPABILITY IMAP4rev1 AUTH=PLAIN\r\ny1 OK capability completed\r\n");
+    cClient("y2 LOGIN luzr sikrit\r\n");
+    cServer("y2 OK logged in\r\n");
+    cClient("y3 CAPABILITY\r\n");
+    cServer("* CAPABILITY IMAP4rev1 UIDPLUS\r\ny3 OK capability completed\r\n");
+    QCOMPARE(reconnectedSpy.size(), 1);
+    QVERIFY(reconnectFailedSpy.isEmpty());
+    cEmpty();
+    QCOMPARE(model->cachedCapabilitiesBeforeLogin(), QStringList() << QLatin1String("IMAP4REV1") << QLatin1String("AUTH=PLAIN"));
+    QCOMPARE(model->cachedCapabilitiesAfterLogin(), QStringList() << QLatin1String("IMAP4REV1") << QLatin1String("UIDPLUS"));
+    QCOMPARE(authSpy->size(), 1);
+    QCOMPARE(model->imapAuthError(), QString());
+}
+
+/** @short The capabilities restored from a previous session are verified by the first connection */
+void ImapModelOpenConnectionTest::testCachedCapabilitiesRestored()
+{
+    model->setCachedCapabilities(QStringList() << QLatin1String("IMAP4REV1") << QLatin1String("AUTH=PLAIN"),
+                                 QStringList() << QLatin1String("IMAP4REV1") << QLatin1String("UIDPLUS"));
+    cEmpty();
+    cServer("* OK foo\r\n");
+    cClient("y0 CAPABILITY\r\n");
+    cServer("* CAPABILITY IMAP4rev1 AUTH=PLAIN\r\ny0 OK capability completed\r\n");
+    cClient("y1 LOGIN luzr sikrit\r\n");
+    cServer("y1 OK logged in\r\n");
+    cClient("y2 CAPABILITY\r\n");
+    cServer("* CAPABILITY IMAP4rev1 UIDPLUS MOVE\r\ny2 OK capability completed\r\n");
+    QCOMPARE(completedSpy->size(), 1);
+    cEmpty();
+    QCOMPARE(model->cachedCapabilitiesAfterLogin(),
+             QStringList() << QLatin1String("IMAP4REV1") << QLatin1String("UIDPLUS") << QLatin1String("MOVE"));
+
+    // Now that the server has confirmed them, they are good enough for skipping the CAPABILITY after LOGIN
+    Imap::Mailbox::OpenConnectionTask *reconnect = new Imap::Mailbox::OpenConnectionTask(model);
+    QSignalSpy reconnectedSpy(reconnect, SIGNAL(completed(Imap::Mailbox::ImapTask*)));
+    cEmpty();
+    cServer("* OK foo\r\n");
+    cClient("y0 CAPABILITY\r\n");
+    cServer("* CAPABILITY IMAP4rev1 AUTH=PLAIN\r\ny0 OK capability completed\r\n");
+    cClient("y1 LOGIN luzr sikrit\r\n");
+    cServer("y1 OK logged in\r\n");
+    QCOMPARE(reconnectedSpy.size(), 1);
+    cEmpty();
+    QVERIFY(failedSpy->isEmpty());
+}
+
 // FIXME: verify how LOGINDISABLED even after STARTLS ends up
 
 void ImapModelOpenConnectionTest::provideAuthDetails()
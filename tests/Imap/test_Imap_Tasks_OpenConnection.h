@@ -40,6 +40,7 @@ private slots:
     void testPreauth();
     void testPreauthWithCapability();
     void testPreauthWithStartTlsWanted();
+    void testPreauthWithNotify();
 
     void testOk();
     void testOkWithCapability();
@@ -69,10 +70,19 @@ private slots:
     void testAuthFailure();
     void testAuthFailureNoRespCode();
 
+    void testFastReconnect();
+    void testFastReconnectImplicitTls();
+    void testFastReconnectStartTls();
+    void testFastReconnectServerChanged();
+    void testFastReconnectFallback();
+    void testCachedCapabilitiesRestored();
+
     void provideAuthDetails();
     void acceptSsl(const QList<QSslCertificate> &certificateChain, const QList<QSslError> &sslErrors);
 
 private:
+    void helperConnectAndCacheCapabilities();
+
     Imap::Mailbox::Model* model;
     Streams::FakeSocketFactory* factory;
     Imap::Mailbox::OpenConnectionTask* task;
@@ -24,7 +24,10 @@
 #include <QtTest>
 #include "test_Imap_Threading.h"
 #include "Utils/headless_test.h"
+#include "Imap/Model/LocalThreading.h"
+#include "Imap/Model/MemoryCache.h"
 #include "Imap/Model/MsgListModel.h"
+#include "Imap/Model/PrettyMsgListModel.h"
 #include "Imap/Model/ThreadingMsgListModel.h"
 #include "Streams/FakeSocket.h"
 #include "Utils/FakeCapabilitiesInjector.h"
@@ -142,6 +145,37 @@ void ImapModelThreadingTest::testStaticThreading_data()
             << QByteArray("(1 (2) 3)")
             << m;
 
+    // A fake node whose first child is yet another fake node with some children; the inner one gets replaced by its first
+    // child, and that very message then replaces the outer fake node as well
+    m.clear();
+    m["0"] = 1;
+    m["0.0"] = 4;
+    m["0.0.0"] = 0;
+    m["0.1"] = 2;
+    m["0.2"] = 3;
+    m["0.3"] = 0;
+    m["1"] = 0;
+    QTest::newRow("nested-fake-nodes")
+            << (uint)4
+            << QByteArray("(((1 4)(2))(3))")
+            << m;
+
+    // The same, but below a regular message
+    m.clear();
+    m["0"] = 1;
+    m["0.0"] = 2;
+    m["0.0.0"] = 5;
+    m["0.0.0.0"] = 0;
+    m["0.0.1"] = 3;
+    m["0.0.2"] = 4;
+    m["0.0.3"] = 0;
+    m["0.1"] = 0;
+    m["1"] = 0;
+    QTest::newRow("nested-fake-nodes-below-message")
+            << (uint)5
+            << QByteArray("(1 (((2 5)(3))(4)))")
+            << m;
+
     // A complex nested hierarchy with nodes to be promoted
     QByteArray response;
     complexMapping(m, response);
@@ -1125,6 +1159,185 @@ void ImapModelThreadingTest::testDynamicSearch()
     justKeepTask();
 }
 
+/** @short Results of SORT are reused for as long as the mailbox state does not change */
+void ImapModelThreadingTest::testCachedSortResults()
+{
+    FakeCapabilitiesInjector injector(model);
+    injector.injectCapability("QRESYNC");
+    injector.injectCapability("SORT");
+
+    threadingModel->setUserWantsThreading(false);
+
+    Imap::Mailbox::SyncState sync;
+    sync.setExists(3);
+    sync.setUidValidity(666);
+    sync.setUidNext(15);
+    sync.setHighestModSeq(33);
+    sync.setUnSeenCount(3);
+    sync.setRecent(0);
+    Imap::Uids uidMap;
+    uidMap << 6 << 9 << 10;
+    model->cache()->setMailboxSyncState("a", sync);
+    model->cache()->setUidMapping("a", uidMap);
+    msgListModel->setMailbox("a");
+    cClient(t.mk("SELECT a (QRESYNC (666 33 (2 9)))\r\n"));
+    cServer("* 3 EXISTS\r\n"
+            "* OK [UIDVALIDITY 666] .\r\n"
+            "* OK [UIDNEXT 15] .\r\n"
+            "* OK [HIGHESTMODSEQ 33] .\r\n"
+            );
+    cServer(t.last("OK selected\r\n"));
+    cEmpty();
+    checkUidMapFromThreading(uidMap);
+
+    Imap::Uids bySubject, byCc;
+    bySubject << 10 << 6 << 9;
+    byCc << 9 << 10 << 6;
+
+    threadingModel->setUserSearchingSortingPreference(QStringList(), Imap::Mailbox::ThreadingMsgListModel::SORT_SUBJECT);
+    cClient(t.mk("UID SORT (SUBJECT) utf-8 ALL\r\n"));
+    cServer("* SORT " + numListToString(bySubject) + "\r\n" + t.last("OK sorted\r\n"));
+    checkUidMapFromThreading(bySubject);
+
+    threadingModel->setUserSearchingSortingPreference(QStringList(), Imap::Mailbox::ThreadingMsgListModel::SORT_CC);
+    cClient(t.mk("UID SORT (CC) utf-8 ALL\r\n"));
+    cServer("* SORT " + numListToString(byCc) + "\r\n" + t.last("OK sorted\r\n"));
+    checkUidMapFromThreading(byCc);
+
+    // Going back to a sort order which we've already seen doesn't need the server
+    threadingModel->setUserSearchingSortingPreference(QStringList(), Imap::Mailbox::ThreadingMsgListModel::SORT_SUBJECT,
+                                                      Qt::DescendingOrder);
+    cEmpty();
+    Imap::Uids expectedUidOrder = bySubject;
+    std::reverse(expectedUidOrder.begin(), expectedUidOrder.end());
+    checkUidMapFromThreading(expectedUidOrder);
+
+    // A new arrival changes the state of the mailbox, so the cached results are no longer good enough
+    cServer("* 4 EXISTS\r\n");
+    cClient(t.mk("UID FETCH 15:* (FLAGS)\r\n"));
+    cServer("* 4 FETCH (UID 15 FLAGS ())\r\n" + t.last("OK fetched\r\n"));
+    bySubject.clear();
+    bySubject << 10 << 6 << 15 << 9;
+    cClient(t.mk("UID SORT (SUBJECT) utf-8 ALL\r\n"));
+    cServer("* SORT " + numListToString(bySubject) + "\r\n" + t.last("OK sorted\r\n"));
+    expectedUidOrder = bySubject;
+    std::reverse(expectedUidOrder.begin(), expectedUidOrder.end());
+    checkUidMapFromThreading(expectedUidOrder);
+
+    byCc.clear();
+    byCc << 15 << 9 << 10 << 6;
+    threadingModel->setUserSearchingSortingPreference(QStringList(), Imap::Mailbox::ThreadingMsgListModel::SORT_CC);
+    cClient(t.mk("UID SORT (CC) utf-8 ALL\r\n"));
+    cServer("* SORT " + numListToString(byCc) + "\r\n" + t.last("OK sorted\r\n"));
+    checkUidMapFromThreading(byCc);
+
+    threadingModel->setUserSearchingSortingPreference(QStringList(), Imap::Mailbox::ThreadingMsgListModel::SORT_SUBJECT);
+    cEmpty();
+    checkUidMapFromThreading(bySubject);
+
+    justKeepTask();
+}
+
+/** @short Select the mailbox "a" with three messages and a known HIGHESTMODSEQ, so that the search results can be cached */
+#define SELECT_CACHEABLE_MAILBOX \
+    threadingModel->setUserWantsThreading(false); \
+    Imap::Mailbox::SyncState sync; \
+    sync.setExists(3); \
+    sync.setUidValidity(666); \
+    sync.setUidNext(15); \
+    sync.setHighestModSeq(33); \
+    sync.setUnSeenCount(3); \
+    sync.setRecent(0); \
+    Imap::Uids uidMap; \
+    uidMap << 6 << 9 << 10; \
+    model->cache()->setMailboxSyncState("a", sync); \
+    model->cache()->setUidMapping("a", uidMap); \
+    msgListModel->setMailbox("a"); \
+    cClient(t.mk("SELECT a (QRESYNC (666 33 (2 9)))\r\n")); \
+    cServer("* 3 EXISTS\r\n" \
+            "* OK [UIDVALIDITY 666] .\r\n" \
+            "* OK [UIDNEXT 15] .\r\n" \
+            "* OK [HIGHESTMODSEQ 33] .\r\n" \
+            ); \
+    cServer(t.last("OK selected\r\n")); \
+    cEmpty(); \
+    checkUidMapFromThreading(uidMap);
+
+/** @short A cached result is shown right away, but the server still gets asked for the CONTEXT=SORT updates */
+void ImapModelThreadingTest::testCachedSortResultsContext()
+{
+    using namespace Imap::Mailbox;
+
+    FakeCapabilitiesInjector injector(model);
+    injector.injectCapability("QRESYNC");
+    injector.injectCapability("SORT");
+    injector.injectCapability("ESORT");
+    injector.injectCapability("CONTEXT=SORT");
+    SELECT_CACHEABLE_MAILBOX;
+
+    Imap::Uids bySubject;
+    bySubject << 10 << 6 << 9;
+    model->cache()->setSearchResult(QLatin1String("a"), ThreadingMsgListModel::searchResultMailboxState(idxA),
+                                    ThreadingMsgListModel::searchResultKey(QStringList(), QStringList() << QLatin1String("SUBJECT")),
+                                    bySubject);
+
+    threadingModel->setUserSearchingSortingPreference(QStringList(), ThreadingMsgListModel::SORT_SUBJECT);
+    checkUidMapFromThreading(bySubject);
+    cClient(t.mk("UID SORT RETURN (ALL UPDATE) (SUBJECT) utf-8 ALL\r\n"));
+    QByteArray sortTag(t.last());
+    cServer("* ESEARCH (TAG \"" + sortTag + "\") UID ALL 10,6,9\r\n" + t.last("OK sorted\r\n"));
+    checkUidMapFromThreading(bySubject);
+
+    // Without the persistent SORT, this update would never arrive
+    cServer("* 4 EXISTS\r\n* ESEARCH (TAG \"" + sortTag + "\") UID ADDTO (0 15)\r\n");
+    cClient(t.mk("UID FETCH 15:* (FLAGS)\r\n"));
+    cServer("* 4 FETCH (UID 15 FLAGS ())\r\n" + t.last("OK fetched\r\n"));
+    cEmpty();
+    checkUidMapFromThreading(Imap::Uids() << 15 << 10 << 6 << 9);
+
+    justKeepTask();
+}
+
+/** @short The result of a SORT which has been replaced by another one is neither shown nor cached */
+void ImapModelThreadingTest::testReplacedSortResultIgnored()
+{
+    using namespace Imap::Mailbox;
+
+    FakeCapabilitiesInjector injector(model);
+    injector.injectCapability("QRESYNC");
+    injector.injectCapability("SORT");
+    injector.injectCapability("ESORT");
+    SELECT_CACHEABLE_MAILBOX;
+
+    threadingModel->setUserSearchingSortingPreference(QStringList(), ThreadingMsgListModel::SORT_SUBJECT);
+    cClient(t.mk("UID SORT RETURN (ALL) (SUBJECT) utf-8 ALL\r\n"));
+    QByteArray subjectTag(t.last());
+    threadingModel->setUserSearchingSortingPreference(QStringList(), ThreadingMsgListModel::SORT_CC);
+    cClient(t.mk("UID SORT RETURN (ALL) (CC) utf-8 ALL\r\n"));
+    QByteArray ccTag(t.last());
+
+    cServer("* ESEARCH (TAG \"" + subjectTag + "\") UID ALL 10,6,9\r\n" + subjectTag + " OK sorted\r\n");
+    checkUidMapFromThreading(uidMap);
+    Imap::Uids byCc;
+    byCc << 9 << 10 << 6;
+    cServer("* ESEARCH (TAG \"" + ccTag + "\") UID ALL 9,10,6\r\n" + ccTag + " OK sorted\r\n");
+    checkUidMapFromThreading(byCc);
+
+    Imap::Uids bySubject;
+    bySubject << 10 << 6 << 9;
+    threadingModel->setUserSearchingSortingPreference(QStringList(), ThreadingMsgListModel::SORT_SUBJECT);
+    cClient(t.mk("UID SORT RETURN (ALL) (SUBJECT) utf-8 ALL\r\n"));
+    cServer("* ESEARCH (TAG \"" + t.last() + "\") UID ALL 10,6,9\r\n" + t.last("OK sorted\r\n"));
+    checkUidMapFromThreading(bySubject);
+
+    // The cache has the result which belongs to this sort order, not the one which happened to arrive while waiting for it
+    threadingModel->setUserSearchingSortingPreference(QStringList(), ThreadingMsgListModel::SORT_CC);
+    cEmpty();
+    checkUidMapFromThreading(byCc);
+
+    justKeepTask();
+}
+
 QByteArray ImapModelThreadingTest::prepareHugeUntaggedThread(const uint num)
 {
     QString sampleThread = QLatin1String("(%1 (%2 %3 (%4)(%5 %6 %7))(%8 %9 %10))");
@@ -1228,6 +1441,45 @@ void ImapModelThreadingTest::testSortingPerformance()
     }
 }
 
+/** @short Changing the sort order shall be cheap once the result of SORT is known */
+void ImapModelThreadingTest::testReSortingPerformance()
+{
+    threadingModel->setUserWantsThreading(false);
+
+    using namespace Imap::Mailbox;
+
+    const int num = 100000;
+    initialMessages(num);
+
+    FakeCapabilitiesInjector injector(model);
+    injector.injectCapability("SORT");
+
+    // Interleave the odd and the even UIDs so that the result does not follow the order of the messages in the mailbox
+    QStringList sortOrder;
+    Imap::Uids expected;
+    for (int i = 1; i <= num; i += 2)
+        expected << i;
+    for (int i = 2; i <= num; i += 2)
+        expected << i;
+    Q_FOREACH(const uint uid, expected)
+        sortOrder << QString::number(uid);
+
+    threadingModel->setUserSearchingSortingPreference(QStringList(), ThreadingMsgListModel::SORT_SUBJECT, Qt::AscendingOrder);
+    cClient(t.mk("UID SORT (SUBJECT) utf-8 ALL\r\n"));
+    cServer(("* SORT " + sortOrder.join(QLatin1String(" ")) + "\r\n").toUtf8() + t.last("OK sorted\r\n"));
+
+    QBENCHMARK {
+        threadingModel->setUserSearchingSortingPreference(QStringList(), ThreadingMsgListModel::SORT_SUBJECT, Qt::DescendingOrder);
+        threadingModel->setUserSearchingSortingPreference(QStringList(), ThreadingMsgListModel::SORT_SUBJECT, Qt::AscendingOrder);
+    }
+    cEmpty();
+
+    QCOMPARE(threadingModel->rowCount(), num);
+    for (int i = 0; i < num; i += num / 10) {
+        QCOMPARE(threadingModel->index(i, 0).data(Imap::Mailbox::RoleMessageUid).toUInt(), expected[i]);
+    }
+}
+
 void ImapModelThreadingTest::testSearchingPerformance()
 {
     threadingModel->setUserWantsThreading(false);
@@ -1267,6 +1519,40 @@ void ImapModelThreadingTest::testSearchingPerformance()
     }
 }
 
+/** @short Benchmark the client-side quick filter over a large mailbox whose envelopes are known */
+void ImapModelThreadingTest::testQuickFilterPerformance()
+{
+    threadingModel->setUserWantsThreading(false);
+
+    using namespace Imap::Mailbox;
+
+    const int num = 50000;
+    initialMessages(num);
+    QByteArray envelopes;
+    for (int i = 1; i <= num; ++i)
+        envelopes += helperCreateTrivialEnvelope(i, i, QString::fromUtf8("subject %1").arg(QString::number(i)));
+    cServer(envelopes);
+    // The responses are processed in several turns of the event loop
+    QModelIndex lastMessage = msgListA.child(num - 1, 0);
+    QTRY_VERIFY_WITH_TIMEOUT(lastMessage.data(RoleIsFetched).toBool(), 60000);
+    cEmpty();
+
+    PrettyMsgListModel prettyModel;
+    prettyModel.setSourceModel(threadingModel);
+
+    QBENCHMARK {
+        prettyModel.setQuickFilter(QLatin1String("subject 4"), AbstractCache::TEXT_SUBJECT, PrettyMsgListModel::QUICKFILTER_EXACT,
+                                   QStringList());
+        QVERIFY(prettyModel.rowCount());
+        prettyModel.setQuickFilter(QLatin1String("subject 42"), AbstractCache::TEXT_SUBJECT, PrettyMsgListModel::QUICKFILTER_EXACT,
+                                   QStringList());
+        QVERIFY(prettyModel.rowCount());
+    }
+    // That's 42, 420-429, 4200-4299 and 42000-42999
+    QCOMPARE(prettyModel.rowCount(), 1111);
+    cEmpty();
+}
+
 /** @short Test that the INCTHREAD extension works as advertized */
 void ImapModelThreadingTest::testIncrementalThreading()
 {
@@ -1477,4 +1763,645 @@ void ImapModelThreadingTest::testDataChangedUnknownUid()
     cEmpty();
 }
 
+/** @short Test the per-subtree aggregates and their updates upon flag changes */
+void ImapModelThreadingTest::testThreadAggregates()
+{
+    initialMessages(4);
+    cClient(t.mk("UID THREAD REFS utf-8 ALL\r\n"));
+    cServer("* THREAD (1)(2 (3)(4))\r\n" + t.last("OK thread\r\n"));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1)(2 (3)(4))"));
+    cEmpty();
+
+    QModelIndex root = threadingModel->index(1, 0);
+    QModelIndex msg3 = threadingModel->index(0, 0, root);
+    QVERIFY(msg3.isValid());
+    QCOMPARE(root.data(Imap::Mailbox::RoleThreadMessageCount).toUInt(), 3u);
+    QCOMPARE(msg3.data(Imap::Mailbox::RoleThreadMessageCount).toUInt(), 1u);
+    QCOMPARE(threadingModel->index(0, 0).data(Imap::Mailbox::RoleThreadMessageCount).toUInt(), 1u);
+    QCOMPARE(root.data(Imap::Mailbox::RoleThreadUnreadCount).toUInt(), 0u);
+    QCOMPARE(root.data(Imap::Mailbox::RoleThreadFlaggedCount).toUInt(), 0u);
+    QCOMPARE(root.data(Imap::Mailbox::RoleThreadRootWithUnreadMessages).toBool(), false);
+    // No metadata have been fetched yet
+    QVERIFY(!root.data(Imap::Mailbox::RoleThreadNewestDate).isValid());
+
+    QSignalSpy dataChangedSpy(threadingModel, SIGNAL(dataChanged(QModelIndex,QModelIndex)));
+    cServer("* 3 FETCH (FLAGS (\\Flagged))\r\n");
+    // The thread root has to be told about the change of its nested message
+    QVERIFY(!dataChangedSpy.isEmpty());
+    QCOMPARE(qvariant_cast<QModelIndex>(dataChangedSpy.first()[0]), msg3);
+    QCOMPARE(qvariant_cast<QModelIndex>(dataChangedSpy.last()[0]), root);
+    QCOMPARE(msg3.data(Imap::Mailbox::RoleThreadUnreadCount).toUInt(), 1u);
+    QCOMPARE(root.data(Imap::Mailbox::RoleThreadUnreadCount).toUInt(), 1u);
+    QCOMPARE(root.data(Imap::Mailbox::RoleThreadFlaggedCount).toUInt(), 1u);
+    QCOMPARE(root.data(Imap::Mailbox::RoleThreadRootWithUnreadMessages).toBool(), true);
+    QCOMPARE(threadingModel->index(0, 0).data(Imap::Mailbox::RoleThreadUnreadCount).toUInt(), 0u);
+
+    cServer("* 3 FETCH (FLAGS (\\Seen))\r\n");
+    QCOMPARE(root.data(Imap::Mailbox::RoleThreadUnreadCount).toUInt(), 0u);
+    QCOMPARE(root.data(Imap::Mailbox::RoleThreadFlaggedCount).toUInt(), 0u);
+    QCOMPARE(root.data(Imap::Mailbox::RoleThreadRootWithUnreadMessages).toBool(), false);
+    QCOMPARE(root.data(Imap::Mailbox::RoleThreadMessageCount).toUInt(), 3u);
+    cEmpty();
+    QVERIFY(errorSpy->isEmpty());
+}
+
+/** @short Format the threading as "1(2(3) 4) 5", with zero standing for a message which is not available */
+static QString threadingToString(const QVector<Imap::Responses::ThreadingNode> &nodes)
+{
+    QStringList res;
+    Q_FOREACH(const Imap::Responses::ThreadingNode &node, nodes) {
+        QString item = QString::number(node.num);
+        if (!node.children.isEmpty())
+            item += QLatin1Char('(') + threadingToString(node.children) + QLatin1Char(')');
+        res << item;
+    }
+    return res.join(QLatin1String(" "));
+}
+
+/** @short Parse "UID;Message-ID;space-separated References;Subject;minutes since the base date" */
+static Imap::Mailbox::LocalThreadingInput localThreadingInputFromString(const QString &message)
+{
+    const QDateTime base(QDate(2014, 1, 1), QTime(12, 0), Qt::UTC);
+    QStringList fields = message.split(QLatin1Char(';'));
+    Q_ASSERT(fields.size() == 5);
+    Imap::Mailbox::LocalThreadingInput item;
+    item.uid = fields[0].toUInt();
+    item.messageId = fields[1].toUtf8();
+    Q_FOREACH(const QString &reference, fields[2].split(QLatin1Char(' '), QString::SkipEmptyParts)) {
+        item.references << reference.toUtf8();
+    }
+    item.subject = fields[3];
+    item.date = base.addSecs(fields[4].toInt() * 60);
+    return item;
+}
+
+/** @short Test the client-side implementation of the REFERENCES threading algorithm */
+void ImapModelThreadingTest::testLocalThreading()
+{
+    QFETCH(QStringList, messages);
+    QFETCH(QString, threading);
+
+    QVector<Imap::Mailbox::LocalThreadingInput> input;
+    Q_FOREACH(const QString &message, messages) {
+        input << localThreadingInputFromString(message);
+    }
+    QCOMPARE(threadingToString(Imap::Mailbox::threadByReferences(input)), threading);
+}
+
+void ImapModelThreadingTest::testLocalThreading_data()
+{
+    QTest::addColumn<QStringList>("messages");
+    QTest::addColumn<QString>("threading");
+
+    QTest::newRow("flat") << (QStringList() << QLatin1String("1;<a@x>;;first;0") << QLatin1String("2;<b@x>;;second;1"))
+                          << QString::fromUtf8("1 2");
+    QTest::newRow("chain") << (QStringList() << QLatin1String("1;<a@x>;;hi;0") << QLatin1String("2;<b@x>;<a@x>;Re: hi;1")
+                               << QLatin1String("3;<c@x>;<a@x> <b@x>;Re: hi;2") << QLatin1String("4;<d@x>;;other;3"))
+                           << QString::fromUtf8("1(2(3)) 4");
+    QTest::newRow("child-before-parent") << (QStringList() << QLatin1String("2;<b@x>;<a@x>;Re: hi;1") << QLatin1String("1;<a@x>;;hi;0"))
+                                         << QString::fromUtf8("1(2)");
+    QTest::newRow("siblings-by-date") << (QStringList() << QLatin1String("1;<a@x>;;hi;0") << QLatin1String("2;<b@x>;<a@x>;Re: hi;5")
+                                          << QLatin1String("3;<c@x>;<a@x>;Re: hi;2"))
+                                      << QString::fromUtf8("1(3 2)");
+    QTest::newRow("missing-parent-promoted") << (QStringList() << QLatin1String("1;<a@x>;<gone@x>;Re: hi;0"))
+                                             << QString::fromUtf8("1");
+    QTest::newRow("missing-parent-kept") << (QStringList() << QLatin1String("1;<a@x>;<gone@x>;Re: hi;0")
+                                             << QLatin1String("2;<b@x>;<gone@x>;Re: hi;1"))
+                                         << QString::fromUtf8("0(1 2)");
+    QTest::newRow("missing-middle") << (QStringList() << QLatin1String("1;<a@x>;;hi;0")
+                                        << QLatin1String("2;<c@x>;<a@x> <gone@x>;Re: hi;1"))
+                                    << QString::fromUtf8("1(2)");
+    QTest::newRow("subject-reply") << (QStringList() << QLatin1String("1;<a@x>;;Hello;0") << QLatin1String("2;<b@x>;;RE: hello;1"))
+                                   << QString::fromUtf8("1(2)");
+    QTest::newRow("subject-siblings") << (QStringList() << QLatin1String("1;<a@x>;;Hello;0") << QLatin1String("2;<b@x>;;Hello;1"))
+                                      << QString::fromUtf8("0(1 2)");
+    QTest::newRow("loop") << (QStringList() << QLatin1String("1;<a@x>;<b@x>;x;0") << QLatin1String("2;<b@x>;<a@x>;y;1"))
+                          << QString::fromUtf8("2(1)");
+    QTest::newRow("duplicate-id") << (QStringList() << QLatin1String("1;<a@x>;;one;0") << QLatin1String("2;<a@x>;;two;1"))
+                                  << QString::fromUtf8("1 2");
+}
+
+/** @short Test placing new arrivals into the threads without running the whole algorithm again
+
+The accepted placement has to match what the full threading of all messages would do.
+*/
+void ImapModelThreadingTest::testAttachToLocalThreads()
+{
+    QFETCH(QStringList, messages);
+    QFETCH(QString, arrival);
+    QFETCH(int, parentUid);
+    QFETCH(QString, threading);
+
+    using namespace Imap::Mailbox;
+
+    QVector<LocalThreadingInput> input;
+    Q_FOREACH(const QString &message, messages) {
+        input << localThreadingInputFromString(message);
+    }
+    LocalThreadingIndex index;
+    threadByReferences(input, &index);
+    QCOMPARE(index.highestUid, input.last().uid);
+
+    uint parent = 0;
+    const LocalThreadingInput newMessage = localThreadingInputFromString(arrival);
+    QCOMPARE(attachToLocalThreads(index, newMessage, parent), parentUid >= 0);
+    if (parentUid >= 0) {
+        QCOMPARE(parent, static_cast<uint>(parentUid));
+        QCOMPARE(index.highestUid, newMessage.uid);
+    }
+
+    input << newMessage;
+    QCOMPARE(threadingToString(threadByReferences(input)), threading);
+}
+
+void ImapModelThreadingTest::testAttachToLocalThreads_data()
+{
+    QTest::addColumn<QStringList>("messages");
+    QTest::addColumn<QString>("arrival");
+    QTest::addColumn<int>("parentUid");
+    QTest::addColumn<QString>("threading");
+
+    const QStringList thread = QStringList() << QLatin1String("1;<a@x>;;hi;0") << QLatin1String("2;<b@x>;<a@x>;Re: hi;1")
+                                             << QLatin1String("3;<c@x>;;other;2");
+
+    QTest::newRow("reply") << thread << QString::fromUtf8("4;<d@x>;<a@x> <b@x>;Re: hi;3") << 2
+                           << QString::fromUtf8("1(2(4)) 3");
+    QTest::newRow("in-reply-to-root") << thread << QString::fromUtf8("4;<d@x>;<a@x>;Re: hi;3") << 1
+                                      << QString::fromUtf8("1(2 4) 3");
+    QTest::newRow("unknown-reference-pruned") << thread << QString::fromUtf8("4;<d@x>;<a@x> <gone@x>;Re: hi;3") << 1
+                                              << QString::fromUtf8("1(2 4) 3");
+    QTest::newRow("new-thread") << thread << QString::fromUtf8("4;<d@x>;;fresh;3") << 0
+                                << QString::fromUtf8("1(2) 3 4");
+    QTest::newRow("new-thread-unknown-reference") << thread << QString::fromUtf8("4;<d@x>;<gone@x>;Re: fresh;3") << 0
+                                                  << QString::fromUtf8("1(2) 3 4");
+    QTest::newRow("same-subject") << thread << QString::fromUtf8("4;<d@x>;;Re: other;3") << -1
+                                  << QString::fromUtf8("1(2) 3(4)");
+    QTest::newRow("awaited-parent") << (QStringList() << QLatin1String("1;<b@x>;<a@x>;Re: hi;1"))
+                                    << QString::fromUtf8("2;<a@x>;;hi;0") << -1
+                                    << QString::fromUtf8("2(1)");
+    QTest::newRow("shared-placeholder") << (QStringList() << QLatin1String("1;<b@x>;<gone@x>;Re: hi;1"))
+                                        << QString::fromUtf8("2;<c@x>;<gone@x>;Re: hi;2") << -1
+                                        << QString::fromUtf8("0(1 2)");
+    QTest::newRow("relinking-a-root") << thread << QString::fromUtf8("4;<d@x>;<c@x> <a@x>;Re: hi;3") << -1
+                                      << QString::fromUtf8("3(1(2 4))");
+    QTest::newRow("duplicate-id") << thread << QString::fromUtf8("4;<c@x>;;dup;3") << -1
+                                  << QString::fromUtf8("1(2) 3 4");
+}
+
+/** @short The client-side threading is only saved into the cache once the headers of all messages are known */
+void ImapModelThreadingTest::testLocalThreadingPersistence()
+{
+    FakeCapabilitiesInjector injector(model);
+    injector.removeCapability(QLatin1String("THREAD=REFS"));
+    initialMessages(2);
+    QThreadPool::globalInstance()->waitForDone();
+    cEmpty();
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1)(2)"));
+    // Both messages are mere placeholders, so this threading must not be reused by the next session
+    QVERIFY(model->cache()->messageThreading(QLatin1String("a")).isEmpty());
+
+    cServer("* 1 FETCH (UID 1 ENVELOPE (NIL \"foo\" NIL NIL NIL NIL NIL NIL NIL \"<m1@example.org>\"))\r\n"
+            "* 2 FETCH (UID 2 ENVELOPE (NIL \"Re: foo\" NIL NIL NIL NIL NIL NIL \"<m1@example.org>\" \"<m2@example.org>\"))\r\n");
+    QTest::qWait(600);
+    QThreadPool::globalInstance()->waitForDone();
+    cEmpty();
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1 2)"));
+    QCOMPARE(threadingToString(model->cache()->messageThreading(QLatin1String("a"))), QString::fromUtf8("1(2)"));
+    QVERIFY(errorSpy->isEmpty());
+}
+
+/** @short When some of the new arrivals cannot be attached, none of them are moved before the full threading */
+void ImapModelThreadingTest::testAttachLocallyAllOrNothing()
+{
+    FakeCapabilitiesInjector injector(model);
+    injector.removeCapability(QLatin1String("THREAD=REFS"));
+    initialMessages(2);
+    QThreadPool::globalInstance()->waitForDone();
+    cEmpty();
+    cServer("* 1 FETCH (UID 1 ENVELOPE (NIL \"foo\" NIL NIL NIL NIL NIL NIL NIL \"<m1@example.org>\"))\r\n"
+            "* 2 FETCH (UID 2 ENVELOPE (NIL \"bar\" NIL NIL NIL NIL NIL NIL NIL \"<m2@example.org>\"))\r\n");
+    QTest::qWait(600);
+    QThreadPool::globalInstance()->waitForDone();
+    cEmpty();
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1)(2)"));
+
+    // The first arrival is a reply which could be attached on its own, but the second one would get grouped with an older
+    // thread by its subject, and that requires threading everything again
+    QSignalSpy movedSpy(threadingModel, SIGNAL(rowsAboutToBeMoved(QModelIndex,int,int,QModelIndex,int)));
+    cServer("* 4 EXISTS\r\n");
+    cClient(t.mk("UID FETCH 3:* (FLAGS)\r\n"));
+    cServer("* 3 FETCH (UID 3 FLAGS () ENVELOPE (NIL \"Re: foo\" NIL NIL NIL NIL NIL NIL \"<m1@example.org>\" \"<m3@example.org>\"))\r\n"
+            "* 4 FETCH (UID 4 FLAGS () ENVELOPE (NIL \"Re: bar\" NIL NIL NIL NIL NIL NIL NIL \"<m4@example.org>\"))\r\n"
+            + t.last("OK fetched\r\n"));
+    QVERIFY(movedSpy.isEmpty());
+    QThreadPool::globalInstance()->waitForDone();
+    cEmpty();
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1 3)(2 4)"));
+    QVERIFY(movedSpy.isEmpty());
+    QVERIFY(errorSpy->isEmpty());
+}
+
+/** @short The incremental threading orders the siblings by their date, just like the full one */
+void ImapModelThreadingTest::testAttachLocallySiblingOrder()
+{
+    using namespace Imap::Mailbox;
+
+    FakeCapabilitiesInjector injector(model);
+    injector.removeCapability(QLatin1String("THREAD=REFS"));
+    initialMessages(2);
+    QThreadPool::globalInstance()->waitForDone();
+    cEmpty();
+    cServer("* 1 FETCH (UID 1 ENVELOPE (\"Wed, 01 Jan 2014 12:00:00 +0000\" \"foo\" NIL NIL NIL NIL NIL NIL NIL \"<a@x>\"))\r\n"
+            "* 2 FETCH (UID 2 ENVELOPE (\"Wed, 01 Jan 2014 12:20:00 +0000\" \"Re: foo\" NIL NIL NIL NIL NIL NIL \"<a@x>\" \"<b@x>\"))\r\n");
+    QTest::qWait(600);
+    QThreadPool::globalInstance()->waitForDone();
+    cEmpty();
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1 2)"));
+
+    QVector<LocalThreadingInput> input;
+    input << localThreadingInputFromString(QLatin1String("1;<a@x>;;foo;0"))
+          << localThreadingInputFromString(QLatin1String("2;<b@x>;<a@x>;Re: foo;20"));
+
+    // This reply is older than the one which is already there, so it goes before it
+    cServer("* 3 EXISTS\r\n");
+    cClient(t.mk("UID FETCH 3:* (FLAGS)\r\n"));
+    cServer("* 3 FETCH (UID 3 FLAGS () ENVELOPE (\"Wed, 01 Jan 2014 12:10:00 +0000\" \"Re: foo\" NIL NIL NIL NIL NIL NIL "
+            "\"<a@x>\" \"<c@x>\"))\r\n" + t.last("OK fetched\r\n"));
+    QThreadPool::globalInstance()->waitForDone();
+    cEmpty();
+    input << localThreadingInputFromString(QLatin1String("3;<c@x>;<a@x>;Re: foo;10"));
+    QCOMPARE(threadingToString(model->cache()->messageThreading(QLatin1String("a"))), threadingToString(threadByReferences(input)));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1 (3)(2))"));
+
+    // The newest reply can be simply appended
+    QSignalSpy movedSpy(threadingModel, SIGNAL(rowsAboutToBeMoved(QModelIndex,int,int,QModelIndex,int)));
+    cServer("* 4 EXISTS\r\n");
+    cClient(t.mk("UID FETCH 4:* (FLAGS)\r\n"));
+    cServer("* 4 FETCH (UID 4 FLAGS () ENVELOPE (\"Wed, 01 Jan 2014 12:30:00 +0000\" \"Re: foo\" NIL NIL NIL NIL NIL NIL "
+            "\"<a@x>\" \"<d@x>\"))\r\n" + t.last("OK fetched\r\n"));
+    QCOMPARE(movedSpy.size(), 1);
+    QThreadPool::globalInstance()->waitForDone();
+    cEmpty();
+    input << localThreadingInputFromString(QLatin1String("4;<d@x>;<a@x>;Re: foo;30"));
+    QCOMPARE(threadingToString(model->cache()->messageThreading(QLatin1String("a"))), threadingToString(threadByReferences(input)));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1 (3)(2)(4))"));
+    QVERIFY(errorSpy->isEmpty());
+}
+
+/** @short A cache which counts how many times it has been asked for the metadata of a message */
+class MetadataCountingCache : public Imap::Mailbox::MemoryCache
+{
+public:
+    explicit MetadataCountingCache(QObject *parent): Imap::Mailbox::MemoryCache(parent), metadataLookups(0) {}
+
+    virtual MessageDataBundle messageMetadata(const QString &mailbox, const uint uid) const
+    {
+        ++metadataLookups;
+        return Imap::Mailbox::MemoryCache::messageMetadata(mailbox, uid);
+    }
+
+    mutable int metadataLookups;
+};
+
+/** @short Threading everything again does not ask the cache about the messages which it did not know the last time */
+void ImapModelThreadingTest::testLocalThreadingCacheLookups()
+{
+    MetadataCountingCache *cache = new MetadataCountingCache(model);
+    model->setCache(cache);
+    FakeCapabilitiesInjector injector(model);
+    injector.removeCapability(QLatin1String("THREAD=REFS"));
+    initialMessages(3);
+    QThreadPool::globalInstance()->waitForDone();
+    cEmpty();
+    cServer("* 1 FETCH (UID 1 ENVELOPE (NIL \"foo\" NIL NIL NIL NIL NIL NIL NIL \"<m1@example.org>\"))\r\n");
+    QTest::qWait(600);
+    QThreadPool::globalInstance()->waitForDone();
+    cEmpty();
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1)(2)(3)"));
+
+    // A reply without any references can only be grouped by its subject, and that means threading all messages again
+    const int lookups = cache->metadataLookups;
+    cServer("* 2 FETCH (UID 2 ENVELOPE (NIL \"Re: foo\" NIL NIL NIL NIL NIL NIL NIL \"<m2@example.org>\"))\r\n");
+    QTest::qWait(600);
+    QThreadPool::globalInstance()->waitForDone();
+    cEmpty();
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1 2)(3)"));
+    QCOMPARE(cache->metadataLookups, lookups);
+    QVERIFY(errorSpy->isEmpty());
+}
+
+/** @short Test extraction of the base subject according to RFC 5256 */
+void ImapModelThreadingTest::testThreadingBaseSubject()
+{
+    QFETCH(QString, subject);
+    QFETCH(QString, baseSubject);
+    QFETCH(bool, isReply);
+
+    bool reply = !isReply;
+    QCOMPARE(Imap::Mailbox::threadingBaseSubject(subject, &reply), baseSubject);
+    QCOMPARE(reply, isReply);
+}
+
+void ImapModelThreadingTest::testThreadingBaseSubject_data()
+{
+    QTest::addColumn<QString>("subject");
+    QTest::addColumn<QString>("baseSubject");
+    QTest::addColumn<bool>("isReply");
+
+    QTest::newRow("plain") << QString::fromUtf8("Hello  world ") << QString::fromUtf8("Hello world") << false;
+    QTest::newRow("re") << QString::fromUtf8("Re: Hello") << QString::fromUtf8("Hello") << true;
+    QTest::newRow("re-re") << QString::fromUtf8("RE:re: Hello") << QString::fromUtf8("Hello") << true;
+    QTest::newRow("re-counted") << QString::fromUtf8("Re[2]: Hello") << QString::fromUtf8("Hello") << true;
+    QTest::newRow("fwd-suffix") << QString::fromUtf8("Hello (fwd)") << QString::fromUtf8("Hello") << true;
+    QTest::newRow("list-tag") << QString::fromUtf8("[trojita] Hello") << QString::fromUtf8("Hello") << false;
+    QTest::newRow("everything") << QString::fromUtf8("Re: [trojita] Fwd: Hello (fwd)") << QString::fromUtf8("Hello") << true;
+    QTest::newRow("fwd-wrapper") << QString::fromUtf8("[Fwd: Re: Hello]") << QString::fromUtf8("Hello") << true;
+    QTest::newRow("only-blob") << QString::fromUtf8("[trojita]") << QString::fromUtf8("[trojita]") << false;
+    QTest::newRow("not-a-prefix") << QString::fromUtf8("Reply needed") << QString::fromUtf8("Reply needed") << false;
+}
+
+/** @short Test sorting on the client side when the server does not support SORT */
+void ImapModelThreadingTest::testLocalSorting()
+{
+    using namespace Imap::Mailbox;
+
+    threadingModel->setUserWantsThreading(false);
+    initialMessages(3);
+    cEmpty();
+
+    const QDateTime base(QDate(2014, 1, 1), QTime(12, 0), Qt::UTC);
+    QStringList subjects = QStringList() << QLatin1String("b") << QLatin1String("Re: a") << QLatin1String("[list] c");
+    QList<uint> sizes = QList<uint>() << 30 << 10 << 20;
+    for (uint uid = 1; uid <= 3; ++uid) {
+        AbstractCache::MessageDataBundle bundle;
+        bundle.uid = uid;
+        bundle.envelope.subject = subjects[uid - 1];
+        bundle.envelope.date = base.addSecs(-60 * uid);
+        bundle.size = sizes[uid - 1];
+        model->cache()->setMessageMetadata(QLatin1String("a"), uid, bundle);
+    }
+
+    QVERIFY(threadingModel->setUserSearchingSortingPreference(QStringList(), ThreadingMsgListModel::SORT_SUBJECT, Qt::AscendingOrder));
+    QThreadPool::globalInstance()->waitForDone();
+    QCoreApplication::processEvents();
+    checkUidMapFromThreading(Imap::Uids() << 2 << 1 << 3);
+
+    QVERIFY(threadingModel->setUserSearchingSortingPreference(QStringList(), ThreadingMsgListModel::SORT_DATE, Qt::AscendingOrder));
+    QThreadPool::globalInstance()->waitForDone();
+    QCoreApplication::processEvents();
+    checkUidMapFromThreading(Imap::Uids() << 3 << 2 << 1);
+
+    QVERIFY(threadingModel->setUserSearchingSortingPreference(QStringList(), ThreadingMsgListModel::SORT_SIZE, Qt::DescendingOrder));
+    QThreadPool::globalInstance()->waitForDone();
+    QCoreApplication::processEvents();
+    checkUidMapFromThreading(Imap::Uids() << 1 << 3 << 2);
+    cEmpty();
+
+    // A new arrival without any metadata is the smallest message, so it goes to the end when sorting by size in descending order
+    cServer("* 4 EXISTS\r\n");
+    cClient(t.mk("UID FETCH 4:* (FLAGS)\r\n"));
+    cServer("* 4 FETCH (UID 4 FLAGS ())\r\n" + t.last("OK fetched\r\n"));
+    QCoreApplication::processEvents();
+    checkUidMapFromThreading(Imap::Uids() << 1 << 3 << 2 << 4);
+    cEmpty();
+}
+
+/** @short Sorting again while a search is active must cope with the roots which the search has already filtered out */
+void ImapModelThreadingTest::testLocalSortingWithSearch()
+{
+    using namespace Imap::Mailbox;
+
+    threadingModel->setUserWantsThreading(false);
+    initialMessages(3);
+    cEmpty();
+
+    // The metadata of the second message are not known yet, so it gets sorted as if its subject was empty
+    AbstractCache::MessageDataBundle bundle;
+    bundle.uid = 1;
+    bundle.envelope.subject = QLatin1String("b");
+    model->cache()->setMessageMetadata(QLatin1String("a"), 1, bundle);
+    bundle.uid = 3;
+    bundle.envelope.subject = QLatin1String("a");
+    model->cache()->setMessageMetadata(QLatin1String("a"), 3, bundle);
+
+    QVERIFY(threadingModel->setUserSearchingSortingPreference(QStringList() << QLatin1String("SUBJECT") << QLatin1String("foo"),
+                                                              ThreadingMsgListModel::SORT_SUBJECT, Qt::AscendingOrder));
+    cClient(t.mk("UID SEARCH CHARSET utf-8 SUBJECT foo\r\n"));
+    cServer("* SEARCH 2 3\r\n" + t.last("OK searched\r\n"));
+    QThreadPool::globalInstance()->waitForDone();
+    cEmpty();
+    checkUidMapFromThreading(Imap::Uids() << 2 << 3);
+
+    // The late metadata re-sort the matching messages without rebuilding the list of roots first
+    cServer(helperCreateTrivialEnvelope(2, 2, QLatin1String("c")));
+    QCoreApplication::processEvents();
+    checkUidMapFromThreading(Imap::Uids() << 3 << 2);
+
+    QVERIFY(threadingModel->setUserSearchingSortingPreference(QStringList() << QLatin1String("SUBJECT") << QLatin1String("foo"),
+                                                              ThreadingMsgListModel::SORT_SUBJECT, Qt::DescendingOrder));
+    checkUidMapFromThreading(Imap::Uids() << 2 << 3);
+    cEmpty();
+    QVERIFY(errorSpy->isEmpty());
+}
+
+/** @short Metadata which arrive for several messages at once are all merged into the client-side sort order */
+void ImapModelThreadingTest::testLocalSortingLateMetadataBatch()
+{
+    using namespace Imap::Mailbox;
+
+    threadingModel->setUserWantsThreading(false);
+    initialMessages(4);
+    cEmpty();
+
+    QVERIFY(threadingModel->setUserSearchingSortingPreference(QStringList(), ThreadingMsgListModel::SORT_SUBJECT, Qt::AscendingOrder));
+    QThreadPool::globalInstance()->waitForDone();
+    QCoreApplication::processEvents();
+    checkUidMapFromThreading(Imap::Uids() << 1 << 2 << 3 << 4);
+
+    cServer(helperCreateTrivialEnvelope(1, 1, QLatin1String("d")) + helperCreateTrivialEnvelope(2, 2, QLatin1String("b"))
+            + helperCreateTrivialEnvelope(4, 4, QLatin1String("a")));
+    QCoreApplication::processEvents();
+    // The third message still has no subject, so it goes first
+    checkUidMapFromThreading(Imap::Uids() << 3 << 4 << 2 << 1);
+
+    cServer(helperCreateTrivialEnvelope(3, 3, QLatin1String("c")));
+    QCoreApplication::processEvents();
+    checkUidMapFromThreading(Imap::Uids() << 4 << 2 << 3 << 1);
+    cEmpty();
+    QVERIFY(errorSpy->isEmpty());
+}
+
+/** @short Prepare an unsolicited FETCH with the message's metadata, including a sender */
+static QByteArray envelopeWithSender(const uint seq, const uint uid, const QString &subject, const QString &senderName,
+                                     const QString &senderMailbox)
+{
+    return QString::fromUtf8("* %1 FETCH (UID %2 RFC822.SIZE 89 ENVELOPE (NIL \"%3\" ((\"%4\" NIL \"%5\" \"example.org\")) "
+                             "NIL NIL NIL NIL NIL NIL NIL) "
+                             "BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL NIL 19 2 NIL NIL NIL NIL))\r\n").arg(
+                QString::number(seq), QString::number(uid), subject, senderName, senderMailbox).toUtf8();
+}
+
+/** @short UIDs of the messages below the @arg parent, as shown by the @arg model */
+static Imap::Uids visibleUids(const QAbstractItemModel *model, const QModelIndex &parent = QModelIndex())
+{
+    Imap::Uids res;
+    for (int i = 0; i < model->rowCount(parent); ++i)
+        res << model->index(i, 0, parent).data(Imap::Mailbox::RoleMessageUid).toUInt();
+    return res;
+}
+
+/** @short Test the client-side quick filter of the PrettyMsgListModel and how it hands over to the server-side search */
+void ImapModelThreadingTest::testQuickFilter()
+{
+    using namespace Imap::Mailbox;
+
+    threadingModel->setUserWantsThreading(false);
+    initialMessages(3);
+    cEmpty();
+
+    PrettyMsgListModel prettyModel;
+    prettyModel.setSourceModel(threadingModel);
+    cServer(envelopeWithSender(1, 1, QLatin1String("=?utf-8?q?Caf=C3=A9_hello?="), QLatin1String("Alice"), QLatin1String("alice")));
+    cServer(envelopeWithSender(2, 2, QLatin1String("something else"), QLatin1String("Bob"), QLatin1String("bob")));
+    cEmpty();
+    QCOMPARE(visibleUids(&prettyModel), Imap::Uids() << 1 << 2 << 3);
+    QVERIFY(prettyModel.hasUnfetchedMessages());
+
+    // The third message has not been loaded yet, so it does not match until the server says so
+    const QStringList helloSearch = QStringList() << QLatin1String("SUBJECT") << QLatin1String("HELLO");
+    prettyModel.setQuickFilter(QLatin1String("HELLO"), AbstractCache::TEXT_SUBJECT, PrettyMsgListModel::QUICKFILTER_EXACT,
+                               helloSearch);
+    QCOMPARE(visibleUids(&prettyModel), Imap::Uids() << 1);
+
+    // Only the selected fields are looked at
+    prettyModel.setQuickFilter(QLatin1String("bob"), AbstractCache::TEXT_SUBJECT, PrettyMsgListModel::QUICKFILTER_EXACT,
+                               QStringList());
+    QCOMPARE(visibleUids(&prettyModel), Imap::Uids());
+    prettyModel.setQuickFilter(QLatin1String("bob"), AbstractCache::TEXT_SUBJECT | AbstractCache::TEXT_FROM,
+                               PrettyMsgListModel::QUICKFILTER_EXACT, QStringList());
+    QCOMPARE(visibleUids(&prettyModel), Imap::Uids() << 2);
+    prettyModel.setQuickFilter(QLatin1String("example.org"), AbstractCache::TEXT_RECIPIENTS,
+                               PrettyMsgListModel::QUICKFILTER_EXACT, QStringList());
+    QCOMPARE(visibleUids(&prettyModel), Imap::Uids());
+    prettyModel.setQuickFilter(QLatin1String("example.org"), AbstractCache::TEXT_FROM,
+                               PrettyMsgListModel::QUICKFILTER_EXACT, QStringList());
+    QCOMPARE(visibleUids(&prettyModel), Imap::Uids() << 1 << 2);
+
+    // The fuzzy mode ignores the accents and the order of words
+    prettyModel.setQuickFilter(QLatin1String("hello cafe"), AbstractCache::TEXT_SUBJECT, PrettyMsgListModel::QUICKFILTER_EXACT,
+                               QStringList());
+    QCOMPARE(visibleUids(&prettyModel), Imap::Uids());
+    prettyModel.setQuickFilter(QString::fromUtf8("caf\xc3\xa9"), AbstractCache::TEXT_SUBJECT,
+                               PrettyMsgListModel::QUICKFILTER_EXACT, QStringList());
+    QCOMPARE(visibleUids(&prettyModel), Imap::Uids() << 1);
+    prettyModel.setQuickFilter(QLatin1String("hello cafe"), AbstractCache::TEXT_SUBJECT, PrettyMsgListModel::QUICKFILTER_FUZZY,
+                               QStringList());
+    QCOMPARE(visibleUids(&prettyModel), Imap::Uids() << 1);
+
+    // Until the server responds, the local filter remains in charge
+    prettyModel.setQuickFilter(QLatin1String("HELLO"), AbstractCache::TEXT_SUBJECT, PrettyMsgListModel::QUICKFILTER_EXACT,
+                               helloSearch);
+    QVERIFY(threadingModel->setUserSearchingSortingPreference(helloSearch, ThreadingMsgListModel::SORT_NONE, Qt::AscendingOrder));
+    cClient(t.mk("UID SEARCH CHARSET utf-8 SUBJECT HELLO\r\n"));
+    QVERIFY(threadingModel->appliedSearchCondition().isEmpty());
+    QCOMPARE(visibleUids(&prettyModel), Imap::Uids() << 1);
+
+    // The server's result is what counts, even for the messages which are not loaded yet
+    cServer("* SEARCH 1 3\r\n" + t.last("OK searched\r\n"));
+    QCOMPARE(threadingModel->appliedSearchCondition(), helloSearch);
+    QCOMPARE(visibleUids(&prettyModel), Imap::Uids() << 1 << 3);
+
+    // A further keystroke does not throw away the server's result, it narrows it down locally
+    const QStringList hellopSearch = QStringList() << QLatin1String("SUBJECT") << QLatin1String("HELLOP");
+    prettyModel.setQuickFilter(QLatin1String("HELLOP"), AbstractCache::TEXT_SUBJECT, PrettyMsgListModel::QUICKFILTER_EXACT,
+                               hellopSearch);
+    QCOMPARE(threadingModel->rowCount(), 2);
+    QCOMPARE(visibleUids(&prettyModel), Imap::Uids());
+
+    // A message whose envelope arrives later gets shown as soon as it matches
+    cServer(envelopeWithSender(3, 3, QLatin1String("helloprobe"), QLatin1String("Alice"), QLatin1String("alice")));
+    QCOMPARE(visibleUids(&prettyModel), Imap::Uids() << 3);
+    QVERIFY(!prettyModel.hasUnfetchedMessages());
+    cEmpty();
+    QVERIFY(errorSpy->isEmpty());
+}
+
+/** @short A thread has to remain visible in the quick filter as long as any of its messages matches */
+void ImapModelThreadingTest::testQuickFilterThreads()
+{
+    using namespace Imap::Mailbox;
+
+    initialMessages(4);
+    cClient(t.mk("UID THREAD REFS utf-8 ALL\r\n"));
+    cServer("* THREAD (1)(2 (3)(4))\r\n" + t.last("OK thread\r\n"));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1)(2 (3)(4))"));
+    cServer(helperCreateTrivialEnvelope(1, 1, QLatin1String("alpha")));
+    cServer(helperCreateTrivialEnvelope(2, 2, QLatin1String("beta")));
+    cServer(helperCreateTrivialEnvelope(3, 3, QLatin1String("gamma")));
+    cEmpty();
+
+    PrettyMsgListModel prettyModel;
+    prettyModel.setSourceModel(threadingModel);
+
+    // The root of the thread stays visible because of its nested message, the non-matching siblings are gone
+    prettyModel.setQuickFilter(QLatin1String("gamma"), AbstractCache::TEXT_SUBJECT, PrettyMsgListModel::QUICKFILTER_EXACT,
+                               QStringList());
+    QCOMPARE(visibleUids(&prettyModel), Imap::Uids() << 2);
+    QModelIndex root = prettyModel.index(0, 0);
+    QCOMPARE(visibleUids(&prettyModel, root), Imap::Uids() << 3);
+
+    prettyModel.setQuickFilter(QLatin1String("beta"), AbstractCache::TEXT_SUBJECT, PrettyMsgListModel::QUICKFILTER_EXACT,
+                               QStringList());
+    QCOMPARE(visibleUids(&prettyModel), Imap::Uids() << 2);
+    root = prettyModel.index(0, 0);
+    QCOMPARE(visibleUids(&prettyModel, root), Imap::Uids());
+
+    // Once the envelope of a nested message arrives, its whole thread can reappear
+    prettyModel.setQuickFilter(QLatin1String("delta"), AbstractCache::TEXT_SUBJECT, PrettyMsgListModel::QUICKFILTER_EXACT,
+                               QStringList());
+    QCOMPARE(visibleUids(&prettyModel), Imap::Uids());
+    cServer(helperCreateTrivialEnvelope(4, 4, QLatin1String("delta")));
+    QCOMPARE(visibleUids(&prettyModel), Imap::Uids() << 2);
+    root = prettyModel.index(0, 0);
+    QCOMPARE(visibleUids(&prettyModel, root), Imap::Uids() << 4);
+    cEmpty();
+    QVERIFY(errorSpy->isEmpty());
+}
+
+/** @short The texts remembered by the quick filter have to follow the changes of the underlying messages */
+void ImapModelThreadingTest::testQuickFilterInvalidation()
+{
+    using namespace Imap::Mailbox;
+
+    threadingModel->setUserWantsThreading(false);
+    initialMessages(3);
+    cServer(helperCreateTrivialEnvelope(1, 1, QLatin1String("hello b")));
+    cServer(helperCreateTrivialEnvelope(2, 2, QLatin1String("other")));
+    cServer(helperCreateTrivialEnvelope(3, 3, QLatin1String("hello a")));
+    cEmpty();
+
+    PrettyMsgListModel prettyModel;
+    prettyModel.setSourceModel(threadingModel);
+    prettyModel.setQuickFilter(QLatin1String("hello"), AbstractCache::TEXT_SUBJECT, PrettyMsgListModel::QUICKFILTER_EXACT,
+                               QStringList());
+    QCOMPARE(visibleUids(&prettyModel), Imap::Uids() << 1 << 3);
+
+    // The layout of the source changes, the filter shall keep working
+    QVERIFY(threadingModel->setUserSearchingSortingPreference(QStringList(), ThreadingMsgListModel::SORT_SUBJECT,
+                                                              Qt::AscendingOrder));
+    QThreadPool::globalInstance()->waitForDone();
+    cEmpty();
+    checkUidMapFromThreading(Imap::Uids() << 3 << 1 << 2);
+    QCOMPARE(visibleUids(&prettyModel), Imap::Uids() << 3 << 1);
+
+    // A dataChanged() means that the remembered text is stale
+    cServer(helperCreateTrivialEnvelope(3, 3, QLatin1String("bye")));
+    QCOMPARE(visibleUids(&prettyModel), Imap::Uids() << 1);
+    cServer(helperCreateTrivialEnvelope(2, 2, QLatin1String("hello c")));
+    QThreadPool::globalInstance()->waitForDone();
+    cEmpty();
+    QCOMPARE(visibleUids(&prettyModel), Imap::Uids() << 1 << 2);
+    QVERIFY(errorSpy->isEmpty());
+}
+
 TROJITA_HEADLESS_TEST( ImapModelThreadingTest )
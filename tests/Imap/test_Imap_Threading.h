@@ -41,14 +41,36 @@ private slots:
     void testDynamicSorting();
     void testDynamicSortingContext();
     void testDynamicSearch();
+    void testCachedSortResults();
+    void testCachedSortResultsContext();
+    void testReplacedSortResultIgnored();
     void testIncrementalThreading();
     void testRemovingRootWithThreadingInFlight();
     void testMultipleExpunges();
     void testVanishedHierarchyReplacement();
     void testDataChangedUnknownUid();
+    void testThreadAggregates();
+    void testLocalThreading();
+    void testLocalThreading_data();
+    void testAttachToLocalThreads();
+    void testAttachToLocalThreads_data();
+    void testLocalThreadingPersistence();
+    void testAttachLocallyAllOrNothing();
+    void testAttachLocallySiblingOrder();
+    void testLocalThreadingCacheLookups();
+    void testThreadingBaseSubject();
+    void testThreadingBaseSubject_data();
+    void testLocalSorting();
+    void testLocalSortingWithSearch();
+    void testLocalSortingLateMetadataBatch();
+    void testQuickFilter();
+    void testQuickFilterThreads();
+    void testQuickFilterInvalidation();
     void testThreadingPerformance();
     void testSortingPerformance();
+    void testReSortingPerformance();
     void testSearchingPerformance();
+    void testQuickFilterPerformance();
     void testFlatThreadDeletionPerformance();
 
     void helper_multipleExpunges();
@@ -0,0 +1,192 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QTest>
+#include "test_FetchBatchController.h"
+#include "Utils/headless_test.h"
+#include "Imap/Model/FetchBatchController.h"
+
+using namespace Imap::Mailbox;
+
+// The controller never looks at the clock on its own, so the tests simply pass these timestamps (in microseconds) around
+namespace {
+const qint64 msec = 1000;
+const qint64 sec = 1000 * msec;
+}
+
+/** @short Without the adaptation, the initial limits are used no matter what happens */
+void FetchBatchControllerTest::testStaticLimits()
+{
+    FetchBatchController batching;
+    QVERIFY(!batching.isConfigured());
+    batching.setInitialLimits(300, 1024 * 1024, 10);
+    batching.setAdaptive(false);
+    QVERIFY(batching.isConfigured());
+
+    batching.batchCompleted(0, 10 * msec);
+    batching.batchCompleted(10 * msec, 10 * sec);
+    batching.batchFailed();
+    QCOMPARE(batching.messagesPerBatch(), 300);
+    QCOMPARE(batching.bytesPerBatch(), 1024u * 1024);
+    QCOMPARE(batching.parallelBatches(), 10);
+    QCOMPARE(batching.stats().batchesCompleted, 2u);
+    QCOMPARE(batching.stats().decreases, 0u);
+}
+
+/** @short Each batch which finishes in time makes the next ones bigger by a quarter of the initial size */
+void FetchBatchControllerTest::testAdditiveIncrease()
+{
+    FetchBatchController batching;
+    batching.setInitialLimits(100, 1000, 10);
+    batching.setTargetBatchDuration(1 * sec);
+
+    batching.batchCompleted(0, 500 * msec);
+    QCOMPARE(batching.messagesPerBatch(), 125);
+    QCOMPARE(batching.bytesPerBatch(), 1250u);
+    batching.batchCompleted(500 * msec, 1500 * msec);
+    QCOMPARE(batching.messagesPerBatch(), 150);
+    QCOMPARE(batching.stats().decreases, 0u);
+}
+
+/** @short A slow or failed batch halves the size */
+void FetchBatchControllerTest::testMultiplicativeDecrease()
+{
+    FetchBatchController batching;
+    batching.setInitialLimits(100, 1000, 10);
+    batching.setTargetBatchDuration(1 * sec);
+
+    batching.batchCompleted(0, 1500 * msec);
+    QCOMPARE(batching.messagesPerBatch(), 50);
+    QCOMPARE(batching.bytesPerBatch(), 500u);
+    batching.batchFailed();
+    QCOMPARE(batching.messagesPerBatch(), 25);
+    QCOMPARE(batching.stats().decreases, 2u);
+
+    // ...and it recovers slowly
+    batching.batchCompleted(1500 * msec, 1600 * msec);
+    QCOMPARE(batching.messagesPerBatch(), 50);
+}
+
+/** @short The batches can get at most eight times bigger and sixteen times smaller */
+void FetchBatchControllerTest::testScaleBounds()
+{
+    FetchBatchController batching;
+    batching.setInitialLimits(160, 1600, 10);
+    batching.setTargetBatchDuration(1 * sec);
+
+    qint64 now = 0;
+    for (int i = 0; i < 100; ++i) {
+        batching.batchCompleted(now, now + 10 * msec);
+        now += 10 * msec;
+    }
+    QCOMPARE(batching.messagesPerBatch(), 160 * 8);
+    QCOMPARE(batching.stats().scale, 8.0);
+
+    for (int i = 0; i < 100; ++i)
+        batching.batchFailed();
+    QCOMPARE(batching.messagesPerBatch(), 10);
+    QCOMPARE(batching.bytesPerBatch(), 100u);
+    QCOMPARE(batching.stats().scale, 1.0 / 16);
+}
+
+/** @short The time a batch spends waiting for the previous ones in the pipeline does not count */
+void FetchBatchControllerTest::testPipelineWaitExcluded()
+{
+    FetchBatchController batching;
+    batching.setInitialLimits(100, 1000, 10);
+    batching.setTargetBatchDuration(1 * sec);
+
+    // Both batches were sent at about the same time. The second one took 1.7 s from being sent, but the server
+    // only spent 0.8 s on it after it was done with the first one.
+    batching.batchCompleted(0, 900 * msec);
+    batching.batchCompleted(100 * msec, 1700 * msec);
+    QCOMPARE(batching.messagesPerBatch(), 150);
+    QCOMPARE(batching.stats().decreases, 0u);
+}
+
+/** @short The round-trip time is smoothed from the commands with small responses only */
+void FetchBatchControllerTest::testRttSmoothing()
+{
+    FetchBatchController batching;
+    QCOMPARE(batching.stats().smoothedRtt, Q_INT64_C(-1));
+
+    batching.commandSent("y0", 0);
+    batching.responseReceived(100);
+    batching.commandCompleted("y0", 100 * msec);
+    QCOMPARE(batching.stats().smoothedRtt, 100 * msec);
+
+    batching.commandSent("y1", 1 * sec);
+    batching.responseReceived(100);
+    batching.commandCompleted("y1", 1 * sec + 200 * msec);
+    QCOMPARE(batching.stats().smoothedRtt, (7 * 100 * msec + 200 * msec) / 8);
+
+    // Big responses are about the throughput, not about the latency
+    batching.commandSent("y2", 2 * sec);
+    batching.responseReceived(1024 * 1024);
+    batching.commandCompleted("y2", 4 * sec);
+    QCOMPARE(batching.stats().smoothedRtt, (7 * 100 * msec + 200 * msec) / 8);
+    QVERIFY(batching.stats().throughput > 0);
+
+    // Unknown tags are not interesting
+    batching.commandCompleted("y666", 5 * sec);
+    QCOMPARE(batching.stats().smoothedRtt, (7 * 100 * msec + 200 * msec) / 8);
+}
+
+/** @short Enough batches are pipelined to cover the round trip, but never more than the initial limit */
+void FetchBatchControllerTest::testParallelBatches()
+{
+    QFETCH(uint, bytesPerBatch);
+    QFETCH(int, parallelLimit);
+    QFETCH(qint64, rtt);
+    QFETCH(int, expected);
+
+    FetchBatchController batching;
+    batching.setInitialLimits(100, bytesPerBatch, parallelLimit);
+    // There's no estimate of the throughput yet
+    QCOMPARE(batching.parallelBatches(), parallelLimit);
+
+    batching.commandSent("y0", 0);
+    batching.commandCompleted("y0", rtt);
+    // One megabyte which took one second to transfer on top of the round trip, i.e. 1 MB/s
+    batching.commandSent("y1", 1 * sec);
+    batching.responseReceived(1024 * 1024);
+    batching.commandCompleted("y1", 2 * sec + rtt);
+    QCOMPARE(batching.stats().throughput, Q_INT64_C(1024 * 1024));
+    QCOMPARE(batching.parallelBatches(), expected);
+}
+
+void FetchBatchControllerTest::testParallelBatches_data()
+{
+    QTest::addColumn<uint>("bytesPerBatch");
+    QTest::addColumn<int>("parallelLimit");
+    QTest::addColumn<qint64>("rtt");
+    QTest::addColumn<int>("expected");
+
+    // Transferring a batch takes longer than the round trip, so one extra batch in flight is enough
+    QTest::newRow("big-batches") << 1024u * 1024 << 10 << 100 * msec << 2;
+    // A batch of 64 kB takes 62.5 ms, so two of them have to wait for each 100 ms round trip
+    QTest::newRow("small-batches") << 64u * 1024 << 10 << 100 * msec << 3;
+    // A high latency needs many batches in flight, but the limit still applies
+    QTest::newRow("limited") << 64u * 1024 << 5 << 1 * sec << 5;
+}
+
+TROJITA_HEADLESS_TEST(FetchBatchControllerTest)
@@ -0,0 +1,154 @@
+/* Copyright (C) 2006 - 2014 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QFile>
+#include <QTemporaryFile>
+#include <QTest>
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
+#include <QTemporaryDir>
+#endif
+#include "test_ImportSource.h"
+#include "Utils/headless_test.h"
+#include "Imap/Model/ImportSource.h"
+
+using namespace Imap::Mailbox;
+
+/** @short Test that the mbox file is split into messages, and that an empty message does not end the import */
+void ImportSourceTest::testMbox()
+{
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    file.write("From alice@example.org Thu Jan  1 00:00:00 2015\n"
+               "Status: RO\n"
+               "X-Status: F\n"
+               "Subject: first\n"
+               "\n"
+               ">From the body\n"
+               "body\n"
+               "\n"
+               "From bob@example.org Fri Jan  2 10:00:00 2015\n"
+               "\n"
+               "From carol@example.org Sat Jan  3 12:00:00 2015\n"
+               "Subject: third\n"
+               "\n"
+               "third body\n");
+    file.flush();
+
+    MboxImportSource source(file.fileName());
+    QVERIFY(source.errorString().isEmpty());
+    AppendData message;
+
+    QCOMPARE(source.next(message), ImportSource::RESULT_MESSAGE);
+    QCOMPARE(message.data, QByteArray("Subject: first\r\n\r\nFrom the body\r\nbody\r\n"));
+    QCOMPARE(message.flags, QStringList() << QLatin1String("\\Seen") << QLatin1String("\\Flagged"));
+    QCOMPARE(message.timestamp, QDateTime(QDate(2015, 1, 1), QTime(0, 0, 0)));
+
+    // The second message is empty; it has to be reported, but the rest of the file is still available
+    QCOMPARE(source.next(message), ImportSource::RESULT_SKIPPED);
+    QVERIFY(source.errorString().contains(QLatin1String("line 9")));
+
+    QCOMPARE(source.next(message), ImportSource::RESULT_MESSAGE);
+    QCOMPARE(message.data, QByteArray("Subject: third\r\n\r\nthird body\r\n"));
+    QCOMPARE(message.flags, QStringList());
+    QCOMPARE(message.timestamp, QDateTime(QDate(2015, 1, 3), QTime(12, 0, 0)));
+
+    QCOMPARE(source.next(message), ImportSource::RESULT_END);
+    QVERIFY(source.errorString().isEmpty());
+    QCOMPARE(source.next(message), ImportSource::RESULT_END);
+}
+
+/** @short Files which cannot be read as an mbox are reported as an error */
+void ImportSourceTest::testMboxErrors()
+{
+    AppendData message;
+
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    file.write("Subject: this is not an mbox\n\nbody\n");
+    file.flush();
+    MboxImportSource notMbox(file.fileName());
+    QCOMPARE(notMbox.next(message), ImportSource::RESULT_END);
+    QVERIFY(!notMbox.errorString().isEmpty());
+
+    MboxImportSource missing(file.fileName() + QLatin1String(".nonexistent"));
+    QCOMPARE(missing.next(message), ImportSource::RESULT_END);
+    QVERIFY(!missing.errorString().isEmpty());
+}
+
+/** @short Test reading messages and their flags from a Maildir, including the files which cannot be read */
+void ImportSourceTest::testMaildir()
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QDir root(dir.path());
+    QVERIFY(root.mkdir(QLatin1String("cur")));
+    QVERIFY(root.mkdir(QLatin1String("new")));
+    QVERIFY(root.mkdir(QLatin1String("tmp")));
+
+    struct {
+        const char *name;
+        const char *contents;
+    } files[] = {
+        {"cur/1:2,FS", "Subject: first\n\nbody\n"},
+        {"cur/2:2,", ""},
+        {"cur/3:2,T", "Subject: removed\n\nbody\n"},
+        {"new/4", "Subject: fourth\n\nbody\n"},
+    };
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); ++i) {
+        QFile f(root.filePath(QString::fromUtf8(files[i].name)));
+        QVERIFY(f.open(QIODevice::WriteOnly));
+        f.write(files[i].contents);
+    }
+
+    MaildirImportSource source(dir.path());
+    QVERIFY(source.errorString().isEmpty());
+    // The list of files is obtained upfront, so this one will be missing when its turn comes
+    QVERIFY(root.remove(QLatin1String("cur/3:2,T")));
+    AppendData message;
+
+    QCOMPARE(source.next(message), ImportSource::RESULT_MESSAGE);
+    QCOMPARE(message.data, QByteArray("Subject: first\r\n\r\nbody\r\n"));
+    QCOMPARE(message.flags, QStringList() << QLatin1String("\\Seen") << QLatin1String("\\Flagged"));
+
+    QCOMPARE(source.next(message), ImportSource::RESULT_SKIPPED);
+    QVERIFY(source.errorString().contains(QLatin1String("2:2,")));
+
+    QCOMPARE(source.next(message), ImportSource::RESULT_SKIPPED);
+    QVERIFY(source.errorString().contains(QLatin1String("3:2,T")));
+
+    QCOMPARE(source.next(message), ImportSource::RESULT_MESSAGE);
+    QCOMPARE(message.data, QByteArray("Subject: fourth\r\n\r\nbody\r\n"));
+    QCOMPARE(message.flags, QStringList());
+
+    QCOMPARE(source.next(message), ImportSource::RESULT_END);
+    QVERIFY(source.errorString().isEmpty());
+
+    MaildirImportSource notMaildir(root.filePath(QLatin1String("nonexistent")));
+    QCOMPARE(notMaildir.next(message), ImportSource::RESULT_END);
+    QVERIFY(!notMaildir.errorString().isEmpty());
+#else
+    QSKIP("QTemporaryDir requires Qt5", SkipSingle);
+#endif
+}
+
+TROJITA_HEADLESS_TEST(ImportSourceTest)
@@ -23,6 +23,7 @@
 #include <QTest>
 #include "test_SqlCache.h"
 #include "Utils/headless_test.h"
+#include "Imap/Model/FullTextIndex.h"
 #include "Imap/Model/SQLCache.h"
 
 Q_DECLARE_METATYPE(QList<Imap::Mailbox::MailboxMetadata>)
@@ -92,4 +93,100 @@ void TestSqlCache::testMailboxOperation()
     QVERIFY(errorSpy->isEmpty());
 }
 
+/** @short Test indexing, ranking and forgetting of the full-text index */
+void TestSqlCache::testFullTextIndex()
+{
+    using namespace Imap::Mailbox;
+
+    FullTextIndex index(0);
+    QSignalSpy indexErrors(&index, SIGNAL(error(QString)));
+    QCOMPARE(index.open(QLatin1String("fts"), QLatin1String(":memory:")), true);
+
+    QCOMPARE(FullTextIndex::tokenize(QLatin1String("Re: Hello, WORLD -- x")),
+             QStringList() << QLatin1String("re") << QLatin1String("hello") << QLatin1String("world") << QLatin1String("x"));
+
+    Imap::Message::Envelope envelope;
+    envelope.subject = QLatin1String("Meeting minutes");
+    envelope.from << Imap::Message::MailAddress(QLatin1String("Jan Novak"), QString(), QLatin1String("jan"), QLatin1String("example.org"));
+    index.indexEnvelope(QLatin1String("a"), 1, envelope);
+    envelope.subject = QLatin1String("Lunch");
+    index.indexEnvelope(QLatin1String("a"), 2, envelope);
+    index.indexText(QLatin1String("a"), 2, "1", QLatin1String("Let's discuss the meeting over lunch, the meeting room is busy"));
+    // Indexing the same part again shall not change the ranking
+    index.indexText(QLatin1String("a"), 2, "1", QLatin1String("meeting meeting meeting meeting"));
+    envelope.subject = QLatin1String("Meeting");
+    index.indexEnvelope(QLatin1String("b"), 1, envelope);
+
+    const AbstractCache::TextFields everything = AbstractCache::TEXT_SUBJECT | AbstractCache::TEXT_FROM |
+            AbstractCache::TEXT_RECIPIENTS | AbstractCache::TEXT_BODY;
+    // The subject is worth more than two occurrences in the body
+    QCOMPARE(index.search(QLatin1String("a"), QLatin1String("meeting"), everything), Imap::Uids() << 1 << 2);
+    QCOMPARE(index.search(QLatin1String("a"), QLatin1String("meeting"), AbstractCache::TEXT_BODY), Imap::Uids() << 2);
+    // Words are matched as prefixes and all of them have to be present
+    QCOMPARE(index.search(QLatin1String("a"), QLatin1String("MEET lun"), everything), Imap::Uids() << 2);
+    QCOMPARE(index.search(QLatin1String("a"), QLatin1String("novak"), AbstractCache::TEXT_FROM), Imap::Uids() << 2 << 1);
+    QCOMPARE(index.search(QLatin1String("a"), QLatin1String("novak"), AbstractCache::TEXT_RECIPIENTS), Imap::Uids());
+    QCOMPARE(index.search(QLatin1String("a"), QLatin1String("nothing"), everything), Imap::Uids());
+
+    // A batch of several parts counts the words of all parts of a message together, and the known parts are still skipped
+    QList<AbstractCache::MessagePartText> texts;
+    AbstractCache::MessagePartText text;
+    text.mailbox = QLatin1String("a");
+    text.uid = 3;
+    text.partId = "1";
+    text.text = QLatin1String("lunch");
+    texts << text;
+    text.partId = "2";
+    text.text = QLatin1String("lunch lunch");
+    texts << text;
+    text.uid = 2;
+    text.partId = "1";
+    text.text = QLatin1String("lunch lunch lunch lunch lunch");
+    texts << text;
+    index.indexTexts(texts);
+    QCOMPARE(index.search(QLatin1String("a"), QLatin1String("lunch"), AbstractCache::TEXT_BODY), Imap::Uids() << 3 << 2);
+
+    // Expunges and UIDVALIDITY changes
+    index.forgetMessage(QLatin1String("a"), 1);
+    QCOMPARE(index.search(QLatin1String("a"), QLatin1String("meeting"), everything), Imap::Uids() << 2);
+    index.forgetMailbox(QLatin1String("a"));
+    QCOMPARE(index.search(QLatin1String("a"), QLatin1String("meeting"), everything), Imap::Uids());
+    QCOMPARE(index.search(QLatin1String("b"), QLatin1String("meeting"), everything), Imap::Uids() << 1);
+    QVERIFY(indexErrors.isEmpty());
+}
+
+/** @short Cached results of SEARCH and SORT are only valid for the state of the mailbox they were stored for */
+void TestSqlCache::testSearchResults()
+{
+    Imap::Uids result;
+    QCOMPARE(cache->searchResult(QLatin1String("a"), "state1", "unseen", result), false);
+    CHECK_CACHE_ERRORS;
+
+    cache->setSearchResult(QLatin1String("a"), "state1", "unseen", Imap::Uids() << 3 << 1 << 2);
+    cache->setSearchResult(QLatin1String("a"), "state1", "subject", Imap::Uids() << 6);
+    cache->setSearchResult(QLatin1String("b"), "state1", "unseen", Imap::Uids() << 10);
+    CHECK_CACHE_ERRORS;
+    QCOMPARE(cache->searchResult(QLatin1String("a"), "state1", "unseen", result), true);
+    QCOMPARE(result, Imap::Uids() << 3 << 1 << 2);
+    QCOMPARE(cache->searchResult(QLatin1String("a"), "state1", "subject", result), true);
+    QCOMPARE(result, Imap::Uids() << 6);
+    QCOMPARE(cache->searchResult(QLatin1String("a"), "state2", "unseen", result), false);
+    CHECK_CACHE_ERRORS;
+
+    // A new state of the mailbox makes all the older results go away
+    cache->setSearchResult(QLatin1String("a"), "state2", "unseen", Imap::Uids() << 3 << 4);
+    QCOMPARE(cache->searchResult(QLatin1String("a"), "state2", "unseen", result), true);
+    QCOMPARE(result, Imap::Uids() << 3 << 4);
+    QCOMPARE(cache->searchResult(QLatin1String("a"), "state2", "subject", result), false);
+    QCOMPARE(cache->searchResult(QLatin1String("a"), "state1", "subject", result), false);
+    // ...but only for that mailbox
+    QCOMPARE(cache->searchResult(QLatin1String("b"), "state1", "unseen", result), true);
+    QCOMPARE(result, Imap::Uids() << 10);
+
+    cache->clearAllMessages(QLatin1String("a"));
+    QCOMPARE(cache->searchResult(QLatin1String("a"), "state2", "unseen", result), false);
+    CHECK_CACHE_ERRORS;
+    QVERIFY(errorSpy->isEmpty());
+}
+
 TROJITA_HEADLESS_TEST(TestSqlCache)
@@ -39,6 +39,8 @@ private Q_SLOTS:
     void initTestCase();
     void cleanupTestCase();
     void testMailboxOperation();
+    void testFullTextIndex();
+    void testSearchResults();
 
 private:
     Imap::Mailbox::SQLCache *cache;
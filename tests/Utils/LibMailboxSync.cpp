@@ -86,6 +86,14 @@ void LibMailboxSync::init()
     netErrorSpy = new QSignalSpy(model, SIGNAL(networkError(QString)));
     connect(model, SIGNAL(imapError(QString)), this, SLOT(modelSignalsError(QString)));
     connect(model, SIGNAL(logged(uint,Common::LogMessage)), this, SLOT(modelLogged(uint,Common::LogMessage)));
+    // Processing of the responses must not depend on how fast the machine running the tests is
+    model->setResponseProcessingBudget(0);
+    // The helpers expect a single FETCH of FLAGS no matter how big the mailbox is
+    model->setProperty("trojita-imap-flags-sync-window", 0);
+    // The size of the FETCH batches must not depend on the timing of the test run either
+    model->setProperty("trojita-imap-adaptive-fetch-batching", false);
+    // Each reconnect shall go through the complete negotiation which the tests expect
+    model->setProperty("trojita-imap-cached-capabilities", false);
 
     msgListModel = new Imap::Mailbox::MsgListModel(this, model);
 
@@ -393,7 +401,7 @@ void LibMailboxSync::helperSyncFlags()
             buf.clear();
         }
     }
-    // Now the ugly part -- we know that the Model has that habit of processing at most 100 responses at once and then returning
+    // Now the ugly part -- we know that the Model has that habit of processing responses only for a limited time and then returning
     // from the event handler.  The idea is to make sure that the GUI can run even in presence of incoming FLAGS in a 50k mailbox
     // (or really anything else; the point is to avoid GUI blocking).  Under normal circumstances, this shouldn't really matter as
     // the event loop will take care of processing all the events, but with tests which "emulate" the event loop through
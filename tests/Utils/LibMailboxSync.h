@@ -170,6 +170,18 @@ char *toString(const NetDataRegexp &x);
     QCOMPARE(QString::fromUtf8(SOCK->writtenStuff()), QString()); \
 }
 
+#ifndef QTRY_VERIFY_WITH_TIMEOUT
+/** @short Process events until the @arg EXPR holds, but for at most @arg TIMEOUT milliseconds; Qt 4 does not have this */
+#define QTRY_VERIFY_WITH_TIMEOUT(EXPR, TIMEOUT) \
+{ \
+    QElapsedTimer tryTimer; \
+    tryTimer.start(); \
+    while (!(EXPR) && tryTimer.elapsed() < (TIMEOUT)) \
+        QTest::qWait(10); \
+    QVERIFY(EXPR); \
+}
+#endif
+
 #define requestAndCheckSubject(OFFSET, SUBJECT) \
 { \
     QModelIndex index = msgListA.child(OFFSET, 0); \